@@ -11,7 +11,9 @@ rule {
     outputs = {"src/version.h"},
 }
 
-local ducible = cc.binary {
+-- Everything except the command line interface, so that other tools can
+-- normalize images and PDBs without running ducible.
+local libducible = cc.static_library {
     name = "ducible",
     srcs = glob {
         "src/util/*.cpp",
@@ -20,13 +22,32 @@ local ducible = cc.binary {
         "src/ducible/*.cpp",
         "src/pe/*.cpp",
         "src/pdb/*.cpp",
+        "!src/ducible/main.cpp",
+        "!src/ducible/server.cpp",
+    },
+    src_deps = {
+        ["src/ducible/stamp.cpp"] = {"src/version.h"},
+    },
+    includes = {"src"},
+    warnings = {"all", "error"},
+    compiler_opts = {"-g", "-pthread"},
+}
+
+local ducible = cc.binary {
+    name = "ducible",
+    deps = {libducible},
+    srcs = {
+        "src/ducible/main.cpp",
+        "src/ducible/server.cpp",
     },
     src_deps = {
         ["src/ducible/main.cpp"] = {"src/version.h"},
+        ["src/ducible/server.cpp"] = {"src/version.h"},
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
 }
 
 local ducible_exe = path.join(".", ducible:path())
@@ -60,7 +81,8 @@ local pdbdump = cc.binary {
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
 }
 
 local pdbdump_exe = path.join(".", pdbdump:path())
@@ -85,3 +107,29 @@ rule {
     task = {{pdbdump_exe, "vs/vs2015/x64/Debug/test_dll.pdb"}},
     outputs = {},
 }
+
+local bench = cc.binary {
+    name = "ducible_bench",
+    deps = {libducible},
+    srcs = glob {
+        "src/bench/*.cpp",
+    },
+    src_deps = {
+        ["src/bench/main.cpp"] = {"src/version.h"},
+    },
+    includes = {"src"},
+    warnings = {"all", "error"},
+    compiler_opts = {"-g", "-pthread"},
+    linker_opts = {"-pthread"},
+}
+
+local bench_exe = path.join(".", bench:path())
+
+--
+-- Test ducible_bench
+--
+rule {
+    inputs = {bench:path()},
+    task = {{bench_exe, "--help"}},
+    outputs = {},
+}
@@ -183,6 +183,16 @@ class Test:
 
         self.clean()
 
+        # Compare the *rewritten* PDBs stream by stream. This is much faster
+        # than diffing hex dumps of them.
+        for pdb in pdbs:
+            name = os.path.basename(pdb)
+            output = os.path.join(analysis, name+'.rewritten.pdbdiff')
+            with open(output, 'w') as f:
+                subprocess.call([pdbdump, '--diff', '--',
+                    os.path.join(analysis, name+'.1.rewritten'),
+                    os.path.join(analysis, name+'.2.rewritten')], stdout=f)
+
         # Copy the analyze script there for convenience
         shutil.copy(os.path.join(_script_dir, 'analyze'), analysis)
 
@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bench/generate.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "pdb/cvinfo.h"
+#include "pdb/format.h"
+#include "pe/format.h"
+
+namespace {
+
+typedef std::mt19937 Random;
+
+// Stream indices of the streams that aren't at a fixed index.
+const uint16_t kLinkInfoStream      = 5;
+const uint16_t kNamesStream         = 6;
+const uint16_t kSymbolRecordsStream = 7;
+const uint16_t kPublicSymbolStream  = 8;
+const uint16_t kGlobalSymbolStream  = 9;
+const uint16_t kFirstModuleStream   = 10;
+
+/**
+ * Builds up the contents of a stream or file.
+ */
+class Buffer {
+   public:
+    std::vector<uint8_t> data;
+
+    size_t size() const { return data.size(); }
+
+    void append(const void* buf, size_t length) {
+        const uint8_t* p = (const uint8_t*)buf;
+        data.insert(data.end(), p, p + length);
+    }
+
+    template <typename T>
+    void append(const T& value) {
+        append(&value, sizeof(value));
+    }
+
+    /**
+     * Appends a string including its null terminator.
+     */
+    void appendString(const std::string& s) { append(s.c_str(), s.size() + 1); }
+
+    /**
+     * Pads the buffer to a multiple of `n` bytes.
+     */
+    void align(size_t n) { data.resize((data.size() + n - 1) / n * n); }
+};
+
+/**
+ * Fills a buffer with random bytes.
+ */
+void randomBytes(Random& rng, uint8_t* buf, size_t length) {
+    for (size_t i = 0; i < length; i += sizeof(uint32_t)) {
+        const uint32_t r = rng();
+        memcpy(buf + i, &r, std::min(sizeof(r), length - i));
+    }
+}
+
+std::vector<uint8_t> randomBytes(Random& rng, size_t length) {
+    std::vector<uint8_t> buf(length);
+    randomBytes(rng, buf.data(), length);
+    return buf;
+}
+
+/**
+ * Returns a random GUID of the form "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}".
+ */
+std::string randomGuid(Random& rng) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{%08X-%04X-%04X-%04X-%04X%08X}",
+             (unsigned)rng(), (unsigned)(rng() & 0xffff),
+             (unsigned)(rng() & 0xffff), (unsigned)(rng() & 0xffff),
+             (unsigned)(rng() & 0xffff), (unsigned)rng());
+    return buf;
+}
+
+/**
+ * Returns true with the given probability.
+ */
+bool chance(Random& rng, double probability) {
+    return std::uniform_real_distribution<double>()(rng) < probability;
+}
+
+/**
+ * Returns a source file name. Some of them have a GUID in them like the
+ * temporary files that the linker creates.
+ */
+std::string fileName(Random& rng, size_t i, double guidDensity) {
+    if (chance(rng, guidDensity))
+        return "c:\\tmp\\lnk" + randomGuid(rng) + ".tmp";
+
+    return "c:\\src\\project\\file" + std::to_string(i) + ".cpp";
+}
+
+void addStream(MsfFile& msf, const std::vector<uint8_t>& data) {
+    msf.addStream(new MsfMemoryStream(data.size(), data.data()));
+}
+
+std::vector<uint8_t> headerStream(Random& rng, const uint8_t signature[16],
+                                  uint32_t age) {
+    Buffer buf;
+
+    PdbStream70 header;
+    header.version   = PdbVersion::vc70;
+    header.timestamp = rng();
+    header.age       = age;
+    memcpy(header.sig70, signature, sizeof(header.sig70));
+    buf.append(header);
+
+    // The table of named streams.
+    const char names[] = "/LinkInfo\0/names";
+    buf.append((uint32_t)sizeof(names));
+    buf.append(names, sizeof(names));
+    buf.append((uint32_t)2);  // Number of elements
+    buf.append((uint32_t)4);  // Maximum number of elements
+    buf.append((uint32_t)1);  // "Present" bit set
+    buf.append((uint32_t)0x3);
+    buf.append((uint32_t)0);  // "Deleted" bit set
+    buf.append((uint32_t)0);
+    buf.append((uint32_t)kLinkInfoStream);
+    buf.append((uint32_t)10);
+    buf.append((uint32_t)kNamesStream);
+
+    // Feature signatures
+    buf.append((uint32_t)0);
+    buf.append(PdbVersion::vc140);
+
+    return buf.data;
+}
+
+std::vector<uint8_t> linkInfoStream(Random& rng) {
+    const std::string cwd     = "c:\\src\\project";
+    const std::string command = "link.exe /out:bench.dll /debug";
+    const std::string libs    = "kernel32.lib";
+
+    LinkInfo info;
+    info.size             = (uint32_t)(sizeof(info) + cwd.size() + 1 +
+                               command.size() + 1);
+    info.version          = 1;
+    info.cwdOffset        = sizeof(info);
+    info.commandOffset    = (uint32_t)(sizeof(info) + cwd.size() + 1);
+    info.outputFileOffset = 10;
+    info.libsOffset       = info.size;
+
+    Buffer buf;
+    buf.append(info);
+    buf.appendString(cwd);
+    buf.appendString(command);
+    buf.appendString(libs);
+
+    // Garbage that gets truncated.
+    auto garbage = randomBytes(rng, 500);
+    buf.append(garbage.data(), garbage.size());
+
+    return buf.data;
+}
+
+std::vector<uint8_t> namesStream(Random& rng, const GenerateOptions& opts) {
+    std::string strings(1, '\0');
+    std::vector<uint32_t> offsets;
+
+    for (size_t i = 0; i < opts.names; ++i) {
+        offsets.push_back((uint32_t)strings.size());
+        strings += fileName(rng, i, opts.guidDensity);
+        strings += '\0';
+    }
+
+    // The offsets are a hash table with some empty buckets.
+    offsets.resize(offsets.size() + offsets.size() / 4 + 1, 0);
+    std::shuffle(offsets.begin(), offsets.end(), rng);
+
+    Buffer buf;
+
+    StringTableHeader header;
+    header.signature   = kHashTableSignature;
+    header.version     = 1;
+    header.stringsSize = (uint32_t)strings.size();
+    buf.append(header);
+    buf.append(strings.data(), strings.size());
+    buf.append((uint32_t)offsets.size());
+    buf.append(offsets.data(), offsets.size() * sizeof(uint32_t));
+    buf.append((uint32_t)opts.names);
+
+    return buf.data;
+}
+
+std::vector<uint8_t> symbolRecordsStream(Random& rng, size_t size) {
+    Buffer buf;
+    buf.data.reserve(size + 64);
+
+    while (buf.size() < size) {
+        const std::string name =
+            "?symbol" + std::to_string(rng() % 1000000) + "@@YAXXZ";
+
+        const size_t dataLength = 10 + name.size() + 1;
+        const size_t padding =
+            (4 - (sizeof(SymbolRecord) + dataLength) % 4) % 4;
+
+        SymbolRecord rec;
+        rec.length = (uint16_t)(sizeof(rec.type) + dataLength + padding);
+        rec.type   = S_PUB32;
+        buf.append(rec);
+
+        buf.append((uint32_t)0);      // Flags
+        buf.append((uint32_t)rng());  // Offset
+        buf.append((uint16_t)1);      // Segment
+        buf.appendString(name);
+
+        // The padding is not initialized by the linker.
+        for (size_t i = 0; i < padding; ++i) buf.data.push_back((uint8_t)rng());
+    }
+
+    return buf.data;
+}
+
+/**
+ * Returns a public symbol stream with a single public symbol, which refers to
+ * the first symbol record. The hash buckets are random.
+ */
+std::vector<uint8_t> publicSymbolStream(Random& rng) {
+    const size_t bucketsSize = 4900;
+
+    GsiHashHeader hash;
+    hash.signature   = gsiHashSignature;
+    hash.version     = gsiHashVersion;
+    hash.recordsSize = sizeof(HashRecord);
+    hash.bucketsSize = (uint32_t)bucketsSize;
+
+    // The offsets of hash records are one more than the offset of the symbol
+    // record.
+    const HashRecord record = {1, 1};
+
+    PublicSymbolHeader header = {};
+    header.hashTableSize =
+        (uint32_t)(sizeof(hash) + sizeof(record) + bucketsSize);
+    header.addrMapSize  = sizeof(uint32_t);
+    header.padding1     = (uint16_t)rng();
+    header.sectionCount = rng();
+
+    Buffer buf;
+    buf.append(header);
+    buf.append(hash);
+    buf.append(record);
+
+    auto buckets = randomBytes(rng, bucketsSize);
+    buf.append(buckets.data(), buckets.size());
+
+    buf.append((uint32_t)0);  // Address map
+
+    return buf.data;
+}
+
+/**
+ * Returns a module stream whose first symbol record is the object name.
+ */
+std::vector<uint8_t> moduleStream(Random& rng, const std::string& objectName,
+                                  size_t size) {
+    Buffer buf;
+    buf.append((uint32_t)CV_SIGNATURE_C13);
+
+    const size_t dataLength = sizeof(uint32_t) + objectName.size() + 1;
+    const size_t padding = (4 - (sizeof(SymbolRecord) + dataLength) % 4) % 4;
+
+    SymbolRecord rec;
+    rec.length = (uint16_t)(sizeof(rec.type) + dataLength + padding);
+    rec.type   = S_OBJNAME;
+    buf.append(rec);
+    buf.append((uint32_t)0);  // Signature
+    buf.appendString(objectName);
+    buf.align(4);
+
+    if (buf.size() < size) {
+        auto rest = randomBytes(rng, size - buf.size());
+        buf.append(rest.data(), rest.size());
+    }
+
+    return buf.data;
+}
+
+std::vector<uint8_t> dbiStream(Random& rng, const GenerateOptions& opts,
+                               uint32_t age) {
+    const size_t modules = opts.modules;
+
+    // Module info
+    Buffer modInfo;
+
+    for (size_t i = 0; i < modules; ++i) {
+        ModuleInfo info;
+        memset(&info, 0, sizeof(info));
+        info.sc.section  = 1;
+        info.sc.padding1 = (uint16_t)rng();
+        info.sc.size     = 16;
+        info.sc.imod     = (uint16_t)i;
+        info.sc.padding2 = (uint16_t)rng();
+        info.stream      = (uint16_t)(kFirstModuleStream + i);
+        info.offsets     = rng();
+        modInfo.append(info);
+
+        if (i == 0) {
+            modInfo.appendString("* Linker Generated Manifest RES *");
+            modInfo.appendString("");
+        } else {
+            modInfo.appendString("c:\\obj\\module" + std::to_string(i) +
+                                 ".obj");
+            modInfo.appendString("c:\\lib\\library.lib");
+        }
+
+        modInfo.align(4);
+    }
+
+    // Section contributions
+    Buffer sectionContribs;
+    sectionContribs.append(SectionContribVersion::v1);
+
+    for (size_t i = 0; i < 2 * modules; ++i) {
+        SectionContribution sc;
+        memset(&sc, 0, sizeof(sc));
+        sc.section         = 1;
+        sc.padding1        = (uint16_t)rng();
+        sc.offset          = (int32_t)(i * 16);
+        sc.size            = 16;
+        sc.characteristics = 0x60000020;
+        sc.imod            = (uint16_t)(i % modules);
+        sc.padding2        = (uint16_t)rng();
+        sectionContribs.append(sc);
+    }
+
+    // Section map with no entries.
+    Buffer sectionMap;
+    sectionMap.append((uint32_t)0);
+
+    // File info
+    std::string names;
+    std::vector<uint32_t> nameOffsets;
+
+    for (size_t i = 0; i < std::max<size_t>(modules, 30); ++i) {
+        nameOffsets.push_back((uint32_t)names.size());
+        names += fileName(rng, i, opts.guidDensity);
+        names += '\0';
+    }
+
+    std::vector<uint16_t> counts;
+    std::vector<uint32_t> offsets;
+
+    for (size_t i = 0; i < modules; ++i) {
+        counts.push_back((uint16_t)(1 + rng() % 8));
+        for (size_t j = 0; j < counts.back(); ++j)
+            offsets.push_back(nameOffsets[rng() % nameOffsets.size()]);
+    }
+
+    Buffer fileInfo;
+
+    FileInfoHeader fileInfoHeader;
+    fileInfoHeader.modiref = 0;
+    fileInfoHeader.modcref = (uint16_t)modules;
+    fileInfo.append(fileInfoHeader);
+
+    for (size_t i = 0; i < modules; ++i) fileInfo.append((uint16_t)0);
+    fileInfo.append(counts.data(), counts.size() * sizeof(uint16_t));
+    fileInfo.append(offsets.data(), offsets.size() * sizeof(uint32_t));
+    fileInfo.append(names.data(), names.size());
+    fileInfo.align(4);
+
+    // Debug header. None of the optional streams exist.
+    Buffer debugHeader;
+    for (size_t i = 0; i < DebugTypes::count; ++i)
+        debugHeader.append(invalidStream);
+
+    DbiHeader header;
+    memset(&header, 0, sizeof(header));
+    header.signature               = dbiHeaderSignature;
+    header.version                 = DbiVersion::v70;
+    header.age                     = age;
+    header.globalSymbolStream      = kGlobalSymbolStream;
+    header.pdbDllVersion.major     = 14;
+    header.pdbDllVersion.format    = 1;
+    header.publicSymbolStream      = kPublicSymbolStream;
+    header.symbolRecordsStream     = kSymbolRecordsStream;
+    header.gpModInfoSize           = (uint32_t)modInfo.size();
+    header.sectionContributionSize = (uint32_t)sectionContribs.size();
+    header.sectionMapSize          = (uint32_t)sectionMap.size();
+    header.fileInfoSize            = (uint32_t)fileInfo.size();
+    header.debugHeaderSize         = (uint32_t)debugHeader.size();
+    header.machine                 = 0x8664;
+
+    Buffer buf;
+    buf.append(header);
+    buf.append(modInfo.data.data(), modInfo.size());
+    buf.append(sectionContribs.data.data(), sectionContribs.size());
+    buf.append(sectionMap.data.data(), sectionMap.size());
+    buf.append(fileInfo.data.data(), fileInfo.size());
+    buf.append(debugHeader.data.data(), debugHeader.size());
+
+    return buf.data;
+}
+
+/**
+ * Generates a PE32+ image with a single section. The export, resource, and
+ * debug directories are at the start of the section.
+ */
+std::vector<uint8_t> generateImage(Random& rng, size_t size,
+                                   const uint8_t signature[16], uint32_t age) {
+    const uint32_t headersSize = 0x400;
+    const uint32_t sectionRva  = 0x1000;
+    const uint32_t sectionSize =
+        (uint32_t)std::max<size_t>(size, headersSize + 0x1000) - headersSize;
+
+    // Offsets of the directories within the section.
+    const uint32_t exportOffset   = 0;
+    const uint32_t resourceOffset = 64;
+    const uint32_t debugOffset    = 128;
+    const uint32_t codeViewOffset = 256;
+
+    std::vector<uint8_t> image(headersSize + sectionSize, 0);
+    randomBytes(rng, image.data() + headersSize, sectionSize);
+
+    uint8_t* section = image.data() + headersSize;
+
+    IMAGE_DOS_HEADER dos;
+    memset(&dos, 0, sizeof(dos));
+    dos.e_magic  = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = sizeof(dos);
+    memcpy(image.data(), &dos, sizeof(dos));
+
+    uint8_t* p = image.data() + dos.e_lfanew;
+    memcpy(p, "PE\0\0", 4);
+    p += 4;
+
+    IMAGE_FILE_HEADER fileHeader;
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    fileHeader.Machine              = 0x8664;
+    fileHeader.NumberOfSections     = 1;
+    fileHeader.TimeDateStamp        = rng();
+    fileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    fileHeader.Characteristics      = 0x22;
+    memcpy(p, &fileHeader, sizeof(fileHeader));
+    p += sizeof(fileHeader);
+
+    IMAGE_OPTIONAL_HEADER64 opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.Magic               = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    opt.ImageBase           = 0x180000000;
+    opt.SectionAlignment    = 0x1000;
+    opt.FileAlignment       = 0x200;
+    opt.SizeOfImage         = sectionRva + sectionSize;
+    opt.SizeOfHeaders       = headersSize;
+    opt.CheckSum            = rng();
+    opt.Subsystem           = 2;
+    opt.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress =
+        sectionRva + exportOffset;
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size =
+        sizeof(IMAGE_EXPORT_DIRECTORY);
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress =
+        sectionRva + resourceOffset;
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE].Size =
+        sizeof(IMAGE_RESOURCE_DIRECTORY);
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress =
+        sectionRva + debugOffset;
+    opt.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].Size =
+        2 * sizeof(IMAGE_DEBUG_DIRECTORY);
+    memcpy(p, &opt, sizeof(opt));
+    p += sizeof(opt);
+
+    IMAGE_SECTION_HEADER sectionHeader;
+    memset(&sectionHeader, 0, sizeof(sectionHeader));
+    memcpy(sectionHeader.Name, ".rdata", 6);
+    sectionHeader.Misc.VirtualSize  = sectionSize;
+    sectionHeader.VirtualAddress    = sectionRva;
+    sectionHeader.SizeOfRawData     = sectionSize;
+    sectionHeader.PointerToRawData  = headersSize;
+    sectionHeader.Characteristics   = 0x40000040;
+    memcpy(p, &sectionHeader, sizeof(sectionHeader));
+
+    IMAGE_EXPORT_DIRECTORY exports;
+    memset(&exports, 0, sizeof(exports));
+    exports.TimeDateStamp = rng();
+    memcpy(section + exportOffset, &exports, sizeof(exports));
+
+    IMAGE_RESOURCE_DIRECTORY resources;
+    memset(&resources, 0, sizeof(resources));
+    resources.TimeDateStamp = rng();
+    memcpy(section + resourceOffset, &resources, sizeof(resources));
+
+    const char pdbName[] = "bench.pdb";
+
+    IMAGE_DEBUG_DIRECTORY debug[2];
+    memset(debug, 0, sizeof(debug));
+    debug[0].TimeDateStamp    = rng();
+    debug[0].Type             = IMAGE_DEBUG_TYPE_CODEVIEW;
+    debug[0].SizeOfData       = offsetof(CV_INFO_PDB70, PdbFileName) +
+                                sizeof(pdbName);
+    debug[0].AddressOfRawData = sectionRva + codeViewOffset;
+    debug[0].PointerToRawData = headersSize + codeViewOffset;
+    debug[1].TimeDateStamp    = rng();
+    debug[1].Type             = 13;  // IMAGE_DEBUG_TYPE_POGO
+    memcpy(section + debugOffset, debug, sizeof(debug));
+
+    uint8_t* cv = section + codeViewOffset;
+    const uint32_t cvSignature = CV_INFO_SIGNATURE_PDB70;
+    memcpy(cv + offsetof(CV_INFO_PDB70, CvSignature), &cvSignature,
+           sizeof(cvSignature));
+    memcpy(cv + offsetof(CV_INFO_PDB70, Signature), signature, 16);
+    memcpy(cv + offsetof(CV_INFO_PDB70, Age), &age, sizeof(age));
+    memcpy(cv + offsetof(CV_INFO_PDB70, PdbFileName), pdbName,
+           sizeof(pdbName));
+
+    return image;
+}
+
+}  // namespace
+
+void generate(const GenerateOptions& opts, std::vector<uint8_t>& image,
+              std::vector<uint8_t>& pdb) {
+    Random rng(opts.seed);
+
+    // The image and PDB must agree on these.
+    uint8_t signature[16];
+    randomBytes(rng, signature, sizeof(signature));
+    const uint32_t age = 3;
+
+    image = generateImage(rng, opts.imageSize, signature, age);
+
+    MsfFile msf;
+    msf.setPageSize(opts.pageSize);
+
+    // The old stream table is garbage once the PDB has been written.
+    addStream(msf, randomBytes(rng, 3000));
+    addStream(msf, headerStream(rng, signature, age));
+    addStream(msf, randomBytes(rng, 64 * 1024));  // TPI
+    addStream(msf, dbiStream(rng, opts, age));
+    addStream(msf, randomBytes(rng, 16 * 1024));  // IPI
+    addStream(msf, linkInfoStream(rng));
+    addStream(msf, namesStream(rng, opts));
+    addStream(msf, symbolRecordsStream(rng, opts.symbolRecords));
+    addStream(msf, publicSymbolStream(rng));
+    addStream(msf, randomBytes(rng, 4000));  // Globals
+
+    for (size_t i = 0; i < opts.modules; ++i) {
+        if (i == 0) {
+            addStream(msf, moduleStream(rng,
+                                        "c:\\tmp\\lnk" + randomGuid(rng) +
+                                            ".tmp",
+                                        0));
+        } else {
+            const size_t size =
+                opts.moduleSize / 2 + rng() % (opts.moduleSize + 1);
+            addStream(msf, moduleStream(rng,
+                                        "c:\\obj\\module" + std::to_string(i) +
+                                            ".obj",
+                                        size));
+        }
+    }
+
+    pdb.clear();
+    msf.write([&](const void* data, size_t length) {
+        const uint8_t* p = (const uint8_t*)data;
+        pdb.insert(pdb.end(), p, p + length);
+    });
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * The size and shape of a synthetic image and PDB.
+ */
+struct GenerateOptions {
+    // Number of module streams. One of these is the linker generated manifest
+    // module, which is the only one ducible patches.
+    size_t modules;
+
+    // Average size of each module stream, in bytes.
+    size_t moduleSize;
+
+    // Size of the symbol record stream, in bytes.
+    size_t symbolRecords;
+
+    // Number of strings in the "/names" stream.
+    size_t names;
+
+    // Fraction of the file names in the "/names" stream and the DBI file info
+    // that contain a GUID which needs to be normalized.
+    double guidDensity;
+
+    // Size of the image, in bytes.
+    size_t imageSize;
+
+    // Seed for the random contents. The same seed always generates the same
+    // files.
+    uint32_t seed;
+
+    // Page size of the PDB.
+    size_t pageSize;
+
+    GenerateOptions()
+        : modules(100),
+          moduleSize(16 * 1024),
+          symbolRecords(16 * 1024 * 1024),
+          names(10000),
+          guidDensity(0.1),
+          imageSize(16 * 1024 * 1024),
+          seed(1),
+          pageSize(4096) {}
+};
+
+/**
+ * Generates a PE32+ image and a matching PDB. They look like the output of
+ * the linker as far as ducible is concerned, but contain random data
+ * everywhere else.
+ */
+void generate(const GenerateOptions& opts, std::vector<uint8_t>& image,
+              std::vector<uint8_t>& pdb);
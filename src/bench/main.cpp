@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Measures how long each phase of patching takes on synthetic files.
+ *
+ * An image and PDB of the requested size and shape are generated once. Then,
+ * for each iteration, the phases that ducible goes through are timed one by
+ * one, followed by the whole patchImage() call.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "bench/generate.h"
+
+#include "ducible/checksum.h"
+#include "ducible/patch.h"
+#include "ducible/patch_image.h"
+#include "ducible/patch_pdb.h"
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "msf/overlay_stream.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/view.h"
+
+#include "pe/pe.h"
+
+#include "util/file.h"
+#include "util/memmap.h"
+
+#include "version.h"
+
+/**
+ * Thrown when there is an error parsing the command line options.
+ */
+class InvalidCommandLine {
+   private:
+    std::string _why;
+
+   public:
+    InvalidCommandLine(const std::string& why) : _why(why) {}
+
+    const std::string& why() const { return _why; }
+};
+
+/**
+ * Thrown when help is requested from the command line.
+ */
+class CommandLineHelp {};
+
+/**
+ * Thrown when version information is requested from the command line.
+ */
+class CommandLineVersion {};
+
+/**
+ * Parses a positive integer option value.
+ */
+size_t parseCount(const std::string& s) {
+    size_t n = 0;
+
+    if (s.empty()) throw InvalidCommandLine("Expected a positive integer");
+
+    for (char c : s) {
+        if (c < '0' || c > '9')
+            throw InvalidCommandLine("Expected a positive integer");
+
+        n = n * 10 + (size_t)(c - '0');
+    }
+
+    if (n == 0) throw InvalidCommandLine("Expected a positive integer");
+
+    return n;
+}
+
+/**
+ * Parses a size in bytes. It may end with one of the suffixes "K", "M", or
+ * "G".
+ */
+size_t parseSize(std::string s) {
+    size_t multiplier = 1;
+
+    if (!s.empty()) {
+        switch (s.back()) {
+            case 'K':
+            case 'k':
+                multiplier = 1024;
+                break;
+            case 'M':
+            case 'm':
+                multiplier = 1024 * 1024;
+                break;
+            case 'G':
+            case 'g':
+                multiplier = 1024 * 1024 * 1024;
+                break;
+        }
+
+        if (multiplier != 1) s.pop_back();
+    }
+
+    return parseCount(s) * multiplier;
+}
+
+/**
+ * Parses a fraction between 0 and 1.
+ */
+double parseFraction(const std::string& s) {
+    std::istringstream stream(s);
+
+    double f;
+    if (!(stream >> f) || !stream.eof() || f < 0 || f > 1)
+        throw InvalidCommandLine("Expected a number between 0 and 1");
+
+    return f;
+}
+
+/**
+ * Command line options.
+ */
+struct CommandOptions {
+    GenerateOptions generate;
+
+    // Number of times each phase is run.
+    size_t iterations;
+
+    // Threads used by the phases that can use more than one.
+    size_t threads;
+
+    // If set, the files are written to this directory and read back through
+    // the filesystem. Otherwise, everything stays in memory.
+    const char* dir;
+
+    CommandOptions() : iterations(5), threads(0), dir(NULL) {}
+
+    /**
+     * Parses the command line arguments.
+     */
+    void parse(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            if (arg == "--help" || arg == "-h") throw CommandLineHelp();
+            if (arg == "--version") throw CommandLineVersion();
+        }
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            if (arg.size() < 2 || arg[0] != '-' || arg[1] != '-')
+                throw InvalidCommandLine("Unexpected argument '" + arg + "'");
+
+            if (++i >= argc)
+                throw InvalidCommandLine("Missing argument for " + arg);
+
+            const std::string value = argv[i];
+
+            if (arg == "--modules")
+                generate.modules = parseCount(value);
+            else if (arg == "--module-size")
+                generate.moduleSize = parseSize(value);
+            else if (arg == "--symbols")
+                generate.symbolRecords = parseSize(value);
+            else if (arg == "--names")
+                generate.names = parseCount(value);
+            else if (arg == "--guids")
+                generate.guidDensity = parseFraction(value);
+            else if (arg == "--image-size")
+                generate.imageSize = parseSize(value);
+            else if (arg == "--seed")
+                generate.seed = (uint32_t)parseCount(value);
+            else if (arg == "--page-size")
+                generate.pageSize = parseSize(value);
+            else if (arg == "--iterations")
+                iterations = parseCount(value);
+            else if (arg == "--threads")
+                threads = parseCount(value);
+            else if (arg == "--dir")
+                dir = argv[i];
+            else
+                throw InvalidCommandLine("Unknown option '" + arg + "'");
+        }
+
+        // Module indices are 16-bit.
+        if (generate.modules > 0xfff0)
+            throw InvalidCommandLine("Too many modules");
+    }
+};
+
+const char* usage =
+    "Usage: ducible_bench [--help] [--version] [--modules N]\n"
+    "                     [--module-size SIZE] [--symbols SIZE] [--names N]\n"
+    "                     [--guids FRACTION] [--image-size SIZE] [--seed N]\n"
+    "                     [--page-size SIZE] [--iterations N] [--threads N]\n"
+    "                     [--dir DIR]";
+
+const char* help =
+    R"(
+Generates a synthetic image and PDB and measures how long each phase of
+patching them takes. Sizes may end with K, M, or G.
+
+Optional arguments:
+  --help, -h          Prints this help.
+  --version           Prints version information.
+  --modules N         Number of module streams in the PDB. Defaults to 100.
+  --module-size SIZE  Average size of a module stream. Defaults to 16K.
+  --symbols SIZE      Size of the symbol record stream. Defaults to 16M.
+  --names N           Number of strings in the /names stream. Defaults to
+                      10000.
+  --guids FRACTION    Fraction of file names that contain a GUID. Defaults to
+                      0.1.
+  --image-size SIZE   Size of the image. Defaults to 16M.
+  --seed N            Seed for the generated contents. Defaults to 1.
+  --page-size SIZE    Page size of the PDB, from 512 to 64K. Defaults to 4K.
+  --iterations N      Number of times to run each phase. Defaults to 5.
+  --threads N         Threads used by the phases that can use more than one.
+                      Defaults to the number of hardware threads.
+  --dir DIR           Write the files to this directory and go through the
+                      filesystem. By default, everything stays in memory.
+)";
+
+/**
+ * Collects the time taken by each phase over all iterations.
+ */
+class Timings {
+   private:
+    // Phase names in the order they were first run.
+    std::vector<std::string> _phases;
+
+    // Times in milliseconds for each phase.
+    std::map<std::string, std::vector<double>> _times;
+
+   public:
+    /**
+     * Runs and times a phase.
+     */
+    void time(const std::string& phase, const std::function<void()>& f) {
+        typedef std::chrono::steady_clock clock;
+
+        const auto start = clock::now();
+        f();
+        const auto end = clock::now();
+
+        auto& times = _times[phase];
+        if (times.empty()) _phases.push_back(phase);
+
+        times.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    /**
+     * Prints the minimum, median, and maximum time of each phase.
+     */
+    void print(std::ostream& os) const {
+        os << std::left << std::setw(28) << "Phase" << std::right
+           << std::setw(14) << "Min (ms)" << std::setw(14) << "Median (ms)"
+           << std::setw(14) << "Max (ms)" << "\n";
+
+        os << std::fixed << std::setprecision(3);
+
+        for (auto&& phase : _phases) {
+            std::vector<double> times = _times.at(phase);
+            std::sort(times.begin(), times.end());
+
+            os << std::left << std::setw(28) << phase << std::right
+               << std::setw(14) << times.front() << std::setw(14)
+               << times[times.size() / 2] << std::setw(14) << times.back()
+               << "\n";
+        }
+    }
+};
+
+/**
+ * Writes a whole file.
+ */
+void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    auto f = openFile(path.c_str(), FileMode<char>::writeEmpty);
+
+    if (fwrite(data.data(), 1, data.size(), f.get()) != data.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to write '" + path + "'");
+    }
+}
+
+/**
+ * Returns the index of a named stream.
+ */
+size_t namedStream(const NameMapView& table, const char* name) {
+    const auto it = table.find(name);
+    if (it == table.end()) throw InvalidPdb("missing named stream");
+    return it->stream;
+}
+
+/**
+ * Replaces a stream with a patched copy of it in memory.
+ */
+void timeInMemory(Timings& timings, const char* phase, MsfFile& msf,
+                  size_t index,
+                  const std::function<void(MsfMemoryStream*)>& patch) {
+    auto original = msf.getStream(index);
+    if (!original) throw InvalidPdb("missing stream");
+
+    std::shared_ptr<MsfMemoryStream> stream;
+
+    timings.time(phase, [&] {
+        stream = std::make_shared<MsfMemoryStream>(original.get(), msf.arena());
+        patch(stream.get());
+    });
+
+    msf.replaceStream(index, stream);
+}
+
+/**
+ * Replaces a stream with a patched overlay of it.
+ */
+void timeOverlay(Timings& timings, const char* phase, MsfFile& msf,
+                 size_t index,
+                 const std::function<void(MsfOverlayStream*)>& patch) {
+    auto original = msf.getStream(index);
+    if (!original) throw InvalidPdb("missing stream");
+
+    std::shared_ptr<MsfOverlayStream> stream;
+
+    timings.time(phase, [&] {
+        stream = std::make_shared<MsfOverlayStream>(original);
+        patch(stream.get());
+    });
+
+    msf.replaceStream(index, stream);
+}
+
+/**
+ * Runs every phase once.
+ */
+void iterate(const CommandOptions& opts, const std::vector<uint8_t>& image,
+             const std::vector<uint8_t>& pdb, Timings& timings,
+             std::vector<uint8_t>& output) {
+    const std::string dir       = opts.dir ? opts.dir : "";
+    const std::string imagePath = dir + "/bench.dll";
+    const std::string pdbPath   = dir + "/bench.pdb";
+    const std::string outPath   = dir + "/bench.pdb.out";
+
+    if (opts.dir) {
+        writeFile(imagePath, image);
+        writeFile(pdbPath, pdb);
+    }
+
+    std::ostringstream log;
+
+    std::unique_ptr<MsfFile> msf;
+
+    timings.time("MsfFile", [&] {
+        MemMapRef map;
+        if (opts.dir)
+            map = std::make_shared<MemMap>(pdbPath.c_str(), 0, true);
+        else
+            map = std::make_shared<MemMap>((void*)pdb.data(), pdb.size());
+
+        msf.reset(new MsfFile(map));
+    });
+
+    const uint32_t timestamp  = 1262304000;
+    const uint8_t signature[16] = {};
+
+    NameMapView table;
+
+    timeInMemory(timings, "patchHeaderStream", *msf,
+                 (size_t)PdbStreamType::header, [&](MsfMemoryStream* stream) {
+                     table = patchHeaderStream(stream, nullptr, timestamp,
+                                               signature, true);
+                 });
+
+    timeOverlay(timings, "patchLinkInfoStream", *msf,
+                namedStream(table, "/LinkInfo"), patchLinkInfoStream);
+
+    timeInMemory(timings, "patchNamesStream", *msf,
+                 namedStream(table, "/names"), patchNamesStream);
+
+    DbiHeader dbi;
+
+    auto dbiStream = msf->getStream((size_t)PdbStreamType::dbi);
+    if (!dbiStream || dbiStream->read(sizeof(dbi), &dbi) != sizeof(dbi))
+        throw InvalidPdb("missing DBI header");
+
+    std::vector<size_t> moduleStreams;
+
+    timeInMemory(timings, "patchDbiStream", *msf,
+                 (size_t)PdbStreamType::dbi, [&](MsfMemoryStream* stream) {
+                     patchDbiStream(stream, moduleStreams, log);
+                 });
+
+    timeInMemory(timings, "patchSymbolRecordsStream", *msf,
+                 dbi.symbolRecordsStream, [&](MsfMemoryStream* stream) {
+                     patchSymbolRecordsStream(stream, opts.threads);
+                 });
+
+    timeOverlay(timings, "patchPublicSymbolStream", *msf,
+                dbi.publicSymbolStream, patchPublicSymbolStream);
+
+    // Module streams are small and numerous, so they are timed together.
+    std::vector<std::pair<size_t, std::shared_ptr<MsfOverlayStream>>> modules;
+
+    timings.time("patchModuleStream", [&] {
+        for (auto index : moduleStreams) {
+            auto original = msf->getStream(index);
+            if (!original) continue;
+
+            auto stream = std::make_shared<MsfOverlayStream>(original);
+            patchModuleStream(stream.get());
+            modules.push_back(std::make_pair(index, stream));
+        }
+    });
+
+    for (auto&& module : modules)
+        msf->replaceStream(module.first, module.second);
+
+    // The patched areas don't make much of a difference to the time it takes.
+    const std::vector<Patch> patches;
+    uint8_t checksum[16];
+
+    timings.time("calculateChecksum", [&] {
+        calculateChecksum(image.data(), image.size(), patches, checksum);
+    });
+
+    timings.time("calculateTreeChecksum", [&] {
+        calculateTreeChecksum(image.data(), image.size(), patches,
+                              opts.threads, checksum);
+    });
+
+    if (opts.dir) {
+        timings.time("MsfFile::write", [&] {
+            msf->write(openFile(outPath.c_str(), FileMode<char>::writeEmpty));
+        });
+
+        msf->setWriteThreads(opts.threads);
+
+        timings.time("MsfFile::_writeConcurrently", [&] {
+            msf->write(openFile(outPath.c_str(), FileMode<char>::writeEmpty));
+        });
+
+        msf->setWriteThreads(1);
+
+        deleteFile(outPath.c_str());
+    } else {
+        output.clear();
+
+        timings.time("MsfFile::write", [&] {
+            msf->write([&](const void* data, size_t length) {
+                const uint8_t* p = (const uint8_t*)data;
+                output.insert(output.end(), p, p + length);
+            });
+        });
+    }
+
+    msf.reset();
+
+    // Finally, everything at once.
+    PatchOptions patchOpts;
+    patchOpts.dryrun  = false;
+    patchOpts.always  = true;
+    patchOpts.threads = opts.threads;
+
+    if (opts.dir) {
+        timings.time("patchImage", [&] {
+            patchImage(imagePath.c_str(), pdbPath.c_str(), patchOpts, log);
+        });
+
+        deleteFile(imagePath.c_str());
+        deleteFile(pdbPath.c_str());
+    } else {
+        std::vector<uint8_t> imageCopy = image;
+
+        output.clear();
+
+        timings.time("patchImage", [&] {
+            patchImage(imageCopy.data(), imageCopy.size(), pdb.data(),
+                       pdb.size(),
+                       [&](const void* data, size_t length) {
+                           const uint8_t* p = (const uint8_t*)data;
+                           output.insert(output.end(), p, p + length);
+                       },
+                       patchOpts, log);
+        });
+    }
+}
+
+/**
+ * Formats a size in bytes for humans.
+ */
+std::string formatSize(size_t size) {
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1)
+       << (double)size / (1024 * 1024) << " MiB";
+    return os.str();
+}
+
+int bench(const CommandOptions& opts) {
+    std::vector<uint8_t> image, pdb;
+    generate(opts.generate, image, pdb);
+
+    std::cout << "Image: " << formatSize(image.size())
+              << ", PDB: " << formatSize(pdb.size()) << " ("
+              << opts.generate.modules << " module streams, "
+              << formatSize(opts.generate.symbolRecords)
+              << " of symbol records, " << opts.generate.names << " names)\n"
+              << "Iterations: " << opts.iterations << "\n\n";
+
+    Timings timings;
+
+    // Reused between iterations so that allocating it isn't measured.
+    std::vector<uint8_t> output;
+    output.reserve(pdb.size());
+
+    for (size_t i = 0; i < opts.iterations; ++i)
+        iterate(opts, image, pdb, timings, output);
+
+    timings.print(std::cout);
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    CommandOptions opts;
+
+    try {
+        opts.parse(argc, argv);
+    } catch (const InvalidCommandLine& error) {
+        std::cout << "Error parsing arguments: " << error.why() << std::endl;
+        std::cout << usage << std::endl;
+        return 1;
+    } catch (const CommandLineHelp&) {
+        std::cout << usage << std::endl;
+        std::cout << help;
+        return 0;
+    } catch (const CommandLineVersion&) {
+        std::cout << DUCIBLE_VERSION << std::endl;
+        return 0;
+    }
+
+    try {
+        return bench(opts);
+    } catch (const InvalidImage& error) {
+        std::cerr << "Error: Invalid image (" << error.why() << ")\n";
+    } catch (const InvalidMsf& error) {
+        std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
+    } catch (const InvalidPdb& error) {
+        std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
+    } catch (const std::system_error& error) {
+        std::cerr << "Error: " << error.what() << "\n";
+    }
+
+    return 1;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/checksum.h"
+
+#include <algorithm>
+
+#include "util/md5.h"
+#include "util/murmur3.h"
+#include "util/sha256.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// Size of each chunk hashed by calculateTreeChecksum(). Changing this changes
+// the resulting signatures.
+const size_t kHashChunkSize = 1024 * 1024;
+
+}  // namespace
+
+void calculateChecksum(const uint8_t* buf, const size_t length,
+                       const std::vector<Patch>& patches, uint8_t output[16]) {
+    size_t pos = 0;
+
+    md5_context ctx;
+    md5_starts(&ctx);
+
+    // Take the checksum of the regions between the patches to ensure a
+    // deterministic file checksum. Since the patches are sorted, we iterate
+    // over the file sequentially.
+    for (auto&& patch : patches) {
+        // Hash everything up to the patch
+        md5_update(&ctx, buf + pos, patch.offset - pos);
+
+        // Skip past the patch
+        pos = patch.offset + patch.length;
+    }
+
+    // Get everything after the last patch
+    md5_update(&ctx, buf + pos, length - pos);
+
+    md5_finish(&ctx, output);
+}
+
+void calculateTreeChecksum(const uint8_t* buf, const size_t length,
+                           const std::vector<Patch>& patches, size_t threads,
+                           uint8_t output[16]) {
+    const size_t chunkCount = (length + kHashChunkSize - 1) / kHashChunkSize;
+
+    std::vector<uint8_t> hashes(chunkCount * 16);
+
+    parallelFor(chunkCount, threads, [&](size_t i) {
+        const size_t start = i * kHashChunkSize;
+        const size_t end   = std::min(length, start + kHashChunkSize);
+
+        // Find the first patch that overlaps this chunk.
+        auto it = std::lower_bound(patches.begin(), patches.end(), start,
+                                   [](const Patch& p, size_t pos) {
+                                       return p.offset + p.length <= pos;
+                                   });
+
+        if (it == patches.end() || it->offset >= end) {
+            murmur3_x64_128(buf + start, end - start, 0, &hashes[i * 16]);
+            return;
+        }
+
+        // Gather the unpatched bytes of the chunk.
+        std::vector<uint8_t> data;
+        data.reserve(end - start);
+
+        size_t pos = start;
+
+        for (; it != patches.end() && it->offset < end; ++it) {
+            if (it->offset > pos)
+                data.insert(data.end(), buf + pos, buf + it->offset);
+
+            pos = std::max(pos, it->offset + it->length);
+        }
+
+        if (pos < end) data.insert(data.end(), buf + pos, buf + end);
+
+        murmur3_x64_128(data.data(), data.size(), 0, &hashes[i * 16]);
+    });
+
+    murmur3_x64_128(hashes.data(), hashes.size(), 1, output);
+}
+
+void calculateImageDigest(const uint8_t* buf, const size_t length,
+                          const std::vector<Patch>& patches,
+                          uint8_t output[32]) {
+    size_t pos = 0;
+
+    sha256_context ctx;
+    sha256_starts(&ctx);
+
+    for (auto&& patch : patches) {
+        // Hash everything up to the patch
+        sha256_update(&ctx, buf + pos, patch.offset - pos);
+
+        // Hash the patch instead of what it replaces
+        sha256_update(&ctx, patch.data, patch.length);
+
+        pos = patch.offset + patch.length;
+    }
+
+    // Get everything after the last patch
+    sha256_update(&ctx, buf + pos, length - pos);
+
+    sha256_finish(&ctx, output);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "ducible/patch.h"
+
+/**
+ * Calculates the checksum for the PE image, skipping over patched areas. This
+ * is used to replace the PDB signature with something that is deterministic.
+ *
+ * The list of patches is assumed to be sorted.
+ *
+ * This uses MD5 over the whole image. See calculateTreeChecksum() for a faster
+ * alternative.
+ */
+void calculateChecksum(const uint8_t* buf, const size_t length,
+                       const std::vector<Patch>& patches, uint8_t output[16]);
+
+/**
+ * Like calculateChecksum(), but uses a two-level tree of MurmurHash3 hashes.
+ *
+ * MurmurHash3 can't incrementally hash chunks of data. Instead, each 1 MiB
+ * chunk of the image is hashed separately, skipping over the patched areas
+ * inside of it. The final checksum is the hash of the concatenated chunk
+ * hashes. Since the chunks are independent, they are hashed concurrently using
+ * up to `threads` threads.
+ */
+void calculateTreeChecksum(const uint8_t* buf, const size_t length,
+                           const std::vector<Patch>& patches, size_t threads,
+                           uint8_t output[16]);
+
+/**
+ * Calculates the SHA-256 digest of the image as it is once the patches are
+ * applied. The patched areas are hashed from the patches themselves, so this
+ * gives the same result whether or not they have been applied yet.
+ *
+ * The list of patches is assumed to be sorted.
+ */
+void calculateImageDigest(const uint8_t* buf, const size_t length,
+                          const std::vector<Patch>& patches,
+                          uint8_t output[32]);
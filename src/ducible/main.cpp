@@ -20,19 +20,32 @@
  * SOFTWARE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <cctype>
+#include <codecvt>
 #include <iostream>
+#include <locale>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <system_error>
 #include <vector>
 
 #include "ducible/patch_image.h"
+#include "ducible/patch_object.h"
+#include "ducible/server.h"
 
 #include "msf/msf.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
 #include "pe/pe.h"
 
+#include "util/file.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
+
 #include "version.h"
 
 /**
@@ -82,28 +95,166 @@ struct OptionNames {};
 
 template <>
 struct OptionNames<char> {
-    const char* helpLong    = "--help";
-    const char* helpShort   = "-h";
-    const char* versionLong = "--version";
-    const char* dryrunLong  = "--dryrun";
-    const char* dryrunShort = "-n";
-    const char* dashDash    = "--";
-    const char* forceLong   = "--force";
-    const char* forceShort  = "-f";
+    const char* helpLong     = "--help";
+    const char* helpShort    = "-h";
+    const char* versionLong  = "--version";
+    const char* dryrunLong   = "--dryrun";
+    const char* dryrunShort  = "-n";
+    const char* dashDash     = "--";
+    const char* forceLong    = "--force";
+    const char* forceShort   = "-f";
+    const char* batchLong    = "--batch";
+    const char* jobsLong     = "--jobs";
+    const char* jobsShort    = "-j";
+    const char* inplaceLong  = "--inplace";
+    const char* threadsLong  = "--threads";
+    const char* hashLong     = "--hash";
+    const char* hashMd5      = "md5";
+    const char* hashMurmur3  = "murmur3";
+    const char* layoutLong   = "--layout";
+    const char* layoutIndex  = "index";
+    const char* layoutLocal  = "locality";
+    const char* alwaysLong   = "--always";
+    const char* stampLong    = "--stamp";
+    const char* verifyLong   = "--verify";
+    const char* failFastLong = "--fail-fast";
+    const char* serverLong   = "--server";
+    const char* connectLong  = "--connect";
+    const char* statsLong    = "--stats";
+    const char* traceLong    = "--trace";
+    const char* digestLong   = "--digest";
+    const char* maxMemLong   = "--max-memory";
+    const char* strippedLong = "--stripped";
+    const char* symstoreLong = "--symstore";
+    const char* storeImgLong = "--symstore-image";
+    const char* objectLong   = "--object";
+    const char* stdoutName   = "-";
 };
 
 template <>
 struct OptionNames<wchar_t> {
-    const wchar_t* helpLong    = L"--help";
-    const wchar_t* helpShort   = L"-h";
-    const wchar_t* versionLong = L"--version";
-    const wchar_t* dryrunLong  = L"--dryrun";
-    const wchar_t* dryrunShort = L"-n";
-    const wchar_t* dashDash    = L"--";
-    const wchar_t* forceLong   = L"--force";
-    const wchar_t* forceShort  = L"-f";
+    const wchar_t* helpLong     = L"--help";
+    const wchar_t* helpShort    = L"-h";
+    const wchar_t* versionLong  = L"--version";
+    const wchar_t* dryrunLong   = L"--dryrun";
+    const wchar_t* dryrunShort  = L"-n";
+    const wchar_t* dashDash     = L"--";
+    const wchar_t* forceLong    = L"--force";
+    const wchar_t* forceShort   = L"-f";
+    const wchar_t* batchLong    = L"--batch";
+    const wchar_t* jobsLong     = L"--jobs";
+    const wchar_t* jobsShort    = L"-j";
+    const wchar_t* inplaceLong  = L"--inplace";
+    const wchar_t* threadsLong  = L"--threads";
+    const wchar_t* hashLong     = L"--hash";
+    const wchar_t* hashMd5      = L"md5";
+    const wchar_t* hashMurmur3  = L"murmur3";
+    const wchar_t* layoutLong   = L"--layout";
+    const wchar_t* layoutIndex  = L"index";
+    const wchar_t* layoutLocal  = L"locality";
+    const wchar_t* alwaysLong   = L"--always";
+    const wchar_t* stampLong    = L"--stamp";
+    const wchar_t* verifyLong   = L"--verify";
+    const wchar_t* failFastLong = L"--fail-fast";
+    const wchar_t* serverLong   = L"--server";
+    const wchar_t* connectLong  = L"--connect";
+    const wchar_t* statsLong    = L"--stats";
+    const wchar_t* traceLong    = L"--trace";
+    const wchar_t* digestLong   = L"--digest";
+    const wchar_t* maxMemLong   = L"--max-memory";
+    const wchar_t* strippedLong = L"--stripped";
+    const wchar_t* symstoreLong = L"--symstore";
+    const wchar_t* storeImgLong = L"--symstore-image";
+    const wchar_t* objectLong   = L"--object";
+    const wchar_t* stdoutName   = L"-";
 };
 
+/**
+ * Converts UTF-8 to the given character type.
+ */
+template <typename CharT>
+std::basic_string<CharT> fromUtf8(const std::string& s);
+
+template <>
+std::string fromUtf8<char>(const std::string& s) {
+    return s;
+}
+
+template <>
+std::wstring fromUtf8<wchar_t>(const std::string& s) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.from_bytes(s);
+}
+
+/**
+ * Converts the given character type to UTF-8 for printing.
+ */
+inline std::string toUtf8(const std::string& s) { return s; }
+
+inline std::string toUtf8(const std::wstring& s) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(s);
+}
+
+/**
+ * Parses a positive integer option value.
+ */
+template <typename CharT>
+size_t parseCount(const std::basic_string<CharT>& s) {
+    size_t n = 0;
+
+    if (s.empty()) throw InvalidCommandLine("Expected a positive integer");
+
+    for (CharT c : s) {
+        if (c < '0' || c > '9')
+            throw InvalidCommandLine("Expected a positive integer");
+
+        const size_t digit = (size_t)(c - '0');
+        if (n > (SIZE_MAX - digit) / 10)
+            throw InvalidCommandLine("Number is too large");
+
+        n = n * 10 + digit;
+    }
+
+    if (n == 0) throw InvalidCommandLine("Expected a positive integer");
+
+    return n;
+}
+
+/**
+ * Parses a size in bytes. It may end with one of the suffixes "K", "M", or
+ * "G".
+ */
+template <typename CharT>
+size_t parseSize(std::basic_string<CharT> s) {
+    size_t multiplier = 1;
+
+    if (!s.empty()) {
+        switch (s.back()) {
+            case 'K':
+            case 'k':
+                multiplier = 1024;
+                break;
+            case 'M':
+            case 'm':
+                multiplier = 1024 * 1024;
+                break;
+            case 'G':
+            case 'g':
+                multiplier = 1024 * 1024 * 1024;
+                break;
+        }
+
+        if (multiplier != 1) s.pop_back();
+    }
+
+    const size_t n = parseCount(s);
+    if (n > SIZE_MAX / multiplier)
+        throw InvalidCommandLine("Size is too large");
+
+    return n * multiplier;
+}
+
 /**
  * Command line options.
  */
@@ -117,8 +268,102 @@ class CommandOptions {
     const CharT* pdb;
     bool dryrun;
     bool force;
+    bool inplace;
+
+    // File listing the image/PDB pairs to patch in batch mode.
+    const CharT* batch;
+
+    // Number of batch items to process concurrently. 0 means to use the number
+    // of hardware threads.
+    size_t jobs;
+
+    // Maximum number of threads used to patch the streams of each PDB. 0 means
+    // to use the number of hardware threads, or 1 in batch mode.
+    size_t threads;
+
+    // Hash used for the PDB signature.
+    SignatureHash hash;
+
+    // Layout of rewritten PDBs.
+    PdbLayout layout;
+
+    // Patch even if the files are already normalized.
+    bool always;
+
+    // Skip files that haven't changed since they were last normalized.
+    bool stamp;
+
+    // Only check that the files are normalized.
+    bool verify;
+
+    // Stop verifying at the first patch site that is not normalized.
+    bool failFast;
 
-    CommandOptions() : image(NULL), pdb(NULL), dryrun(false) {}
+    // Address to listen on for requests. If set, this process is a server.
+    const CharT* server;
+
+    // Address of the server to forward requests to. If null, the address is
+    // taken from the DUCIBLE_SERVER environment variable, if set.
+    const CharT* connect;
+
+    // Files to write the timings and counters to, as JSON and in the Chrome
+    // trace event format.
+    const CharT* stats;
+    const CharT* trace;
+
+    // File to write the SHA-256 digests of the normalized files to, or "-" for
+    // stdout.
+    const CharT* digest;
+
+    // Maximum heap memory for copies of the streams of each PDB. 0 means there
+    // is no limit.
+    size_t maxMemory;
+
+    // Also write a stripped copy of the PDB.
+    bool stripped;
+
+    // Symbol store to write the normalized PDB to, and whether the image goes
+    // there too.
+    const CharT* symstore;
+    bool storeImage;
+
+    // The positional arguments are object files or static libraries instead of
+    // an image/PDB pair.
+    bool object;
+    std::vector<const CharT*> objects;
+
+    CommandOptions()
+        : image(NULL),
+          pdb(NULL),
+          dryrun(false),
+          force(false),
+          inplace(false),
+          batch(NULL),
+          jobs(0),
+          threads(0),
+          hash(SignatureHash::md5),
+          layout(PdbLayout::index),
+          always(false),
+          stamp(false),
+          verify(false),
+          failFast(false),
+          server(NULL),
+          connect(NULL),
+          stats(NULL),
+          trace(NULL),
+          digest(NULL),
+          maxMemory(0),
+          stripped(false),
+          symstore(NULL),
+          storeImage(false),
+          object(false) {}
+
+    /**
+     * Returns true if the digests are to be printed to stdout.
+     */
+    bool digestToStdout() const {
+        return digest && std::basic_string<CharT>(digest) == opt.stdoutName;
+    }
 
     /**
      * Parses the command line arguments.
@@ -163,6 +408,87 @@ class CommandOptions {
                 dryrun = true;
             } else if (arg == opt.forceLong || arg == opt.forceShort) {
                 force = true;
+            } else if (arg == opt.inplaceLong) {
+                inplace = true;
+            } else if (arg == opt.alwaysLong) {
+                always = true;
+            } else if (arg == opt.stampLong) {
+                stamp = true;
+            } else if (arg == opt.verifyLong) {
+                verify = true;
+            } else if (arg == opt.failFastLong) {
+                failFast = true;
+            } else if (arg == opt.strippedLong) {
+                stripped = true;
+            } else if (arg == opt.storeImgLong) {
+                storeImage = true;
+            } else if (arg == opt.objectLong) {
+                object = true;
+            } else if (arg == opt.symstoreLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --symstore");
+                symstore = argv[i];
+            } else if (arg == opt.serverLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --server");
+                server = argv[i];
+            } else if (arg == opt.connectLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --connect");
+                connect = argv[i];
+            } else if (arg == opt.statsLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --stats");
+                stats = argv[i];
+            } else if (arg == opt.traceLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --trace");
+                trace = argv[i];
+            } else if (arg == opt.digestLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --digest");
+                digest = argv[i];
+            } else if (arg == opt.maxMemLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine(
+                        "Missing argument for --max-memory");
+                maxMemory = parseSize(string(argv[i]));
+            } else if (arg == opt.batchLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --batch");
+                batch = argv[i];
+            } else if (arg == opt.jobsLong || arg == opt.jobsShort) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --jobs");
+                jobs = parseCount(string(argv[i]));
+            } else if (arg == opt.threadsLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --threads");
+                threads = parseCount(string(argv[i]));
+            } else if (arg == opt.hashLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --hash");
+
+                const string name = argv[i];
+                if (name == opt.hashMd5)
+                    hash = SignatureHash::md5;
+                else if (name == opt.hashMurmur3)
+                    hash = SignatureHash::murmur3;
+                else
+                    throw InvalidCommandLine("Unknown hash '" + toUtf8(name) +
+                                             "' for --hash");
+            } else if (arg == opt.layoutLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --layout");
+
+                const string name = argv[i];
+                if (name == opt.layoutIndex)
+                    layout = PdbLayout::index;
+                else if (name == opt.layoutLocal)
+                    layout = PdbLayout::locality;
+                else
+                    throw InvalidCommandLine("Unknown layout '" +
+                                             toUtf8(name) + "' for --layout");
             } else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             } else {
@@ -170,6 +496,47 @@ class CommandOptions {
             }
         }
 
+        if (storeImage && !symstore) {
+            throw InvalidCommandLine(
+                "--symstore-image can only be used with --symstore");
+        }
+
+        if (object && verify) {
+            throw InvalidCommandLine(
+                "--object and --verify cannot be used together");
+        }
+
+        if (server) {
+            if (batch || !positional.empty()) {
+                throw InvalidCommandLine(
+                    "Files to patch cannot be given with --server");
+            }
+
+            if (connect) {
+                throw InvalidCommandLine(
+                    "--server and --connect cannot be used together");
+            }
+
+            return;
+        }
+
+        if (batch) {
+            if (!positional.empty()) {
+                throw InvalidCommandLine(
+                    "Positional arguments cannot be used with --batch");
+            }
+
+            return;
+        }
+
+        if (object) {
+            if (positional.empty())
+                throw InvalidCommandLine("Missing positional argument");
+
+            objects = positional;
+            return;
+        }
+
         switch (positional.size()) {
             case 2:
                 pdb = positional[1];
@@ -190,7 +557,151 @@ class CommandOptions {
 template <typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
-const char* usage = "Usage: ducible image [pdb] [--help] [--dryrun]";
+/**
+ * Returns true if the given path is absolute.
+ */
+template <typename CharT>
+bool isAbsolutePath(const std::basic_string<CharT>& path) {
+#ifdef _WIN32
+    return (path.length() >= 2 && path[1] == ':') ||
+           (!path.empty() && (path[0] == '\\' || path[0] == '/'));
+#else
+    return !path.empty() && path[0] == '/';
+#endif
+}
+
+/**
+ * Resolves a path relative to the given directory. Absolute paths are returned
+ * unchanged.
+ */
+template <typename CharT>
+std::basic_string<CharT> resolvePath(const std::basic_string<CharT>& dir,
+                                     const std::basic_string<CharT>& path) {
+    if (dir.empty() || isAbsolutePath(path)) return path;
+
+#ifdef _WIN32
+    const CharT separator = '\\';
+#else
+    const CharT separator = '/';
+#endif
+
+    std::basic_string<CharT> resolved = dir;
+    if (resolved.back() != '/' && resolved.back() != separator)
+        resolved += separator;
+
+    return resolved + path;
+}
+
+/**
+ * A single image/PDB pair in a batch file.
+ */
+template <typename CharT>
+struct BatchItem {
+    std::basic_string<CharT> image;
+
+    // Empty if there is no PDB.
+    std::basic_string<CharT> pdb;
+};
+
+/**
+ * Splits a line of a batch file into paths. Paths are separated by whitespace
+ * and may be enclosed in double quotes if they contain whitespace.
+ */
+std::vector<std::string> splitBatchLine(const std::string& line,
+                                        size_t lineNumber) {
+    std::vector<std::string> paths;
+
+    for (size_t i = 0; i < line.length();) {
+        if (isspace((unsigned char)line[i])) {
+            ++i;
+            continue;
+        }
+
+        std::string path;
+
+        if (line[i] == '"') {
+            const size_t end = line.find('"', i + 1);
+            if (end == std::string::npos) {
+                throw InvalidCommandLine("Unterminated quote on line " +
+                                         std::to_string(lineNumber) +
+                                         " of the batch file");
+            }
+
+            path = line.substr(i + 1, end - i - 1);
+            i    = end + 1;
+        } else {
+            const size_t start = i;
+            while (i < line.length() && !isspace((unsigned char)line[i])) ++i;
+            path = line.substr(start, i - start);
+        }
+
+        paths.push_back(path);
+    }
+
+    return paths;
+}
+
+/**
+ * Reads a batch file. Each non-empty line consists of an image path, optionally
+ * followed by a PDB path. Lines starting with '#' are ignored. The file is
+ * expected to be UTF-8.
+ */
+template <typename CharT>
+std::vector<BatchItem<CharT>> readBatchFile(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    std::string contents;
+
+    char buf[4096];
+    while (size_t n = fread(buf, 1, sizeof(buf), f.get()))
+        contents.append(buf, n);
+
+    if (ferror(f.get())) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to read batch file");
+    }
+
+    // Skip the UTF-8 byte order mark, if any.
+    if (contents.compare(0, 3, "\xEF\xBB\xBF") == 0) contents.erase(0, 3);
+
+    std::vector<BatchItem<CharT>> items;
+
+    std::istringstream lines(contents);
+    std::string line;
+
+    for (size_t lineNumber = 1; std::getline(lines, line); ++lineNumber) {
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        const auto paths = splitBatchLine(line, lineNumber);
+
+        if (paths.size() > 2) {
+            throw InvalidCommandLine("Too many paths on line " +
+                                     std::to_string(lineNumber) +
+                                     " of the batch file");
+        }
+
+        BatchItem<CharT> item;
+        item.image = fromUtf8<CharT>(paths[0]);
+        if (paths.size() == 2) item.pdb = fromUtf8<CharT>(paths[1]);
+
+        items.push_back(item);
+    }
+
+    return items;
+}
+
+const char* usage =
+    "Usage: ducible {image [pdb] | --batch file} [--help] [--dryrun]\n"
+    "               [--force] [--inplace] [--jobs N] [--threads N]\n"
+    "               [--hash NAME] [--layout NAME] [--always] [--stamp]\n"
+    "               [--verify] [--fail-fast]\n"
+    "               [--connect ADDRESS] [--stats FILE] [--trace FILE]\n"
+    "               [--digest FILE] [--max-memory SIZE] [--stripped]\n"
+    "               [--symstore DIR] [--symstore-image]\n"
+    "       ducible --object {object... | --batch file} [--dryrun]\n"
+    "               [--threads N] [--jobs N]\n"
+    "       ducible --server ADDRESS [--jobs N]";
 
 const char* help =
     R"(
@@ -210,55 +721,566 @@ Positional arguments:
 Optional arguments:
   --help, -h    Prints this help.
   --dryrun, -n  No files are modified, only what would have been patched are
-                printed.
+                printed, along with the size of the rewritten PDB. Nothing is
+                written to disk, not even a temporary PDB.
   --force, -f   Proceed even if the PDB signatures don't match. Useful if you
                 already know an image is compatible with a PDB even though the
                 signatures don't match.
+  --inplace     Patch the PDB in place instead of writing a new copy of it.
+                This is much faster for large PDBs, but the PDB is left corrupt
+                if ducible is interrupted, and the layout of the PDB is kept as
+                the linker wrote it. If a change can't be made in place, the
+                PDB is rewritten as usual.
+  --batch file  Patches every image/PDB pair listed in the given file instead
+                of the positional arguments. Each line of the file has an image
+                path optionally followed by a PDB path. Paths containing spaces
+                must be enclosed in double quotes. Lines starting with '#' are
+                ignored. A failure in one pair does not stop the others from
+                being patched, but the exit code is non-zero if any failed. The
+                same file must not appear in more than one pair.
+  --jobs N, -j N
+                Number of batch pairs to patch concurrently. Defaults to the
+                number of hardware threads.
+  --threads N   Maximum number of threads used to patch each image/PDB pair.
+                Defaults to the number of hardware threads, or 1 in batch mode
+                where the pairs are already patched concurrently.
+  --hash NAME   Hash of the image used to generate the PDB signature. Either
+                "md5" (the default) or "murmur3". "murmur3" is much faster for
+                large images and can use multiple threads, but it produces
+                different signatures than "md5". Every build that needs to be
+                reproducible must use the same hash.
+  --layout NAME How the streams of the PDB are laid out when it is rewritten.
+                Either "index" (the default), which writes them in order, or
+                "locality", which writes the streams that a debugger reads
+                first at the start of the PDB. "locality" makes loading
+                symbols from a cold cache or a network share faster. It
+                implies that the PDB is never patched in place.
+  --always      Patch the files even if their headers show that they have
+                already been normalized. Use this after changing --hash or
+                --layout.
+  --stamp       Write a stamp file next to the image once it is normalized,
+                and skip the image/PDB pair without opening it next time if
+                neither file has changed.
+  --verify      Only check that the image and PDB are already normalized. Both
+                files are opened read-only and nothing is written. Every patch
+                site that is not normalized is printed, and the exit code is
+                non-zero if there are any.
+  --fail-fast   With --verify, stop at the first patch site that is not
+                normalized.
+  --server ADDRESS
+                Run as a server that patches files on behalf of other ducible
+                processes, using --jobs worker threads. On Windows, the address
+                is the name of a pipe. Otherwise, it is the path of a Unix
+                domain socket. Requests for the same files must not be sent
+                concurrently.
+  --connect ADDRESS
+                Send the request to the server listening on the given address
+                instead of handling it in this process. If no server is
+                listening, the request is handled locally. Defaults to the
+                value of the DUCIBLE_SERVER environment variable, if set.
+  --stats FILE  Write how long each phase took, how much was read, written,
+                and patched, and the peak memory usage to the given file as
+                JSON. In batch mode, this covers every pair. If the request is
+                handled by a server, the peak memory usage is the server's.
+  --trace FILE  Write how long each phase took to the given file in the Chrome
+                trace event format. It can be viewed with chrome://tracing.
+  --digest FILE Write the SHA-256 digest of each normalized image and PDB to
+                the given file (or stdout if it is "-") in the format of
+                sha256sum. The PDB is hashed while it is being written, so
+                neither file has to be read again. Nothing is written for a
+                dry run or with --verify.
+  --max-memory SIZE
+                Limit the memory used for copies of the streams of each PDB to
+                SIZE bytes. SIZE may end with "K", "M", or "G". Copies beyond
+                the limit are backed by temporary files instead. The output is
+                the same either way. In batch mode, the limit applies to each
+                pair separately.
+  --stripped    Also write a stripped copy of the normalized PDB next to it,
+                like one linked with /PDBSTRIPPED. If the PDB is "foo.pdb", the
+                copy is "foo.stripped.pdb". It only has the public symbols and
+                the section headers, which is enough to walk the stack and to
+                find the names of functions, and it matches the image. The
+                files are patched even if they are already normalized, as with
+                --always, so that the stripped PDB is always written.
+  --symstore DIR
+                Write the normalized PDB straight into the symbol store DIR, in
+                the same layout as symstore.exe ("name.pdb/<GUID><age>/
+                name.pdb"), instead of next to the original. The original path
+                is then linked to the PDB in the store. A reflink is made where
+                the file system supports it, and the file is copied otherwise.
+                Hard links are never made, so the PDB in the store doesn't
+                change if the original is modified in place. Files skipped
+                because they are already normalized are linked into the store
+                as well.
+                --stamp has no effect with it.
+  --symstore-image
+                With --symstore, also link the image into the symbol store.
+  --object      The positional arguments are COFF object files (.obj) or
+                static libraries (.lib) instead of an image/PDB pair, and each
+                is patched in place. The timestamps in the object headers, the
+                dates of the library members, and the GUID that the compiler
+                adds to the object path in the debug information of objects
+                compiled with /Zi are cleared. Only one object can be listed on
+                each line of the batch file. It cannot be used with --verify,
+                and no digests are written for objects.
 )";
 
-template <typename CharT = char>
-int ducible(int argc, CharT** argv) {
-    CommandOptions<CharT> opts;
+/**
+ * Formats a digest of a file in the same way as sha256sum.
+ */
+template <typename CharT>
+std::string digestLine(const uint8_t digest[32], const CharT* path) {
+    static const char hex[] = "0123456789abcdef";
 
-    try {
-        opts.parse(argc, argv);
-    } catch (const InvalidCommandLine& error) {
-        std::cout << "Error parsing arguments: " << error.why() << std::endl;
-        std::cout << usage << std::endl;
-        return 1;
-    } catch (const UnknownOption<CharT>& error) {
-        std::cout << "Error parsing arguments: Unknown option '" << error.name()
-                  << "'" << std::endl;
-        std::cout << usage << std::endl;
-        return 1;
-    } catch (const CommandLineHelp&) {
-        std::cout << usage << std::endl;
-        std::cout << help;
-        return 0;
-    } catch (const CommandLineVersion&) {
-        std::cout << DUCIBLE_VERSION << std::endl;
-        return 0;
+    std::string line;
+
+    for (size_t i = 0; i < 32; ++i) {
+        line += hex[digest[i] >> 4];
+        line += hex[digest[i] & 0xf];
     }
 
+    return line + "  " + toUtf8(std::basic_string<CharT>(path)) + "\n";
+}
+
+/**
+ * Patches a single image/PDB pair. Returns the exit code. If `digests` is not
+ * null, the digests of the normalized files are appended to it.
+ */
+template <typename CharT>
+int patchOne(const CharT* image, const CharT* pdb,
+             const CommandOptions<CharT>& opts, Stats* stats,
+             std::string* digests, std::ostream& log, std::ostream& err) {
+    PatchOptions patchOpts;
+    patchOpts.dryrun      = opts.dryrun;
+    patchOpts.force       = opts.force;
+    patchOpts.inplace     = opts.inplace;
+    patchOpts.threads     = opts.threads;
+    patchOpts.hash        = opts.hash;
+    patchOpts.layout      = opts.layout;
+    patchOpts.always      = opts.always;
+    patchOpts.stamp       = opts.stamp;
+    patchOpts.maxMemory   = opts.maxMemory;
+    patchOpts.stripped    = opts.stripped;
+    patchOpts.symbolStore = opts.symstore;
+    patchOpts.storeImage  = opts.storeImage;
+    patchOpts.stats       = stats;
+
+    OutputDigests outputDigests;
+    if (digests) patchOpts.digests = &outputDigests;
+
+    // The batch items are already patched concurrently.
+    if (opts.batch && opts.threads == 0) patchOpts.threads = 1;
+
     try {
-        patchImage(opts.image, opts.pdb, opts.dryrun, opts.force);
+        if (opts.object) {
+            patchObject(image, patchOpts, log);
+        } else if (opts.verify) {
+            const size_t mismatches =
+                verifyImage(image, pdb, patchOpts, opts.failFast, log);
+
+            if (mismatches > 0) {
+                err << "Error: The image is not normalized\n";
+                return 1;
+            }
+        } else {
+            patchImage(image, pdb, patchOpts, log);
+        }
     } catch (const InvalidImage& error) {
-        std::cerr << "Error: Invalid image (" << error.why() << ")\n";
+        err << "Error: Invalid image (" << error.why() << ")\n";
         return 1;
     } catch (const InvalidMsf& error) {
-        std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
+        err << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
         return 1;
     } catch (const InvalidPdb& error) {
-        std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
+        err << "Error: Invalid PDB format (" << error.why() << ")\n";
         return 1;
     } catch (const std::system_error& error) {
-        std::cerr << "Error: " << error.what() << "\n";
+        err << "Error: " << error.what() << "\n";
+        return 1;
+    } catch (const std::exception& error) {
+        err << "Error: " << error.what() << "\n";
         return 1;
     }
 
+    if (outputDigests.hasImage)
+        *digests += digestLine(outputDigests.image, image);
+
+    if (outputDigests.hasPdb) *digests += digestLine(outputDigests.pdb, pdb);
+
     return 0;
 }
 
+/**
+ * Patches every pair listed in the batch file. Returns the exit code.
+ *
+ * The output of each pair is buffered and printed in the order the pairs are
+ * listed, regardless of the order in which they finish, so that the output is
+ * deterministic.
+ */
+template <typename CharT>
+int patchBatch(const CommandOptions<CharT>& opts, Stats* stats,
+               std::string* digests, std::ostream& out, std::ostream& err,
+               const std::basic_string<CharT>& baseDir) {
+    std::vector<BatchItem<CharT>> items;
+
+    try {
+        items = readBatchFile(opts.batch);
+    } catch (const InvalidCommandLine& error) {
+        err << "Error: " << error.why() << "\n";
+        return 1;
+    } catch (const std::system_error& error) {
+        err << "Error: " << error.what() << "\n";
+        return 1;
+    }
+
+    if (opts.object) {
+        for (auto& item : items) {
+            if (!item.pdb.empty()) {
+                err << "Error: Only one object can be listed on each line of "
+                       "the batch file\n";
+                return 1;
+            }
+        }
+    }
+
+    if (!baseDir.empty()) {
+        for (auto& item : items) {
+            item.image = resolvePath(baseDir, item.image);
+            if (!item.pdb.empty()) item.pdb = resolvePath(baseDir, item.pdb);
+        }
+    }
+
+    const size_t count = items.size();
+
+    std::vector<std::string> outputs(count);
+    std::vector<std::string> itemDigests(count);
+    std::vector<bool> finished(count, false);
+    size_t nextToPrint = 0;
+    size_t failures    = 0;
+    std::mutex mutex;
+
+    {
+        ThreadPool pool(opts.jobs);
+
+        for (size_t i = 0; i < count; ++i) {
+            pool.submit([&, i]() {
+                const BatchItem<CharT>& item = items[i];
+
+                std::ostringstream log;
+                log << "[" << (i + 1) << "/" << count << "] "
+                    << toUtf8(item.image) << "\n";
+
+                const int result =
+                    patchOne(item.image.c_str(),
+                             item.pdb.empty() ? NULL : item.pdb.c_str(), opts,
+                             stats, digests ? &itemDigests[i] : nullptr, log,
+                             log);
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (result != 0) ++failures;
+
+                outputs[i]  = log.str();
+                finished[i] = true;
+
+                // Print everything that is ready, in order.
+                for (; nextToPrint < count && finished[nextToPrint];
+                     ++nextToPrint) {
+                    out << outputs[nextToPrint];
+                    outputs[nextToPrint].clear();
+                }
+
+                out.flush();
+            });
+        }
+
+        pool.wait();
+    }
+
+    // The digests are also listed in the same order as the pairs.
+    if (digests) {
+        for (auto& d : itemDigests) *digests += d;
+    }
+
+    out << (count - failures) << " of " << count
+        << " batch items succeeded.\n";
+
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * Parses the command line. Returns false if the program should exit with
+ * `exitCode` instead of continuing.
+ */
+template <typename CharT>
+bool parseOptions(CommandOptions<CharT>& opts, int argc, CharT** argv,
+                  std::ostream& out, int& exitCode) {
+    try {
+        opts.parse(argc, argv);
+    } catch (const InvalidCommandLine& error) {
+        out << "Error parsing arguments: " << error.why() << std::endl;
+        out << usage << std::endl;
+        exitCode = 1;
+        return false;
+    } catch (const UnknownOption<CharT>& error) {
+        out << "Error parsing arguments: Unknown option '"
+            << toUtf8(error.name()) << "'" << std::endl;
+        out << usage << std::endl;
+        exitCode = 1;
+        return false;
+    } catch (const CommandLineHelp&) {
+        out << usage << std::endl;
+        out << help;
+        exitCode = 0;
+        return false;
+    } catch (const CommandLineVersion&) {
+        out << DUCIBLE_VERSION << std::endl;
+        exitCode = 0;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Replaces the contents of a file.
+ */
+template <typename CharT>
+void writeFile(const CharT* path, const std::string& contents) {
+    auto f = openFile(path, FileMode<CharT>::writeEmpty);
+
+    if (fwrite(contents.data(), 1, contents.length(), f.get()) !=
+            contents.length() ||
+        fflush(f.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to write output file");
+    }
+}
+
+/**
+ * Writes the statistics to the files given by the options. Returns false if
+ * that fails.
+ */
+template <typename CharT>
+bool writeStats(const CommandOptions<CharT>& opts, const Stats& stats,
+                std::ostream& err) {
+    try {
+        if (opts.stats) {
+            std::ostringstream json;
+            stats.writeJson(json);
+            writeFile(opts.stats, json.str());
+        }
+
+        if (opts.trace) {
+            std::ostringstream trace;
+            stats.writeTrace(trace);
+            writeFile(opts.trace, trace.str());
+        }
+    } catch (const std::system_error& error) {
+        err << "Error: " << error.what() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the digests to the file given by the options. Returns false if that
+ * fails.
+ */
+template <typename CharT>
+bool writeDigests(const CommandOptions<CharT>& opts, const std::string& digests,
+                  std::ostream& out, std::ostream& err) {
+    if (opts.digestToStdout()) {
+        out << digests;
+        return true;
+    }
+
+    try {
+        writeFile(opts.digest, digests);
+    } catch (const std::system_error& error) {
+        err << "Error: " << error.what() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Patches the files given by the options. Relative paths in a batch file are
+ * resolved against `baseDir` if it isn't empty. Returns the exit code.
+ */
+template <typename CharT>
+int run(const CommandOptions<CharT>& opts, std::ostream& out,
+        std::ostream& err, const std::basic_string<CharT>& baseDir) {
+    // Nothing is measured unless it is going to be written out.
+    std::unique_ptr<Stats> stats;
+    if (opts.stats || opts.trace) stats.reset(new Stats());
+
+    std::string digests;
+    std::string* digestsRef = opts.digest ? &digests : nullptr;
+
+    int exitCode = 0;
+    if (opts.batch) {
+        exitCode =
+            patchBatch(opts, stats.get(), digestsRef, out, err, baseDir);
+    } else if (opts.object) {
+        // A failure in one object does not stop the others from being patched.
+        for (auto object : opts.objects) {
+            if (patchOne(object, (const CharT*)NULL, opts, stats.get(),
+                         digestsRef, out, err) != 0) {
+                exitCode = 1;
+            }
+        }
+    } else {
+        exitCode = patchOne(opts.image, opts.pdb, opts, stats.get(),
+                            digestsRef, out, err);
+    }
+
+    if (stats && !writeStats(opts, *stats, err)) return 1;
+
+    if (opts.digest && !writeDigests(opts, digests, out, err)) return 1;
+
+    return exitCode;
+}
+
+/**
+ * Handles a request that was forwarded to the server.
+ */
+template <typename CharT>
+int handleRequest(const ServerRequest& request, std::ostream& out,
+                  std::ostream& err) {
+    typedef std::basic_string<CharT> string;
+
+    std::vector<string> args(1, fromUtf8<CharT>("ducible"));
+    for (auto& arg : request.args) args.push_back(fromUtf8<CharT>(arg));
+
+    std::vector<CharT*> argv;
+    for (auto& arg : args) argv.push_back(&arg[0]);
+    argv.push_back(NULL);
+
+    CommandOptions<CharT> opts;
+
+    int exitCode;
+    if (!parseOptions(opts, (int)args.size(), argv.data(), out, exitCode))
+        return exitCode;
+
+    if (opts.server) {
+        err << "Error: A server cannot be started by a request\n";
+        return 1;
+    }
+
+    // The paths are relative to the client's current directory.
+    const string cwd = fromUtf8<CharT>(request.cwd);
+
+    string image, pdb, batch, stats, trace, digest, symstore;
+
+    if (opts.image) {
+        image      = resolvePath(cwd, string(opts.image));
+        opts.image = image.c_str();
+    }
+
+    if (opts.pdb) {
+        pdb      = resolvePath(cwd, string(opts.pdb));
+        opts.pdb = pdb.c_str();
+    }
+
+    if (opts.batch) {
+        batch      = resolvePath(cwd, string(opts.batch));
+        opts.batch = batch.c_str();
+    }
+
+    if (opts.stats) {
+        stats      = resolvePath(cwd, string(opts.stats));
+        opts.stats = stats.c_str();
+    }
+
+    if (opts.trace) {
+        trace      = resolvePath(cwd, string(opts.trace));
+        opts.trace = trace.c_str();
+    }
+
+    if (opts.digest && !opts.digestToStdout()) {
+        digest      = resolvePath(cwd, string(opts.digest));
+        opts.digest = digest.c_str();
+    }
+
+    if (opts.symstore) {
+        symstore      = resolvePath(cwd, string(opts.symstore));
+        opts.symstore = symstore.c_str();
+    }
+
+    std::vector<string> objects;
+    for (auto object : opts.objects)
+        objects.push_back(resolvePath(cwd, string(object)));
+
+    for (size_t i = 0; i < objects.size(); ++i)
+        opts.objects[i] = objects[i].c_str();
+
+    // Requests are already handled concurrently.
+    if (opts.threads == 0) opts.threads = 1;
+
+    return run(opts, out, err, cwd);
+}
+
+/**
+ * Returns the address of the server to forward requests to, or an empty string
+ * if there is none.
+ */
+template <typename CharT>
+std::string serverAddress(const CommandOptions<CharT>& opts) {
+    if (opts.connect) return toUtf8(opts.connect);
+
+#ifdef _WIN32
+    char* value = NULL;
+    size_t length;
+    if (_dupenv_s(&value, &length, "DUCIBLE_SERVER") != 0 || !value) return "";
+
+    const std::string address(value);
+    free(value);
+    return address;
+#else
+    const char* value = getenv("DUCIBLE_SERVER");
+    return value ? value : "";
+#endif
+}
+
+template <typename CharT = char>
+int ducible(int argc, CharT** argv) {
+    CommandOptions<CharT> opts;
+
+    int exitCode;
+    if (!parseOptions(opts, argc, argv, std::cout, exitCode)) return exitCode;
+
+    if (opts.server) {
+        try {
+            runServer(toUtf8(opts.server), opts.jobs, handleRequest<CharT>);
+        } catch (const std::system_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Let the server handle the request if there is one.
+    const std::string address = serverAddress(opts);
+
+    if (!address.empty()) {
+        ServerRequest request;
+        request.cwd = getCurrentDir();
+        for (int i = 1; i < argc; ++i) request.args.push_back(toUtf8(argv[i]));
+
+        try {
+            if (forwardRequest(address, request, exitCode)) return exitCode;
+        } catch (const std::system_error&) {
+            // Handle it locally instead.
+        }
+    }
+
+    return run(opts, std::cout, std::cerr, std::basic_string<CharT>());
+}
+
 #if defined(_WIN32) && defined(UNICODE)
 
 int wmain(int argc, wchar_t** argv) { return ducible<wchar_t>(argc, argv); }
@@ -31,18 +31,22 @@ Patch::Patch(size_t offset, size_t length, const uint8_t* data,
              const char* name)
     : offset(offset), length(length), data(data), name(name) {}
 
-void Patch::apply(uint8_t* buf, bool dryRun) {
+bool Patch::isApplied(const uint8_t* buf) const {
+    return memcmp(buf + offset, data, length) == 0;
+}
+
+void Patch::apply(uint8_t* buf, bool dryRun, std::ostream& log) {
     // Only apply the patch if necessary. This makes it easier to see what
     // actually changed in the output.
-    if (memcmp(buf + offset, data, length) == 0) return;
+    if (isApplied(buf)) return;
 
-    std::cout << *this << std::endl;
+    log << "Patching " << *this << std::endl;
 
     if (!dryRun) memcpy(buf + offset, data, length);
 }
 
 std::ostream& operator<<(std::ostream& os, const Patch& patch) {
-    os << "Patching '" << patch.name << "' at offset 0x" << std::hex
+    os << "'" << patch.name << "' at offset 0x" << std::hex
        << patch.offset << std::dec << " (" << patch.length << " bytes)";
     return os;
 }
@@ -58,11 +58,17 @@ class Patch {
           data((const uint8_t*)data),
           name(name) {}
 
+    /**
+     * Returns true if the location already contains the patch data.
+     */
+    bool isApplied(const uint8_t* buf) const;
+
     /**
      * Applies the patch. Note that no bounds checking is done. It is assumed
-     * that it has already been done.
+     * that it has already been done. The patch is printed to `log` if it
+     * changes anything.
      */
-    void apply(uint8_t* buf, bool dryRun);
+    void apply(uint8_t* buf, bool dryRun, std::ostream& log);
 
     friend std::ostream& operator<<(std::ostream& os, const Patch& patch);
 
@@ -25,10 +25,12 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "ducible/patch_ilk.h"
 
 #include "util/memmap.h"
+#include "util/thread_pool.h"
 
 namespace {
 
@@ -43,11 +45,99 @@ const char Strings<char>::ilkExtension[] = ".ilk";
 template <>
 const wchar_t Strings<wchar_t>::ilkExtension[] = L".ilk";
 
+const size_t signatureSize = 16;
+
+// ILK files larger than this are searched in chunks of this size in parallel.
+const size_t chunkSize = 64 * 1024 * 1024;
+
+/**
+ * Searches for a signature using the Boyer-Moore-Horspool algorithm. Since the
+ * signature is essentially random, most of the time this skips ahead by the
+ * full length of the signature.
+ */
+class SignatureSearch {
+   private:
+    const uint8_t* _signature;
+
+    // How far we can skip ahead based on the last byte of the current window.
+    size_t _skip[256];
+
+   public:
+    SignatureSearch(const uint8_t signature[signatureSize])
+        : _signature(signature) {
+        for (size_t i = 0; i < 256; ++i) _skip[i] = signatureSize;
+
+        for (size_t i = 0; i < signatureSize - 1; ++i)
+            _skip[signature[i]] = signatureSize - 1 - i;
+    }
+
+    /**
+     * Finds all non-overlapping occurrences that start in `[begin, end)`. The
+     * buffer must be readable up to `limit` so that occurrences that start near
+     * `end` can be matched.
+     */
+    void find(const uint8_t* begin, const uint8_t* end, const uint8_t* limit,
+              const uint8_t* base, std::vector<size_t>& offsets) const {
+        const uint8_t last = _signature[signatureSize - 1];
+
+        const uint8_t* p = begin;
+
+        while (p < end && (size_t)(limit - p) >= signatureSize) {
+            const uint8_t c = p[signatureSize - 1];
+
+            if (c == last && memcmp(p, _signature, signatureSize - 1) == 0) {
+                offsets.push_back(p - base);
+                p += signatureSize;
+            } else {
+                p += _skip[c];
+            }
+        }
+    }
+};
+
+/**
+ * Finds the offsets of all non-overlapping occurrences of the signature in the
+ * buffer. Large buffers are split into chunks that are searched in parallel.
+ * Each chunk also searches the first few bytes of the next chunk so that
+ * occurrences straddling a chunk boundary are not missed.
+ */
+std::vector<size_t> findSignatures(const uint8_t* buf, size_t length,
+                                   const uint8_t signature[signatureSize],
+                                   size_t threads) {
+    const SignatureSearch search(signature);
+
+    const uint8_t* bufEnd = buf + length;
+
+    const size_t chunks = (length + chunkSize - 1) / chunkSize;
+
+    std::vector<std::vector<size_t>> found(chunks);
+
+    parallelFor(chunks, threads, [&](size_t i) {
+        const uint8_t* begin = buf + i * chunkSize;
+        const uint8_t* end   = std::min(begin + chunkSize, bufEnd);
+        search.find(begin, end, bufEnd, buf, found[i]);
+    });
+
+    // Merge the results, dropping any occurrences that overlap with one found
+    // at the end of the previous chunk.
+    std::vector<size_t> offsets;
+
+    for (const auto& chunk : found) {
+        for (size_t offset : chunk) {
+            if (offsets.empty() || offset >= offsets.back() + signatureSize)
+                offsets.push_back(offset);
+        }
+    }
+
+    return offsets;
+}
+
 }  // namespace
 
 template <typename CharT>
 void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
-                  const uint8_t newSignature[16], bool dryrun) {
+                  const uint8_t newSignature[16], bool dryrun, size_t threads,
+                  std::ostream& log) {
     std::basic_string<CharT> ilkPath(imagePath);
     size_t extpos = ilkPath.find_last_of('.');
 
@@ -60,18 +150,26 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
     try {
         MemMap ilk(ilkPath.c_str());
 
-        uint8_t* buf    = (uint8_t*)ilk.buf();
-        uint8_t* bufEnd = buf + ilk.length();
+        uint8_t* buf = (uint8_t*)ilk.buf();
+
+        // All of it is searched, in chunks on several threads unless there is
+        // only one.
+        ilk.advise(threads == 1 ? MemAccess::sequential : MemAccess::willNeed);
 
         // Find
-        uint8_t* it =
-            std::find_first_of(buf, bufEnd, oldSignature, oldSignature + 16);
+        const auto offsets =
+            findSignatures(buf, ilk.length(), oldSignature, threads);
 
         // Replace
-        if (it != bufEnd) {
-            std::cout << "Replacing old PDB signature in ILK file.\n";
-
-            if (!dryrun) memcpy(it, newSignature, 16);
+        if (!offsets.empty()) {
+            log << "Replacing old PDB signature in ILK file (" << offsets.size()
+                << (offsets.size() == 1 ? " occurrence" : " occurrences")
+                << ").\n";
+
+            if (!dryrun) {
+                for (size_t offset : offsets)
+                    memcpy(buf + offset, newSignature, signatureSize);
+            }
         }
     } catch (const std::system_error&) {
         // Ignore.
@@ -81,15 +179,17 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
 #if defined(_WIN32) && defined(UNICODE)
 
 void patchIlk(const wchar_t* imagePath, const uint8_t oldSignature[16],
-              const uint8_t newSignature[16], bool dryrun) {
-    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun);
+              const uint8_t newSignature[16], bool dryrun, size_t threads,
+              std::ostream& log) {
+    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun, threads, log);
 }
 
 #else
 
 void patchIlk(const char* imagePath, const uint8_t oldSignature[16],
-              const uint8_t newSignature[16], bool dryrun) {
-    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun);
+              const uint8_t newSignature[16], bool dryrun, size_t threads,
+              std::ostream& log) {
+    patchIlkImpl(imagePath, oldSignature, newSignature, dryrun, threads, log);
 }
 
 #endif
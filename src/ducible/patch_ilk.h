@@ -21,18 +21,26 @@
  */
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+
 /**
  * Patches the PDB signature in the .ilk file so that incremental linking
- * doesn't fail.
+ * doesn't fail. Every occurrence of the old signature is replaced. Large files
+ * are searched using up to `threads` threads (0 means the number of hardware
+ * threads). Progress is printed to `log`.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
 void patchIlk(const wchar_t* imagePath, const uint8_t oldSignature[16],
-              const uint8_t newSignature[16], bool dryrun);
+              const uint8_t newSignature[16], bool dryrun, size_t threads,
+              std::ostream& log);
 
 #else
 
 void patchIlk(const char* imagePath, const uint8_t oldSignature[16],
-              const uint8_t newSignature[16], bool dryrun);
+              const uint8_t newSignature[16], bool dryrun, size_t threads,
+              std::ostream& log);
 
 #endif
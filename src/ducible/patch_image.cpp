@@ -68,36 +68,51 @@
  *   implementation for reading/writing PDBs.)
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
-#include <regex>
+#include <string>
 #include <vector>
 
 #include "ducible/patch_ilk.h"
 #include "ducible/patch_image.h"
 
+#include "ducible/checksum.h"
+#include "ducible/patch_pdb.h"
 #include "ducible/patches.h"
+#include "ducible/stamp.h"
+#include "ducible/strip_pdb.h"
+#include "ducible/symbol_store.h"
+#include "ducible/symbol_records.h"
 
 #include "pe/pe.h"
 
 #include "util/file.h"
 
+#include "msf/file_stream.h"
 #include "msf/memory_stream.h"
 #include "msf/msf.h"
+#include "msf/overlay_stream.h"
 #include "msf/stream.h"
 
 #include "pdb/cvinfo.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
 
-#include "util/md5.h"
 #include "util/memmap.h"
+#include "util/sha256.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
 
 namespace {
 
@@ -105,56 +120,41 @@ namespace {
 template <typename CharT>
 struct Strings {
     static const CharT tmpExtension[];
-    static const CharT nullGuid[];
+    static const CharT strippedExtension[];
+    static const CharT pathSeparators[];
 };
 
 template <>
 const char Strings<char>::tmpExtension[] = ".tmp";
 template <>
-const char Strings<char>::nullGuid[] = "{00000000-0000-0000-0000-000000000000}";
-template <>
 const wchar_t Strings<wchar_t>::tmpExtension[] = L".tmp";
+
+template <>
+const char Strings<char>::strippedExtension[] = ".stripped";
+template <>
+const wchar_t Strings<wchar_t>::strippedExtension[] = L".stripped";
+
 template <>
-const wchar_t Strings<wchar_t>::nullGuid[] =
-    L"{00000000-0000-0000-0000-000000000000}";
+const char Strings<char>::pathSeparators[] = "/\\";
+template <>
+const wchar_t Strings<wchar_t>::pathSeparators[] = L"/\\";
 
 /**
  * There are 0 or more debug data directories. We need to patch the timestamp in
  * all of them.
  */
-template <typename OptHeader>
-void patchDebugDataDirectories(const PEFile& pe, Patches& patches,
-                               const OptHeader* opt) {
-    size_t debugDirCount;
-    auto dir = pe.getDebugDataDirs(opt, debugDirCount);
-
-    if (!dir) return;
-
-    // Information about the PDB.
-    const CV_INFO_PDB70* cvInfo = NULL;
+void patchDebugDataDirectories(const PEFile& pe, Patches& patches) {
+    for (size_t i = 0; i < pe.debugDirCount; ++i) {
+        const IMAGE_DEBUG_DIRECTORY& dir = pe.debugDirs[i];
 
-    // Patch all of the debug data directories. Note that, at most, one of these
-    // will be of type IMAGE_DEBUG_TYPE_CODEVIEW. We will use this to also patch
-    // the PDB.
-    for (size_t i = 0; i < debugDirCount; ++i) {
-        if (dir->TimeDateStamp != 0)
-            patches.add(&dir->TimeDateStamp, &pe.timestamp,
+        if (dir.TimeDateStamp != 0)
+            patches.add(&dir.TimeDateStamp, &pe.timestamp,
                         "IMAGE_DEBUG_DIRECTORY.TimeDateStamp");
-
-        if (dir->Type == IMAGE_DEBUG_TYPE_CODEVIEW) {
-            if (cvInfo)
-                throw InvalidImage("found multiple CodeView debug entries");
-
-            cvInfo = (const CV_INFO_PDB70*)(pe.buf + dir->PointerToRawData);
-
-            if (!pe.isValidRef(cvInfo))
-                throw InvalidImage("invalid CodeView debug entry location");
-        }
-
-        ++dir;
     }
 
-    if (cvInfo) {
+    // The CodeView entry also has information about the PDB which needs to be
+    // patched.
+    if (auto cvInfo = pe.pdbInfo) {
         if (cvInfo->CvSignature != CV_INFO_SIGNATURE_PDB70)
             throw InvalidImage(
                 "unsupported PDB format, only version 7.0 is supported");
@@ -174,703 +174,1088 @@ void patchOptionalHeader(const PEFile& pe, Patches& patches,
     patches.add(&optional->CheckSum, &pe.timestamp, "OptionalHeader.CheckSum");
 
     // Patch exports directory timestamp
-    if (auto dir = pe.getDataDir<IMAGE_EXPORT_DIRECTORY>(
-            optional, IMAGE_DIRECTORY_ENTRY_EXPORT)) {
+    if (auto dir = pe.exportDir) {
         patches.add(&dir->TimeDateStamp, &pe.timestamp,
                     "IMAGE_EXPORT_DIRECTORY.TimeDateStamp");
     }
 
     // Patch resource directory timestamp
-    if (auto dir = pe.getDataDir<IMAGE_RESOURCE_DIRECTORY>(
-            optional, IMAGE_DIRECTORY_ENTRY_RESOURCE)) {
+    if (auto dir = pe.resourceDir) {
         patches.add(&dir->TimeDateStamp, &pe.timestamp,
                     "IMAGE_RESOURCE_DIRECTORY.TimeDateStamp");
     }
 
     // Patch the debug directories
-    patchDebugDataDirectories(pe, patches, optional);
+    patchDebugDataDirectories(pe, patches);
 }
 
 /**
- * Calculates the checksum for the PE image, skipping over patched areas. This
- * is used to replace the PDB signature with something that is deterministic.
- *
- * The list of patches is assumed to be sorted.
- *
- * Note that this uses the MD5 hashing algorithm, but any 128-bit hashing
- * algorithm could be used instead. It might be a good idea to use a hashing
- * algorithm with better distribution to avoid collisions. MurmurHash3 could be
- * a good choice, but it can't incrementally hash chunks of data.
+ * Returns a temporary PDB path name. The PDB will be written here first and
+ * then renamed to the original after everything succeeds.
  */
-void calculateChecksum(const uint8_t* buf, const size_t length,
-                       const std::vector<Patch>& patches, uint8_t output[16]) {
-    size_t pos = 0;
-
-    md5_context ctx;
-    md5_starts(&ctx);
+template <typename CharT>
+std::basic_string<CharT> getTempPdbPath(const CharT* pdbPath) {
+    std::basic_string<CharT> temp(pdbPath);
+    temp.append(Strings<CharT>::tmpExtension);
+    return temp;
+}
 
-    // Take the checksum of the regions between the patches to ensure a
-    // deterministic file checksum. Since the patches are sorted, we iterate
-    // over the file sequentially.
-    for (auto&& patch : patches) {
-        // Hash everything up to the patch
-        md5_update(&ctx, buf + pos, patch.offset - pos);
+/**
+ * Returns the path of the stripped PDB. The stripped extension is inserted
+ * before the extension of the PDB, if it has one.
+ */
+template <typename CharT>
+std::basic_string<CharT> getStrippedPdbPath(const CharT* pdbPath) {
+    std::basic_string<CharT> path(pdbPath);
 
-        // Skip past the patch
-        pos = patch.offset + patch.length;
-    }
+    size_t dot = path.rfind('.');
 
-    // Get everything after the last patch
-    md5_update(&ctx, buf + pos, length - pos);
+    const size_t slash = path.find_last_of(Strings<CharT>::pathSeparators);
+    if (dot != std::string::npos && slash != std::string::npos && dot < slash)
+        dot = std::string::npos;
 
-    md5_finish(&ctx, output);
+    path.insert(dot == std::string::npos ? path.length() : dot,
+                Strings<CharT>::strippedExtension);
+    return path;
 }
 
+// Symbol record streams larger than this are patched as they are written
+// instead of being copied into memory first.
+const size_t kMaxInMemorySymbolRecords = 64 * 1024 * 1024;
+
 /**
- * Compares the PE and PDB signatures to see if they match.
+ * A stream that can be patched independently of the others.
  */
-bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
-                        const PdbStream70& pdbHeader) {
-    if (pdbInfo.Age != pdbHeader.age ||
-        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) !=
-            0) {
-        return false;
+struct StreamTask {
+    typedef std::function<MsfStreamRef(MsfStreamRef)> Patcher;
+
+    size_t index;
+    MsfStreamRef original;
+    Patcher patch;
+
+    // Name of the phase for statistics.
+    const char* name;
+
+    // Set after the task has been run.
+    MsfStreamRef result;
+    std::exception_ptr error;
+
+    StreamTask(size_t index, MsfStreamRef original, Patcher patch,
+               const char* name)
+        : index(index), original(original), patch(patch), name(name) {}
+
+    void run(Stats* stats) {
+        StatsPhase phase(stats, name);
+
+        try {
+            result = patch(original);
+        } catch (...) {
+            error = std::current_exception();
+        }
     }
+};
 
-    return true;
+/**
+ * Returns a patcher that copies the stream into memory allocated from `arena`
+ * and patches it there.
+ */
+StreamTask::Patcher patchInMemory(
+    MsfArenaRef arena, std::function<void(MsfMemoryStream*)> patch) {
+    return [arena, patch](MsfStreamRef original) {
+        auto stream = std::make_shared<MsfMemoryStream>(original.get(), arena);
+        patch(stream.get());
+        return MsfStreamRef(stream);
+    };
 }
 
 /**
- * Returns a temporary PDB path name. The PDB will be written here first and
- * then renamed to the original after everything succeeds.
+ * Returns a patcher that only copies the pages of the stream that are modified.
+ * This is much cheaper for large streams where only a few bytes are changed.
  */
-template <typename CharT>
-std::basic_string<CharT> getTempPdbPath(const CharT* pdbPath) {
-    std::basic_string<CharT> temp(pdbPath);
-    temp.append(Strings<CharT>::tmpExtension);
-    return temp;
+StreamTask::Patcher patchOverlay(std::function<void(MsfOverlayStream*)> patch) {
+    return [patch](MsfStreamRef original) {
+        auto stream = std::make_shared<MsfOverlayStream>(original);
+        patch(stream.get());
+        return MsfStreamRef(stream);
+    };
 }
 
 /**
- * Helper function for normalizing a GUID in a NULL terminated file name.
+ * Patches the symbol records stream. Large streams are patched as they are
+ * written to keep memory usage down. With a memory limit, streams that don't
+ * fit in it are also patched that way rather than being copied to a temporary
+ * file. Streams that are copied are patched with up to `threads` threads.
  */
-template <typename CharT>
-void normalizeFileNameGuid(CharT* path, size_t length) {
-    static const std::regex guidRegex(
-        "\\{"
-        "[0-9a-fA-F]{8}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{12}"
-        "\\}");
+StreamTask::Patcher patchSymbolRecordsTask(MsfArenaRef arena, size_t threads) {
+    return [arena, threads](MsfStreamRef original) -> MsfStreamRef {
+        const size_t length    = original->length();
+        const size_t maxMemory = arena->maxMemory();
+
+        if (length > kMaxInMemorySymbolRecords ||
+            (maxMemory != 0 && length > maxMemory)) {
+            auto stream = std::make_shared<SymbolRecordStream>(original);
+            stream->validate();
+            return stream;
+        }
 
-    std::match_results<const CharT*> match;
+        return patchInMemory(arena, [threads](MsfMemoryStream* stream) {
+            patchSymbolRecordsStream(stream, threads);
+        })(original);
+    };
+}
 
-    if (std::regex_search((const CharT*)path, (const CharT*)path + length,
-                          match, guidRegex)) {
-        memcpy(path + match.position(0), Strings<CharT>::nullGuid,
-               sizeof(Strings<CharT>::nullGuid));
+/**
+ * Counts a patched stream in the statistics, depending on how much of it had
+ * to be copied.
+ */
+void countPatchedStream(Stats* stats, const MsfStreamRef& stream) {
+    if (!stats) return;
+
+    if (auto memory = std::dynamic_pointer_cast<MsfMemoryStream>(stream)) {
+        stats->add("streamsCopied", 1);
+        stats->add("bytesCopied", memory->length());
+    } else if (auto overlay =
+                   std::dynamic_pointer_cast<MsfOverlayStream>(stream)) {
+        stats->add("streamsOverlaid", 1);
+        stats->add("pagesOverlaid", overlay->dirtyPageCount());
     }
 }
 
 /**
- * Patches the "/LinkInfo" named stream.
+ * Adds what has been read from the streams of the original PDB to the
+ * statistics. This is done once the PDB is no longer needed.
  */
-void patchLinkInfoStream(MsfMemoryStream* stream) {
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
-
-    if (length == 0) return;
-
-    if (length < sizeof(LinkInfo))
-        throw InvalidPdb("got partial LinkInfo stream");
-
-    const LinkInfo* linkInfo = (LinkInfo*)data;
-
-    if (linkInfo->size > length)
-        throw InvalidPdb("LinkInfo size too large for stream");
-
-    // The rest of the stream appears to be garbage. Thus, we truncate it.
-    stream->resize(linkInfo->size);
+void countPdbReads(Stats* stats, const MsfFile& msf) {
+    addStat(stats, "bytesRead", msf.bytesRead());
+    addStat(stats, "pagesRead", msf.pagesRead());
 }
 
 /**
- * Patches the "/names" stream.
+ * Rewrites a PDB, eliminating non-determinism.
+ *
+ * Once the PDB header stream has been patched, the named streams, the DBI
+ * stream, the symbol records stream, and the public symbols stream are patched
+ * concurrently using up to `threads` threads. The streams are replaced in a
+ * fixed order afterwards, so the result does not depend on the number of
+ * threads.
+ *
+ * If `signature` is null, it must be set with setPdbSignature() before the PDB
+ * is written.
  */
-void patchNamesStream(MsfMemoryStream* stream) {
-    uint8_t* data    = stream->data();
-    uint8_t* dataEnd = data + stream->length();
+void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+              const uint8_t signature[16], bool force, size_t threads,
+              std::ostream& log, Stats* stats) {
+    StatsPhase phase(stats, "patchStreams");
 
-    // Parse the header
-    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
-        throw InvalidPdb("missing string table header");
+    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
 
-    StringTableHeader* header = (StringTableHeader*)data;
+    // Copies of streams are allocated from here.
+    const auto arena = msf.arena();
 
-    data += sizeof(*header);
+    // Read the PDB header
+    auto origPdbHeaderStream = msf.getStream((size_t)PdbStreamType::header);
+    if (!origPdbHeaderStream) throw InvalidPdb("missing PDB header stream");
 
-    if (header->signature != kHashTableSignature)
-        throw InvalidPdb("got invalid string table signature");
+    auto pdbHeaderStream = std::shared_ptr<MsfMemoryStream>(
+        new MsfMemoryStream(origPdbHeaderStream.get(), arena));
 
-    if (header->version != 1 && header->version != 2)
-        throw InvalidPdb("got invalid or unsupported string table version");
+    const auto table = patchHeaderStream(pdbHeaderStream.get(), pdbInfo,
+                                         timestamp, signature, force);
 
-    if (size_t(dataEnd - data) < header->stringsSize)
-        throw InvalidPdb("got partial string table data");
+    msf.replaceStream((size_t)PdbStreamType::header, pdbHeaderStream);
+    countPatchedStream(stats, pdbHeaderStream);
 
-    data += header->stringsSize;
+    std::vector<StreamTask> tasks;
 
-    if (size_t(dataEnd - data) < sizeof(uint32_t))
-        throw InvalidPdb("missing string table offset array length");
+    // Number of GUIDs normalized by all of the tasks.
+    std::atomic<size_t> guids(0);
 
-    // Offsets array length
-    uint32_t offsetsLength = *(uint32_t*)data;
+    // Patch the LinkInfo stream.
+    {
+        const auto it = table.find("/LinkInfo");
+        if (it != table.end()) {
+            auto stream = msf.getStream(it->stream);
+            if (!stream) throw InvalidPdb("missing '/LinkInfo' stream");
 
-    data += sizeof(offsetsLength);
+            tasks.emplace_back(it->stream, stream,
+                               patchOverlay(patchLinkInfoStream),
+                               "patchLinkInfoStream");
+        }
+    }
 
-    if (size_t(dataEnd - data) < offsetsLength * sizeof(uint32_t))
-        throw InvalidPdb("got partial string table offsets array");
+    // Rewrite /names hash table
+    {
+        const auto it = table.find("/names");
+        if (it != table.end()) {
+            auto stream = msf.getStream(it->stream);
+            if (!stream) throw InvalidPdb("missing '/names' stream");
+
+            tasks.emplace_back(it->stream, stream,
+                               patchInMemory(arena,
+                                             [&](MsfMemoryStream* stream) {
+                                                 guids +=
+                                                     patchNamesStream(stream);
+                                             }),
+                               "patchNamesStream");
+        }
+    }
 
-    uint32_t* offsets = (uint32_t*)data;
+    // Patch the DBI stream
+    const size_t dbiTask = tasks.size();
+    std::vector<size_t> moduleStreams;
+
+    if (auto dbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
+        tasks.emplace_back((size_t)PdbStreamType::dbi, dbiStream,
+                           patchInMemory(arena, [&](MsfMemoryStream* stream) {
+                               guids +=
+                                   patchDbiStream(stream, moduleStreams, log);
+                           }),
+                           "patchDbiStream");
+
+        // We need the DBI header to get the symbol record stream and the
+        // public symbols stream. If this is invalid, patching the DBI stream
+        // will fail.
+        DbiHeader dbiHeader;
+        dbiStream->setPos(0);
+        if (dbiStream->read(sizeof(dbiHeader), &dbiHeader) ==
+            sizeof(dbiHeader)) {
+            // Patch the symbol records stream
+            if (auto stream = msf.getStream(dbiHeader.symbolRecordsStream)) {
+                tasks.emplace_back(dbiHeader.symbolRecordsStream, stream,
+                                   patchSymbolRecordsTask(arena, threads),
+                                   "patchSymbolRecordsStream");
+            }
+
+            // Patch the public symbols info stream
+            if (auto stream = msf.getStream(dbiHeader.publicSymbolStream)) {
+                tasks.emplace_back(dbiHeader.publicSymbolStream, stream,
+                                   patchOverlay(patchPublicSymbolStream),
+                                   "patchPublicSymbolStream");
+            }
+        }
+        dbiStream->setPos(0);
+    }
 
-    data += offsetsLength * sizeof(uint32_t);
+    // Streams can't be read concurrently. This can only happen if the PDB is
+    // malformed, or if it is read through a FILE*, which every MsfFileStream
+    // shares along with its file position.
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (std::dynamic_pointer_cast<MsfFileStream>(tasks[i].original))
+            threads = 1;
 
-    // Sort the offsets. There is some non-determinism creeping in here somehow.
-    std::sort(offsets, offsets + offsetsLength);
+        for (size_t j = i + 1; j < tasks.size(); ++j) {
+            if (tasks[i].original == tasks[j].original) threads = 1;
+        }
+    }
 
-    for (size_t i = 0; i < offsetsLength; ++i) {
-        const size_t offset = offsets[i];
+    parallelFor(tasks.size(), threads, [&](size_t i) { tasks[i].run(stats); });
 
-        if (offset == 0) continue;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        StreamTask& task = tasks[i];
 
-        if (offset >= header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
+        if (task.error) std::rethrow_exception(task.error);
 
-        char* str  = &header->strings[offset];
-        size_t len = strlen(str);
+        if (i == dbiTask) {
+            StatsPhase modulePhase(stats, "patchModuleStreams");
 
-        if (offset + len + 1 > header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
+            for (auto index : moduleStreams) {
+                auto origModuleStream = msf.getStream(index);
+                if (!origModuleStream) continue;
 
-        normalizeFileNameGuid(str, len);
+                auto moduleStream =
+                    std::make_shared<MsfOverlayStream>(origModuleStream);
+
+                guids += patchModuleStream(moduleStream.get());
+
+                msf.replaceStream(index, moduleStream);
+                countPatchedStream(stats, moduleStream);
+            }
+        }
+
+        msf.replaceStream(task.index, task.result);
+        countPatchedStream(stats, task.result);
     }
+
+    addStat(stats, "streams", msf.streamCount());
+    addStat(stats, "guidsNormalized", guids);
+    addStat(stats, "arenaBytes", arena->peakUsage());
+    addStat(stats, "arenaSpilledBytes", arena->spilledBytes());
 }
 
 /**
- * Patches the PDB header stream.
+ * Calculates the SHA-256 digest of a buffer.
  */
-void patchHeaderStream(MsfFile& msf, MsfMemoryStream* stream,
-                       const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
-                       const uint8_t signature[16], bool force) {
-    uint8_t* data          = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
+void digestMemory(const void* buf, size_t length, uint8_t digest[32]) {
+    sha256((const unsigned char*)buf, length, digest);
+}
 
-    if (size_t(dataEnd - data) < sizeof(PdbStream70))
-        throw InvalidPdb("missing PDB 7.0 header");
+/**
+ * Calculates the SHA-256 digest of a whole file.
+ */
+template <typename CharT>
+void digestFile(const CharT* path, uint8_t digest[32]) {
+    MemMap map(path, 0, true);
+    map.advise(MemAccess::sequential);
+    digestMemory(map.buf(), map.length(), digest);
+}
 
-    PdbStream70* header = (PdbStream70*)data;
+/**
+ * Stores the digests of files that were already normalized, and so were not
+ * written. They have to be read in full.
+ */
+template <typename CharT>
+void digestUnchangedFiles(const CharT* imagePath, const CharT* pdbPath,
+                          const PatchOptions& opts) {
+    if (!opts.digests || opts.dryrun) return;
 
-    data += sizeof(*header);
+    StatsPhase phase(opts.stats, "digestUnchanged");
 
-    if (header->version < PdbVersion::vc70)
-        throw InvalidPdb("unsupported PDB implementation version");
+    digestFile(imagePath, opts.digests->image);
+    opts.digests->hasImage = true;
 
-    // Check that this PDB matches what the PE file expects. Don't do the check
-    // if `force` was specified.
-    if (!force && (!pdbInfo || !matchingSignatures(*pdbInfo, *header)))
-        throw InvalidPdb("PE and PDB signatures do not match");
+    if (pdbPath) {
+        digestFile(pdbPath, opts.digests->pdb);
+        opts.digests->hasPdb = true;
+    }
+}
 
-    // Patch the PDB header stream
-    header->timestamp = timestamp;
-    header->age       = 1;
-    memcpy(header->sig70, signature, sizeof(header->sig70));
+/**
+ * Returns the key of the image in a symbol store.
+ */
+std::string imageKey(const PEFile& pe) {
+    uint32_t sizeOfImage;
 
-    const auto table = readNameMapTable(data, dataEnd);
+    if (pe.magic() == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+        sizeOfImage = pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>()->SizeOfImage;
+    else
+        sizeOfImage = pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>()->SizeOfImage;
 
-    // Patch the LinkInfo stream.
-    {
-        const auto it = table.find("/LinkInfo");
-        if (it != table.end()) {
-            auto origLinkInfoStream = msf.getStream(it->second);
-            if (!origLinkInfoStream)
-                throw InvalidPdb("missing '/LinkInfo' stream");
+    return imageStoreKey(pe.timestamp, sizeOfImage);
+}
 
-            auto linkInfoStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origLinkInfoStream.get()));
+/**
+ * Stores the digest of the image once the patches are applied.
+ */
+void digestImage(const PEFile& pe, const Patches& patches,
+                 const PatchOptions& opts) {
+    if (!opts.digests || opts.dryrun) return;
 
-            patchLinkInfoStream(linkInfoStream.get());
+    StatsPhase phase(opts.stats, "digestImage");
 
-            msf.replaceStream(it->second, linkInfoStream);
-        }
-    }
+    calculateImageDigest(pe.buf, pe.length, patches.patches,
+                         opts.digests->image);
+    opts.digests->hasImage = true;
+}
 
-    // Rewrite /names hash table
-    {
-        const auto it = table.find("/names");
-        if (it != table.end()) {
-            auto origNamesStream = msf.getStream(it->second);
-            if (!origNamesStream) throw InvalidPdb("missing '/names' stream");
+/**
+ * Lays out the rewritten PDB for a dry run and reports how large it would be.
+ * Nothing is read or written, but the PDB is checked in the same way as when it
+ * is written.
+ */
+void planPdb(const MsfFile& msf, std::ostream& log, Stats* stats) {
+    StatsPhase phase(stats, "planMsf");
 
-            auto namesStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origNamesStream.get()));
+    const size_t pages    = msf.writtenPageCount();
+    const size_t pageSize = msf.pageSize();
 
-            patchNamesStream(namesStream.get());
+    log << "Note: The rewritten PDB would be " << (uint64_t)pages * pageSize
+        << " bytes (" << pages << " pages of " << pageSize << " bytes)."
+        << std::endl;
 
-            msf.replaceStream(it->second, namesStream);
-        }
-    }
+    addStat(stats, "pagesPlanned", pages);
+    addStat(stats, "bytesPlanned", (uint64_t)pages * pageSize);
 }
 
 /**
- * Patches a module stream.
+ * Strips the normalized PDB and writes it next to the original. This reuses
+ * the streams of `msf`, so nothing is read again, and leaves `msf` stripped.
+ * In a dry run, only the size of the stripped PDB is reported.
  */
-void patchModuleStream(MsfMemoryStream* stream) {
-    uint8_t* data          = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
+template <typename CharT>
+void writeStrippedPdb(const CharT* pdbPath, MsfFile& msf,
+                      const PatchOptions& opts, std::ostream& log) {
+    StatsPhase phase(opts.stats, "stripPdb");
 
-    if (size_t(dataEnd - data) < sizeof(uint16_t))
-        throw InvalidPdb("got partial module info stream");
+    stripPDB(msf);
 
-    uint32_t type = *(uint32_t*)data;
-    data += sizeof(type);
+    // The leading streams may have been removed.
+    msf.setLeadingStreams(std::vector<size_t>());
 
-    if (type != CV_SIGNATURE_C13) return;
+    if (opts.dryrun) {
+        const size_t pages = msf.writtenPageCount();
 
-    if (size_t(dataEnd - data) < sizeof(SymbolRecord))
-        throw InvalidPdb("missing symbol record in module info stream");
+        log << "Note: The stripped PDB would be "
+            << (uint64_t)pages * msf.pageSize() << " bytes." << std::endl;
+        return;
+    }
 
-    const SymbolRecord* sym = (const SymbolRecord*)data;
+    const auto strippedPath = getStrippedPdbPath(pdbPath);
+    const auto tmpPath      = getTempPdbPath(strippedPath.c_str());
 
-    // We're only concerned about objects here
-    if (sym->type != S_OBJNAME) return;
+    {
+        auto f = openFile(tmpPath.c_str(), FileMode<CharT>::writeEmpty);
+        msf.write(f, opts.stats);
+    }
 
-    // Recast now that we know the type.
-    OBJNAMESYM* objsym = (OBJNAMESYM*)data;
+    renameFile(tmpPath.c_str(), strippedPath.c_str());
+}
 
-    // The signature always seems to be 0.
-    if (objsym->signature != 0)
-        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
+/**
+ * Links a file that has already been normalized into the symbol store. In a
+ * dry run, only its key is printed.
+ */
+template <typename CharT>
+void addToStore(const CharT* path, const char* what, const std::string& key,
+                const PatchOptions& opts, std::ostream& log) {
+    if (opts.dryrun) {
+        log << "Note: The " << what << " would be stored under the key '"
+            << key << "'." << std::endl;
+        return;
+    }
 
-    if (size_t(dataEnd - data) < objsym->reclen)
-        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+    StatsPhase phase(opts.stats, "store");
 
-    size_t namelen = strlen((const char*)objsym->name);
+    const auto storePath = getStorePath(opts.symbolStore, path, key);
 
-    if ((uint8_t*)objsym->name + namelen + 1 > dataEnd)
-        throw InvalidPdb("object path in symbol record is not null-terminated");
+    createStoreDirectory(storePath);
+    const FileLink how = linkFile(path, storePath.c_str());
 
-    normalizeFileNameGuid((char*)objsym->name, namelen);
+    log << "Note: The " << what << " is stored under the key '" << key
+        << "' (" << fileLinkName(how) << ")." << std::endl;
 }
 
-const char* kIncLinkWarning =
-    "\
-Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
-is known to not work with Ducible.";
-
 /**
- * Patches the DBI stream.
+ * Patches a PDB file.
+ *
+ * The image may still be being hashed, so `signature` is only called once the
+ * rest of the PDB has been patched. It returns the signature, waiting for it
+ * to be calculated if necessary.
  */
-void patchDbiStream(MsfFile& msf, MsfMemoryStream* stream) {
-    if (stream->length() < sizeof(DbiHeader))
-        throw InvalidPdb("DBI stream too short");
+template <typename CharT>
+void patchPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp,
+              const std::function<const uint8_t*()>& signature,
+              const PatchOptions& opts, std::ostream& log) {
+    StatsPhase phase(opts.stats, "patchPdb");
+
+    // Where the rewritten PDB is written. With a symbol store, this is the
+    // path in the store, and the PDB is linked back to `pdbPath` afterwards.
+    std::basic_string<CharT> outPath(pdbPath);
+    std::string storeKey;
+
+    // Where to store the digest of the PDB, if anywhere.
+    uint8_t* digest = nullptr;
+    if (opts.digests && !opts.dryrun) {
+        digest               = opts.digests->pdb;
+        opts.digests->hasPdb = true;
+    }
 
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
-    size_t offset       = 0;
+    {
+        StatsPhase readPhase(opts.stats, "readPdb");
 
-    DbiHeader* dbi = (DbiHeader*)data;
+        // The mapping only needs to be writable if we're going to patch the
+        // PDB in place.
+        auto pdb = std::make_shared<MemMap>(pdbPath, 0,
+                                            !opts.inplace || opts.dryrun);
 
-    // Sanity checks
-    if (dbi->signature != dbiHeaderSignature)
-        throw InvalidPdb("invalid DBI header signature");
+        addStat(opts.stats, "pdbBytes", pdb->length());
 
-    if (dbi->version != DbiVersion::v70)
-        throw InvalidPdb("Unsupported DBI stream version");
+        MsfFile msf(pdb);
+        msf.arena()->setMaxMemory(opts.maxMemory);
 
-    // Display a warning about incrementally linking
-    if (dbi->flags.incLink) std::cout << kIncLinkWarning << std::endl;
+        readPhase.stop();
 
-    // Patch the age. This must match the age in the PDB stream.
-    dbi->age = 1;
+        patchPDB(msf, pdbInfo, timestamp, nullptr, opts.force, opts.threads,
+                 log, opts.stats);
 
-    offset += sizeof(*dbi);
+        const uint8_t* pdbSignature = signature();
 
-    // The module info immediately follows the header.
+        setPdbSignature(msf.getStream((size_t)PdbStreamType::header).get(),
+                        pdbSignature);
 
-    // Check bounds
-    if (offset + dbi->gpModInfoSize > length)
-        throw InvalidPdb("DBI module info size exceeds stream length");
+        // The age is always 1 once the PDB is normalized.
+        if (opts.symbolStore) storeKey = pdbStoreKey(pdbSignature, 1);
 
-    // Number of modules
-    size_t moduleCount = 0;
+        if (opts.layout == PdbLayout::locality)
+            msf.setLeadingStreams(directoryStreams(msf));
 
-    // Patch the module info entries
-    for (size_t i = 0; i < dbi->gpModInfoSize;) {
-        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
-            throw InvalidPdb("got partial DBI module info");
+        if (opts.inplace) {
+            StatsPhase phase(opts.stats, "writeInPlace");
 
-        ModuleInfo* info = (ModuleInfo*)(data + offset + i);
+            if (opts.dryrun ? msf.canWriteInPlace() : msf.writeInPlace()) {
+                // Only the changed pages were written, so the digest has to
+                // be taken from the whole mapping.
+                if (digest) {
+                    StatsPhase digestPhase(opts.stats, "digestPdb");
+                    digestMemory(pdb->buf(), pdb->length(), digest);
+                }
 
-        info->sc.padding1 = 0;
-        info->sc.padding2 = 0;
+                if (opts.stripped) writeStrippedPdb(pdbPath, msf, opts, log);
 
-        // Patch the offsets "array". This is not used directly by Microsoft's
-        // DBI implementation and may contain non-deterministic data (e.g., the
-        // memory address of the actual allocated array). Thus, we need to zero
-        // it out.
-        info->offsets = 0;
+                if (opts.symbolStore)
+                    addToStore(pdbPath, "PDB", storeKey, opts, log);
 
-        // There is one entry that contains a path with a GUID. We need to patch
-        // this. It is often the first module info entry, but it is safer to
-        // find it by name.
-        if (strcmp(info->moduleName(), "* Linker Generated Manifest RES *") ==
-                0 &&
-            strcmp(info->objectName(), "") == 0) {
-            auto origModuleStream = msf.getStream(info->stream);
-            if (!origModuleStream) continue;
+                countPdbReads(opts.stats, msf);
+                return;
+            }
 
-            auto moduleStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origModuleStream.get()));
+            log << "Note: The PDB cannot be patched in place. Rewriting it "
+                   "instead."
+                << std::endl;
+        }
 
-            patchModuleStream(moduleStream.get());
+        if (opts.dryrun) {
+            planPdb(msf, log, opts.stats);
+            if (opts.stripped) writeStrippedPdb(pdbPath, msf, opts, log);
+            if (opts.symbolStore)
+                addToStore(pdbPath, "PDB", storeKey, opts, log);
+            countPdbReads(opts.stats, msf);
+            return;
+        }
 
-            msf.replaceStream(info->stream, moduleStream);
+        if (opts.symbolStore) {
+            outPath = getStorePath(opts.symbolStore, pdbPath, storeKey);
+            createStoreDirectory(outPath);
         }
 
-        i += info->size();
-        ++moduleCount;
-    }
+        {
+            auto tmpPdb = openFile(getTempPdbPath(outPath.c_str()).c_str(),
+                                   FileMode<CharT>::writeEmpty);
 
-    offset += dbi->gpModInfoSize;
+            // Write out the rewritten PDB to disk.
+            msf.setWriteThreads(opts.threads);
+            msf.write(tmpPdb, opts.stats, digest);
+        }
 
-    // The section contributions follow the module info entries. These contain
-    // garbage due to struct alignment. They needed to be zeroed out.
+        if (opts.stripped) writeStrippedPdb(pdbPath, msf, opts, log);
 
-    if (offset + dbi->sectionContributionSize > length) {
-        throw InvalidPdb(
-            "DBI section contributions size exceeds stream length");
+        countPdbReads(opts.stats, msf);
     }
 
-    const SectionContribVersion scVersion =
-        *(SectionContribVersion*)(data + offset);
-    offset += sizeof(scVersion);
+    // Rename the new PDB file over the old one
+    renameFile(getTempPdbPath(outPath.c_str()).c_str(), outPath.c_str());
 
-    if (scVersion != SectionContribVersion::v1 &&
-        scVersion != SectionContribVersion::v2) {
-        throw InvalidPdb("got invalid section contribution substream version");
-    }
+    if (opts.symbolStore) {
+        StatsPhase phase(opts.stats, "store");
 
-    const size_t scCount = (dbi->sectionContributionSize - sizeof(scVersion)) /
-                           sizeof(SectionContribution);
+        const FileLink how = linkFile(outPath.c_str(), pdbPath);
 
-    SectionContribution* sectionContribs =
-        (SectionContribution*)(data + offset);
-
-    for (size_t i = 0; i < scCount; ++i) {
-        SectionContribution& sc = sectionContribs[i];
-        sc.padding1             = 0;
-        sc.padding2             = 0;
+        log << "Note: The PDB is stored under the key '" << storeKey << "' ("
+            << fileLinkName(how) << ")." << std::endl;
     }
+}
 
-    offset += dbi->sectionContributionSize - sizeof(scVersion);
+/**
+ * Returns true if every patch, except for the PDB signature, has already been
+ * applied to the image. The signature can't be checked without hashing the
+ * whole image.
+ */
+bool isNormalizedImage(const PEFile& pe, const Patches& patches) {
+    for (auto&& patch : patches.patches) {
+        if (patch.data == pe.pdbSignature) continue;
 
-    // Skip over the section map
-    offset += dbi->sectionMapSize;
+        if (memcmp(pe.buf + patch.offset, patch.data, patch.length) != 0)
+            return false;
+    }
 
-    // In the list of files, there are some temporary files with random GUIDs in
-    // the name.
-    if (dbi->fileInfoSize > 0) {
-        if (offset + dbi->fileInfoSize > length)
-            throw InvalidPdb("Missing file info in DBI stream");
+    return true;
+}
 
-        uint8_t* p    = data + offset;
-        uint8_t* pEnd = p + dbi->fileInfoSize;
+/**
+ * Returns true if the headers of the PDB show that it has already been patched
+ * to match the image. Only the PDB header stream and the DBI header are read.
+ */
+template <typename CharT>
+bool isNormalizedPdb(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
+                     uint32_t timestamp) {
+    if (!pdbInfo) return false;
 
-        // Skip over the header as it doesn't always provide correct
-        // information.
-        p += sizeof(FileInfoHeader);
+    MsfFile msf(std::make_shared<MemMap>(pdbPath, 0, true));
 
-        // Skip over file indices array. We don't need them.
-        p += moduleCount * sizeof(uint16_t);
+    PdbStream70 header;
 
-        // File counts array
-        uint16_t* fileCounts = (uint16_t*)p;
-        p += moduleCount * sizeof(*fileCounts);
+    auto headerStream = msf.getStream((size_t)PdbStreamType::header);
+    if (!headerStream ||
+        headerStream->read(sizeof(header), &header) != sizeof(header)) {
+        return false;
+    }
 
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+    if (header.timestamp != timestamp || !matchingSignatures(*pdbInfo, header))
+        return false;
 
-        uint32_t* offsets = (uint32_t*)p;
+    DbiHeader dbi;
 
-        uint32_t offsetCount = 0;
-        for (size_t i = 0; i < moduleCount; ++i) offsetCount += fileCounts[i];
+    auto dbiStream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!dbiStream || dbiStream->read(sizeof(dbi), &dbi) != sizeof(dbi))
+        return false;
 
-        p += offsetCount * sizeof(*offsets);
+    return dbi.age == 1;
+}
 
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+/**
+ * Finds everything that needs to be patched in the image. Returns the CodeView
+ * debug entry, if any.
+ */
+const CV_INFO_PDB70* findImagePatches(const PEFile& pe, Patches& patches) {
+    patches.add(&pe.fileHeader->TimeDateStamp, &pe.timestamp,
+                "IMAGE_FILE_HEADER.TimeDateStamp");
 
-        char* names = (char*)p;
+    switch (pe.magic()) {
+        case IMAGE_NT_OPTIONAL_HDR32_MAGIC:
+            // Patch as a PE32 file
+            patchOptionalHeader(
+                pe, patches, pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>());
+            break;
 
-        for (size_t i = 0; i < offsetCount; ++i) {
-            const uint32_t& off = offsets[i];
+        case IMAGE_NT_OPTIONAL_HDR64_MAGIC:
+            // Patch as a PE32+ file
+            patchOptionalHeader(
+                pe, patches, pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>());
+            break;
 
-            if ((uint8_t*)names + off + 1 > pEnd)
-                throw InvalidPdb("invalid offset for file info name");
+        default:
+            throw InvalidImage("unsupported IMAGE_NT_HEADERS.OptionalHeader");
+    }
 
-            char* name = names + off;
-            size_t len = strlen(name);
+    patches.sort();
 
-            if ((uint8_t*)name + len + 1 > pEnd)
-                throw InvalidPdb("file name exceeds file info section size");
+    return pe.pdbInfo;
+}
 
-            normalizeFileNameGuid(name, len);
-        }
+/**
+ * Calculates the signature of the PE file. This is stored in the PDB signature.
+ * When the patches are applied, this checksum is what will be set in the file.
+ */
+void calculateSignature(PEFile& pe, const Patches& patches,
+                        const PatchOptions& opts) {
+    StatsPhase phase(opts.stats, "hashImage");
+
+    switch (opts.hash) {
+        case SignatureHash::md5:
+            calculateChecksum(pe.buf, pe.length, patches.patches,
+                              pe.pdbSignature);
+            break;
+        case SignatureHash::murmur3:
+            calculateTreeChecksum(pe.buf, pe.length, patches.patches,
+                                  opts.threads, pe.pdbSignature);
+            break;
     }
+}
 
-    // Skip past the file info
-    offset += dbi->fileInfoSize;
+/**
+ * Returns how the image is read while calculating its signature.
+ */
+MemAccess hashAccess(const PatchOptions& opts) {
+    // The tree checksum hashes chunks of the image on several threads.
+    if (opts.hash == SignatureHash::murmur3 && opts.threads != 1)
+        return MemAccess::willNeed;
+
+    return MemAccess::sequential;
+}
+
+/**
+ * Starts calculating the signature of the PE file on another thread. The image
+ * must not be modified until the returned future is ready. With a single
+ * thread, the image is hashed when the signature is first needed instead.
+ *
+ * Destroying the future waits for the hash to finish if it has been started,
+ * so it must not outlive `pe`, `patches`, or `opts`.
+ */
+std::shared_future<void> hashImage(PEFile& pe, const Patches& patches,
+                                   const PatchOptions& opts) {
+    const auto policy =
+        opts.threads == 1 ? std::launch::deferred : std::launch::async;
+
+    return std::async(policy, [&pe, &patches, &opts]() {
+               calculateSignature(pe, patches, opts);
+           }).share();
+}
 
-    // Skip past the TSM substream
-    offset += dbi->typeServerMapSize;
+/**
+ * Links files that were already normalized, and so were not patched, into the
+ * symbol store.
+ */
+template <typename CharT>
+void storeUnchangedFiles(const CharT* imagePath, const CharT* pdbPath,
+                         const PEFile& pe, const PatchOptions& opts,
+                         std::ostream& log) {
+    if (!opts.symbolStore) return;
 
-    // Skip past the EC info
-    offset += dbi->ecInfoSize;
+    if (opts.storeImage) addToStore(imagePath, "image", imageKey(pe), opts, log);
 
-    // Skip past the debug header. This should be the last substream in the DBI
-    // stream.
-    offset += dbi->debugHeaderSize;
+    if (pdbPath && pe.pdbInfo) {
+        addToStore(pdbPath, "PDB",
+                   pdbStoreKey(pe.pdbInfo->Signature, pe.pdbInfo->Age), opts,
+                   log);
+    }
 }
 
 /**
- * Patches the symbol record stream.
- *
- * There is up to 3 bytes of padding at the end of each symbol record. Since
- * garbage just lives there, it needs to be zeroed out.
+ * Patches the image and its PDB. Returns early if they have already been
+ * normalized.
  */
-void patchSymbolRecordsStream(MsfMemoryStream* stream) {
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
+template <typename CharT>
+void patchFiles(const CharT* imagePath, const CharT* pdbPath,
+                const PatchOptions& opts, std::ostream& log) {
+    StatsPhase readPhase(opts.stats, "readImage");
 
-    for (size_t i = 0; i < length;) {
-        if (length - i < sizeof(SymbolRecord))
-            throw InvalidPdb("got partial symbol record");
+    MemMap image(imagePath);
 
-        SymbolRecord* rec = (SymbolRecord*)(data + i);
+    addStat(opts.stats, "imageBytes", image.length());
 
-        // The symbol record length must be at least the size of
-        // SymbolRecord::type and the size of the entire record must be a
-        // multiple of 4.
-        if (rec->length < sizeof(rec->type) ||
-            (rec->length + sizeof(rec->length)) % 4 != 0) {
-            throw InvalidPdb("invalid symbol record size");
-        }
+    uint8_t* buf = (uint8_t*)image.buf();
 
-        const size_t dataLength = rec->length - sizeof(rec->type);
+    PEFile pe = PEFile(buf, image.length());
 
-        // Bounds check.
-        if (i + sizeof(SymbolRecord) + dataLength > length)
-            throw InvalidPdb("symbol record size too large");
+    Patches patches(buf);
 
-        // There is a maximum of 3 bytes of padding at the end of the data.
-        // Note that if the data length is < 3 and this overflows,
-        size_t tail = dataLength - 3;
+    const CV_INFO_PDB70* pdbInfo = findImagePatches(pe, patches);
+
+    readPhase.stop();
+
+    // Re-running on files that have already been normalized is common in
+    // incremental builds. Detecting that only requires reading the headers.
+    // The stripped PDB is made from the streams as they are patched, so the
+    // files aren't skipped if one is wanted.
+    if (!opts.always && !opts.stripped && isNormalizedImage(pe, patches) &&
+        (!pdbPath || isNormalizedPdb(pdbPath, pdbInfo, pe.timestamp))) {
+        log << "Note: The image is already normalized. Skipping it."
+            << std::endl;
+        addStat(opts.stats, "imagesSkipped", 1);
+        digestUnchangedFiles(imagePath, pdbPath, opts);
+        storeUnchangedFiles(imagePath, pdbPath, pe, opts, log);
+        return;
+    }
 
-        // Find the null terminator at the end. The padding (if any) will be
-        // after this point.
-        while (tail + 1 < dataLength && rec->data[tail] != 0) ++tail;
+    image.advise(hashAccess(opts));
 
-        // Zero out the padding.
-        while (tail < dataLength) rec->data[tail++] = 0;
+    // The image is hashed while the PDB is patched since only the signature in
+    // the PDB header stream depends on it.
+    auto hashed = hashImage(pe, patches, opts);
 
-        // Skip to next symbol record
-        i += sizeof(SymbolRecord) + dataLength;
+    // Patch the PDB file.
+    if (pdbPath) {
+        patchPDB(pdbPath, pdbInfo, pe.timestamp,
+                 [&]() {
+                     hashed.get();
+                     return pe.pdbSignature;
+                 },
+                 opts, log);
     }
-}
 
-/**
- * Patch the public symbol info stream.
- */
-void patchPublicSymbolStream(MsfMemoryStream* stream) {
-    // The public symbol info stream starts with the public symbol header
-    // followed by the (Global Symbol Info) GSI hash header. We only care about
-    // the public symbol header.
-    if (stream->length() < sizeof(PublicSymbolHeader))
-        throw InvalidPdb("public symbol stream too short");
+    hashed.get();
 
-    PublicSymbolHeader* header = (PublicSymbolHeader*)stream->data();
+    // Patch the ilk file with the new PDB signature. If we don't do this,
+    // incremental linking will fail due to a signature mismatch.
+    if (pdbInfo) {
+        StatsPhase phase(opts.stats, "patchIlk");
+        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature, opts.dryrun,
+                 opts.threads, log);
+    }
+
+    StatsPhase applyPhase(opts.stats, "applyPatches");
+    patches.apply(opts.dryrun, log);
+    applyPhase.stop();
+
+    digestImage(pe, patches, opts);
 
-    // Struct alignment padding
-    header->padding1 = 0;
+    if (opts.symbolStore && opts.storeImage)
+        addToStore(imagePath, "image", imageKey(pe), opts, log);
 
-    // Microsoft's PDB writer has a bug where this field is not initialized in
-    // the constructor. However, there are other code paths that do initialize
-    // this value, but only sometimes. Thus, since Microsoft's tools are already
-    // broken because of this, we zero this out without worrying about it.
-    //
-    // Since fixing this would be a trivial one-liner for Microsoft, this patch
-    // could become silently obsolete in the future.
-    header->sectionCount = 0;
+    addStat(opts.stats, "imagesPatched", 1);
 }
 
 /**
- * Rewrites a PDB, eliminating non-determinism.
+ * Returns a description of a PDB stream for diagnostics.
  */
-void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
-              const uint8_t signature[16], bool force) {
-    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
+std::string streamDescription(size_t index) {
+    std::string desc = "PDB stream " + std::to_string(index);
+
+    switch ((PdbStreamType)index) {
+        case PdbStreamType::streamTable:
+            return desc + " (old stream table)";
+        case PdbStreamType::header:
+            return desc + " (PDB header)";
+        case PdbStreamType::tbi:
+            return desc + " (TPI)";
+        case PdbStreamType::dbi:
+            return desc + " (DBI)";
+        case PdbStreamType::ipi:
+            return desc + " (IPI)";
+        default:
+            return desc;
+    }
+}
 
-    // Read the PDB header
-    auto origPdbHeaderStream = msf.getStream((size_t)PdbStreamType::header);
-    if (!origPdbHeaderStream) throw InvalidPdb("missing PDB header stream");
+/**
+ * Returns true if the two streams have the same contents. A null stream is the
+ * same as an empty stream.
+ */
+bool sameContents(MsfStream* a, MsfStream* b) {
+    const size_t length = a ? a->length() : 0;
 
-    auto pdbHeaderStream = std::shared_ptr<MsfMemoryStream>(
-        new MsfMemoryStream(origPdbHeaderStream.get()));
+    if (length != (b ? b->length() : 0)) return false;
+    if (length == 0) return true;
 
-    patchHeaderStream(msf, pdbHeaderStream.get(), pdbInfo, timestamp, signature,
-                      force);
+    uint8_t bufA[4096], bufB[4096];
 
-    msf.replaceStream((size_t)PdbStreamType::header, pdbHeaderStream);
+    // The position is set before every read since one stream may be reading
+    // from the other.
+    for (size_t pos = 0; pos < length;) {
+        const size_t n = std::min(length - pos, sizeof(bufA));
 
-    // Patch the DBI stream
-    if (auto origDbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
-        auto dbiStream = std::make_shared<MsfMemoryStream>(origDbiStream.get());
+        a->setPos(pos);
+        if (a->read(n, bufA) != n) return false;
+
+        b->setPos(pos);
+        if (b->read(n, bufB) != n) return false;
 
-        patchDbiStream(msf, dbiStream.get());
+        if (memcmp(bufA, bufB, n) != 0) return false;
 
-        msf.replaceStream((size_t)PdbStreamType::dbi, dbiStream);
+        pos += n;
+    }
 
-        // We need the DBI header to get the symbol record stream. Note that
-        // bounds checking has already been done at this point.
-        const DbiHeader* dbiHeader = (const DbiHeader*)dbiStream->data();
+    return true;
+}
 
-        // Patch the symbol records stream
-        if (auto origSymRecStream =
-                msf.getStream(dbiHeader->symbolRecordsStream)) {
-            auto symRecStream =
-                std::make_shared<MsfMemoryStream>(origSymRecStream.get());
+/**
+ * Patches the PDB in memory and reports every stream that would have changed.
+ * The PDB is only mapped for reading. Returns the number of streams that are
+ * not normalized.
+ */
+template <typename CharT>
+size_t verifyPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
+                 uint32_t timestamp, const uint8_t signature[16],
+                 const PatchOptions& opts, bool failFast, std::ostream& log) {
+    MsfFile msf(std::make_shared<MemMap>(pdbPath, 0, true));
+    msf.arena()->setMaxMemory(opts.maxMemory);
 
-            patchSymbolRecordsStream(symRecStream.get());
+    std::vector<MsfStreamRef> original;
+    for (size_t i = 0; i < msf.streamCount(); ++i)
+        original.push_back(msf.getStream(i));
 
-            msf.replaceStream(dbiHeader->symbolRecordsStream, symRecStream);
-        }
+    patchPDB(msf, pdbInfo, timestamp, signature, opts.force, opts.threads,
+             log, opts.stats);
 
-        // Patch the public symbols info stream
-        if (auto origPubSymStream =
-                msf.getStream(dbiHeader->publicSymbolStream)) {
-            auto pubSymStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origPubSymStream.get()));
+    size_t mismatches = 0;
 
-            patchPublicSymbolStream(pubSymStream.get());
+    for (size_t i = 0; i < original.size(); ++i) {
+        const auto stream = msf.getStream(i);
 
-            msf.replaceStream(dbiHeader->publicSymbolStream, pubSymStream);
+        if (stream == original[i] ||
+            sameContents(stream.get(), original[i].get())) {
+            continue;
         }
+
+        log << "Not normalized: " << streamDescription(i) << std::endl;
+
+        ++mismatches;
+        if (failFast) break;
     }
+
+    return mismatches;
 }
 
 /**
- * Patches a PDB file.
+ * Checks that the image and its PDB are already normalized without modifying
+ * either of them. Every patch site that is not normalized is printed to `log`.
+ * Returns the number of such patch sites.
  */
 template <typename CharT>
-void patchPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
-              uint32_t timestamp, const uint8_t signature[16], bool dryrun,
-              bool force) {
-    auto tmpPdbPath = getTempPdbPath(pdbPath);
+size_t verifyFiles(const CharT* imagePath, const CharT* pdbPath,
+                   const PatchOptions& opts, bool failFast,
+                   std::ostream& log) {
+    MemMap image(imagePath, 0, true);
 
-    {
-        auto pdb    = openFile(pdbPath, FileMode<CharT>::readExisting);
-        auto tmpPdb = openFile(tmpPdbPath.c_str(), FileMode<CharT>::writeEmpty);
+    uint8_t* buf = (uint8_t*)image.buf();
 
-        MsfFile msf(pdb);
+    PEFile pe = PEFile(buf, image.length());
+
+    Patches patches(buf);
+
+    const CV_INFO_PDB70* pdbInfo = findImagePatches(pe, patches);
+
+    size_t mismatches = 0;
+
+    // Check everything in the image that doesn't require hashing first.
+    for (auto&& patch : patches.patches) {
+        if (patch.data == pe.pdbSignature || patch.isApplied(buf)) continue;
 
-        patchPDB(msf, pdbInfo, timestamp, signature, force);
+        log << "Not normalized: " << patch << std::endl;
 
-        // Write out the rewritten PDB to disk.
-        msf.write(tmpPdb);
+        ++mismatches;
+        if (failFast) return mismatches;
     }
 
-    if (dryrun) {
-        // Delete the temporary file
-        deleteFile(tmpPdbPath.c_str());
-    } else {
-        // Rename the new PDB file over the old one
-        renameFile(tmpPdbPath.c_str(), pdbPath);
+    image.advise(hashAccess(opts));
+    calculateSignature(pe, patches, opts);
+
+    for (auto&& patch : patches.patches) {
+        if (patch.data != pe.pdbSignature || patch.isApplied(buf)) continue;
+
+        log << "Not normalized: " << patch << std::endl;
+
+        ++mismatches;
+        if (failFast) return mismatches;
     }
+
+    if (pdbPath) {
+        mismatches += verifyPDB(pdbPath, pdbInfo, pe.timestamp,
+                                pe.pdbSignature, opts, failFast, log);
+    }
+
+    return mismatches;
 }
 
-template <typename CharT>
-void patchImageImpl(const CharT* imagePath, const CharT* pdbPath, bool dryrun,
-                    bool force) {
-    MemMap image(imagePath);
+/**
+ * Patches an image in memory and an already opened PDB. The PDB is written to
+ * the given sink.
+ */
+void patchBuffers(uint8_t* image, size_t imageLength, MsfFile* pdb,
+                  const PdbSink& sink, const PatchOptions& opts,
+                  std::ostream& log) {
+    StatsPhase readPhase(opts.stats, "readImage");
 
-    uint8_t* buf        = (uint8_t*)image.buf();
-    const size_t length = image.length();
+    addStat(opts.stats, "imageBytes", imageLength);
 
-    PEFile pe = PEFile(buf, length);
+    PEFile pe = PEFile(image, imageLength);
 
-    Patches patches(buf);
+    Patches patches(image);
 
-    patches.add(&pe.fileHeader->TimeDateStamp, &pe.timestamp,
-                "IMAGE_FILE_HEADER.TimeDateStamp");
+    const CV_INFO_PDB70* pdbInfo = findImagePatches(pe, patches);
 
-    const CV_INFO_PDB70* pdbInfo = NULL;
+    readPhase.stop();
 
-    switch (pe.magic()) {
-        case IMAGE_NT_OPTIONAL_HDR32_MAGIC: {
-            // Patch as a PE32 file
-            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>();
-            pdbInfo  = pe.pdbInfo(opt);
-            patchOptionalHeader(pe, patches, opt);
-            break;
-        }
+    auto hashed = hashImage(pe, patches, opts);
 
-        case IMAGE_NT_OPTIONAL_HDR64_MAGIC: {
-            // Patch as a PE32+ file
-            auto opt = pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>();
-            pdbInfo  = pe.pdbInfo(opt);
-            patchOptionalHeader(pe, patches, opt);
-            break;
+    if (pdb) {
+        pdb->arena()->setMaxMemory(opts.maxMemory);
+
+        patchPDB(*pdb, pdbInfo, pe.timestamp, nullptr, opts.force,
+                 opts.threads, log, opts.stats);
+
+        hashed.get();
+        setPdbSignature(pdb->getStream((size_t)PdbStreamType::header).get(),
+                        pe.pdbSignature);
+
+        if (opts.layout == PdbLayout::locality)
+            pdb->setLeadingStreams(directoryStreams(*pdb));
+
+        if (opts.dryrun) {
+            planPdb(*pdb, log, opts.stats);
+        } else {
+            uint8_t* digest = nullptr;
+            if (opts.digests) {
+                digest               = opts.digests->pdb;
+                opts.digests->hasPdb = true;
+            }
+
+            pdb->write(sink, opts.stats, digest);
         }
 
-        default:
-            throw InvalidImage("unsupported IMAGE_NT_HEADERS.OptionalHeader");
+        countPdbReads(opts.stats, *pdb);
     }
 
-    patches.sort();
+    hashed.get();
 
-    // Calculate the checksum of the PE file. Note that the checksum is stored
-    // in the PDB signature. When the patches are applied, this checksum is what
-    // will be set in the file.
-    calculateChecksum(buf, length, patches.patches, pe.pdbSignature);
+    StatsPhase applyPhase(opts.stats, "applyPatches");
+    patches.apply(opts.dryrun, log);
+    applyPhase.stop();
 
-    // Patch the PDB file.
-    if (pdbPath) {
-        patchPDB(pdbPath, pdbInfo, pe.timestamp, pe.pdbSignature, dryrun,
-                 force);
-    }
+    digestImage(pe, patches, opts);
 
-    // Patch the ilk file with the new PDB signature. If we don't do this,
-    // incremental linking will fail due to a signature mismatch.
-    if (pdbInfo) {
-        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature, dryrun);
+    addStat(opts.stats, "imagesPatched", 1);
+}
+
+template <typename CharT>
+void patchImageImpl(const CharT* imagePath, const CharT* pdbPath,
+                    const PatchOptions& opts, std::ostream& log) {
+    // With a symbol store, the image has to be parsed to find where it goes
+    // in the store, so the stamp doesn't save anything.
+    if (opts.stamp && !opts.always && !opts.stripped && !opts.symbolStore) {
+        StatsPhase phase(opts.stats, "checkStamp");
+
+        if (checkStamp(imagePath, pdbPath, opts)) {
+            log << "Note: The image has not changed since it was last "
+                   "normalized. Skipping it."
+                << std::endl;
+            addStat(opts.stats, "imagesSkipped", 1);
+            phase.stop();
+            digestUnchangedFiles(imagePath, pdbPath, opts);
+            return;
+        }
     }
 
-    patches.apply(dryrun);
+    patchFiles(imagePath, pdbPath, opts, log);
+
+    // The image must be closed first so that its modification time is final.
+    if (opts.stamp && !opts.dryrun) {
+        StatsPhase phase(opts.stats, "writeStamp");
+        writeStamp(imagePath, pdbPath, opts);
+    }
 }
 
 }  // namespace
 
 #if defined(_WIN32) && defined(UNICODE)
 
+void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& opts, std::ostream& log) {
+    patchImageImpl(imagePath, pdbPath, opts, log);
+}
+
+size_t verifyImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                   const PatchOptions& opts, bool failFast,
+                   std::ostream& log) {
+    return verifyFiles(imagePath, pdbPath, opts, failFast, log);
+}
+
 void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath, bool dryrun,
-                bool force) {
-    patchImageImpl(imagePath, pdbPath, dryrun, force);
+                bool force, std::ostream& log) {
+    PatchOptions opts;
+    opts.dryrun = dryrun;
+    opts.force  = force;
+    patchImageImpl(imagePath, pdbPath, opts, log);
 }
 
 #else
 
+void patchImage(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts, std::ostream& log) {
+    patchImageImpl(imagePath, pdbPath, opts, log);
+}
+
+size_t verifyImage(const char* imagePath, const char* pdbPath,
+                   const PatchOptions& opts, bool failFast,
+                   std::ostream& log) {
+    return verifyFiles(imagePath, pdbPath, opts, failFast, log);
+}
+
 void patchImage(const char* imagePath, const char* pdbPath, bool dryrun,
-                bool force) {
-    patchImageImpl(imagePath, pdbPath, dryrun, force);
+                bool force, std::ostream& log) {
+    PatchOptions opts;
+    opts.dryrun = dryrun;
+    opts.force  = force;
+    patchImageImpl(imagePath, pdbPath, opts, log);
 }
 
 #endif
+
+void patchImage(uint8_t* image, size_t imageLength, const void* pdb,
+                size_t pdbLength, const PdbSink& sink, const PatchOptions& opts,
+                std::ostream& log) {
+    if (!pdb) {
+        patchBuffers(image, imageLength, nullptr, sink, opts, log);
+        return;
+    }
+
+    MsfFile msf(std::make_shared<MemMap>(const_cast<void*>(pdb), pdbLength));
+
+    patchBuffers(image, imageLength, &msf, sink, opts, log);
+}
+
+void patchImage(uint8_t* image, size_t imageLength, MsfFile* pdb,
+                const PdbSink& sink, const PatchOptions& opts,
+                std::ostream& log) {
+    patchBuffers(image, imageLength, pdb, sink, opts, log);
+}
@@ -21,18 +21,224 @@
  */
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <iostream>
+
+class MsfFile;
+class Stats;
+
+/**
+ * The hash used to calculate the deterministic PDB signature from the contents
+ * of the image.
+ */
+enum class SignatureHash {
+    // MD5 over the whole image. This is the default and is compatible with
+    // previous versions.
+    md5,
+
+    // A tree of MurmurHash3 hashes over 1 MiB chunks. This is much faster and
+    // can use multiple threads.
+    murmur3,
+};
+
+/**
+ * How the streams of a rewritten PDB are laid out.
+ */
+enum class PdbLayout {
+    // Streams are written in index order followed by the stream table. This
+    // is the default.
+    index,
+
+    // The streams that a debugger reads first are written first and next to
+    // the stream table (see directoryStreams()). The rest of the streams
+    // follow in index order. This makes loading symbols from a cold cache or a
+    // network share faster.
+    locality,
+};
+
+/**
+ * SHA-256 digests of the files as they are once they have been normalized.
+ */
+struct OutputDigests {
+    // Whether each digest has been set. Nothing is set in a dry run.
+    bool hasImage;
+    bool hasPdb;
+
+    uint8_t image[32];
+    uint8_t pdb[32];
+
+    OutputDigests() : hasImage(false), hasPdb(false) {}
+};
+
+/**
+ * Options for patching an image and its PDB.
+ */
+struct PatchOptions {
+    // If true, nothing is modified. Only what would have been patched is
+    // printed.
+    bool dryrun;
+
+    // Proceed even if the PE and PDB signatures don't match.
+    bool force;
+
+    // Patch the PDB in place instead of rewriting it to a temporary file. If
+    // any of the changes can't be made in place, the PDB is rewritten anyway.
+    bool inplace;
+
+    // Maximum number of threads to use for patching the streams of the PDB and
+    // for searching the ILK file. If 0, the number of hardware threads is used.
+    size_t threads;
+
+    // Hash used for the PDB signature. Also limited to `threads` threads.
+    SignatureHash hash;
+
+    // Layout of the PDB when it is rewritten. Patching in place keeps the
+    // original layout, so with any other layout the PDB is always rewritten.
+    PdbLayout layout;
+
+    // Patch the files even if they appear to be normalized already. By
+    // default, files whose headers show that they have already been patched
+    // are skipped.
+    bool always;
+
+    // Record the state of the files in a stamp next to the image once they
+    // are normalized. If neither file has changed the next time, they are
+    // skipped without being opened.
+    bool stamp;
+
+    // Maximum number of bytes of heap memory used for copies of the streams of
+    // the PDB. Copies beyond that are backed by temporary files instead. The
+    // output is the same either way. 0 means there is no limit.
+    size_t maxMemory;
+
+    // Also write a stripped copy of the normalized PDB next to it, with only
+    // the public symbols and the section headers. See stripPDB(). If the PDB
+    // is "foo.pdb", the copy is "foo.stripped.pdb". The files are then never
+    // skipped for being normalized already, as if `always` were set.
+    bool stripped;
+
+    // If not null, the normalized PDB is written straight into this symbol
+    // store (see symbol_store.h) and linked back to its original path. If
+    // `storeImage` is also true, the image is linked into the store as well.
+    // Files that are already normalized are still linked into the store, so
+    // the stamp is not checked.
+#if defined(_WIN32) && defined(UNICODE)
+    const wchar_t* symbolStore;
+#else
+    const char* symbolStore;
+#endif
+    bool storeImage;
+
+    // If not null, the time taken by each phase and counts of what was read,
+    // written, and patched are added to this. Nothing is measured otherwise.
+    Stats* stats;
+
+    // If not null, the digests of the normalized files are stored here. The
+    // PDB is hashed while it is being written, so neither file has to be read
+    // again afterwards unless it was skipped or the PDB was patched in place.
+    OutputDigests* digests;
+
+    PatchOptions()
+        : dryrun(true),
+          force(false),
+          inplace(false),
+          threads(1),
+          hash(SignatureHash::md5),
+          layout(PdbLayout::index),
+          always(false),
+          stamp(false),
+          maxMemory(0),
+          stripped(false),
+          symbolStore(nullptr),
+          storeImage(false),
+          stats(nullptr),
+          digests(nullptr) {}
+};
+
 /**
  * Patches the given image and its associated PDB to eliminate the
- * non-deterministic parts of the files.
+ * non-deterministic parts of the files. Everything that gets patched is printed
+ * to `log`.
+ *
+ * This is safe to call concurrently from multiple threads as long as the calls
+ * do not operate on the same files.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
 void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
-                bool dryrun = true, bool force = false);
+                const PatchOptions& opts, std::ostream& log = std::cout);
+
+void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                bool dryrun = true, bool force = false,
+                std::ostream& log = std::cout);
 
 #else
 
+void patchImage(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts, std::ostream& log = std::cout);
+
 void patchImage(const char* imagePath, const char* pdbPath, bool dryrun = true,
-                bool force = false);
+                bool force = false, std::ostream& log = std::cout);
 
 #endif
+
+/**
+ * Checks that the given image and its associated PDB are already normalized
+ * without modifying either of them. Both files are only opened for reading.
+ * Every patch site that is not normalized is printed to `log`. If `failFast` is
+ * true, this stops at the first one.
+ *
+ * Only `force`, `threads`, and `hash` are used from `opts`.
+ *
+ * Returns the number of patch sites that are not normalized.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+size_t verifyImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                   const PatchOptions& opts, bool failFast = false,
+                   std::ostream& log = std::cout);
+
+#else
+
+size_t verifyImage(const char* imagePath, const char* pdbPath,
+                   const PatchOptions& opts, bool failFast = false,
+                   std::ostream& log = std::cout);
+
+#endif
+
+/**
+ * Receives the normalized PDB in order, one block at a time. The data is only
+ * valid for the duration of the call.
+ */
+typedef std::function<void(const void* data, size_t length)> PdbSink;
+
+/**
+ * Patches an image and its PDB that are already in memory. Nothing is read from
+ * or written to the filesystem. This is meant for embedding ducible in other
+ * tools, such as a linker wrapper.
+ *
+ * The image buffer is patched in place. The PDB buffer is only read and the
+ * normalized PDB is passed to `sink`. `pdb` may be null if there is no PDB.
+ * Both buffers are owned by the caller and must outlive the call.
+ *
+ * If `opts.dryrun` is true, the image is not modified and `sink` is not called.
+ * The `inplace`, `always`, `stamp`, `stripped`, and `symbolStore` options have
+ * no effect. No ILK file is patched.
+ */
+void patchImage(uint8_t* image, size_t imageLength, const void* pdb,
+                size_t pdbLength, const PdbSink& sink, const PatchOptions& opts,
+                std::ostream& log = std::cout);
+
+/**
+ * Same as above, but the PDB is given as an MsfFile. This allows the PDB to be
+ * read through any MsfStream implementation. The MsfFile is modified to refer
+ * to the patched streams. The streams of an MsfFile that reads from a FILE*
+ * share its position, so they are patched on one thread regardless of
+ * `opts.threads`.
+ */
+void patchImage(uint8_t* image, size_t imageLength, MsfFile* pdb,
+                const PdbSink& sink, const PatchOptions& opts,
+                std::ostream& log = std::cout);
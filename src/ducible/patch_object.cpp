@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/patch_object.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ducible/patch_pdb.h"
+#include "ducible/patches.h"
+
+#include "pdb/cvinfo.h"
+#include "pe/format.h"
+#include "pe/pe.h"
+
+#include "util/memmap.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// Replacement for the timestamp in the header of an object. Unlike an image,
+// an object is never loaded, so zero can be used.
+const uint32_t kObjectTimestamp = 0;
+
+// Replacement for the date of a library member.
+const uint8_t kArchiveDate[12] = {'0', ' ', ' ', ' ', ' ', ' ',
+                                  ' ', ' ', ' ', ' ', ' ', ' '};
+
+// Class ID of ANON_OBJECT_HEADER_BIGOBJ.
+const uint8_t kBigObjClassId[16] = {0xc7, 0xa1, 0xba, 0xd1, 0xee, 0xba,
+                                    0xa9, 0x4b, 0xaf, 0x20, 0xfa, 0xf6,
+                                    0x6a, 0xa4, 0xdc, 0xb8};
+
+// Name of the sections with the CodeView symbols of an object.
+const uint8_t kDebugSymbolsName[IMAGE_SIZEOF_SHORT_NAME] = {
+    '.', 'd', 'e', 'b', 'u', 'g', '$', 'S'};
+
+// Type of the .debug$S subsection with the symbol records.
+const uint32_t kDebugSubsectionSymbols = 0xf1;
+
+// Members compiled with LLVM's LTO are bitcode, with or without a wrapper.
+const uint8_t kBitcodeMagic[4]        = {'B', 'C', 0xc0, 0xde};
+const uint8_t kBitcodeWrapperMagic[4] = {0xde, 0xc0, 0x17, 0x0b};
+
+/**
+ * A member of a library.
+ */
+struct ArchiveMember {
+    // Offset of the member header in the file.
+    size_t header;
+
+    // Offset and length of the member's data.
+    size_t offset;
+    size_t length;
+
+    // True if this is the symbol table, long names table, or some other
+    // special member rather than an object.
+    bool special;
+};
+
+/**
+ * Reads a possibly unaligned value.
+ */
+template <typename T>
+T readValue(const uint8_t* p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Finds the GUIDs in S_OBJNAME records in a symbols subsection.
+ */
+void findObjNamePatches(const uint8_t* buf, size_t offset, size_t length,
+                        Patches& patches) {
+    for (size_t pos = 0; length - pos >= 2 * sizeof(uint16_t);) {
+        const uint8_t* rec = buf + offset + pos;
+
+        // The length includes the type, but not itself.
+        const size_t recordLength = readValue<uint16_t>(rec);
+        if (recordLength < sizeof(uint16_t) ||
+            recordLength > length - pos - sizeof(uint16_t)) {
+            throw InvalidImage("invalid symbol record in .debug$S section");
+        }
+
+        const size_t nameOffset = offsetof(OBJNAMESYM, name);
+
+        if (readValue<uint16_t>(rec + sizeof(uint16_t)) == S_OBJNAME &&
+            recordLength + sizeof(uint16_t) > nameOffset) {
+            const char* name     = (const char*)rec + nameOffset;
+            const size_t maxlen  = recordLength + sizeof(uint16_t) - nameOffset;
+            const size_t namelen = strnlen(name, maxlen);
+
+            if (namelen == maxlen) {
+                throw InvalidImage(
+                    "object path in symbol record is not null-terminated");
+            }
+
+            const size_t guid = findFileNameGuid(name, namelen);
+            if (guid != namelen) {
+                patches.add(Patch(offset + pos + nameOffset + guid,
+                                  kGuidLength,
+                                  (const uint8_t*)nullFileNameGuid(),
+                                  "S_OBJNAME GUID"));
+            }
+        }
+
+        pos += sizeof(uint16_t) + recordLength;
+    }
+}
+
+/**
+ * Finds the patches in a .debug$S section. Sections without the C13 signature
+ * are left alone.
+ */
+void findDebugSymbolPatches(const uint8_t* buf, size_t offset, size_t length,
+                            Patches& patches) {
+    if (length < sizeof(uint32_t) ||
+        readValue<uint32_t>(buf + offset) != CV_SIGNATURE_C13) {
+        return;
+    }
+
+    for (size_t pos = sizeof(uint32_t); length - pos >= 2 * sizeof(uint32_t);) {
+        const uint32_t type = readValue<uint32_t>(buf + offset + pos);
+        const uint32_t size =
+            readValue<uint32_t>(buf + offset + pos + sizeof(uint32_t));
+
+        pos += 2 * sizeof(uint32_t);
+
+        if (size > length - pos)
+            throw InvalidImage("invalid .debug$S subsection length");
+
+        if (type == kDebugSubsectionSymbols)
+            findObjNamePatches(buf, offset + pos, size, patches);
+
+        // Subsections are aligned to 4 bytes.
+        pos += size;
+        pos += (4 - pos % 4) % 4;
+        if (pos > length) break;
+    }
+}
+
+/**
+ * Finds the patches in the sections of an object. The section headers start
+ * at `sections`, relative to the start of the object.
+ */
+void findSectionPatches(const uint8_t* buf, size_t offset, size_t length,
+                        size_t sections, size_t count, Patches& patches) {
+    if (sections > length ||
+        (uint64_t)count * sizeof(IMAGE_SECTION_HEADER) > length - sections) {
+        throw InvalidImage("object section headers are truncated");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto section = readValue<IMAGE_SECTION_HEADER>(
+            buf + offset + sections + i * sizeof(IMAGE_SECTION_HEADER));
+
+        if (memcmp(section.Name, kDebugSymbolsName, sizeof(section.Name)) != 0)
+            continue;
+
+        if (section.PointerToRawData > length ||
+            section.SizeOfRawData > length - section.PointerToRawData) {
+            throw InvalidImage(".debug$S section is out of bounds");
+        }
+
+        findDebugSymbolPatches(buf, offset + section.PointerToRawData,
+                               section.SizeOfRawData, patches);
+    }
+}
+
+/**
+ * Returns true if `machine` is the machine type of a COFF object. Without this,
+ * any other file would be mistaken for an object.
+ */
+bool isObjectMachine(uint16_t machine) {
+    switch (machine) {
+        case IMAGE_FILE_MACHINE_UNKNOWN:
+        case IMAGE_FILE_MACHINE_I386:
+        case IMAGE_FILE_MACHINE_R3000:
+        case IMAGE_FILE_MACHINE_R4000:
+        case IMAGE_FILE_MACHINE_R10000:
+        case IMAGE_FILE_MACHINE_WCEMIPSV2:
+        case IMAGE_FILE_MACHINE_ALPHA:
+        case IMAGE_FILE_MACHINE_SH3:
+        case IMAGE_FILE_MACHINE_SH3DSP:
+        case IMAGE_FILE_MACHINE_SH3E:
+        case IMAGE_FILE_MACHINE_SH4:
+        case IMAGE_FILE_MACHINE_SH5:
+        case IMAGE_FILE_MACHINE_ARM:
+        case IMAGE_FILE_MACHINE_THUMB:
+        case IMAGE_FILE_MACHINE_ARMNT:
+        case IMAGE_FILE_MACHINE_AM33:
+        case IMAGE_FILE_MACHINE_POWERPC:
+        case IMAGE_FILE_MACHINE_POWERPCFP:
+        case IMAGE_FILE_MACHINE_IA64:
+        case IMAGE_FILE_MACHINE_MIPS16:
+        case IMAGE_FILE_MACHINE_ALPHA64:
+        case IMAGE_FILE_MACHINE_MIPSFPU:
+        case IMAGE_FILE_MACHINE_MIPSFPU16:
+        case IMAGE_FILE_MACHINE_TRICORE:
+        case IMAGE_FILE_MACHINE_CEF:
+        case IMAGE_FILE_MACHINE_EBC:
+        case IMAGE_FILE_MACHINE_AMD64:
+        case IMAGE_FILE_MACHINE_M32R:
+        case IMAGE_FILE_MACHINE_ARM64:
+        case IMAGE_FILE_MACHINE_ARM64EC:
+        case IMAGE_FILE_MACHINE_ARM64X:
+        case IMAGE_FILE_MACHINE_CEE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Finds the patches in an object that starts at `offset`.
+ */
+void findObjectPatches(const uint8_t* buf, size_t offset, size_t length,
+                       Patches& patches) {
+    const uint8_t* p = buf + offset;
+
+    if (length >= sizeof(kBitcodeMagic) &&
+        (memcmp(p, kBitcodeMagic, sizeof(kBitcodeMagic)) == 0 ||
+         memcmp(p, kBitcodeWrapperMagic, sizeof(kBitcodeWrapperMagic)) == 0)) {
+        return;
+    }
+
+    if (length >= sizeof(IMPORT_OBJECT_HEADER) &&
+        readValue<uint16_t>(p) == IMAGE_FILE_MACHINE_UNKNOWN &&
+        readValue<uint16_t>(p + sizeof(uint16_t)) == IMPORT_OBJECT_HDR_SIG2) {
+        const IMPORT_OBJECT_HEADER header =
+            readValue<IMPORT_OBJECT_HEADER>(p);
+
+        // The timestamp is in the same place in every kind of header.
+        const size_t timestamp =
+            offset + offsetof(IMPORT_OBJECT_HEADER, TimeDateStamp);
+
+        if (header.Version == 0) {
+            patches.add(Patch(timestamp, &kObjectTimestamp,
+                              "IMPORT_OBJECT_HEADER.TimeDateStamp"));
+            return;
+        }
+
+        if (header.Version >= 2 &&
+            length >= sizeof(ANON_OBJECT_HEADER_BIGOBJ) &&
+            memcmp(p + offsetof(ANON_OBJECT_HEADER_BIGOBJ, ClassID),
+                   kBigObjClassId, sizeof(kBigObjClassId)) == 0) {
+            const auto bigobj = readValue<ANON_OBJECT_HEADER_BIGOBJ>(p);
+
+            patches.add(Patch(timestamp, &kObjectTimestamp,
+                              "ANON_OBJECT_HEADER_BIGOBJ.TimeDateStamp"));
+
+            findSectionPatches(buf, offset, length, sizeof(bigobj),
+                               bigobj.NumberOfSections, patches);
+            return;
+        }
+
+        // Anything else, such as an object compiled with /GL, is opaque.
+        patches.add(Patch(timestamp, &kObjectTimestamp,
+                          "ANON_OBJECT_HEADER.TimeDateStamp"));
+        return;
+    }
+
+    if (length >= sizeof(uint16_t) &&
+        readValue<uint16_t>(p) == IMAGE_DOS_SIGNATURE) {
+        throw InvalidImage("this is an image, not an object file");
+    }
+
+    if (length < sizeof(IMAGE_FILE_HEADER))
+        throw InvalidImage("missing IMAGE_FILE_HEADER");
+
+    const auto header = readValue<IMAGE_FILE_HEADER>(p);
+
+    if (!isObjectMachine(header.Machine))
+        throw InvalidImage("unknown machine type in IMAGE_FILE_HEADER");
+
+    patches.add(Patch(offset + offsetof(IMAGE_FILE_HEADER, TimeDateStamp),
+                      &kObjectTimestamp, "IMAGE_FILE_HEADER.TimeDateStamp"));
+
+    findSectionPatches(buf, offset, length,
+                       sizeof(header) + header.SizeOfOptionalHeader,
+                       header.NumberOfSections, patches);
+}
+
+/**
+ * Parses a decimal field of an archive member header, which is padded with
+ * spaces.
+ */
+size_t parseArchiveField(const uint8_t* field, size_t length) {
+    size_t value = 0;
+    size_t i     = 0;
+
+    for (; i < length && field[i] >= '0' && field[i] <= '9'; ++i)
+        value = value * 10 + (field[i] - '0');
+
+    if (i == 0) throw InvalidImage("invalid archive member size");
+
+    for (; i < length; ++i) {
+        if (field[i] != ' ') throw InvalidImage("invalid archive member size");
+    }
+
+    return value;
+}
+
+/**
+ * Reads the headers of every member of a library.
+ */
+std::vector<ArchiveMember> readArchiveMembers(const uint8_t* buf,
+                                              size_t length) {
+    std::vector<ArchiveMember> members;
+
+    for (size_t pos = IMAGE_ARCHIVE_START_SIZE; pos < length;) {
+        if (length - pos < sizeof(IMAGE_ARCHIVE_MEMBER_HEADER))
+            throw InvalidImage("archive member header is truncated");
+
+        const auto header = (const IMAGE_ARCHIVE_MEMBER_HEADER*)(buf + pos);
+
+        if (memcmp(header->EndHeader, IMAGE_ARCHIVE_END,
+                   sizeof(header->EndHeader)) != 0) {
+            throw InvalidImage("invalid archive member header");
+        }
+
+        ArchiveMember member;
+        member.header = pos;
+        member.offset = pos + sizeof(IMAGE_ARCHIVE_MEMBER_HEADER);
+        member.length = parseArchiveField(header->Size, sizeof(header->Size));
+
+        if (member.length > length - member.offset)
+            throw InvalidImage("archive member is truncated");
+
+        // Special members are named "/", "//", or "/<NAME>/". Objects with long
+        // names are named "/" followed by an offset into the long names.
+        member.special = header->Name[0] == '/' &&
+                         !(header->Name[1] >= '0' && header->Name[1] <= '9');
+
+        members.push_back(member);
+
+        // Members are aligned to 2 bytes.
+        pos = member.offset + member.length + (member.length & 1);
+    }
+
+    return members;
+}
+
+template <typename CharT>
+void patchObjectImpl(const CharT* path, const PatchOptions& opts,
+                     std::ostream& log) {
+    StatsPhase readPhase(opts.stats, "readObject");
+
+    MemMap map(path, 0, opts.dryrun);
+
+    addStat(opts.stats, "objectBytes", map.length());
+
+    readPhase.stop();
+
+    patchObject((uint8_t*)map.buf(), map.length(), opts, log);
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void patchObject(const wchar_t* path, const PatchOptions& opts,
+                 std::ostream& log) {
+    patchObjectImpl(path, opts, log);
+}
+
+#else
+
+void patchObject(const char* path, const PatchOptions& opts,
+                 std::ostream& log) {
+    patchObjectImpl(path, opts, log);
+}
+
+#endif
+
+void patchObject(uint8_t* buf, size_t length, const PatchOptions& opts,
+                 std::ostream& log) {
+    StatsPhase phase(opts.stats, "patchObject");
+
+    Patches patches(buf);
+
+    if (length >= IMAGE_ARCHIVE_START_SIZE &&
+        memcmp(buf, IMAGE_ARCHIVE_START, IMAGE_ARCHIVE_START_SIZE) == 0) {
+        const auto members = readArchiveMembers(buf, length);
+
+        // Each member is searched separately. Nothing is patched until every
+        // member has been searched.
+        std::vector<Patches> memberPatches(members.size(), Patches(buf));
+
+        parallelFor(members.size(), opts.threads, [&](size_t i) {
+            const ArchiveMember& member = members[i];
+
+            memberPatches[i].add(
+                Patch(member.header +
+                          offsetof(IMAGE_ARCHIVE_MEMBER_HEADER, Date),
+                      sizeof(kArchiveDate), kArchiveDate,
+                      "IMAGE_ARCHIVE_MEMBER_HEADER.Date"));
+
+            if (!member.special) {
+                findObjectPatches(buf, member.offset, member.length,
+                                  memberPatches[i]);
+            }
+        });
+
+        for (auto&& p : memberPatches) {
+            patches.patches.insert(patches.patches.end(), p.patches.begin(),
+                                   p.patches.end());
+        }
+
+        addStat(opts.stats, "archiveMembers", members.size());
+    } else {
+        findObjectPatches(buf, 0, length, patches);
+    }
+
+    patches.sort();
+    patches.apply(opts.dryrun, log);
+
+    addStat(opts.stats, "objectsPatched", 1);
+}
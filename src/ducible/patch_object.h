@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+
+#include "ducible/patch_image.h"
+
+/**
+ * Normalizes a COFF object file (.obj) or a static library (.lib) in place so
+ * that compiling the same source twice produces the same file. This patches:
+ *
+ *  - the timestamp in the header of each object,
+ *  - the date of each member of a library, and
+ *  - GUIDs in the path of the object in the S_OBJNAME symbol record in each
+ *    .debug$S section.
+ *
+ * The members of a library are found in one pass over the member headers and
+ * are then searched using up to `opts.threads` threads. Nothing is modified
+ * unless every member could be parsed. Only `dryrun`, `threads`, and `stats`
+ * are used from `opts`. Everything that gets patched is printed to `log`.
+ *
+ * Throws: InvalidImage if the file is not an object file or a library.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void patchObject(const wchar_t* path, const PatchOptions& opts,
+                 std::ostream& log = std::cout);
+
+#else
+
+void patchObject(const char* path, const PatchOptions& opts,
+                 std::ostream& log = std::cout);
+
+#endif
+
+/**
+ * Same as above, but the object file or library is already in memory. The
+ * buffer is patched in place.
+ */
+void patchObject(uint8_t* buf, size_t length, const PatchOptions& opts,
+                 std::ostream& log = std::cout);
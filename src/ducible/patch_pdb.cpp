@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/patch_pdb.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "ducible/symbol_records.h"
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "msf/overlay_stream.h"
+
+#include "pdb/cvinfo.h"
+
+namespace {
+
+// Helpers for CharT generalization
+template <typename CharT>
+struct Strings {
+    static const CharT nullGuid[];
+};
+
+template <>
+const char Strings<char>::nullGuid[] = "{00000000-0000-0000-0000-000000000000}";
+template <>
+const wchar_t Strings<wchar_t>::nullGuid[] =
+    L"{00000000-0000-0000-0000-000000000000}";
+
+/**
+ * Returns true if the given character is a hexadecimal digit.
+ */
+template <typename CharT>
+inline bool isHexDigit(CharT c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+           (c >= 'A' && c <= 'F');
+}
+
+/**
+ * Returns true if a GUID starts at `s`. There must be at least kGuidLength
+ * characters available.
+ */
+template <typename CharT>
+bool isGuid(const CharT* s) {
+    if (s[0] != '{' || s[kGuidLength - 1] != '}') return false;
+
+    for (size_t i = 1; i < kGuidLength - 1; ++i) {
+        switch (i) {
+            case 9:
+            case 14:
+            case 19:
+            case 24:
+                if (s[i] != '-') return false;
+                break;
+            default:
+                if (!isHexDigit(s[i])) return false;
+                break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Finds the first GUID in the given string. Returns `length` if there is none.
+ *
+ * Candidates are found by searching for an opening brace, which is much faster
+ * than a regular expression since std::char_traits<char>::find() is memchr().
+ */
+template <typename CharT>
+size_t findGuid(const CharT* s, size_t length) {
+    typedef std::char_traits<CharT> traits;
+
+    for (size_t i = 0; i + kGuidLength <= length;) {
+        const CharT* brace =
+            traits::find(s + i, length - kGuidLength + 1 - i, '{');
+        if (!brace) break;
+
+        const size_t pos = brace - s;
+        if (isGuid(brace)) return pos;
+
+        i = pos + 1;
+    }
+
+    return length;
+}
+
+/**
+ * Helper function for normalizing a GUID in a NULL terminated file name.
+ *
+ * The first GUID is replaced with the null GUID. Note that this includes the
+ * null terminator, so the rest of the string after the GUID is discarded.
+ *
+ * Returns true if a GUID was found.
+ */
+template <typename CharT>
+bool normalizeFileNameGuid(CharT* path, size_t length) {
+    const size_t pos = findGuid(path, length);
+
+    if (pos == length) return false;
+
+    memcpy(path + pos, Strings<CharT>::nullGuid,
+           sizeof(Strings<CharT>::nullGuid));
+    return true;
+}
+
+const char* kIncLinkWarning =
+    "\
+Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
+is known to not work with Ducible.";
+
+}  // namespace
+
+size_t findFileNameGuid(const char* name, size_t length) {
+    return findGuid(name, length);
+}
+
+const char* nullFileNameGuid() { return Strings<char>::nullGuid; }
+
+bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
+                        const PdbStream70& pdbHeader) {
+    if (pdbInfo.Age != pdbHeader.age ||
+        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) !=
+            0) {
+        return false;
+    }
+
+    return true;
+}
+
+void patchLinkInfoStream(MsfOverlayStream* stream) {
+    const size_t length = stream->length();
+
+    if (length == 0) return;
+
+    LinkInfo linkInfo;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(linkInfo), &linkInfo) != sizeof(linkInfo))
+        throw InvalidPdb("got partial LinkInfo stream");
+
+    if (linkInfo.size > length)
+        throw InvalidPdb("LinkInfo size too large for stream");
+
+    // The rest of the stream appears to be garbage. Thus, we truncate it.
+    stream->truncate(linkInfo.size);
+}
+
+size_t patchNamesStream(MsfMemoryStream* stream) {
+    uint8_t* data    = stream->data();
+    uint8_t* dataEnd = data + stream->length();
+
+    // Parse the header
+    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
+        throw InvalidPdb("missing string table header");
+
+    StringTableHeader* header = (StringTableHeader*)data;
+
+    data += sizeof(*header);
+
+    if (header->signature != kHashTableSignature)
+        throw InvalidPdb("got invalid string table signature");
+
+    if (header->version != 1 && header->version != 2)
+        throw InvalidPdb("got invalid or unsupported string table version");
+
+    if (size_t(dataEnd - data) < header->stringsSize)
+        throw InvalidPdb("got partial string table data");
+
+    data += header->stringsSize;
+
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing string table offset array length");
+
+    // Offsets array length
+    uint32_t offsetsLength = *(uint32_t*)data;
+
+    data += sizeof(offsetsLength);
+
+    if (size_t(dataEnd - data) < offsetsLength * sizeof(uint32_t))
+        throw InvalidPdb("got partial string table offsets array");
+
+    uint32_t* offsets = (uint32_t*)data;
+
+    data += offsetsLength * sizeof(uint32_t);
+
+    // Sort the offsets. There is some non-determinism creeping in here somehow.
+    std::sort(offsets, offsets + offsetsLength);
+
+    size_t guids = 0;
+
+    for (size_t i = 0; i < offsetsLength; ++i) {
+        const size_t offset = offsets[i];
+
+        // Skip duplicates. They have already been normalized.
+        if (offset == 0 || (i > 0 && offset == offsets[i - 1])) continue;
+
+        if (offset >= header->stringsSize)
+            throw InvalidPdb("got invalid offset into string table");
+
+        char* str  = &header->strings[offset];
+        size_t len = strlen(str);
+
+        if (offset + len + 1 > header->stringsSize)
+            throw InvalidPdb("got invalid offset into string table");
+
+        if (normalizeFileNameGuid(str, len)) ++guids;
+    }
+
+    return guids;
+}
+
+NameMapView patchHeaderStream(MsfMemoryStream* stream,
+                              const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+                              const uint8_t signature[16], bool force) {
+    uint8_t* data          = stream->data();
+    const uint8_t* dataEnd = stream->data() + stream->length();
+
+    if (size_t(dataEnd - data) < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    PdbStream70* header = (PdbStream70*)data;
+
+    data += sizeof(*header);
+
+    if (header->version < PdbVersion::vc70)
+        throw InvalidPdb("unsupported PDB implementation version");
+
+    // Check that this PDB matches what the PE file expects. Don't do the check
+    // if `force` was specified.
+    if (!force && (!pdbInfo || !matchingSignatures(*pdbInfo, *header)))
+        throw InvalidPdb("PE and PDB signatures do not match");
+
+    // Patch the PDB header stream
+    header->timestamp = timestamp;
+    header->age       = 1;
+    if (signature) memcpy(header->sig70, signature, sizeof(header->sig70));
+
+    return NameMapView(data, dataEnd);
+}
+
+void setPdbSignature(MsfStream* stream, const uint8_t signature[16]) {
+    PdbStream70 header;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    memcpy(header.sig70, signature, sizeof(header.sig70));
+
+    stream->setPos(0);
+    stream->write(sizeof(header), &header);
+}
+
+size_t patchModuleStream(MsfOverlayStream* stream) {
+    const size_t length = stream->length();
+
+    uint32_t type;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(type), &type) != sizeof(type))
+        throw InvalidPdb("got partial module info stream");
+
+    if (type != CV_SIGNATURE_C13) return 0;
+
+    SymbolRecord sym;
+    if (stream->read(sizeof(sym), &sym) != sizeof(sym))
+        throw InvalidPdb("missing symbol record in module info stream");
+
+    // We're only concerned about objects here
+    if (sym.type != S_OBJNAME) return 0;
+
+    if (length - sizeof(type) < sym.length)
+        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+
+    // Only the first record needs to be read.
+    std::vector<uint8_t> record(
+        std::min(length - sizeof(type), sizeof(sym.length) + sym.length));
+
+    if (record.size() < offsetof(OBJNAMESYM, name))
+        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+
+    stream->setPos(sizeof(type));
+    stream->read(record.size(), record.data());
+
+    // Recast now that we know the type.
+    OBJNAMESYM* objsym = (OBJNAMESYM*)record.data();
+
+    // The signature always seems to be 0.
+    if (objsym->signature != 0)
+        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
+
+    char* name = (char*)objsym->name;
+    const size_t maxlen = record.size() - offsetof(OBJNAMESYM, name);
+
+    const size_t namelen = std::find(name, name + maxlen, '\0') - name;
+
+    if (namelen == maxlen)
+        throw InvalidPdb("object path in symbol record is not null-terminated");
+
+    if (!normalizeFileNameGuid(name, namelen)) return 0;
+
+    stream->setPos(sizeof(type));
+    stream->write(record.size(), record.data());
+
+    return 1;
+}
+
+size_t patchDbiStream(MsfMemoryStream* stream,
+                      std::vector<size_t>& moduleStreams, std::ostream& log) {
+    const DbiView view(stream->data(), stream->length());
+
+    DbiHeader* dbi = &view.header();
+
+    // Sanity checks
+    if (dbi->signature != dbiHeaderSignature)
+        throw InvalidPdb("invalid DBI header signature");
+
+    if (dbi->version != DbiVersion::v70)
+        throw InvalidPdb("Unsupported DBI stream version");
+
+    // Display a warning about incrementally linking
+    if (dbi->flags.incLink) log << kIncLinkWarning << std::endl;
+
+    // Patch the age. This must match the age in the PDB stream.
+    dbi->age = 1;
+
+    // Number of modules
+    size_t moduleCount = 0;
+
+    // Patch the module info entries. The module info immediately follows the
+    // header.
+    for (const ModuleEntry& module : view.moduleInfo()) {
+        ModuleInfo* info = module.info;
+
+        info->sc.padding1 = 0;
+        info->sc.padding2 = 0;
+
+        // Patch the offsets "array". This is not used directly by Microsoft's
+        // DBI implementation and may contain non-deterministic data (e.g., the
+        // memory address of the actual allocated array). Thus, we need to zero
+        // it out.
+        info->offsets = 0;
+
+        // There is one entry that contains a path with a GUID. We need to patch
+        // this. It is often the first module info entry, but it is safer to
+        // find it by name.
+        if (module.moduleName == "* Linker Generated Manifest RES *" &&
+            module.objectName.empty()) {
+            moduleStreams.push_back(info->stream);
+        }
+
+        ++moduleCount;
+    }
+
+    // The section contributions follow the module info entries. These contain
+    // garbage due to struct alignment. They needed to be zeroed out.
+    for (SectionContribution& sc : view.sectionContributions()) {
+        sc.padding1 = 0;
+        sc.padding2 = 0;
+    }
+
+    size_t guids = 0;
+
+    // In the list of files, there are some temporary files with random GUIDs in
+    // the name.
+    if (dbi->fileInfoSize > 0) {
+        const FileInfoView fileInfo = view.fileInfo(moduleCount);
+
+        // Many of the offsets refer to the same file name. Only normalize each
+        // one once.
+        std::vector<bool> normalized(dbi->fileInfoSize);
+
+        for (size_t i = 0; i < fileInfo.nameCount(); ++i) {
+            const uint32_t off = fileInfo.nameOffset(i);
+
+            if (normalized[off]) continue;
+            normalized[off] = true;
+
+            const StringRef name = fileInfo.name(i);
+
+            if (normalizeFileNameGuid(fileInfo.names() + off, name.length()))
+                ++guids;
+        }
+    }
+
+    return guids;
+}
+
+void patchSymbolRecordsStream(MsfMemoryStream* stream, size_t threads) {
+    patchSymbolRecords(stream->data(), stream->length(), threads);
+}
+
+void patchPublicSymbolStream(MsfOverlayStream* stream) {
+    // The public symbol info stream starts with the public symbol header
+    // followed by the (Global Symbol Info) GSI hash header. We only care about
+    // the public symbol header.
+    PublicSymbolHeader header;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("public symbol stream too short");
+
+    // Struct alignment padding
+    header.padding1 = 0;
+
+    // Microsoft's PDB writer has a bug where this field is not initialized in
+    // the constructor. However, there are other code paths that do initialize
+    // this value, but only sometimes. Thus, since Microsoft's tools are already
+    // broken because of this, we zero this out without worrying about it.
+    //
+    // Since fixing this would be a trivial one-liner for Microsoft, this patch
+    // could become silently obsolete in the future.
+    header.sectionCount = 0;
+
+    stream->setPos(0);
+    stream->write(sizeof(header), &header);
+}
+
+std::vector<size_t> directoryStreams(MsfFile& msf) {
+    std::vector<size_t> streams;
+
+    // The header stream has the table of named streams.
+    std::vector<uint8_t> data;
+    NameMapView table;
+
+    if (auto stream = msf.getStream((size_t)PdbStreamType::header)) {
+        streams.push_back((size_t)PdbStreamType::header);
+
+        data.resize(stream->length());
+
+        stream->setPos(0);
+        if (stream->read(data.size(), data.data()) == data.size() &&
+            data.size() >= sizeof(PdbStream70)) {
+            table = NameMapView(data.data() + sizeof(PdbStream70),
+                                data.data() + data.size());
+        }
+        stream->setPos(0);
+    }
+
+    // The DBI header has the symbol hash streams.
+    DbiHeader dbi;
+    bool hasDbi = false;
+
+    if (auto stream = msf.getStream((size_t)PdbStreamType::dbi)) {
+        streams.push_back((size_t)PdbStreamType::dbi);
+
+        stream->setPos(0);
+        hasDbi = stream->read(sizeof(dbi), &dbi) == sizeof(dbi);
+        stream->setPos(0);
+    }
+
+    const auto it = table.find("/names");
+    if (it != table.end()) streams.push_back(it->stream);
+
+    if (hasDbi) {
+        streams.push_back(dbi.globalSymbolStream);
+        streams.push_back(dbi.publicSymbolStream);
+    }
+
+    return streams;
+}
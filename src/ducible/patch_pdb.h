@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <vector>
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/view.h"
+#include "pe/format.h"
+
+class MsfFile;
+class MsfMemoryStream;
+class MsfOverlayStream;
+class MsfStream;
+
+/**
+ * The functions for patching each of the streams of a PDB. patchImage() uses
+ * these to patch the PDB, but they can also be used on their own. For example,
+ * to measure how long each of them takes.
+ *
+ * Throws: InvalidPdb if the stream is invalid.
+ */
+
+// Length of a GUID of the form "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}".
+const size_t kGuidLength = 38;
+
+/**
+ * Finds the first GUID in a file name. Returns `length` if there is none.
+ *
+ * File names of temporary files often contain GUIDs. They are normalized by
+ * replacing the first GUID with nullFileNameGuid().
+ */
+size_t findFileNameGuid(const char* name, size_t length);
+
+/**
+ * Returns the null-terminated null GUID that GUIDs in file names are replaced
+ * with. It is kGuidLength characters long.
+ */
+const char* nullFileNameGuid();
+
+/**
+ * Compares the PE and PDB signatures to see if they match.
+ */
+bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
+                        const PdbStream70& pdbHeader);
+
+/**
+ * Patches the "/LinkInfo" named stream.
+ */
+void patchLinkInfoStream(MsfOverlayStream* stream);
+
+/**
+ * Patches the "/names" stream. Returns the number of GUIDs that were
+ * normalized.
+ */
+size_t patchNamesStream(MsfMemoryStream* stream);
+
+/**
+ * Patches the PDB header stream. Returns the table of named streams, which
+ * points into the stream's data.
+ *
+ * Unless `force` is true, the signature in the header must match `pdbInfo`.
+ * If `signature` is null, the new signature must be set later with
+ * setPdbSignature().
+ */
+NameMapView patchHeaderStream(MsfMemoryStream* stream,
+                              const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+                              const uint8_t signature[16], bool force);
+
+/**
+ * Sets the signature in a PDB header stream that has already been patched.
+ */
+void setPdbSignature(MsfStream* stream, const uint8_t signature[16]);
+
+/**
+ * Patches a module stream. Returns the number of GUIDs that were normalized.
+ */
+size_t patchModuleStream(MsfOverlayStream* stream);
+
+/**
+ * Patches the DBI stream. The module streams that need patching are appended to
+ * `moduleStreams`. Returns the number of GUIDs that were normalized.
+ */
+size_t patchDbiStream(MsfMemoryStream* stream,
+                      std::vector<size_t>& moduleStreams, std::ostream& log);
+
+/**
+ * Patches the symbol record stream using up to `threads` threads. 0 means to use
+ * the number of hardware threads.
+ */
+void patchSymbolRecordsStream(MsfMemoryStream* stream, size_t threads = 1);
+
+/**
+ * Patch the public symbol info stream.
+ */
+void patchPublicSymbolStream(MsfOverlayStream* stream);
+
+/**
+ * Returns the streams that a debugger reads first when it loads the PDB. These
+ * are the header, the DBI, "/names", and the global and public symbol hash
+ * streams, in that order. Streams that don't exist are left out.
+ */
+std::vector<size_t> directoryStreams(MsfFile& msf);
@@ -30,6 +30,6 @@ void Patches::add(Patch patch) { patches.push_back(patch); }
 
 void Patches::sort() { std::sort(patches.begin(), patches.end()); }
 
-void Patches::apply(bool dryRun) {
-    for (auto&& patch : patches) patch.apply(_buf, dryRun);
+void Patches::apply(bool dryRun, std::ostream& log) {
+    for (auto&& patch : patches) patch.apply(_buf, dryRun, log);
 }
@@ -22,6 +22,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <iostream>
 #include <vector>
 
 #include "ducible/patch.h"
@@ -58,7 +59,8 @@ class Patches {
     void sort();
 
     /**
-     * Applies the patches.
+     * Applies the patches. Each patch that changes something is printed to
+     * `log`.
      */
-    void apply(bool dryRun = false);
+    void apply(bool dryRun = false, std::ostream& log = std::cout);
 };
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/server.h"
+
+#include <stdint.h>
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+
+#include "util/ipc.h"
+#include "util/thread_pool.h"
+
+#include "version.h"
+
+/**
+ * The protocol is a sequence of messages over a stream. Integers are sent in
+ * native byte order since both ends are on the same machine. The client sends
+ * the version of ducible, the current directory, and the arguments. The server
+ * replies with any number of output messages followed by the exit code, or
+ * with a rejection if the version does not match.
+ */
+
+namespace {
+
+enum class Reply : uint8_t {
+    // Output for stdout.
+    out = 'o',
+
+    // Output for stderr.
+    err = 'e',
+
+    // The exit code. This is the last reply.
+    exit = 'x',
+
+    // The server can't handle the request. The client must handle it instead.
+    reject = 'r',
+};
+
+// Sent at the start of every request. A client and a server of different
+// versions could disagree on how to patch a file, so they must match exactly.
+const char kProtocolVersion[] = "ducible " DUCIBLE_VERSION;
+
+// Requests larger than this are assumed to be garbage.
+const uint32_t kMaxStringLength = 1 << 20;
+
+// How long the server waits for more of a request before giving up on the
+// client, in milliseconds. A client that stalls would otherwise hold on to a
+// worker thread forever.
+const unsigned kReadTimeout = 10000;
+
+bool writeUint32(IpcConnection& c, uint32_t n) {
+    return c.write(&n, sizeof(n));
+}
+
+bool readUint32(IpcConnection& c, uint32_t& n) {
+    return c.read(&n, sizeof(n));
+}
+
+bool writeString(IpcConnection& c, const std::string& s) {
+    return writeUint32(c, (uint32_t)s.length()) &&
+           c.write(s.data(), s.length());
+}
+
+bool readString(IpcConnection& c, std::string& s) {
+    uint32_t length;
+    if (!readUint32(c, length) || length > kMaxStringLength) return false;
+
+    s.resize(length);
+    return length == 0 || c.read(&s[0], length);
+}
+
+bool writeReply(IpcConnection& c, Reply reply, const std::string& s) {
+    return c.write(&reply, sizeof(reply)) && writeString(c, s);
+}
+
+bool readRequest(IpcConnection& c, ServerRequest& request) {
+    uint32_t count;
+
+    if (!readString(c, request.cwd) || !readUint32(c, count) ||
+        count > kMaxStringLength) {
+        return false;
+    }
+
+    request.args.resize(count);
+
+    for (auto& arg : request.args) {
+        if (!readString(c, arg)) return false;
+    }
+
+    return true;
+}
+
+bool writeRequest(IpcConnection& c, const ServerRequest& request) {
+    if (!writeString(c, kProtocolVersion) || !writeString(c, request.cwd) ||
+        !writeUint32(c, (uint32_t)request.args.size())) {
+        return false;
+    }
+
+    for (auto& arg : request.args) {
+        if (!writeString(c, arg)) return false;
+    }
+
+    return true;
+}
+
+void handleConnection(IpcConnection& c, const RequestHandler& handler) {
+    c.setReadTimeout(kReadTimeout);
+
+    std::string version;
+    if (!readString(c, version)) return;
+
+    if (version != kProtocolVersion) {
+        writeReply(c, Reply::reject, "version mismatch");
+        return;
+    }
+
+    ServerRequest request;
+    if (!readRequest(c, request)) return;
+
+    std::ostringstream out, err;
+
+    // This runs on a worker thread of the pool, where an exception would
+    // terminate the server along with the requests of every other client.
+    int exitCode;
+    try {
+        exitCode = handler(request, out, err);
+    } catch (const std::exception& error) {
+        err << "Error: " << error.what() << "\n";
+        exitCode = 1;
+    }
+
+    // If the client went away, there is nobody to tell.
+    if (!writeReply(c, Reply::out, out.str())) return;
+    if (!writeReply(c, Reply::err, err.str())) return;
+    writeReply(c, Reply::exit, std::to_string(exitCode));
+}
+
+}  // namespace
+
+void runServer(const std::string& address, size_t threads,
+               RequestHandler handler, std::ostream& log) {
+    IpcListener listener(address);
+
+    ThreadPool pool(threads);
+
+    log << "Listening on '" << address << "' with " << pool.size()
+        << " worker threads." << std::endl;
+
+    while (true) {
+        std::shared_ptr<IpcConnection> connection(listener.accept());
+
+        pool.submit([connection, &handler]() {
+            handleConnection(*connection, handler);
+        });
+    }
+}
+
+bool forwardRequest(const std::string& address, const ServerRequest& request,
+                    int& exitCode) {
+    // If the request can't be sent in full, the server doesn't handle it.
+    auto c = connectIpc(address);
+    if (!c || !writeRequest(*c, request)) return false;
+
+    while (true) {
+        Reply reply;
+        std::string s;
+
+        if (!c->read(&reply, sizeof(reply)) || !readString(*c, s)) {
+            // The server may have gone away partway through patching the
+            // files, so they can't be patched again locally.
+            std::cerr << "Error: Lost connection to the ducible server\n";
+            exitCode = 1;
+            return true;
+        }
+
+        switch (reply) {
+            case Reply::out:
+                std::cout << s;
+                break;
+            case Reply::err:
+                std::cerr << s;
+                break;
+            case Reply::exit:
+                exitCode = atoi(s.c_str());
+                return true;
+            case Reply::reject:
+                return false;
+            default:
+                std::cerr << "Error: Got an invalid reply from the ducible "
+                             "server\n";
+                exitCode = 1;
+                return true;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * A request sent from a client to the server. Everything is UTF-8.
+ */
+struct ServerRequest {
+    // Current directory of the client. Relative paths are relative to this.
+    std::string cwd;
+
+    // Command line arguments, not including the program name.
+    std::vector<std::string> args;
+};
+
+/**
+ * Handles a single request. The output is written to `out` and `err`. Returns
+ * the exit code. This shouldn't throw. If it does, the server reports the
+ * exception as an error of that request.
+ */
+typedef std::function<int(const ServerRequest& request, std::ostream& out,
+                          std::ostream& err)>
+    RequestHandler;
+
+/**
+ * Listens for requests on the given address and handles them until the process
+ * is killed. Up to `threads` requests are handled concurrently by the same
+ * worker threads for the lifetime of the server. A client that stops sending
+ * its request partway through is disconnected after a few seconds.
+ *
+ * Throws: std::system_error if the address can't be listened on.
+ */
+void runServer(const std::string& address, size_t threads,
+               RequestHandler handler, std::ostream& log = std::cout);
+
+/**
+ * Sends the request to the server listening on the given address, then prints
+ * the output of the request to stdout and stderr.
+ *
+ * Returns false if no compatible server could be reached or the request could
+ * not be sent. In that case, the request was not handled and should be handled
+ * locally instead. Once the request has been sent, a lost connection is
+ * reported as an error, since the server may have been partway through it.
+ */
+bool forwardRequest(const std::string& address, const ServerRequest& request,
+                    int& exitCode);
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/stamp.h"
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include "util/file.h"
+
+#include "version.h"
+
+namespace {
+
+template <typename CharT>
+struct StampStrings {
+    static const CharT extension[];
+};
+
+template <>
+const char StampStrings<char>::extension[] = ".ducible";
+template <>
+const wchar_t StampStrings<wchar_t>::extension[] = L".ducible";
+
+template <typename CharT>
+std::basic_string<CharT> getStampPath(const CharT* imagePath) {
+    std::basic_string<CharT> path(imagePath);
+    path.append(StampStrings<CharT>::extension);
+    return path;
+}
+
+std::ostream& operator<<(std::ostream& os, const FileId& id) {
+    return os << id.device << " " << id.index << " " << id.size << " "
+              << id.modified;
+}
+
+/**
+ * Gets what the contents of the stamp should be given the current state of the
+ * files. Returns false if any of the files are missing.
+ *
+ * The version of ducible is included so that upgrading it invalidates all of
+ * the stamps. Likewise for the hash, since it changes the PDB signature, and
+ * the layout, since it changes the PDB.
+ */
+template <typename CharT>
+bool getStampContents(const CharT* imagePath, const CharT* pdbPath,
+                      const PatchOptions& opts, std::string& contents) {
+    FileId image, pdb;
+
+    if (!getFileId(imagePath, image)) return false;
+    if (pdbPath && !getFileId(pdbPath, pdb)) return false;
+
+    std::ostringstream os;
+    os << "ducible " << DUCIBLE_VERSION << "\n";
+    os << "hash " << (int)opts.hash << "\n";
+    os << "layout " << (int)opts.layout << "\n";
+    os << "image " << image << "\n";
+
+    if (pdbPath)
+        os << "pdb " << pdb << "\n";
+    else
+        os << "pdb none\n";
+
+    contents = os.str();
+    return true;
+}
+
+template <typename CharT>
+bool checkStampImpl(const CharT* imagePath, const CharT* pdbPath,
+                    const PatchOptions& opts) {
+    std::string expected;
+    if (!getStampContents(imagePath, pdbPath, opts, expected)) return false;
+
+    const auto path = getStampPath(imagePath);
+
+    // Don't bother opening the stamp if it can't possibly match.
+    FileId id;
+    if (!getFileId(path.c_str(), id) || id.size != expected.length())
+        return false;
+
+    try {
+        auto f = openFile(path.c_str(), FileMode<CharT>::readExisting);
+
+        std::string actual(expected.length(), '\0');
+        if (fread(&actual[0], 1, actual.length(), f.get()) != actual.length())
+            return false;
+
+        return actual == expected;
+    } catch (const std::system_error&) {
+        return false;
+    }
+}
+
+template <typename CharT>
+void writeStampImpl(const CharT* imagePath, const CharT* pdbPath,
+                    const PatchOptions& opts) {
+    std::string contents;
+    if (!getStampContents(imagePath, pdbPath, opts, contents)) return;
+
+    const auto path = getStampPath(imagePath);
+
+    auto f = openFile(path.c_str(), FileMode<CharT>::writeEmpty);
+
+    if (fwrite(contents.data(), 1, contents.length(), f.get()) !=
+            contents.length() ||
+        fflush(f.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to write stamp file");
+    }
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+bool checkStamp(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& opts) {
+    return checkStampImpl(imagePath, pdbPath, opts);
+}
+
+void writeStamp(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& opts) {
+    writeStampImpl(imagePath, pdbPath, opts);
+}
+
+#else
+
+bool checkStamp(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts) {
+    return checkStampImpl(imagePath, pdbPath, opts);
+}
+
+void writeStamp(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts) {
+    writeStampImpl(imagePath, pdbPath, opts);
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "ducible/patch_image.h"
+
+/**
+ * Stamp files remember that an image and its PDB have already been normalized.
+ *
+ * The stamp is stored next to the image with a ".ducible" extension. It records
+ * the identity, size, and modification time of both files right after they were
+ * patched. If neither file has changed since then, they can be skipped without
+ * even being opened.
+ */
+
+#if defined(_WIN32) && defined(UNICODE)
+
+/**
+ * Returns true if the stamp for the image matches the current state of the
+ * image and PDB. `pdbPath` may be null if there is no PDB. The stamp also has
+ * to have been written with the same options that affect the output.
+ */
+bool checkStamp(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& opts);
+
+/**
+ * Writes the stamp for the image based on the current state of the image and
+ * PDB.
+ *
+ * Throws: std::system_error if the stamp could not be written.
+ */
+void writeStamp(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& opts);
+
+#else
+
+bool checkStamp(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts);
+
+void writeStamp(const char* imagePath, const char* pdbPath,
+                const PatchOptions& opts);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/strip_pdb.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/view.h"
+
+namespace {
+
+// Number of bytes of the symbol record stream that are read at a time.
+const size_t kWindowSize = 1024 * 1024;
+
+// Number of buckets in a GSI hash table. The buckets that are used are marked
+// in a bitmap that has one extra bit.
+const size_t kGsiBucketCount = 4096;
+const size_t kGsiBitmapSize  = (kGsiBucketCount + 32) / 32 * sizeof(uint32_t);
+
+/**
+ * Reads the whole stream into memory.
+ */
+std::vector<uint8_t> readStream(MsfStream* stream) {
+    std::vector<uint8_t> data(stream->length());
+
+    stream->setPos(0);
+    if (stream->read(data.size(), data.data()) != data.size())
+        throw InvalidPdb("failed to read stream");
+
+    return data;
+}
+
+MsfStreamRef memoryStream(const std::vector<uint8_t>& data) {
+    return std::make_shared<MsfMemoryStream>(data.size(), data.data());
+}
+
+/**
+ * Returns a copy of a TPI or IPI stream with the same header, but no type
+ * records or hashes.
+ */
+MsfStreamRef emptyTypeStream(MsfStream* stream) {
+    TpiStreamHeader header;
+
+    stream->setPos(0);
+    if (stream->read(sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("type stream too short");
+
+    header.headerSize        = sizeof(header);
+    header.typeIndexEnd      = header.typeIndexBegin;
+    header.typeRecordBytes   = 0;
+    header.hashStream        = invalidStream;
+    header.hashAuxStream     = invalidStream;
+    header.hashValueOffset   = 0;
+    header.hashValueSize     = 0;
+    header.indexOffsetOffset = 0;
+    header.indexOffsetSize   = 0;
+    header.hashAdjOffset     = 0;
+    header.hashAdjSize       = 0;
+
+    return std::make_shared<MsfMemoryStream>(sizeof(header), &header);
+}
+
+/**
+ * Returns a global symbol stream with an empty hash table.
+ */
+MsfStreamRef emptyGlobalsStream() {
+    std::vector<uint8_t> data(sizeof(GsiHashHeader) + kGsiBitmapSize);
+
+    const GsiHashHeader header = {gsiHashSignature, gsiHashVersion, 0,
+                                  (uint32_t)kGsiBitmapSize};
+    memcpy(data.data(), &header, sizeof(header));
+
+    return memoryStream(data);
+}
+
+/**
+ * Returns the file info substream of the DBI stream for modules without any
+ * files. The names buffer can't be empty, so it has a single empty string.
+ */
+std::vector<uint8_t> emptyFileInfo(size_t moduleCount) {
+    // The header is followed by the index of the first file of each module
+    // and the number of files in each.
+    const size_t length =
+        sizeof(FileInfoHeader) + moduleCount * 2 * sizeof(uint16_t) + 1;
+
+    std::vector<uint8_t> data((length + 3) & ~(size_t)3);
+
+    const FileInfoHeader header = {0, (uint16_t)moduleCount};
+    memcpy(data.data(), &header, sizeof(header));
+
+    return data;
+}
+
+/**
+ * Keeps only the symbol records that the public symbols refer to. The offsets
+ * of the records in the public symbol stream are changed to match.
+ */
+void stripSymbolRecords(MsfFile& msf, size_t publicsIndex,
+                        size_t recordsIndex) {
+    auto publicsStream = msf.getStream(publicsIndex);
+    auto recordsStream = msf.getStream(recordsIndex);
+
+    if (!publicsStream || !recordsStream) return;
+
+    std::vector<uint8_t> publics = readStream(publicsStream.get());
+
+    PublicSymbolHeader header;
+    GsiHashHeader hash;
+
+    if (publics.size() < sizeof(header) + sizeof(hash))
+        throw InvalidPdb("public symbol stream too short");
+
+    memcpy(&header, publics.data(), sizeof(header));
+    memcpy(&hash, publics.data() + sizeof(header), sizeof(hash));
+
+    if (header.hashTableSize < sizeof(hash) ||
+        (uint64_t)header.hashTableSize + header.addrMapSize >
+            publics.size() - sizeof(header) ||
+        hash.recordsSize > header.hashTableSize - sizeof(hash)) {
+        throw InvalidPdb("public symbol stream too short");
+    }
+
+    if (hash.signature != gsiHashSignature)
+        throw InvalidPdb("invalid public symbol hash header");
+
+    HashRecord* records =
+        (HashRecord*)(publics.data() + sizeof(header) + sizeof(hash));
+    const size_t recordCount = hash.recordsSize / sizeof(HashRecord);
+
+    uint32_t* addresses =
+        (uint32_t*)(publics.data() + sizeof(header) + header.hashTableSize);
+    const size_t addressCount = header.addrMapSize / sizeof(uint32_t);
+
+    // The offsets of the records that are referred to. The offsets in the
+    // hash records are one more than the offset of the symbol record.
+    std::vector<uint32_t> offsets;
+    offsets.reserve(recordCount + addressCount);
+
+    for (size_t i = 0; i < recordCount; ++i) {
+        if (records[i].offset <= 0)
+            throw InvalidPdb("invalid public symbol hash record");
+
+        offsets.push_back((uint32_t)records[i].offset - 1);
+    }
+
+    offsets.insert(offsets.end(), addresses, addresses + addressCount);
+
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+    // Copy the records that are referred to, reading the stream through a
+    // window so that it doesn't all have to be in memory at once.
+    std::vector<uint8_t> kept;
+    std::vector<uint32_t> newOffsets(offsets.size());
+    size_t found = 0;
+
+    std::vector<uint8_t> window;
+    size_t windowStart = 0;
+
+    const size_t length = recordsStream->length();
+
+    recordsStream->setPos(0);
+
+    while (windowStart + window.size() < length) {
+        const size_t oldSize = window.size();
+        const size_t n =
+            std::min(kWindowSize, length - windowStart - oldSize);
+
+        window.resize(oldSize + n);
+
+        if (recordsStream->read(n, window.data() + oldSize) != n)
+            throw InvalidPdb("failed to read symbol records");
+
+        const bool final = windowStart + window.size() == length;
+
+        SymbolRecordReader reader(window.data(), window.size(), final);
+
+        while (const SymbolRecord* rec = reader.next()) {
+            const size_t offset =
+                windowStart + ((const uint8_t*)rec - window.data());
+
+            auto it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+            if (it == offsets.end() || *it != offset) continue;
+
+            newOffsets[it - offsets.begin()] = (uint32_t)kept.size();
+            ++found;
+
+            const uint8_t* p = (const uint8_t*)rec;
+            kept.insert(kept.end(), p, p + sizeof(rec->length) + rec->length);
+        }
+
+        // Keep the start of a record that continues past the window.
+        window.erase(window.begin(), window.begin() + reader.offset());
+        windowStart += reader.offset();
+    }
+
+    if (found != offsets.size())
+        throw InvalidPdb("public symbol refers to an invalid symbol record");
+
+    auto newOffset = [&](uint32_t offset) {
+        return newOffsets[std::lower_bound(offsets.begin(), offsets.end(),
+                                           offset) -
+                          offsets.begin()];
+    };
+
+    for (size_t i = 0; i < recordCount; ++i) {
+        records[i].offset =
+            (int32_t)newOffset((uint32_t)records[i].offset - 1) + 1;
+    }
+
+    for (size_t i = 0; i < addressCount; ++i)
+        addresses[i] = newOffset(addresses[i]);
+
+    msf.replaceStream(publicsIndex, memoryStream(publics));
+    msf.replaceStream(recordsIndex, memoryStream(kept));
+}
+
+}  // namespace
+
+void stripPDB(MsfFile& msf) {
+    std::vector<bool> keep(msf.streamCount(), false);
+
+    auto keepStream = [&](size_t index) {
+        if (index < keep.size()) keep[index] = true;
+    };
+
+    keepStream((size_t)PdbStreamType::header);
+    keepStream((size_t)PdbStreamType::tbi);
+    keepStream((size_t)PdbStreamType::dbi);
+    keepStream((size_t)PdbStreamType::ipi);
+
+    // Only the string table and the link info of the named streams are kept.
+    if (auto stream = msf.getStream((size_t)PdbStreamType::header)) {
+        const std::vector<uint8_t> data = readStream(stream.get());
+
+        if (data.size() < sizeof(PdbStream70))
+            throw InvalidPdb("missing PDB 7.0 header");
+
+        const NameMapView names(data.data() + sizeof(PdbStream70),
+                                data.data() + data.size());
+
+        for (const char* name : {"/names", "/LinkInfo"}) {
+            const auto it = names.find(name);
+            if (it != names.end()) keepStream(it->stream);
+        }
+    }
+
+    auto dbiStream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!dbiStream) throw InvalidPdb("missing DBI stream");
+
+    std::vector<uint8_t> dbiData = readStream(dbiStream.get());
+
+    const DbiView view(dbiData.data(), dbiData.size());
+
+    DbiHeader& dbi = view.header();
+
+    if (dbi.signature != dbiHeaderSignature)
+        throw InvalidPdb("invalid DBI header signature");
+
+    keepStream(dbi.globalSymbolStream);
+    keepStream(dbi.publicSymbolStream);
+    keepStream(dbi.symbolRecordsStream);
+
+    if (dbi.debugHeaderSize > 0) {
+        const int16_t* debugStreams = view.debugStreams();
+
+        for (size_t i = 0; i < dbi.debugHeaderSize / sizeof(int16_t); ++i) {
+            if (debugStreams[i] >= 0) keepStream((size_t)debugStreams[i]);
+        }
+    }
+
+    // The modules are still listed, but without their streams or files.
+    size_t moduleCount = 0;
+
+    for (const ModuleEntry& module : view.moduleInfo()) {
+        ModuleInfo* info = module.info;
+
+        info->stream       = invalidStream;
+        info->symbolsSize  = 0;
+        info->linesSize    = 0;
+        info->c13LinesSize = 0;
+        info->fileCount    = 0;
+
+        ++moduleCount;
+    }
+
+    const uint64_t fileInfoOffset = sizeof(DbiHeader) +
+                                    (uint64_t)dbi.gpModInfoSize +
+                                    dbi.sectionContributionSize +
+                                    dbi.sectionMapSize;
+
+    if (fileInfoOffset + dbi.fileInfoSize > dbiData.size())
+        throw InvalidPdb("DBI file info size exceeds stream length");
+
+    const std::vector<uint8_t> fileInfo = emptyFileInfo(moduleCount);
+
+    const auto fileInfoBegin = dbiData.begin() + (size_t)fileInfoOffset;
+    const auto fileInfoEnd   = fileInfoBegin + dbi.fileInfoSize;
+
+    dbi.fileInfoSize   = (uint32_t)fileInfo.size();
+    dbi.flags.stripped = 1;
+
+    std::vector<uint8_t> stripped(dbiData.begin(), fileInfoBegin);
+    stripped.insert(stripped.end(), fileInfo.begin(), fileInfo.end());
+    stripped.insert(stripped.end(), fileInfoEnd, dbiData.end());
+
+    for (size_t i = 0; i < keep.size(); ++i) {
+        if (!keep[i]) msf.replaceStream(i, nullptr);
+    }
+
+    for (auto type : {PdbStreamType::tbi, PdbStreamType::ipi}) {
+        if (auto stream = msf.getStream((size_t)type))
+            msf.replaceStream((size_t)type, emptyTypeStream(stream.get()));
+    }
+
+    msf.replaceStream((size_t)PdbStreamType::dbi, memoryStream(stripped));
+
+    if (dbi.globalSymbolStream < keep.size())
+        msf.replaceStream(dbi.globalSymbolStream, emptyGlobalsStream());
+
+    if (dbi.publicSymbolStream < keep.size() &&
+        dbi.symbolRecordsStream < keep.size()) {
+        stripSymbolRecords(msf, dbi.publicSymbolStream,
+                           dbi.symbolRecordsStream);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+class MsfFile;
+
+/**
+ * Strips the private symbols from a PDB that has already been patched, in the
+ * same way as linking with /PDBSTRIPPED. What is left is enough to walk the
+ * stack and to find the names of functions:
+ *
+ *  - the PDB header stream, "/names", and "/LinkInfo",
+ *  - the DBI stream, without the file info, and with each module's stream
+ *    removed,
+ *  - the section headers, FPO data, and the rest of the DBI debug streams,
+ *  - the public symbols and the symbol records they refer to.
+ *
+ * The type records, the global symbols, the module streams, and any other
+ * streams are removed. The indices of the streams that are kept are the same,
+ * so the stripped PDB still matches the image. The streams are replaced in
+ * `msf`, which can then be written out as usual.
+ *
+ * Throws: InvalidPdb if the PDB is invalid.
+ */
+void stripPDB(MsfFile& msf);
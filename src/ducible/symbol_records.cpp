@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/symbol_records.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/view.h"
+
+#include "util/thread_pool.h"
+
+namespace {
+
+// Buffers smaller than this are patched serially. Splitting them isn't worth
+// starting threads for.
+const size_t kMinParallelSymbolRecords = 4 * 1024 * 1024;
+
+// Minimum size of each piece a buffer is split into.
+const size_t kMinSymbolRecordsPiece = 1024 * 1024;
+
+/**
+ * Finds record boundaries that split the buffer into pieces of at least
+ * `pieceSize` bytes. The returned offsets start with 0 and end with `length`.
+ *
+ * Only records that SymbolRecordReader would accept are skipped over. If an
+ * invalid record is found, the rest of the buffer becomes the last piece so
+ * that patching it throws the same error as patching serially.
+ */
+std::vector<size_t> findSymbolRecordSplits(const uint8_t* data, size_t length,
+                                           size_t pieceSize) {
+    std::vector<size_t> splits(1, 0);
+
+    size_t next = pieceSize;
+
+    for (size_t pos = 0; length - pos >= sizeof(SymbolRecord);) {
+        uint16_t recordLength;
+        memcpy(&recordLength, data + pos, sizeof(recordLength));
+
+        const size_t size = sizeof(recordLength) + recordLength;
+
+        if (recordLength < sizeof(SymbolRecord::type) || size % 4 != 0 ||
+            size > length - pos) {
+            break;
+        }
+
+        pos += size;
+
+        if (pos >= next && pos < length) {
+            splits.push_back(pos);
+            next = pos + pieceSize;
+        }
+    }
+
+    splits.push_back(length);
+
+    return splits;
+}
+
+}  // namespace
+
+size_t patchSymbolRecords(uint8_t* data, size_t length, bool final) {
+    SymbolRecordReader reader(data, length, final);
+
+    while (SymbolRecord* rec = reader.next()) {
+        const size_t dataLength = rec->length - sizeof(rec->type);
+
+        // There is a maximum of 3 bytes of padding at the end of the data.
+        // Note that if the data length is < 3 and this overflows,
+        size_t tail = dataLength - 3;
+
+        // Find the null terminator at the end. The padding (if any) will be
+        // after this point.
+        while (tail + 1 < dataLength && rec->data[tail] != 0) ++tail;
+
+        // Zero out the padding.
+        while (tail < dataLength) rec->data[tail++] = 0;
+    }
+
+    return reader.offset();
+}
+
+void patchSymbolRecords(uint8_t* data, size_t length, size_t threads) {
+    if (threads == 0) threads = defaultThreadCount();
+
+    if (threads <= 1 || length < kMinParallelSymbolRecords) {
+        patchSymbolRecords(data, length, true);
+        return;
+    }
+
+    // A few pieces per thread keeps the threads busy if the records in some
+    // pieces take longer than others.
+    const size_t pieceSize =
+        std::max(length / (threads * 4), kMinSymbolRecordsPiece);
+
+    const auto splits = findSymbolRecordSplits(data, length, pieceSize);
+
+    parallelFor(splits.size() - 1, threads, [&](size_t i) {
+        patchSymbolRecords(data + splits[i], splits[i + 1] - splits[i], true);
+    });
+}
+
+SymbolRecordStream::SymbolRecordStream(MsfStreamRef stream, size_t windowSize)
+    : _stream(stream),
+      _windowSize(windowSize),
+      _pos(0),
+      _windowStart(0),
+      _patched(0) {}
+
+void SymbolRecordStream::validate() {
+    reset();
+
+    while (_windowStart + _patched < length()) {
+        _pos = _windowStart + _patched;
+        advance();
+    }
+
+    reset();
+    _pos = 0;
+}
+
+size_t SymbolRecordStream::length() const { return _stream->length(); }
+
+size_t SymbolRecordStream::getPos() const { return _pos; }
+
+void SymbolRecordStream::setPos(size_t pos) { _pos = pos; }
+
+void SymbolRecordStream::reset() {
+    _window.clear();
+    _windowStart = 0;
+    _patched     = 0;
+}
+
+void SymbolRecordStream::advance() {
+    // Discard everything before the current position that has been patched.
+    const size_t discard =
+        std::min(_pos, _windowStart + _patched) - _windowStart;
+
+    _window.erase(_window.begin(), _window.begin() + discard);
+    _windowStart += discard;
+    _patched -= discard;
+
+    // Read the next part of the stream.
+    const size_t start  = _windowStart + _window.size();
+    const size_t length = std::min(_windowSize, this->length() - start);
+
+    const size_t oldSize = _window.size();
+    _window.resize(oldSize + length);
+
+    _stream->setPos(start);
+    if (_stream->read(length, _window.data() + oldSize) != length)
+        throw InvalidPdb("failed to read symbol records");
+
+    const bool final = start + length == this->length();
+
+    _patched += patchSymbolRecords(_window.data() + _patched,
+                                   _window.size() - _patched, final);
+}
+
+size_t SymbolRecordStream::read(size_t length, void* buf) {
+    if (_pos >= this->length()) return 0;
+
+    length = std::min(length, this->length() - _pos);
+
+    if (_pos < _windowStart) reset();
+
+    while (_windowStart + _patched < _pos + length) advance();
+
+    memcpy(buf, _window.data() + (_pos - _windowStart), length);
+    _pos += length;
+
+    return length;
+}
+
+size_t SymbolRecordStream::read(void* buf) {
+    if (_pos >= length()) return 0;
+    return read(length() - _pos, buf);
+}
+
+size_t SymbolRecordStream::write(size_t length, const void* buf) {
+    (void)length;
+    (void)buf;
+    return 0;
+}
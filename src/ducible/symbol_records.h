@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "msf/msf.h"
+#include "msf/stream.h"
+
+/**
+ * Zeroes out the padding at the end of each complete symbol record in the
+ * given buffer.
+ *
+ * There is up to 3 bytes of padding at the end of each symbol record. Since
+ * garbage just lives there, it needs to be zeroed out.
+ *
+ * Params:
+ *   data   = The symbol records. This must start at the beginning of a record.
+ *   length = The length of the buffer.
+ *   final  = True if the buffer ends at the end of the stream. If false, the
+ *            buffer may end in the middle of a record.
+ *
+ * Returns: The length of the complete records that were patched. If `final` is
+ * false, the rest of the buffer is the start of a record that continues past
+ * the end of the buffer.
+ *
+ * Throws: InvalidPdb if a symbol record is invalid.
+ */
+size_t patchSymbolRecords(uint8_t* data, size_t length, bool final);
+
+/**
+ * Same as patchSymbolRecords() on a buffer that ends at the end of the stream,
+ * but uses up to `threads` threads for large buffers.
+ *
+ * A sequential pass that only reads the length of each record finds record
+ * boundaries that split the buffer into pieces of about the same size. The
+ * pieces are then patched concurrently. The result is the same as patching the
+ * buffer serially.
+ *
+ * Throws: InvalidPdb if a symbol record is invalid.
+ */
+void patchSymbolRecords(uint8_t* data, size_t length, size_t threads);
+
+/**
+ * A symbol record stream that is patched as it is read.
+ *
+ * Instead of copying the whole stream into memory first, the original stream is
+ * read through a sliding window and only the records inside of the window are
+ * patched. Thus, memory usage is proportional to the size of the window rather
+ * than the size of the stream. Records that span the end of the window are
+ * kept until the rest of the record has been read.
+ *
+ * Reads are expected to be sequential. Seeking backwards restarts patching from
+ * the beginning of the stream.
+ */
+class SymbolRecordStream : public MsfStream {
+   private:
+    MsfStreamRef _stream;
+    size_t _windowSize;
+    size_t _pos;
+
+    // Bytes [_windowStart, _windowStart + _window.size()) of the stream. Only
+    // the first _patched bytes are complete records that have been patched.
+    std::vector<uint8_t> _window;
+    size_t _windowStart;
+    size_t _patched;
+
+   public:
+    /**
+     * Params:
+     *   stream     = The original symbol record stream.
+     *   windowSize = Number of bytes to read from the original stream at a
+     *                time.
+     */
+    explicit SymbolRecordStream(MsfStreamRef stream,
+                                size_t windowSize = 1024 * 1024);
+
+    /**
+     * Reads through the whole stream to check that all of the symbol records
+     * are valid. Once this succeeds, reading from the stream can't fail due to
+     * a bad symbol record.
+     *
+     * Throws: InvalidPdb if a symbol record is invalid.
+     */
+    void validate();
+
+    size_t length() const;
+
+    size_t getPos() const;
+
+    void setPos(size_t p);
+
+    size_t read(size_t length, void* buf);
+
+    size_t read(void* buf);
+
+    /**
+     * Writing is not supported. Always returns 0.
+     */
+    size_t write(size_t length, const void* buf);
+
+   private:
+    /**
+     * Starts over from the beginning of the stream.
+     */
+    void reset();
+
+    /**
+     * Discards the part of the window before the current position and reads
+     * and patches the next part of the stream.
+     */
+    void advance();
+};
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/symbol_store.h"
+
+#include <stdio.h>
+
+namespace {
+
+template <typename CharT>
+bool isPathSeparator(CharT c) {
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+template <typename CharT>
+std::basic_string<CharT> getStorePathImpl(const CharT* store,
+                                          const CharT* path,
+                                          const std::string& key) {
+    std::basic_string<CharT> name(path);
+
+    size_t start = name.length();
+    while (start > 0 && !isPathSeparator(name[start - 1])) --start;
+    name.erase(0, start);
+
+    std::basic_string<CharT> result(store);
+    if (!result.empty() && !isPathSeparator(result.back())) result += '/';
+
+    result += name;
+    result += '/';
+    result.append(key.begin(), key.end());
+    result += '/';
+    result += name;
+
+    return result;
+}
+
+template <typename CharT>
+void createStoreDirectoryImpl(const std::basic_string<CharT>& storePath) {
+    size_t end = storePath.length();
+    while (end > 0 && !isPathSeparator(storePath[end - 1])) --end;
+
+    createDirectories(storePath.substr(0, end).c_str());
+}
+
+}  // namespace
+
+std::string pdbStoreKey(const uint8_t signature[16], uint32_t age) {
+    // The signature is a GUID. The first three fields are little-endian.
+    const uint8_t* s = signature;
+
+    char key[48];
+    snprintf(key, sizeof(key),
+             "%02X%02X%02X%02X%02X%02X%02X%02X"
+             "%02X%02X%02X%02X%02X%02X%02X%02X%X",
+             s[3], s[2], s[1], s[0], s[5], s[4], s[7], s[6], s[8], s[9], s[10],
+             s[11], s[12], s[13], s[14], s[15], age);
+
+    return key;
+}
+
+std::string imageStoreKey(uint32_t timestamp, uint32_t sizeOfImage) {
+    char key[24];
+    snprintf(key, sizeof(key), "%08X%x", timestamp, sizeOfImage);
+    return key;
+}
+
+const char* fileLinkName(FileLink how) {
+    switch (how) {
+        case FileLink::reflink:
+            return "reflinked";
+        case FileLink::copy:
+            return "copied";
+    }
+
+    return "linked";
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+std::wstring getStorePath(const wchar_t* store, const wchar_t* path,
+                          const std::string& key) {
+    return getStorePathImpl(store, path, key);
+}
+
+void createStoreDirectory(const std::wstring& storePath) {
+    createStoreDirectoryImpl(storePath);
+}
+
+#else
+
+std::string getStorePath(const char* store, const char* path,
+                         const std::string& key) {
+    return getStorePathImpl(store, path, key);
+}
+
+void createStoreDirectory(const std::string& storePath) {
+    createStoreDirectoryImpl(storePath);
+}
+
+#endif
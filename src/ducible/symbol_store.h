@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "util/file.h"
+
+/**
+ * A symbol store is a directory tree in the layout used by symstore.exe and
+ * symbol servers. Each file is stored at "<name>/<key>/<name>", where the key
+ * identifies the version of the file. Debuggers find the PDB of an image from
+ * the key alone.
+ */
+
+/**
+ * Returns the key of a PDB. This is its GUID followed by its age.
+ */
+std::string pdbStoreKey(const uint8_t signature[16], uint32_t age);
+
+/**
+ * Returns the key of an image. This is its timestamp followed by its size in
+ * memory.
+ */
+std::string imageStoreKey(uint32_t timestamp, uint32_t sizeOfImage);
+
+#if defined(_WIN32) && defined(UNICODE)
+
+/**
+ * Returns the path of a file in the symbol store. Only the file name of `path`
+ * is used.
+ */
+std::wstring getStorePath(const wchar_t* store, const wchar_t* path,
+                          const std::string& key);
+
+/**
+ * Creates the directory of the given path in the symbol store.
+ *
+ * Throws: std::system_error if it could not be created.
+ */
+void createStoreDirectory(const std::wstring& storePath);
+
+#else
+
+std::string getStorePath(const char* store, const char* path,
+                         const std::string& key);
+
+void createStoreDirectory(const std::string& storePath);
+
+#endif
+
+/**
+ * Returns how a file was linked, for diagnostics.
+ */
+const char* fileLinkName(FileLink how);
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/arena.h"
+
+#include "util/memmap.h"
+
+namespace {
+
+// Size of the blocks that small buffers are carved out of.
+const size_t kBlockSize = 1024 * 1024;
+
+// Buffers larger than this get a block of their own so that the end of the
+// current block isn't wasted.
+const size_t kMaxSharedLength = kBlockSize / 4;
+
+// Alignment of every buffer.
+const size_t kAlignment = 16;
+
+}  // namespace
+
+MsfArena::MsfArena()
+    : _next(nullptr),
+      _available(0),
+      _reserved(0),
+      _spilledBytes(0),
+      _maxMemory(0) {}
+
+MsfArena::~MsfArena() {}
+
+void MsfArena::setMaxMemory(size_t maxMemory) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxMemory = maxMemory;
+}
+
+size_t MsfArena::maxMemory() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maxMemory;
+}
+
+uint8_t* MsfArena::_allocateBlock(size_t length) {
+    const size_t heapBytes = _reserved - _spilledBytes;
+
+    if (_maxMemory == 0 || heapBytes + length <= _maxMemory) {
+        _blocks.emplace_back(new uint8_t[length]);
+        _reserved += length;
+        return _blocks.back().get();
+    }
+
+    _spilled.emplace_back(new MemMap(length));
+    _reserved += length;
+    _spilledBytes += length;
+    return (uint8_t*)_spilled.back()->buf();
+}
+
+uint8_t* MsfArena::allocate(size_t length) {
+    length = (length + kAlignment - 1) & ~(kAlignment - 1);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (length > kMaxSharedLength) return _allocateBlock(length);
+
+    if (length > _available) {
+        _next      = _allocateBlock(kBlockSize);
+        _available = kBlockSize;
+    }
+
+    uint8_t* buf = _next;
+    _next += length;
+    _available -= length;
+
+    return buf;
+}
+
+size_t MsfArena::peakUsage() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _reserved;
+}
+
+size_t MsfArena::spilledBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _spilledBytes;
+}
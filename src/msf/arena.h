@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class MemMap;
+
+/**
+ * Hands out memory for copies of streams. Nothing is freed until the arena is
+ * destroyed, at which point everything is freed at once. Unlike a
+ * std::vector, the memory is not zero-initialized first.
+ *
+ * If a memory limit is set, blocks that would exceed it are mapped from
+ * temporary files instead of being allocated from the heap.
+ *
+ * This is safe to use from multiple threads at once.
+ */
+class MsfArena {
+   private:
+    mutable std::mutex _mutex;
+
+    std::vector<std::unique_ptr<uint8_t[]>> _blocks;
+    std::vector<std::unique_ptr<MemMap>> _spilled;
+
+    // Free space left in the current block.
+    uint8_t* _next;
+    size_t _available;
+
+    // Total size of all blocks, and how much of that is in temporary files.
+    size_t _reserved;
+    size_t _spilledBytes;
+
+    // Maximum size of the blocks allocated from the heap. 0 if there is no
+    // limit.
+    size_t _maxMemory;
+
+    // Allocates a new block of the given length. The mutex must be held.
+    uint8_t* _allocateBlock(size_t length);
+
+   public:
+    MsfArena();
+    ~MsfArena();
+
+    MsfArena(const MsfArena&) = delete;
+    MsfArena& operator=(const MsfArena&) = delete;
+
+    /**
+     * Limits how much memory is allocated from the heap. Blocks allocated
+     * after reaching the limit are backed by temporary files. 0 means there is
+     * no limit, which is the default.
+     */
+    void setMaxMemory(size_t maxMemory);
+    size_t maxMemory() const;
+
+    /**
+     * Allocates an uninitialized buffer of the given length. It stays valid
+     * for as long as the arena.
+     */
+    uint8_t* allocate(size_t length);
+
+    /**
+     * Returns the number of bytes allocated from the system so far. Since
+     * nothing is freed early, this is also the peak usage.
+     */
+    size_t peakUsage() const;
+
+    /**
+     * Returns the number of bytes, out of peakUsage(), that are backed by
+     * temporary files.
+     */
+    size_t spilledBytes() const;
+};
+
+typedef std::shared_ptr<MsfArena> MsfArenaRef;
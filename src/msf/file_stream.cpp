@@ -29,9 +29,20 @@
 
 MsfFileStream::MsfFileStream(FileRef f, size_t pageSize, size_t length,
                              const uint32_t* pages)
-    : _f(f), _pageSize(pageSize), _pos(0), _length(length) {
-    _pages.assign(pages, pages + ::pageCount(pageSize, length));
-}
+    : MsfFileStream(f, pageSize, length,
+                    std::make_shared<std::vector<uint32_t>>(
+                        pages, pages + ::pageCount(pageSize, length)),
+                    0) {}
+
+MsfFileStream::MsfFileStream(FileRef f, size_t pageSize, size_t length,
+                             MsfPageListRef pageList, size_t offset)
+    : _f(f),
+      _pageSize(pageSize),
+      _pos(0),
+      _length(length),
+      _pageList(pageList),
+      _pages(pageList->data() + offset),
+      _pageCount(::pageCount(pageSize, length)) {}
 
 size_t MsfFileStream::length() const { return _length; }
 
@@ -41,8 +52,10 @@ void MsfFileStream::setPos(size_t pos) { _pos = pos; }
 
 size_t MsfFileStream::readFromPage(size_t page, size_t length, void* buf,
                                    size_t offset) {
-    // Seek to the desired offset in the file.
-    if (fseek(_f.get(), (long)(_pageSize * page + offset), SEEK_SET) != 0) {
+    // Seek to the desired offset in the file. This can be beyond 2 GB.
+    const int64_t pos = (int64_t)_pageSize * page + offset;
+
+    if (seekFile(_f.get(), pos, SEEK_SET) != 0) {
         throw std::system_error(errno, std::system_category(),
                                 "Failed to seek to MSF page");
     }
@@ -52,16 +65,18 @@ size_t MsfFileStream::readFromPage(size_t page, size_t length, void* buf,
 
 size_t MsfFileStream::read(size_t length, void* buf) {
     size_t bytesRead = 0;
+    size_t pagesRead = 0;
 
     while (length > 0) {
         size_t i         = _pos / _pageSize;
         size_t offset    = _pos % _pageSize;
         size_t chunkSize = std::min(length, _pageSize - offset);
 
-        if (i >= _pages.size()) break;
+        if (i >= _pageCount) break;
 
         size_t chunkRead = readFromPage(_pages[i], chunkSize, buf, offset);
         bytesRead += chunkRead;
+        ++pagesRead;
 
         _pos += chunkRead;
 
@@ -71,6 +86,8 @@ size_t MsfFileStream::read(size_t length, void* buf) {
         buf = (uint8_t*)buf + chunkSize;
     }
 
+    if (_reads) _reads->add(bytesRead, pagesRead);
+
     return bytesRead;
 }
 
@@ -36,7 +36,14 @@ class MsfFileStream : public MsfStream {
     size_t _pageSize;
     size_t _pos;
     size_t _length;
-    std::vector<uint32_t> _pages;
+
+    // Keeps `_pages` alive.
+    MsfPageListRef _pageList;
+    const uint32_t* _pages;
+    size_t _pageCount;
+
+    // See countReads().
+    MsfReadCounterRef _reads;
 
    public:
     /**
@@ -50,6 +57,13 @@ class MsfFileStream : public MsfStream {
     MsfFileStream(FileRef f, size_t pageSize, size_t length,
                   const uint32_t* pages);
 
+    /**
+     * Initializes the stream with a range of a shared page list instead of a
+     * copy of its pages. The range starts at `offset`.
+     */
+    MsfFileStream(FileRef f, size_t pageSize, size_t length,
+                  MsfPageListRef pageList, size_t offset);
+
     /**
      * Returns the length of the stream, in bytes.
      */
@@ -95,9 +109,29 @@ class MsfFileStream : public MsfStream {
     size_t write(size_t length, const void* buf);
 
     /**
-     * Returns the pages in the stream. This is useful for diagnostic purposes.
+     * Returns the pages in the stream. There are pageCount() of them.
+     */
+    const uint32_t* pages() const { return _pages; }
+
+    /**
+     * Returns the number of pages in the stream.
+     */
+    size_t pageCount() const { return _pageCount; }
+
+    /**
+     * Returns the length of one page, in bytes.
+     */
+    size_t pageSize() const { return _pageSize; }
+
+    /**
+     * Adds every read from this stream to `reads` from now on.
+     */
+    void countReads(MsfReadCounterRef reads) { _reads = reads; }
+
+    /**
+     * Returns the file that the pages are read from.
      */
-    const std::vector<uint32_t>& pages() const { return _pages; }
+    FileRef file() const { return _f; }
 
    private:
     /**
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/mapped_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "msf/msf.h"
+
+MsfMappedStream::MsfMappedStream(MemMapRef map, size_t pageSize, size_t length,
+                                 const uint32_t* pages)
+    : MsfMappedStream(map, pageSize, length,
+                      std::make_shared<std::vector<uint32_t>>(
+                          pages, pages + ::pageCount(pageSize, length)),
+                      0) {
+    const size_t mappedPages = _map->length() / pageSize;
+
+    for (size_t i = 0; i < _pageCount; ++i) {
+        if (_pages[i] >= mappedPages)
+            throw InvalidMsf("invalid MSF page number");
+    }
+}
+
+MsfMappedStream::MsfMappedStream(MemMapRef map, size_t pageSize, size_t length,
+                                 MsfPageListRef pageList, size_t offset)
+    : _map(map),
+      _pageSize(pageSize),
+      _pos(0),
+      _length(length),
+      _pageList(pageList),
+      _pages(pageList->data() + offset),
+      _pageCount(::pageCount(pageSize, length)) {}
+
+size_t MsfMappedStream::length() const { return _length; }
+
+size_t MsfMappedStream::getPos() const { return _pos; }
+
+void MsfMappedStream::setPos(size_t pos) { _pos = pos; }
+
+size_t MsfMappedStream::read(size_t length, void* buf) {
+    // Like MsfFileStream, reads are bounded by the stream's pages rather than
+    // its length. This keeps the output of MsfFile::write() identical
+    // regardless of which stream implementation is used.
+    const size_t end = _pageCount * _pageSize;
+
+    if (_pos >= end) return 0;
+
+    length = std::min(length, end - _pos);
+
+    size_t bytesRead = 0;
+    size_t pagesRead = 0;
+
+    while (bytesRead < length) {
+        const size_t i      = _pos / _pageSize;
+        const size_t offset = _pos % _pageSize;
+        const size_t chunkSize =
+            std::min(length - bytesRead, _pageSize - offset);
+
+        memcpy((uint8_t*)buf + bytesRead, page(i) + offset, chunkSize);
+
+        bytesRead += chunkSize;
+        _pos += chunkSize;
+        ++pagesRead;
+    }
+
+    if (_reads) _reads->add(bytesRead, pagesRead);
+
+    return bytesRead;
+}
+
+size_t MsfMappedStream::read(void* buf) {
+    if (_pos >= _length) return 0;
+    return read(_length - _pos, buf);
+}
+
+size_t MsfMappedStream::write(size_t length, const void* buf) {
+    (void)length;
+    (void)buf;
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "msf/stream.h"
+#include "util/memmap.h"
+
+/**
+ * Represents an MSF stream whose pages are read from a memory mapped MSF file.
+ *
+ * Unlike MsfFileStream, reading from this stream does not require any system
+ * calls. The pages of the stream can also be accessed directly without copying
+ * them.
+ */
+class MsfMappedStream : public MsfStream {
+   private:
+    MemMapRef _map;
+    size_t _pageSize;
+    size_t _pos;
+    size_t _length;
+
+    // Keeps `_pages` alive.
+    MsfPageListRef _pageList;
+    const uint32_t* _pages;
+    size_t _pageCount;
+
+    // See countReads().
+    MsfReadCounterRef _reads;
+
+   public:
+    /**
+     * Params:
+     *   map      = The memory mapped MSF file. A reference to it is kept for
+     *              the lifetime of this stream.
+     *   pageSize = Length of one page, in bytes.
+     *   length   = Length of the stream, in bytes.
+     *   pages    = List of pages. The length of this array is calculated using
+     *              the page size and stream length.
+     *
+     * Throws: InvalidMsf if any of the pages are outside of the mapping.
+     */
+    MsfMappedStream(MemMapRef map, size_t pageSize, size_t length,
+                    const uint32_t* pages);
+
+    /**
+     * Initializes the stream with a range of a shared page list instead of a
+     * copy of its pages. The range starts at `offset`.
+     *
+     * The pages are not checked here. MsfFile already checks every page of
+     * the stream table when it reads it.
+     */
+    MsfMappedStream(MemMapRef map, size_t pageSize, size_t length,
+                    MsfPageListRef pageList, size_t offset);
+
+    /**
+     * Returns the length of the stream, in bytes.
+     */
+    size_t length() const;
+
+    /**
+     * Gets the current position, in bytes, in the stream.
+     */
+    size_t getPos() const;
+
+    /**
+     * Sets the current position, in bytes, in the stream.
+     */
+    void setPos(size_t p);
+
+    /**
+     * Reads a length of the stream. This abstracts reading from multiple pages.
+     *
+     * Params:
+     *   length = The number of bytes to read from the stream.
+     *   buf    = The buffer to read the stream into.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(size_t length, void* buf);
+
+    /**
+     * Reads the entire stream.
+     *
+     * Params:
+     *   buf = The buffer to read the stream into. This must be large enough to
+     *         hold the entire stream.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(void* buf);
+
+    /**
+     * Writing is not supported. Always returns 0.
+     */
+    size_t write(size_t length, const void* buf);
+
+    /**
+     * Returns the pages in the stream. There are pageCount() of them.
+     */
+    const uint32_t* pages() const { return _pages; }
+
+    /**
+     * Returns the number of pages in the stream.
+     */
+    size_t pageCount() const { return _pageCount; }
+
+    /**
+     * Returns the length of one page, in bytes.
+     */
+    size_t pageSize() const { return _pageSize; }
+
+    /**
+     * Adds every read from this stream to `reads` from now on.
+     */
+    void countReads(MsfReadCounterRef reads) { _reads = reads; }
+
+    /**
+     * Returns the mapping that the pages are read from.
+     */
+    MemMapRef map() const { return _map; }
+
+    /**
+     * Returns a pointer to the `i`th page of the stream inside the mapping.
+     * The whole page is always valid to read, even if the stream ends before
+     * the end of the page.
+     */
+    const uint8_t* page(size_t i) const {
+        return (const uint8_t*)_map->buf() + (size_t)_pages[i] * _pageSize;
+    }
+};
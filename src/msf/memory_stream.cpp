@@ -25,58 +25,89 @@
 
 #include "msf/memory_stream.h"
 
-MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf) : _pos(0) {
-    _data.resize(length);
-    memcpy(_data.data(), buf, length);
+MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf)
+    : _pos(0), _data(nullptr), _length(0), _capacity(0) {
+    _grow(length);
+    memcpy(_data, buf, length);
+    _length = length;
 }
 
-MsfMemoryStream::MsfMemoryStream(MsfStream* stream) : _pos(0) {
+MsfMemoryStream::MsfMemoryStream(MsfStream* stream, MsfArenaRef arena)
+    : _pos(0), _arena(arena), _data(nullptr), _length(0), _capacity(0) {
     const size_t length = stream->length();
 
-    _data.resize(length);
+    // Every byte is overwritten by the read, so the buffer is not cleared
+    // first.
+    _grow(length);
 
     const size_t pos = stream->getPos();
     stream->setPos(0);
 
-    stream->read(length, _data.data());
+    _length = stream->read(length, _data);
 
     stream->setPos(pos);
 }
 
-size_t MsfMemoryStream::length() const { return _data.size(); }
+void MsfMemoryStream::_grow(size_t capacity) {
+    if (capacity <= _capacity) return;
 
-void MsfMemoryStream::resize(size_t length) { _data.resize(length); }
+    uint8_t* data;
+
+    if (_arena) {
+        data = _arena->allocate(capacity);
+        memcpy(data, _data, _length);
+    } else {
+        std::unique_ptr<uint8_t[]> owned(new uint8_t[capacity]);
+        data = owned.get();
+        memcpy(data, _data, _length);
+        _owned = std::move(owned);
+    }
+
+    _data     = data;
+    _capacity = capacity;
+}
+
+size_t MsfMemoryStream::length() const { return _length; }
+
+void MsfMemoryStream::resize(size_t length) {
+    if (length > _length) {
+        _grow(std::max(length, _capacity * 2));
+        memset(_data + _length, 0, length - _length);
+    }
+
+    _length = length;
+    _pos    = std::min(_pos, _length);
+}
 
 size_t MsfMemoryStream::getPos() const { return _pos; }
 
 void MsfMemoryStream::setPos(size_t pos) {
     // Don't allow setting the position past the end of the stream.
-    _pos = std::min(_data.size(), pos);
+    _pos = std::min(_length, pos);
 }
 
 size_t MsfMemoryStream::read(size_t length, void* buf) {
-    if (_pos >= _data.size()) return 0;
+    if (_pos >= _length) return 0;
 
-    size_t available = std::min(_data.size() - _pos, length);
+    size_t available = std::min(_length - _pos, length);
 
-    memcpy(buf, &_data[_pos], available);
+    memcpy(buf, _data + _pos, available);
 
     _pos += available;
 
     return available;
 }
 
-size_t MsfMemoryStream::read(void* buf) {
-    return read(_data.size() - _pos, buf);
-}
+size_t MsfMemoryStream::read(void* buf) { return read(_length - _pos, buf); }
 
 size_t MsfMemoryStream::write(size_t length, const void* buf) {
-    const size_t available = _data.size() - _pos;
-
     // Not enough room, need to grow the stream.
-    if (available < length) _data.resize(_pos + length);
+    if (_pos + length > _length) {
+        _grow(std::max(_pos + length, _capacity * 2));
+        _length = _pos + length;
+    }
 
-    memcpy(&_data[_pos], buf, length);
+    memcpy(_data + _pos, buf, length);
 
     _pos += length;
 
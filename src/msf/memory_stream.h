@@ -22,17 +22,30 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
+#include <memory>
 
+#include "msf/arena.h"
 #include "msf/stream.h"
 
 /**
  * Represents an MSF file stream.
+ *
+ * The data is either owned by the stream or allocated from an MsfArena. In the
+ * latter case, the stream keeps the arena alive.
  */
 class MsfMemoryStream : public MsfStream {
    private:
     size_t _pos;
-    std::vector<uint8_t> _data;
+
+    MsfArenaRef _arena;
+    std::unique_ptr<uint8_t[]> _owned;
+
+    uint8_t* _data;
+    size_t _length;
+    size_t _capacity;
+
+    // Moves the data to a buffer that can hold at least `capacity` bytes.
+    void _grow(size_t capacity);
 
    public:
     /**
@@ -45,9 +58,10 @@ class MsfMemoryStream : public MsfStream {
     MsfMemoryStream(size_t length, const void* buf);
 
     /**
-     * Initialize the stream with another stream.
+     * Initialize the stream with another stream. If `arena` is given, the
+     * buffer is allocated from it.
      */
-    MsfMemoryStream(MsfStream* stream);
+    MsfMemoryStream(MsfStream* stream, MsfArenaRef arena = nullptr);
 
     /**
      * Returns the length of the stream, in bytes.
@@ -55,14 +69,15 @@ class MsfMemoryStream : public MsfStream {
     size_t length() const;
 
     /**
-     * Truncates the stream to the given length.
+     * Truncates the stream to the given length. If the stream grows, the new
+     * bytes are zero.
      */
     void resize(size_t length);
 
     /**
      * Returns a pointer to the underlying data.
      */
-    uint8_t* data() { return _data.data(); }
+    uint8_t* data() { return _data; }
 
     /**
      * Gets the current position, in bytes, in the stream.
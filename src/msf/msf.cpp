@@ -22,50 +22,89 @@
 
 #include "msf.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 #include "util/file.h"
+#include "util/sha256.h"
+#include "util/stats.h"
+#include "util/thread_pool.h"
 
 #include "msf/file_stream.h"
+#include "msf/mapped_stream.h"
+#include "msf/overlay_stream.h"
 #include "msf/readonly_stream.h"
 
 namespace {
 
-// A good page size to use when writing out the MSF.
+// Page size used for new MSF files. MSF files that are read keep their page
+// size when they are written out again.
 const size_t kPageSize = 4096;
 
-// A blank page. Used to write uninitialized pages to the MSF file.
-const uint8_t kBlankPage[kPageSize] = {0};
+// Smallest and largest supported page sizes.
+const size_t kMinPageSize = 512;
+const size_t kMaxPageSize = 65536;
+
+// Size of the buffer used to gather pages before writing them out. This is a
+// multiple of every supported page size.
+const size_t kWriteBufferSize = 1024 * 1024;
+
+// Number of buffers that can be waiting to be written to a file at once.
+const size_t kWriteBufferCount = 4;
+
+// Largest number of bytes copied from the original MSF by one thread at a time
+// when writing concurrently. Streams bigger than this are split up.
+const size_t kConcurrentCopySize = 8 * 1024 * 1024;
+
+/**
+ * Returns true if the given page size is supported. It must be a power of two
+ * for the FPM to be laid out correctly.
+ */
+bool isValidPageSize(size_t pageSize) {
+    return pageSize >= kMinPageSize && pageSize <= kMaxPageSize &&
+           (pageSize & (pageSize - 1)) == 0;
+}
 
 /**
  * Helper function for finding the size of the given file.
  */
 int64_t getFileSize(FILE* f) {
     // Save our spot...
-    int64_t pos = ftell(f);
+    int64_t pos = tellFile(f);
     if (pos == -1) {
         throw std::system_error(errno, std::system_category(),
                                 "ftell() failed");
     }
 
     // Go to the end
-    if (fseek(f, 0, SEEK_END) == -1) {
+    if (seekFile(f, 0, SEEK_END) != 0) {
         throw std::system_error(errno, std::system_category(),
                                 "fseek() failed");
     }
 
     // Current position is the size of the file.
-    int64_t size = ftell(f);
+    int64_t size = tellFile(f);
     if (size == -1) {
         throw std::system_error(errno, std::system_category(),
                                 "ftell() failed");
     }
 
     // Go back to our old spot
-    if (fseek(f, (long)pos, SEEK_SET) == -1) {
+    if (seekFile(f, pos, SEEK_SET) != 0) {
         throw std::system_error(errno, std::system_category(),
                                 "fseek() failed");
     }
@@ -85,7 +124,7 @@ int64_t getFileSize(FILE* f) {
  * out there or add an unreasonable complexity to the file format, so we're
  * stuck with it for the foreseeable future.
  */
-bool isFpmPage(size_t page, size_t pageSize = kPageSize) noexcept {
+bool isFpmPage(size_t page, size_t pageSize) noexcept {
     switch (page & (pageSize - 1)) {
         case 1:
         case 2:
@@ -95,51 +134,6 @@ bool isFpmPage(size_t page, size_t pageSize = kPageSize) noexcept {
     }
 }
 
-/**
- * Writes a page to the given file handle.
- */
-void writePage(FileRef f, const uint8_t* data, size_t pageSize,
-               std::vector<uint32_t>* pagesWritten, uint32_t& pageCount) {
-    if (fwrite(data, 1, pageSize, f.get()) != pageSize) {
-        throw std::system_error(errno, std::system_category(),
-                                "failed writing page");
-    }
-
-    if (pagesWritten) pagesWritten->push_back(pageCount);
-    pageCount++;
-}
-
-/**
- * Writes a stream to the given file handle.
- *
- * The non-FPM pages that are written are appended to the given vector.  Page
- * count is incremented for both normal and FPM pages.
- */
-void writeStream(FileRef f, MsfStreamRef stream,
-                 std::vector<uint32_t>& pagesWritten, uint32_t& pageCount) {
-    if (!stream || stream->length() == 0) return;
-
-    uint8_t buf[kPageSize];
-
-    stream->setPos(0);
-
-    while (size_t bytesRead = stream->read(kPageSize, buf)) {
-        assert(bytesRead <= kPageSize);
-
-        size_t leftOver = kPageSize - bytesRead;
-
-        // Pad the rest of the buffer with zeros
-        memset(buf + bytesRead, 0, leftOver);
-
-        if (isFpmPage(pageCount)) {
-            writePage(f, kBlankPage, sizeof(kBlankPage), nullptr, pageCount);
-            writePage(f, kBlankPage, sizeof(kBlankPage), nullptr, pageCount);
-        }
-
-        writePage(f, buf, sizeof(buf), &pagesWritten, pageCount);
-    }
-}
-
 /**
  * The Free Page Map (FPM). This is used to keep track of free pages in the MSF.
  *
@@ -172,12 +166,14 @@ class FreePageMap {
     void setUsed(size_t page) { _data[page / 8] &= ~(1 << (page % 8)); }
 
     /**
-     * Writes the FPM to the MSF.
+     * Gets the contents of the given FPM page. The first page of the FPM is
+     * stored at page 1 of the MSF, the second at page `pageSize + 1`, and so
+     * on.
      */
-    void write(FILE* f, size_t pageSize = kPageSize) const;
+    void page(size_t index, uint8_t* buf, size_t pageSize) const;
 };
 
-void FreePageMap::write(FILE* f, size_t pageSize) const {
+void FreePageMap::page(size_t index, uint8_t* buf, size_t pageSize) const {
     // The FPM is spread out across the MSF at regular intervals. There are two
     // FPM pages every 4096 pages (or whatever the page size is), starting at
     // page index 1. We do not write to the second FPM page in each pair.
@@ -190,257 +186,1568 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
     // large portion of them are never used and are just wasted space in the
     // file. This is due to a bug in Microsoft's PDB implementation and is
     // unlikely to be fixed in the future.
+    const size_t offset = index * pageSize;
 
-    // Start at the first page.
-    size_t page = 1;
+    if (offset >= _data.size()) {
+        memset(buf, 0, pageSize);
+        return;
+    }
 
-    size_t chunks = _data.size() / pageSize;
+    const size_t length = std::min(pageSize, _data.size() - offset);
 
-    const uint8_t* data = _data.data();
+    memcpy(buf, _data.data() + offset, length);
 
-    for (size_t i = 0; i < chunks; ++i) {
-        // Seek to the FPM page
-        if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to seek to MSF page");
-        }
+    // Fill the rest with 1s to indicate free pages.
+    memset(buf + length, 0xFF, pageSize - length);
+}
 
-        // Write a page of the FPM
-        if (fwrite(data, 1, pageSize, f) != pageSize) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to write FPM page");
-        }
+#ifdef __linux__
 
-        page += pageSize;
-        data += pageSize;
+/**
+ * Copies a range of bytes from one file to another entirely in the kernel.
+ *
+ * Returns false if copy_file_range() is not supported for these files and
+ * nothing was copied. In that case, the copy must be done in user space.
+ */
+bool copyFileRange(FILE* in, int64_t offset, FILE* out, size_t length) {
+    if (fflush(out) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "fflush() failed");
     }
 
-    // Write the remainder of the FPM and fill with 0xFF.
-    if (const size_t leftOver = _data.size() % pageSize) {
-        // Seek to the FPM page
-        if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to seek to final MSF page");
+    off64_t inOffset  = offset;
+    // The output must be seekable for this to work.
+    off64_t outOffset = ftello(out);
+    if (outOffset == -1) return false;
+
+    bool copied = false;
+
+    while (length > 0) {
+        ssize_t n = copy_file_range(fileno(in), &inOffset, fileno(out),
+                                    &outOffset, length, 0);
+        if (n <= 0) {
+            if (n < 0 && !copied &&
+                (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                 errno == EOPNOTSUPP || errno == EBADF)) {
+                return false;
+            }
+
+            throw std::system_error(n < 0 ? errno : EIO,
+                                    std::system_category(),
+                                    "copy_file_range() failed");
         }
 
-        // Write a partial page of the FPM
-        if (fwrite(data, 1, leftOver, f) != leftOver) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to write final FPM page");
-        }
+        copied = true;
+        length -= (size_t)n;
+    }
 
-        // Fill the rest with 1s to indicate free pages.
-        std::vector<uint8_t> ones(pageSize - leftOver, 0xFF);
-        if (fwrite(ones.data(), 1, ones.size(), f) != ones.size()) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to write final FPM page");
-        }
+    // copy_file_range() does not move the file offset when an explicit offset
+    // is given.
+    if (fseeko(out, outOffset, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "fseeko() failed");
     }
+
+    return true;
 }
 
-}  // namespace
+#endif
 
-MsfFile::MsfFile(FileRef f) {
-    MSF_HEADER header;
+/**
+ * Passes blocks of data to a sink on a dedicated thread. This lets the next
+ * pages be read while the previous ones are being written.
+ *
+ * Blocks are either one of a fixed ring of buffers owned by this class or
+ * external data that stays valid until drain() returns. Since the ring is
+ * bounded, at most `count` buffers are waiting to be written at once.
+ */
+class WriteThread {
+   private:
+    struct Block {
+        const uint8_t* data;
+        size_t length;
 
-    // Read the header
-    if (fread(&header, sizeof(header), 1, f.get()) != 1)
-        throw InvalidMsf("Missing MSF header");
+        // Index of the buffer to release once written, or -1 for external
+        // data.
+        size_t buffer;
+    };
 
-    // Check that this is indeed an MSF header
-    if (memcmp(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
-        throw InvalidMsf("Invalid MSF header");
+    const MsfSink& _sink;
 
-    // Check that the file size makes sense
-    if (header.pageSize * header.pageCount != getFileSize(f.get()))
-        throw InvalidMsf("Invalid MSF file length");
+    std::vector<std::vector<uint8_t>> _buffers;
+    std::vector<size_t> _free;
 
-    // The number of pages required to store the pages of the stream table
-    // stream.
-    size_t stPagesPagesCount =
-        ::pageCount(header.pageSize, header.streamTableInfo.size);
+    // Blocks waiting to be written and whether one is being written.
+    std::deque<Block> _queue;
+    bool _busy;
 
-    // Read the stream table page directory
-    std::unique_ptr<uint32_t> streamTablePagesPages(
-        new uint32_t[stPagesPagesCount]);
+    std::mutex _mutex;
 
-    if (fread(streamTablePagesPages.get(), sizeof(uint32_t), stPagesPagesCount,
-              f.get()) != stPagesPagesCount) {
-        throw InvalidMsf("Missing root MSF stream table page list");
-    }
+    // Signaled when a block is queued or when the thread is stopping.
+    std::condition_variable _queued;
 
-    MsfFileStream streamTablePagesStream(f, header.pageSize,
-                                         stPagesPagesCount * sizeof(uint32_t),
-                                         streamTablePagesPages.get());
+    // Signaled when a block has been written.
+    std::condition_variable _written;
 
-    // Read the list of stream table pages.
-    std::vector<uint32_t> streamTablePages(stPagesPagesCount);
-    if (streamTablePagesStream.read(&streamTablePages[0]) !=
-        stPagesPagesCount * sizeof(uint32_t)) {
-        throw InvalidMsf("failed to read stream table page list");
-    }
+    std::exception_ptr _error;
+    bool _stopping;
 
-    // Finally, read the stream table itself
-    MsfFileStream streamTableStream(
-        f, header.pageSize, header.streamTableInfo.size, &streamTablePages[0]);
-    std::vector<uint32_t> streamTable(header.streamTableInfo.size /
-                                      sizeof(uint32_t));
-    if (streamTableStream.read(&streamTable[0]) != header.streamTableInfo.size)
-        throw InvalidMsf("failed to read stream table");
+    std::thread _thread;
 
-    // The first element in the stream table is the total number of streams.
-    const uint32_t& streamCount = streamTable[0];
+    void _work();
 
-    // The sizes of each stream then follow.
-    const uint32_t* streamSizes = &streamTable[1];
+    void _push(const Block& block);
 
-    // After all the sizes, there are the lists of pages for each stream. We
-    // calculate the number of pages required for the stream using the stream
-    // size.
-    const uint32_t* streamPages = streamSizes + streamCount;
+    void _rethrow();
 
-    uint32_t pagesIndex = 0;
-    for (uint32_t i = 0; i < streamCount; ++i) {
-        // If we were given a bogus stream count, we could potentially overflow
-        // the stream table vector. Detect that here.
-        if (pagesIndex >= streamTable.size())
-            throw InvalidMsf("invalid stream count in stream table");
+   public:
+    WriteThread(const MsfSink& sink, size_t count, size_t size);
 
-        uint32_t size = streamSizes[i];
+    /**
+     * Stops the thread. Anything that has not been written yet is dropped.
+     */
+    ~WriteThread();
 
-        // Microsoft's PDB implementation sometimes sets the size of a stream to
-        // -1. We can't ignore this stream as it will invalidate the stream
-        // IDs everywhere. Instead, just set it to a length of 0.
-        if (size == (uint32_t)-1) size = 0;
+    /**
+     * Waits for a free buffer and returns it along with its index.
+     */
+    uint8_t* acquire(size_t& index);
 
-        addStream(new MsfFileStream(f, header.pageSize, size,
-                                    streamPages + pagesIndex));
+    /**
+     * Queues the first `length` bytes of an acquired buffer to be written.
+     */
+    void submit(size_t index, size_t length);
+
+    /**
+     * Queues external data to be written. It must stay valid until drain().
+     */
+    void submit(const void* data, size_t length);
+
+    /**
+     * Waits until everything that was queued has been written.
+     *
+     * Throws: Whatever the sink threw on the write thread.
+     */
+    void drain();
+};
+
+WriteThread::WriteThread(const MsfSink& sink, size_t count, size_t size)
+    : _sink(sink),
+      _buffers(count, std::vector<uint8_t>(size)),
+      _busy(false),
+      _stopping(false) {
+    for (size_t i = 0; i < count; ++i) _free.push_back(i);
+
+    _thread = std::thread(&WriteThread::_work, this);
+}
 
-        pagesIndex += ::pageCount(header.pageSize, size);
+WriteThread::~WriteThread() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
     }
+
+    _queued.notify_one();
+    _thread.join();
 }
 
-MsfFile::~MsfFile() {}
+void WriteThread::_work() {
+    std::unique_lock<std::mutex> lock(_mutex);
 
-size_t MsfFile::addStream(MsfStream* stream) {
-    _streams.push_back(MsfStreamRef(stream));
-    return _streams.size() - 1;
+    while (true) {
+        _queued.wait(lock, [this] { return _stopping || !_queue.empty(); });
+
+        if (_stopping) break;
+
+        const Block block = _queue.front();
+        _queue.pop_front();
+        _busy = true;
+
+        // After a failure, the rest of the blocks are only released.
+        if (!_error) {
+            lock.unlock();
+
+            try {
+                _sink(block.data, block.length);
+            } catch (...) {
+                lock.lock();
+                _error = std::current_exception();
+                lock.unlock();
+            }
+
+            lock.lock();
+        }
+
+        if (block.buffer != (size_t)-1) _free.push_back(block.buffer);
+
+        _busy = false;
+        _written.notify_all();
+    }
 }
 
-MsfStreamRef MsfFile::getStream(size_t index) {
-    if (index < _streams.size()) {
-        return _streams[index];
+void WriteThread::_rethrow() {
+    if (_error) std::rethrow_exception(_error);
+}
+
+void WriteThread::_push(const Block& block) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rethrow();
+        _queue.push_back(block);
     }
 
-    return nullptr;
+    _queued.notify_one();
 }
 
-void MsfFile::replaceStream(size_t index, MsfStreamRef stream) {
-    _streams[index] = stream;
+uint8_t* WriteThread::acquire(size_t& index) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _written.wait(lock, [this] { return !_free.empty() || _error; });
+    _rethrow();
+
+    index = _free.back();
+    _free.pop_back();
+
+    return _buffers[index].data();
 }
 
-size_t MsfFile::streamCount() const { return _streams.size(); }
+void WriteThread::submit(size_t index, size_t length) {
+    _push({_buffers[index].data(), length, index});
+}
+
+void WriteThread::submit(const void* data, size_t length) {
+    _push({(const uint8_t*)data, length, (size_t)-1});
+}
 
-void MsfFile::write(FileRef f) const {
-    uint32_t pageCount = 0;
+void WriteThread::drain() {
+    std::unique_lock<std::mutex> lock(_mutex);
 
-    // Write out 4 blank pages: one for the header, two for the FPM, and one
-    // superfluous blank page. We'll come back at the end and write in the
-    // header and free page map. We can't do it now, because we don't have that
-    // information yet.
-    for (; pageCount < 4; ++pageCount) {
-        if (fwrite(kBlankPage, 1, kPageSize, f.get()) != kPageSize) {
-            throw std::system_error(errno, std::system_category(),
-                                    "failed writing MSF preamble");
+    _written.wait(lock,
+                  [this] { return (_queue.empty() && !_busy) || _error; });
+    _rethrow();
+}
+
+/**
+ * Writes pages sequentially to a file.
+ *
+ * Pages are gathered into large blocks before they are written out. FPM pages
+ * are written as they are reached so that the whole file is written in a single
+ * pass without seeking.
+ *
+ * When writing to a file, the blocks are written by a WriteThread so that
+ * reading the streams overlaps with writing them. Otherwise, the sink is called
+ * on the calling thread.
+ */
+class PageWriter {
+   private:
+    const MsfSink& _sink;
+
+    // The file that `_sink` writes to, if any.
+    FILE* _f;
+
+    // Whether pages may be copied into `_f` by the kernel, bypassing `_sink`.
+    const bool _kernelCopy;
+
+    const FreePageMap& _fpm;
+
+    const size_t _pageSize;
+
+    // Writes the blocks when writing to a file.
+    std::unique_ptr<WriteThread> _thread;
+
+    // Pages waiting to be written. This is either `_ownBuf` or a buffer
+    // acquired from `_thread`.
+    std::vector<uint8_t> _ownBuf;
+    uint8_t* _buf;
+    size_t _bufIndex;
+    size_t _used;
+
+    // Number of pages written so far, including those in the buffer.
+    uint32_t _pageCount;
+
+    // Number of pages copied unchanged from the original MSF, and how many of
+    // those the kernel copied.
+    size_t _copiedPages;
+    size_t _kernelCopiedPages;
+
+   public:
+    PageWriter(const MsfSink& sink, FILE* f, bool kernelCopy,
+               const FreePageMap& fpm, size_t pageSize)
+        : _sink(sink),
+          _f(f),
+          _kernelCopy(kernelCopy),
+          _fpm(fpm),
+          _pageSize(pageSize),
+          _buf(nullptr),
+          _bufIndex(0),
+          _used(0),
+          _pageCount(0),
+          _copiedPages(0),
+          _kernelCopiedPages(0) {
+        if (f) {
+            _thread.reset(
+                new WriteThread(sink, kWriteBufferCount, kWriteBufferSize));
+            _buf = _thread->acquire(_bufIndex);
+        } else {
+            _ownBuf.resize(kWriteBufferSize);
+            _buf = _ownBuf.data();
         }
     }
 
-    // Initialize the stream table.
-    std::vector<uint32_t> streamTable;
-    streamTable.push_back((uint32_t)streamCount());
+    /**
+     * Returns the size of each page.
+     */
+    size_t pageSize() const { return _pageSize; }
+
+    /**
+     * Returns the number of pages written so far.
+     */
+    uint32_t pageCount() const { return _pageCount; }
+
+    /**
+     * Returns the number of pages that were copied from the original MSF by
+     * writePages() or copyPages().
+     */
+    size_t copiedPages() const { return _copiedPages; }
+
+    /**
+     * Returns the number of pages that the kernel copied by itself.
+     */
+    size_t kernelCopiedPages() const { return _kernelCopiedPages; }
+
+    /**
+     * Writes the FPM pages if the next page is an FPM page. This must be called
+     * before writing each page of a stream.
+     */
+    void skipFpm();
+
+    /**
+     * Writes a single page. If `length` is less than a page, the rest of the
+     * page is filled with zeros.
+     */
+    void writePage(const void* data, size_t length);
+
+    /**
+     * Writes `count` whole pages. None of the pages may be FPM pages.
+     */
+    void writePages(const void* data, size_t count);
+
+    /**
+     * Copies `count` whole pages from the given file starting at `offset`. The
+     * kernel does the copy if allowed and possible. None of the pages may be
+     * FPM pages.
+     */
+    void copyPages(FILE* in, int64_t offset, size_t count);
+
+    /**
+     * Queues any buffered pages to be written.
+     */
+    void flush();
+
+    /**
+     * Writes any buffered pages and waits until everything has been written to
+     * the file.
+     */
+    void finish();
+
+   private:
+    uint8_t* reserve();
+};
+
+uint8_t* PageWriter::reserve() {
+    if (_used == kWriteBufferSize) flush();
+
+    uint8_t* page = _buf + _used;
+    _used += _pageSize;
+    ++_pageCount;
+    return page;
+}
+
+void PageWriter::skipFpm() {
+    if (!isFpmPage(_pageCount, _pageSize)) return;
 
-    for (auto&& stream : _streams) {
-        if (stream)
-            streamTable.push_back((uint32_t)stream->length());
+    _fpm.page(_pageCount / _pageSize, reserve(), _pageSize);
+    memset(reserve(), 0, _pageSize);
+}
+
+void PageWriter::writePage(const void* data, size_t length) {
+    assert(length <= _pageSize);
+
+    uint8_t* page = reserve();
+    if (length > 0) memcpy(page, data, length);
+    memset(page + length, 0, _pageSize - length);
+}
+
+void PageWriter::writePages(const void* data, size_t count) {
+    const size_t length = count * _pageSize;
+
+    if (_used + length > kWriteBufferSize) flush();
+
+    if (length >= kWriteBufferSize) {
+        // Too big to be worth buffering. The pages come from the original MSF,
+        // which outlives the writer.
+        if (_thread)
+            _thread->submit(data, length);
         else
-            streamTable.push_back(0);
+            _sink(data, length);
+    } else {
+        memcpy(_buf + _used, data, length);
+        _used += length;
     }
 
-    // Write out each stream and add the stream's page numbers to the stream
-    // table. Note that stream 0 is special, we need to keep track of which
-    // pages it was written to so we can mark them as free later.
-    size_t streamZeroStart = streamTable.size();
-    if (_streams.size() > 0) {
-        writeStream(f, _streams[0], streamTable, pageCount);
+    _pageCount += (uint32_t)count;
+    _copiedPages += count;
+}
+
+void PageWriter::copyPages(FILE* in, int64_t offset, size_t count) {
+    flush();
+
+    _copiedPages += count;
+
+#ifdef __linux__
+    // The kernel writes at the current file position, so everything before it
+    // has to be written first.
+    if (_thread) _thread->drain();
+
+    if (_f && _kernelCopy && copyFileRange(in, offset, _f, count * _pageSize)) {
+        _pageCount += (uint32_t)count;
+        _kernelCopiedPages += count;
+        return;
     }
-    size_t streamZeroEnd = streamTable.size();
+#endif
 
-    for (size_t i = 1; i < _streams.size(); ++i) {
-        writeStream(f, _streams[i], streamTable, pageCount);
+    if (seekFile(in, offset, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to seek to MSF page");
     }
 
-    // Write the stream table stream at the end of the file, keeping track of
-    // which pages were written.
-    std::vector<uint32_t> streamTablePages;
-    MsfStreamRef streamTableStream(new MsfReadOnlyStream(
-        streamTable.size() * sizeof(streamTable[0]), streamTable.data()));
+    // Read directly into the buffer.
+    while (count > 0) {
+        const size_t n = std::min(count, kWriteBufferSize / _pageSize);
+        const size_t length = n * _pageSize;
 
-    writeStream(f, streamTableStream, streamTablePages, pageCount);
+        if (fread(_buf, 1, length, in) != length) {
+            throw std::system_error(errno, std::system_category(),
+                                    "failed reading pages");
+        }
 
-    // Write the stream table pages, keeping track of which pages were written.
-    // These pages in turn will be written after the MSF header.
-    std::vector<uint32_t> streamTablePgPg;
-    MsfStreamRef streamTableStreamPages(new MsfReadOnlyStream(
-        streamTablePages.size() * sizeof(uint32_t), streamTablePages.data()));
+        _used = length;
+        _pageCount += (uint32_t)n;
+        flush();
 
-    writeStream(f, streamTableStreamPages, streamTablePgPg, pageCount);
+        count -= n;
+    }
+}
 
-    // Write the header
-    MSF_HEADER header = {};
-    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
-    header.pageSize    = kPageSize;
-    header.freePageMap = 1;
-    header.pageCount   = pageCount;
-    header.streamTableInfo.size =
-        (uint32_t)streamTable.size() * sizeof(streamTable[0]);
-    header.streamTableInfo.index = 0;
+void PageWriter::flush() {
+    if (_used == 0) return;
 
-    if (fseek(f.get(), 0, SEEK_SET) != 0) {
-        throw std::system_error(errno, std::system_category(),
-                                "fseek() failed");
+    if (_thread) {
+        _thread->submit(_bufIndex, _used);
+        _buf = _thread->acquire(_bufIndex);
+    } else {
+        _sink(_buf, _used);
     }
 
-    if (fwrite(&header, sizeof(header), 1, f.get()) != 1) {
-        throw std::system_error(errno, std::system_category(),
-                                "failed writing MSF header");
+    _used = 0;
+}
+
+void PageWriter::finish() {
+    flush();
+
+    if (_thread) _thread->drain();
+}
+
+/**
+ * Allocates pages in the output file for a stream of the given length. FPM
+ * pages are skipped over. The allocated pages are appended to `pages`.
+ */
+void allocatePages(size_t length, size_t pageSize, uint32_t& pageCount,
+                   std::vector<uint32_t>& pages) {
+    for (size_t i = ::pageCount(pageSize, length); i > 0; --i) {
+        if (isFpmPage(pageCount, pageSize)) pageCount += 2;
+        pages.push_back(pageCount++);
     }
+}
 
-    // Make sure there aren't too many root stream table pages. This could only
-    // happen for ridiculously large PDBs or if there is a bug in this program.
-    const size_t streamTablePgPgLength =
-        streamTablePgPg.size() * sizeof(streamTablePgPg[0]);
+/**
+ * Copies the pages of an unmodified stream straight through to the output.
+ *
+ * Pages that are contiguous in the source, and that don't cross an FPM page in
+ * the output, are written as a single run. `writeRun` has the signature
+ * `void writeRun(size_t first, size_t count)`, where `first` is an index into
+ * `pages`.
+ */
+template <typename WriteRun>
+void copyStreamPages(PageWriter& writer, const uint32_t* pages, size_t length,
+                     WriteRun writeRun) {
+    const size_t pageSize = writer.pageSize();
 
-    if (streamTablePgPgLength > kPageSize - sizeof(header)) {
-        throw InvalidMsf(
-            "root stream table pages are too large to fit in one page");
+    size_t i = 0;
+
+    while (i < length) {
+        writer.skipFpm();
+
+        // Number of pages that can be written before the next FPM page.
+        const uint32_t pageCount = writer.pageCount();
+
+        size_t nextFpm = (pageCount / pageSize) * pageSize + 1;
+        if (nextFpm <= pageCount) nextFpm += pageSize;
+
+        const size_t untilFpm = nextFpm - pageCount;
+
+        size_t count = 1;
+        while (count < untilFpm && i + count < length &&
+               pages[i + count] == pages[i] + count) {
+            ++count;
+        }
+
+        writeRun(i, count);
+
+        i += count;
     }
+}
 
-    // Write the root pages for the stream table.
-    if (fwrite(streamTablePgPg.data(), sizeof(streamTablePgPg[0]),
-               streamTablePgPg.size(), f.get()) != streamTablePgPg.size()) {
-        throw std::system_error(errno, std::system_category(),
-                                "failed writing MSF header");
+/**
+ * Where the pages of a stream that was read from an MSF file are.
+ */
+struct OriginalPages {
+    // The mapping that the pages are in. If null, they are read from `file`.
+    const uint8_t* map;
+    FILE* file;
+
+    size_t pageSize;
+    const uint32_t* pages;
+};
+
+/**
+ * Finds the pages of a stream that was read from an MSF file. Returns false if
+ * the stream was not.
+ */
+bool findOriginalPages(MsfStream* stream, OriginalPages& original) {
+    if (auto mapped = dynamic_cast<MsfMappedStream*>(stream)) {
+        original = {(const uint8_t*)mapped->map()->buf(), nullptr,
+                    mapped->pageSize(), mapped->pages()};
+        return true;
     }
 
-    // Construct the free page map.
-    FreePageMap fpm(pageCount);
-    fpm.setFree(3);  // The omnipresent superfluous page
+    if (auto file = dynamic_cast<MsfFileStream*>(stream)) {
+        original = {nullptr, file->file().get(), file->pageSize(),
+                    file->pages()};
+        return true;
+    }
+
+    return false;
+}
 
-    // Mark stream 0 pages as free
-    for (size_t i = streamZeroStart; i < streamZeroEnd; ++i) {
-        fpm.setFree(streamTable[i]);
+/**
+ * Copies the first `count` pages of a stream that was read from an MSF file
+ * directly to the output. If `overlay` is given, its modified pages are written
+ * in place of the original ones.
+ *
+ * Returns false if the pages can't be copied directly, in which case nothing is
+ * written.
+ */
+bool copyOriginalPages(PageWriter& writer, const OriginalPages& original,
+                       size_t count,
+                       const MsfOverlayStream* overlay = nullptr) {
+    const size_t pageSize = writer.pageSize();
+
+    if (original.pageSize != pageSize) return false;
+
+    const uint32_t* pages = original.pages;
+
+    std::function<void(size_t, size_t)> copy;
+
+    if (original.map) {
+        copy = [=, &writer](size_t first, size_t n) {
+            writer.writePages(original.map + (size_t)pages[first] * pageSize,
+                              n);
+        };
+    } else {
+        copy = [=, &writer](size_t first, size_t n) {
+            writer.copyPages(original.file, (int64_t)pages[first] * pageSize,
+                             n);
+        };
+    }
+
+    copyStreamPages(writer, pages, count, [&](size_t first, size_t n) {
+        size_t clean = first;
+
+        for (size_t i = first; overlay && i < first + n; ++i) {
+            if (const uint8_t* page = overlay->dirtyPage(i)) {
+                if (i > clean) copy(clean, i - clean);
+                writer.writePage(page, pageSize);
+                clean = i + 1;
+            }
+        }
+
+        if (first + n > clean) copy(clean, first + n - clean);
+    });
+
+    return true;
+}
+
+/**
+ * Starts reading the pages of a stream in the mapping before they are copied.
+ * Each run of contiguous pages is a single range.
+ */
+void prefetchPages(const MemMap& map, size_t pageSize, const uint32_t* pages,
+                   size_t count) {
+    size_t i = 0;
+
+    while (i < count) {
+        size_t n = 1;
+        while (i + n < count && pages[i + n] == pages[i] + n) ++n;
+
+        map.advise(MemAccess::willNeed, (size_t)pages[i] * pageSize,
+                   n * pageSize);
+
+        i += n;
+    }
+}
+
+/**
+ * Writes `length` bytes to the given pages of a file. Contiguous pages are
+ * written at once. The rest of the last page is left as it is.
+ */
+void writePagesAt(FILE* f, const uint32_t* pages, size_t pageSize,
+                  const uint8_t* data, size_t length) {
+    size_t i = 0;
+
+    while (length > 0) {
+        size_t n = 1;
+        while (n * pageSize < length && pages[i + n] == pages[i] + n) ++n;
+
+        const size_t chunk = std::min(length, n * pageSize);
+
+        writeFileAt(f, (int64_t)pages[i] * pageSize, data, chunk);
+
+        data += chunk;
+        length -= chunk;
+        i += n;
+    }
+}
+
+/**
+ * Copies `count` whole pages of an MSF in `map` to the given pages of a file.
+ * Runs of pages that are contiguous in both are written at once.
+ */
+void copyPagesAt(FILE* f, const uint32_t* pages, size_t pageSize,
+                 const uint8_t* map, const uint32_t* from, size_t count) {
+    size_t i = 0;
+
+    while (i < count) {
+        size_t n = 1;
+        while (i + n < count && pages[i + n] == pages[i] + n &&
+               from[i + n] == from[i] + n) {
+            ++n;
+        }
+
+        writeFileAt(f, (int64_t)pages[i] * pageSize,
+                    map + (size_t)from[i] * pageSize, n * pageSize);
+
+        i += n;
+    }
+}
+
+/**
+ * Reads a whole stream and writes it to the given pages of a file.
+ */
+void writeStreamAt(FILE* f, const uint32_t* pages, size_t pageSize,
+                   MsfStream* stream) {
+    std::vector<uint8_t> buf(kWriteBufferSize);
+
+    stream->setPos(0);
+
+    for (size_t i = 0;; i += kWriteBufferSize / pageSize) {
+        const size_t n = stream->read(buf.size(), buf.data());
+        if (n == 0) break;
+
+        writePagesAt(f, pages + i, pageSize, buf.data(), n);
+
+        if (n < buf.size()) break;
+    }
+}
+
+/**
+ * Writes a stream to the output. The number of pages written is always the
+ * number of pages allocated for it by allocatePages().
+ */
+void writeStream(PageWriter& writer, MsfStreamRef stream) {
+    if (!stream || stream->length() == 0) return;
+
+    const size_t pageSize = writer.pageSize();
+    const size_t count    = ::pageCount(pageSize, stream->length());
+
+    // Streams that were read from the original MSF and have not been replaced
+    // can have their pages copied directly.
+    OriginalPages original;
+    if (findOriginalPages(stream.get(), original) &&
+        copyOriginalPages(writer, original, count)) {
+        return;
+    }
+
+    size_t i = 0;
+
+    // Likewise for the unmodified pages of an overlay. A partial last page is
+    // written below instead so that the rest of it is zeroed out.
+    if (auto overlay = std::dynamic_pointer_cast<MsfOverlayStream>(stream)) {
+        const size_t whole = stream->length() / pageSize;
+
+        if (overlay->pageSize() == pageSize &&
+            findOriginalPages(overlay->original().get(), original) &&
+            copyOriginalPages(writer, original, whole, overlay.get())) {
+            i = whole;
+        }
+    }
+
+    std::vector<uint8_t> buf(pageSize);
+
+    stream->setPos(i * pageSize);
+
+    for (; i < count; ++i) {
+        writer.skipFpm();
+        writer.writePage(buf.data(), stream->read(pageSize, buf.data()));
+    }
+}
+
+/**
+ * Reads the stream table into `streamTable` and parses it.
+ *
+ * The given function is used to create the streams needed to read the stream
+ * table. It has the signature
+ * `MsfStream* makeStream(size_t length, const uint32_t* pages)`. This allows
+ * the stream table to be parsed in the same way regardless of how the pages are
+ * read.
+ *
+ * Each stream is then passed, in order, to
+ * `void addStream(uint32_t length, size_t offset)`, where `offset` is the index
+ * of its first page in `streamTable`.
+ *
+ * Returns the list of pages that the stream table is stored in.
+ */
+template <typename MakeStream, typename AddStream>
+std::vector<uint32_t> readStreamTable(const MSF_HEADER& header,
+                                      const uint32_t* rootPages,
+                                      MakeStream makeStream,
+                                      std::vector<uint32_t>& streamTable,
+                                      AddStream addStream) {
+    // The number of pages required to store the stream table.
+    const size_t stPagesCount =
+        ::pageCount(header.pageSize, header.streamTableInfo.size);
+
+    std::unique_ptr<MsfStream> streamTablePagesStream(
+        makeStream(stPagesCount * sizeof(uint32_t), rootPages));
+
+    // Read the list of stream table pages.
+    std::vector<uint32_t> streamTablePages(stPagesCount);
+    if (streamTablePagesStream->read(streamTablePages.data()) !=
+        stPagesCount * sizeof(uint32_t)) {
+        throw InvalidMsf("failed to read stream table page list");
+    }
+
+    // Finally, read the stream table itself
+    std::unique_ptr<MsfStream> streamTableStream(
+        makeStream(header.streamTableInfo.size, streamTablePages.data()));
+    streamTable.resize(header.streamTableInfo.size / sizeof(uint32_t));
+    if (streamTable.empty() ||
+        streamTableStream->read(streamTable.data()) !=
+            header.streamTableInfo.size) {
+        throw InvalidMsf("failed to read stream table");
+    }
+
+    // The first element in the stream table is the total number of streams.
+    const uint32_t streamCount = streamTable[0];
+
+    if (streamCount > streamTable.size() - 1)
+        throw InvalidMsf("invalid stream count in stream table");
+
+    // The sizes of each stream then follow.
+    const uint32_t* streamSizes = &streamTable[1];
+
+    // After all the sizes, there are the lists of pages for each stream. We
+    // calculate the number of pages required for the stream using the stream
+    // size.
+    const size_t streamPages = 1 + streamCount;
+
+    const size_t streamPagesCount = streamTable.size() - 1 - streamCount;
+
+    size_t pagesIndex = 0;
+    for (uint32_t i = 0; i < streamCount; ++i) {
+        uint32_t size = streamSizes[i];
+
+        // Microsoft's PDB implementation sometimes sets the size of a stream to
+        // -1. We can't ignore this stream as it will invalidate the stream
+        // IDs everywhere. Instead, just set it to a length of 0.
+        if (size == (uint32_t)-1) size = 0;
+
+        const size_t count = ::pageCount(header.pageSize, size);
+
+        // If we were given a bogus stream size, we could potentially overflow
+        // the stream table vector. Detect that here.
+        if (count > streamPagesCount - pagesIndex)
+            throw InvalidMsf("invalid stream size in stream table");
+
+        addStream(size, streamPages + pagesIndex);
+
+        pagesIndex += count;
+    }
+
+    return streamTablePages;
+}
+
+}  // namespace
+
+MsfFile::MsfFile()
+    : _originalPageSize(kPageSize),
+      _arena(new MsfArena()),
+      _reads(new MsfReadCounter()),
+      _pageSize(kPageSize),
+      _writeThreads(1) {}
+
+MsfFile::MsfFile(FileRef f)
+    : _arena(new MsfArena()), _reads(new MsfReadCounter()), _writeThreads(1) {
+    MSF_HEADER header;
+
+    // Read the header
+    if (fread(&header, sizeof(header), 1, f.get()) != 1)
+        throw InvalidMsf("Missing MSF header");
+
+    // Check that this is indeed an MSF header
+    if (memcmp(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
+        throw InvalidMsf("Invalid MSF header");
+
+    if (!isValidPageSize(header.pageSize))
+        throw InvalidMsf("Unsupported MSF page size");
+
+    // Check that the file size makes sense
+    if ((int64_t)header.pageSize * header.pageCount != getFileSize(f.get()))
+        throw InvalidMsf("Invalid MSF file length");
+
+    _pageSize = header.pageSize;
+
+    // The number of pages required to store the pages of the stream table
+    // stream.
+    size_t stPagesPagesCount =
+        ::pageCount(header.pageSize, header.streamTableInfo.size);
+
+    // Read the stream table page directory
+    std::unique_ptr<uint32_t[]> streamTablePagesPages(
+        new uint32_t[stPagesPagesCount]);
+
+    if (fread(streamTablePagesPages.get(), sizeof(uint32_t), stPagesPagesCount,
+              f.get()) != stPagesPagesCount) {
+        throw InvalidMsf("Missing root MSF stream table page list");
+    }
+
+    auto pageList = std::make_shared<std::vector<uint32_t>>();
+
+    readStreamTable(header, streamTablePagesPages.get(),
+                    [&](size_t length, const uint32_t* pages) {
+                        return new MsfFileStream(f, header.pageSize, length,
+                                                 pages);
+                    },
+                    *pageList,
+                    [&](uint32_t length, size_t offset) {
+                        _spans.push_back({offset, length});
+                    });
+
+    _pageList         = pageList;
+    _originalPageSize = header.pageSize;
+    _file             = f;
+
+    _streams.resize(_spans.size());
+    _isOriginal.assign(_spans.size(), true);
+}
+
+MsfFile::MsfFile(MemMapRef map)
+    : _arena(new MsfArena()), _reads(new MsfReadCounter()), _writeThreads(1) {
+    if (map->length() < sizeof(MSF_HEADER))
+        throw InvalidMsf("Missing MSF header");
+
+    const uint8_t* buf = (const uint8_t*)map->buf();
+
+    MSF_HEADER header;
+    memcpy(&header, buf, sizeof(header));
+
+    // Check that this is indeed an MSF header
+    if (memcmp(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
+        throw InvalidMsf("Invalid MSF header");
+
+    if (!isValidPageSize(header.pageSize))
+        throw InvalidMsf("Unsupported MSF page size");
+
+    // Check that the file size makes sense
+    if ((uint64_t)header.pageSize * header.pageCount != map->length())
+        throw InvalidMsf("Invalid MSF file length");
+
+    _pageSize = header.pageSize;
+
+    // The root stream table page list must fit in the header page.
+    const size_t stPagesCount = ::pageCount<size_t>(
+        header.pageSize, header.streamTableInfo.size);
+
+    if (::pageCount<size_t>(header.pageSize, stPagesCount * sizeof(uint32_t)) >
+        (header.pageSize - sizeof(header)) / sizeof(uint32_t)) {
+        throw InvalidMsf("Missing root MSF stream table page list");
+    }
+
+    auto pageList = std::make_shared<std::vector<uint32_t>>();
+
+    // The pages of the streams are checked here since they may be copied
+    // without ever creating a stream for them.
+    const size_t mappedPages = map->length() / header.pageSize;
+
+    _streamTablePages = readStreamTable(
+        header, (const uint32_t*)(buf + sizeof(header)),
+        [&](size_t length, const uint32_t* pages) {
+            return new MsfMappedStream(map, header.pageSize, length, pages);
+        },
+        *pageList,
+        [&](uint32_t length, size_t offset) {
+            const uint32_t* pages = pageList->data() + offset;
+
+            for (size_t i = ::pageCount<size_t>(header.pageSize, length);
+                 i > 0; --i) {
+                if (pages[i - 1] >= mappedPages)
+                    throw InvalidMsf("invalid MSF page number");
+            }
+
+            _spans.push_back({offset, length});
+        });
+
+    _pageList         = pageList;
+    _originalPageSize = header.pageSize;
+    _map              = map;
+
+    _streams.resize(_spans.size());
+    _isOriginal.assign(_spans.size(), true);
+}
+
+MsfFile::~MsfFile() {}
+
+size_t MsfFile::addStream(MsfStream* stream) {
+    _streams.push_back(MsfStreamRef(stream));
+    _isOriginal.push_back(false);
+    return _streams.size() - 1;
+}
+
+MsfStreamRef MsfFile::getStream(size_t index) {
+    if (index < _streams.size()) {
+        if (!_streams[index] && _isOriginal[index])
+            _streams[index] = _originalStream(index);
+
+        return _streams[index];
+    }
+
+    return nullptr;
+}
+
+void MsfFile::replaceStream(size_t index, MsfStreamRef stream) {
+    // Putting back the stream returned by getStream() doesn't change anything.
+    if (!stream || stream != _streams[index]) _isOriginal[index] = false;
+
+    _streams[index] = stream;
+}
+
+MsfStreamRef MsfFile::_originalStream(size_t index) const {
+    const StreamSpan& span = _spans[index];
+
+    if (_map) {
+        auto stream = std::make_shared<MsfMappedStream>(
+            _map, _originalPageSize, span.length, _pageList, span.offset);
+        stream->countReads(_reads);
+        return stream;
+    }
+
+    auto stream = std::make_shared<MsfFileStream>(
+        _file, _originalPageSize, span.length, _pageList, span.offset);
+    stream->countReads(_reads);
+    return stream;
+}
+
+bool MsfFile::_readsOriginal(size_t index, const MsfStream* stream) const {
+    if (index >= _spans.size()) return false;
+
+    const StreamSpan& span = _spans[index];
+    const uint32_t* pages  = _pageList->data() + span.offset;
+
+    if (auto mapped = dynamic_cast<const MsfMappedStream*>(stream)) {
+        return mapped->pages() == pages && mapped->length() == span.length;
+    }
+
+    if (auto file = dynamic_cast<const MsfFileStream*>(stream)) {
+        return file->pages() == pages && file->length() == span.length;
+    }
+
+    return false;
+}
+
+size_t MsfFile::_streamLength(size_t index) const {
+    if (_isOriginal[index]) return _spans[index].length;
+
+    const auto& stream = _streams[index];
+    return stream ? stream->length() : 0;
+}
+
+size_t MsfFile::streamCount() const { return _streams.size(); }
+
+MsfArenaRef MsfFile::arena() const { return _arena; }
+
+uint64_t MsfFile::bytesRead() const { return _reads->bytes; }
+
+uint64_t MsfFile::pagesRead() const { return _reads->pages; }
+
+void MsfFile::setLeadingStreams(const std::vector<size_t>& streams) {
+    _leading = streams;
+}
+
+void MsfFile::setWriteThreads(size_t threads) { _writeThreads = threads; }
+
+size_t MsfFile::pageSize() const { return _pageSize; }
+
+void MsfFile::setPageSize(size_t pageSize) {
+    if (!isValidPageSize(pageSize)) throw InvalidMsf("Unsupported page size");
+
+    _pageSize = pageSize;
+}
+
+void MsfFile::write(FileRef f, Stats* stats, uint8_t digest[32]) const {
+    FILE* file = f.get();
+
+    if (_writeThreads != 1 && !digest && _canWriteConcurrently()) {
+        _writeConcurrently(file, stats);
+        return;
+    }
+
+    _write(
+        [=](const void* data, size_t length) {
+            if (fwrite(data, 1, length, file) != length) {
+                throw std::system_error(errno, std::system_category(),
+                                        "failed writing pages");
+            }
+        },
+        file, stats, digest);
+}
+
+void MsfFile::write(const MsfSink& sink, Stats* stats,
+                    uint8_t digest[32]) const {
+    _write(sink, nullptr, stats, digest);
+}
+
+size_t MsfFile::writtenPageCount() const {
+    WriteLayout layout;
+    _planWrite(layout);
+    return layout.pageCount;
+}
+
+void MsfFile::_planWrite(WriteLayout& layout) const {
+    // The first 4 pages are for the header, the FPM, and one superfluous blank
+    // page. Every other page is laid out before anything is written so that
+    // the header and FPM are known up front and the file can be written in a
+    // single pass.
+    uint32_t pageCount = 4;
+
+    // The order in which the streams are laid out. Leading streams come first,
+    // followed by the stream table (if there are any leading streams) and
+    // then the rest of the streams in index order.
+    std::vector<size_t>& order = layout.order;
+    std::vector<bool> isLeading(_streams.size(), false);
+
+    for (auto i : _leading) {
+        if (i < _streams.size() && !isLeading[i]) {
+            isLeading[i] = true;
+            order.push_back(i);
+        }
+    }
+
+    const size_t leadingCount = order.size();
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        if (!isLeading[i]) order.push_back(i);
+    }
+
+    // The length of the stream table is known before any pages are allocated
+    // so that it can be placed anywhere.
+    size_t streamPageCount = 0;
+    for (size_t i = 0; i < _streams.size(); ++i)
+        streamPageCount += ::pageCount(_pageSize, _streamLength(i));
+
+    const size_t streamTableLength =
+        (1 + _streams.size() + streamPageCount) * sizeof(uint32_t);
+
+    // Allocate pages for each stream in the order they will be written.
+    std::vector<std::vector<uint32_t>>& streamPages = layout.streamPages;
+    streamPages.resize(_streams.size());
+    std::vector<uint32_t>& streamTablePages = layout.streamTablePages;
+    std::vector<uint32_t>& streamTablePgPg  = layout.streamTablePgPg;
+
+    // The stream table stream is followed by the pages of the stream table
+    // stream. These pages in turn are listed after the MSF header.
+    auto allocateStreamTable = [&]() {
+        allocatePages(streamTableLength, _pageSize, pageCount,
+                      streamTablePages);
+        allocatePages(streamTablePages.size() * sizeof(uint32_t), _pageSize,
+                      pageCount, streamTablePgPg);
+    };
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i == leadingCount && leadingCount > 0) allocateStreamTable();
+
+        allocatePages(_streamLength(order[i]), _pageSize, pageCount,
+                      streamPages[order[i]]);
+    }
+
+    // By default, the stream table goes after all the other streams.
+    if (leadingCount == 0 || leadingCount == order.size())
+        allocateStreamTable();
+
+    // Initialize the stream table with the stream sizes followed by the pages
+    // of every stream.
+    std::vector<uint32_t>& streamTable = layout.streamTable;
+    streamTable.reserve(streamTableLength / sizeof(uint32_t));
+    streamTable.push_back((uint32_t)streamCount());
+
+    for (size_t i = 0; i < _streams.size(); ++i)
+        streamTable.push_back((uint32_t)_streamLength(i));
+
+    for (auto&& pages : streamPages)
+        streamTable.insert(streamTable.end(), pages.begin(), pages.end());
+
+    assert(streamTable.size() * sizeof(uint32_t) == streamTableLength);
+
+    // Make sure there aren't too many root stream table pages. This could only
+    // happen for ridiculously large PDBs or if there is a bug in this program.
+    if (streamTablePgPg.size() * sizeof(streamTablePgPg[0]) >
+        _pageSize - sizeof(MSF_HEADER)) {
+        throw InvalidMsf(
+            "root stream table pages are too large to fit in one page");
+    }
+
+    // Pages of stream 0 are free. Note that stream 0 is special, it is the
+    // old stream table.
+    if (!streamPages.empty()) layout.freePages = streamPages[0];
+
+    layout.leadingCount = leadingCount;
+    layout.pageCount    = pageCount;
+
+    // Construct the header page.
+    MSF_HEADER header = {};
+    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
+    header.pageSize              = (uint32_t)_pageSize;
+    header.freePageMap           = 1;
+    header.pageCount             = pageCount;
+    header.streamTableInfo.size  = (uint32_t)streamTableLength;
+    header.streamTableInfo.index = 0;
+
+    std::vector<uint8_t>& headerPage = layout.headerPage;
+    headerPage.assign(_pageSize, 0);
+    memcpy(headerPage.data(), &header, sizeof(header));
+    memcpy(headerPage.data() + sizeof(header), streamTablePgPg.data(),
+           streamTablePgPg.size() * sizeof(streamTablePgPg[0]));
+}
+
+void MsfFile::_write(const MsfSink& sink, FILE* f, Stats* stats,
+                     uint8_t digest[32]) const {
+    StatsPhase phase(stats, "writeMsf");
+
+    WriteLayout layout;
+    _planWrite(layout);
+
+    const std::vector<size_t>& order              = layout.order;
+    const size_t leadingCount                     = layout.leadingCount;
+    const std::vector<uint32_t>& streamTable      = layout.streamTable;
+    const std::vector<uint32_t>& streamTablePages = layout.streamTablePages;
+    const std::vector<uint8_t>& headerPage        = layout.headerPage;
+    const uint32_t pageCount                      = layout.pageCount;
+
+    const size_t streamTableLength = streamTable.size() * sizeof(uint32_t);
+
+    const size_t streamTablePagesLength =
+        streamTablePages.size() * sizeof(streamTablePages[0]);
+
+    // Construct the free page map.
+    FreePageMap fpm(pageCount);
+    fpm.setFree(3);  // The omnipresent superfluous page
+
+    for (auto page : layout.freePages) fpm.setFree(page);
+
+    // Everything is hashed on its way to the sink. This happens on the writing
+    // thread, so it overlaps with reading the next pages.
+    sha256_context ctx;
+    sha256_starts(&ctx);
+
+    const MsfSink hashingSink = [&](const void* data, size_t length) {
+        sha256_update(&ctx, (const unsigned char*)data, length);
+        sink(data, length);
+    };
+
+    // Now, write everything out in order.
+    PageWriter writer(digest ? hashingSink : sink, f, !digest, fpm, _pageSize);
+
+    writer.writePage(headerPage.data(), headerPage.size());
+    writer.skipFpm();
+    writer.writePage(nullptr, 0);
+
+    auto writeStreamTable = [&]() {
+        writeStream(writer, MsfStreamRef(new MsfReadOnlyStream(
+                                streamTableLength, streamTable.data())));
+
+        writeStream(writer,
+                    MsfStreamRef(new MsfReadOnlyStream(
+                        streamTablePagesLength, streamTablePages.data())));
+    };
+
+    // The pages of the original streams are copied straight from the stream
+    // table without creating a stream for each of them.
+    auto writeIndex = [&](size_t index) {
+        if (!_isOriginal[index]) {
+            writeStream(writer, _streams[index]);
+            return;
+        }
+
+        const StreamSpan& span = _spans[index];
+
+        const OriginalPages original = {
+            _map ? (const uint8_t*)_map->buf() : nullptr, _file.get(),
+            _originalPageSize, _pageList->data() + span.offset};
+
+        if (!copyOriginalPages(writer, original,
+                               ::pageCount<size_t>(_pageSize, span.length))) {
+            writeStream(writer, _originalStream(index));
+        }
+    };
+
+    // The next original stream is read in while the current one is written.
+    auto prefetchIndex = [&](size_t index) {
+        if (!_map || !_isOriginal[index]) return;
+
+        const StreamSpan& span = _spans[index];
+
+        prefetchPages(*_map, _originalPageSize, _pageList->data() + span.offset,
+                      ::pageCount<size_t>(_originalPageSize, span.length));
+    };
+
+    if (!order.empty()) prefetchIndex(order[0]);
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i == leadingCount && leadingCount > 0) writeStreamTable();
+
+        if (i + 1 < order.size()) prefetchIndex(order[i + 1]);
+
+        writeIndex(order[i]);
+    }
+
+    if (leadingCount == 0 || leadingCount == order.size()) writeStreamTable();
+
+    writer.finish();
+
+    assert(writer.pageCount() == pageCount);
+
+    if (digest) sha256_finish(&ctx, digest);
+
+    addStat(stats, "pagesWritten", pageCount);
+    addStat(stats, "bytesWritten", (uint64_t)pageCount * _pageSize);
+    addStat(stats, "pagesCopied", writer.copiedPages());
+    addStat(stats, "pagesCopiedByKernel", writer.kernelCopiedPages());
+}
+
+bool MsfFile::_canWriteConcurrently() const {
+    if (_file) return false;
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        if (_isOriginal[i]) continue;
+
+        MsfStream* stream = _streams[i].get();
+
+        if (auto overlay = dynamic_cast<MsfOverlayStream*>(stream))
+            stream = overlay->original().get();
+
+        if (dynamic_cast<MsfFileStream*>(stream)) return false;
+    }
+
+    return true;
+}
+
+void MsfFile::_writeConcurrently(FILE* f, Stats* stats) const {
+    StatsPhase phase(stats, "writeMsf");
+
+    WriteLayout layout;
+    _planWrite(layout);
+
+    const uint32_t pageCount = layout.pageCount;
+
+    FreePageMap fpm(pageCount);
+    fpm.setFree(3);  // The omnipresent superfluous page
+
+    for (auto page : layout.freePages) fpm.setFree(page);
+
+    // Pages that aren't written below are left as zeros, which is what the
+    // sequential write would have written there.
+    resizeFile(f, (int64_t)pageCount * _pageSize);
+
+    // Every task writes its own pages, so they can run in any order.
+    std::vector<std::function<void()>> tasks;
+
+    std::atomic<size_t> copiedPages(0);
+
+    // The header and the first copy of each FPM.
+    tasks.push_back([&]() {
+        writeFileAt(f, 0, layout.headerPage.data(), _pageSize);
+
+        std::vector<uint8_t> buf(_pageSize);
+
+        for (size_t page = 1; page < pageCount; page += _pageSize) {
+            fpm.page(page / _pageSize, buf.data(), _pageSize);
+            writeFileAt(f, (int64_t)page * _pageSize, buf.data(), _pageSize);
+        }
+    });
+
+    tasks.push_back([&]() {
+        writePagesAt(f, layout.streamTablePages.data(), _pageSize,
+                     (const uint8_t*)layout.streamTable.data(),
+                     layout.streamTable.size() * sizeof(uint32_t));
+
+        writePagesAt(f, layout.streamTablePgPg.data(), _pageSize,
+                     (const uint8_t*)layout.streamTablePages.data(),
+                     layout.streamTablePages.size() * sizeof(uint32_t));
+    });
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        const std::vector<uint32_t>& pages = layout.streamPages[i];
+        if (pages.empty()) continue;
+
+        OriginalPages original = {};
+
+        if (_isOriginal[i]) {
+            original = {(const uint8_t*)_map->buf(), nullptr, _originalPageSize,
+                        _pageList->data() + _spans[i].offset};
+        } else {
+            findOriginalPages(_streams[i].get(), original);
+        }
+
+        // Pages of an MSF that are copied unchanged are split up so that big
+        // streams are copied by several threads.
+        if (original.map && original.pageSize == _pageSize) {
+            const size_t step = kConcurrentCopySize / _pageSize;
+
+            for (size_t first = 0; first < pages.size(); first += step) {
+                const size_t count = std::min(step, pages.size() - first);
+
+                tasks.push_back([=, &pages, &copiedPages]() {
+                    copyPagesAt(f, pages.data() + first, _pageSize,
+                                original.map, original.pages + first, count);
+                    copiedPages += count;
+                });
+            }
+
+            continue;
+        }
+
+        tasks.push_back([=, &pages]() {
+            MsfStreamRef stream =
+                _isOriginal[i] ? _originalStream(i) : _streams[i];
+            writeStreamAt(f, pages.data(), _pageSize, stream.get());
+        });
+    }
+
+    parallelFor(tasks.size(), _writeThreads, [&](size_t i) { tasks[i](); });
+
+    addStat(stats, "pagesWritten", pageCount);
+    addStat(stats, "bytesWritten", (uint64_t)pageCount * _pageSize);
+    addStat(stats, "pagesCopied", copiedPages);
+}
+
+bool MsfFile::_planInPlace(std::vector<uint32_t>& streamTable,
+                           std::vector<uint32_t>& streamTablePages,
+                           std::vector<uint32_t>& freed) const {
+    if (!_map || _streams.size() != _spans.size()) return false;
+
+    const MSF_HEADER* header = (const MSF_HEADER*)_map->buf();
+    const size_t pageSize    = header->pageSize;
+
+    // The page size and layout can only be changed by rewriting the whole MSF.
+    if (pageSize != _pageSize || !_leading.empty()) return false;
+
+    if (header->freePageMap != 1 && header->freePageMap != 2) return false;
+
+    streamTable.push_back((uint32_t)_streams.size());
+
+    for (size_t i = 0; i < _streams.size(); ++i)
+        streamTable.push_back((uint32_t)_streamLength(i));
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        const auto& stream    = _streams[i];
+        const uint32_t* pages = _pageList->data() + _spans[i].offset;
+
+        const size_t originalCount =
+            ::pageCount<size_t>(pageSize, _spans[i].length);
+
+        size_t count = 0;
+
+        if (_isOriginal[i]) {
+            count = originalCount;
+        } else if (stream) {
+            // The new stream must not depend on the pages we are about to
+            // overwrite. An overlay of the original stream is fine since only
+            // its modified pages are written.
+            if (std::dynamic_pointer_cast<MsfMappedStream>(stream))
+                return false;
+
+            if (auto overlay =
+                    std::dynamic_pointer_cast<MsfOverlayStream>(stream)) {
+                if (!_readsOriginal(i, overlay->original().get()) ||
+                    overlay->pageSize() != pageSize) {
+                    return false;
+                }
+            }
+
+            count = ::pageCount(pageSize, stream->length());
+
+            // Too big to fit in the original pages.
+            if (count > originalCount) return false;
+        }
+
+        streamTable.insert(streamTable.end(), pages, pages + count);
+        freed.insert(freed.end(), pages + count, pages + originalCount);
+    }
+
+    // The new stream table can't be larger than the original since none of the
+    // streams got any bigger.
+    const size_t stPagesCount =
+        ::pageCount(pageSize, streamTable.size() * sizeof(uint32_t));
+    assert(stPagesCount <= _streamTablePages.size());
+
+    streamTablePages.assign(_streamTablePages.begin(),
+                            _streamTablePages.begin() + stPagesCount);
+    freed.insert(freed.end(), _streamTablePages.begin() + stPagesCount,
+                 _streamTablePages.end());
+
+    // Likewise for the pages that list the stream table pages.
+    const uint32_t* rootPages = (const uint32_t*)(header + 1);
+
+    const size_t rootCount =
+        ::pageCount(pageSize, _streamTablePages.size() * sizeof(uint32_t));
+    const size_t newRootCount =
+        ::pageCount(pageSize, stPagesCount * sizeof(uint32_t));
+
+    freed.insert(freed.end(), rootPages + newRootCount, rootPages + rootCount);
+
+    return true;
+}
+
+bool MsfFile::canWriteInPlace() const {
+    std::vector<uint32_t> streamTable, streamTablePages, freed;
+    return _planInPlace(streamTable, streamTablePages, freed);
+}
+
+bool MsfFile::writeInPlace() {
+    std::vector<uint32_t> streamTable, streamTablePages, freed;
+
+    if (!_map || _map->readOnly() ||
+        !_planInPlace(streamTable, streamTablePages, freed)) {
+        return false;
+    }
+
+    uint8_t* buf          = (uint8_t*)_map->buf();
+    MSF_HEADER* header    = (MSF_HEADER*)buf;
+    const size_t pageSize = header->pageSize;
+
+    auto page = [&](size_t p) { return buf + p * pageSize; };
+
+    // Write out the replaced streams. Each one is written from the start of
+    // its original pages. The rest of the last page is zeroed out.
+    const uint32_t* pages = streamTable.data() + 1 + _streams.size();
+
+    for (size_t i = 0; i < _streams.size(); ++i) {
+        const auto& stream = _streams[i];
+
+        const size_t count = ::pageCount(pageSize, _streamLength(i));
+
+        auto overlay = std::dynamic_pointer_cast<MsfOverlayStream>(stream);
+
+        if (overlay) {
+            // The unmodified pages are already where they need to be.
+            for (size_t j = 0; j < count; ++j) {
+                if (const uint8_t* dirty = overlay->dirtyPage(j))
+                    memcpy(page(pages[j]), dirty, pageSize);
+            }
+
+            const size_t n = stream->length() % pageSize;
+            if (n > 0) memset(page(pages[count - 1]) + n, 0, pageSize - n);
+        } else if (stream && !_isOriginal[i]) {
+            stream->setPos(0);
+
+            for (size_t j = 0; j < count; ++j) {
+                uint8_t* p = page(pages[j]);
+                const size_t n = stream->read(pageSize, p);
+                memset(p + n, 0, pageSize - n);
+            }
+        }
+
+        pages += count;
+    }
+
+    // Write the stream table and the list of its pages.
+    const uint8_t* data = (const uint8_t*)streamTable.data();
+    size_t remaining    = streamTable.size() * sizeof(uint32_t);
+
+    for (auto p : streamTablePages) {
+        const size_t n = std::min(remaining, pageSize);
+        memcpy(page(p), data, n);
+        memset(page(p) + n, 0, pageSize - n);
+        data += n;
+        remaining -= n;
+    }
+
+    uint32_t* rootPages = (uint32_t*)(header + 1);
+
+    data      = (const uint8_t*)streamTablePages.data();
+    remaining = streamTablePages.size() * sizeof(uint32_t);
+
+    for (size_t i = 0; remaining > 0; ++i) {
+        const size_t n = std::min(remaining, pageSize);
+        memcpy(page(rootPages[i]), data, n);
+        memset(page(rootPages[i]) + n, 0, pageSize - n);
+        data += n;
+        remaining -= n;
+    }
+
+    // Update the header. The unused root page numbers are cleared.
+    const size_t rootCount =
+        ::pageCount(pageSize, _streamTablePages.size() * sizeof(uint32_t));
+    const size_t newRootCount =
+        ::pageCount(pageSize, streamTablePages.size() * sizeof(uint32_t));
+
+    memset(rootPages + newRootCount, 0,
+           (rootCount - newRootCount) * sizeof(uint32_t));
+
+    header->streamTableInfo.size =
+        (uint32_t)(streamTable.size() * sizeof(uint32_t));
+
+    // Mark the unused pages as free in the active FPM.
+    const size_t fpmPage = header->freePageMap;
+
+    auto fpmByte = [&](size_t p) -> uint8_t& {
+        const size_t i = p / 8;
+        return page((i / pageSize) * pageSize + fpmPage)[i % pageSize];
+    };
+
+    for (auto p : freed) fpmByte(p) |= 1 << (p % 8);
+
+    // Zero out every free page. Besides the pages freed above, these can
+    // contain leftovers from previous incremental links.
+    for (size_t p = 1; p < header->pageCount; ++p) {
+        if (isFpmPage(p, pageSize)) continue;
+        if (!(fpmByte(p) & (1 << (p % 8)))) continue;
+
+        uint8_t* contents = page(p);
+        if (contents[0] != 0 ||
+            memcmp(contents, contents + 1, pageSize - 1) != 0) {
+            memset(contents, 0, pageSize);
+        }
     }
 
-    // Write the free page map.
-    fpm.write(f.get());
+    return true;
 }
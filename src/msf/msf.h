@@ -23,11 +23,15 @@
 
 #include <stdint.h>
 #include <stdio.h>  // For FILE*
+#include <functional>
 #include <memory>
 #include <vector>
 
+#include "msf/arena.h"
 #include "msf/format.h"
+#include "msf/stream.h"
 #include "util/file.h"
+#include "util/memmap.h"
 
 /**
  * Thrown when an MSF is found to be invalid or unsupported.
@@ -42,17 +46,82 @@ class InvalidMsf {
     const char* why() const { return _why; }
 };
 
-class MsfStream;
+class Stats;
 
 typedef std::shared_ptr<MsfStream> MsfStreamRef;
 
+/**
+ * Receives the output of MsfFile::write() in order, one block at a time. The
+ * data is only valid for the duration of the call.
+ */
+typedef std::function<void(const void* data, size_t length)> MsfSink;
+
 class MsfFile {
    private:
+    // Where the pages of a stream read from the original MSF are listed.
+    struct StreamSpan {
+        // Index of the first page in `_pageList`.
+        size_t offset;
+
+        // Length of the stream, in bytes.
+        uint32_t length;
+    };
+
+    // The streams that have been added or replaced, or that have been
+    // returned by getStream(). A stream of the original MSF is null here until
+    // it is first needed.
     std::vector<MsfStreamRef> _streams;
 
+    // Whether each stream is still the one read from the original MSF.
+    std::vector<bool> _isOriginal;
+
+    // The page list of every original stream, as read from the stream table.
+    MsfPageListRef _pageList;
+    std::vector<StreamSpan> _spans;
+
+    // Page size of the original MSF.
+    size_t _originalPageSize;
+
+    // Memory for copies of streams made while patching.
+    MsfArenaRef _arena;
+
+    // Counts the reads from the streams of the original MSF.
+    MsfReadCounterRef _reads;
+
+    // Size of the pages used when writing this MSF out.
+    size_t _pageSize;
+
+    // Streams that are written out first. See setLeadingStreams().
+    std::vector<size_t> _leading;
+
+    // Number of threads that write() may use. See setWriteThreads().
+    size_t _writeThreads;
+
+    // The original MSF is read from one of these.
+    FileRef _file;
+    MemMapRef _map;
+
+    // Pages of the original stream table. These are needed to write the MSF
+    // back in place.
+    std::vector<uint32_t> _streamTablePages;
+
    public:
+    /**
+     * Creates an empty MSF. Streams can then be added with addStream(). This
+     * allows an MSF to be assembled from any stream implementation.
+     */
+    MsfFile();
+
     MsfFile(FileRef f);
 
+    /**
+     * Reads the MSF from a memory mapped file. The streams read their pages
+     * directly from the mapping and keep a reference to it.
+     *
+     * Throws: InvalidMsf if the MSF is invalid.
+     */
+    MsfFile(MemMapRef map);
+
     virtual ~MsfFile();
 
     /**
@@ -64,6 +133,10 @@ class MsfFile {
     /**
      * Returns the stream with the given index. Returns nullptr if it doesn't
      * exist.
+     *
+     * Streams of the original MSF are only created when they are first asked
+     * for. The same stream is returned every time after that. This is not safe
+     * to call from multiple threads at once.
      */
     MsfStreamRef getStream(size_t index);
 
@@ -77,11 +150,199 @@ class MsfFile {
      */
     size_t streamCount() const;
 
+    /**
+     * Returns the arena that copies of this MSF's streams should be allocated
+     * from. It is freed along with the MSF (and any streams still using it).
+     */
+    MsfArenaRef arena() const;
+
+    /**
+     * Returns the number of bytes read from the streams of the original MSF so
+     * far, by anything. Pages that write() copies straight to the output are
+     * not read through a stream and are counted by the "pagesCopied" statistic
+     * instead.
+     */
+    uint64_t bytesRead() const;
+
+    /**
+     * Returns the number of page reads that bytesRead() took. A page is counted
+     * each time it is read from.
+     */
+    uint64_t pagesRead() const;
+
+    /**
+     * Returns the size of the pages used when writing this MSF out. This is
+     * 4096 for a new MSF and the page size of the original file otherwise.
+     */
+    size_t pageSize() const;
+
+    /**
+     * Changes the page size used when writing this MSF out. It must be a power
+     * of two from 512 to 65536 bytes. Larger pages allow for larger MSFs.
+     *
+     * Throws: InvalidMsf if the page size is not supported.
+     */
+    void setPageSize(size_t pageSize);
+
+    /**
+     * Sets the streams that write() lays out first, in the given order. They
+     * are followed by the stream table and then by the rest of the streams in
+     * index order. This keeps the streams that are needed to find everything
+     * else close together at the start of the file. Indices of streams that
+     * don't exist are ignored.
+     *
+     * By default, all of the streams are written in index order followed by
+     * the stream table.
+     */
+    void setLeadingStreams(const std::vector<size_t>& streams);
+
+    /**
+     * Sets the number of threads that write(FileRef) may use, or 0 to use one
+     * per hardware thread. With more than one, the whole layout is planned and
+     * the file is resized before anything is written. The streams are then
+     * written straight to their pages in the file at the same time. The result
+     * is the same as writing them in order.
+     *
+     * This is ignored if a digest is requested or if this MSF was read from a
+     * file instead of a mapping, since those have to be read or written in
+     * order. By default, only one thread is used.
+     */
+    void setWriteThreads(size_t threads);
+
     /**
      * Writes this MsfFile out to a new file. A new header, FPM, and stream
      * table will be created.
      *
+     * The pages are written to the file on a separate thread while the next
+     * ones are being read, with a few large buffers in flight at once. See
+     * setWriteThreads() for writing streams concurrently instead.
+     *
+     * If `stats` is given, the time taken and the number of pages written are
+     * added to it.
+     *
+     * If `digest` is given, the SHA-256 digest of the whole file is stored in
+     * it. The pages are hashed on the writing thread as they are written, so
+     * the file doesn't need to be read again. Pages are then never copied by
+     * the kernel, since they would not pass through the hash.
+     *
      * Throws: MsfWriteError if the write fails.
      */
-    void write(FileRef f) const;
+    void write(FileRef f, Stats* stats = nullptr,
+               uint8_t digest[32] = nullptr) const;
+
+    /**
+     * Writes this MsfFile out in the same way as write(FileRef), but passes the
+     * bytes to the given sink instead of a file.
+     */
+    void write(const MsfSink& sink, Stats* stats = nullptr,
+               uint8_t digest[32] = nullptr) const;
+
+    /**
+     * Lays out this MsfFile in the same way as write() without reading or
+     * writing any pages. Returns the number of pages that write() would
+     * write, each of which is pageSize() bytes.
+     *
+     * Throws: InvalidMsf if write() would fail for the same reason.
+     */
+    size_t writtenPageCount() const;
+
+    /**
+     * Returns true if writeInPlace() can write this MsfFile back into the
+     * mapping it was read from. This is the case if every replaced stream fits
+     * in the pages of the original stream and no streams have been added.
+     */
+    bool canWriteInPlace() const;
+
+    /**
+     * Writes this MsfFile back into the writable mapping it was read from. Each
+     * replaced stream is written to the pages of the original stream and the
+     * stream table is rewritten in its original pages. Pages that are no longer
+     * used are zeroed out and marked as free.
+     *
+     * Unlike write(), this is not atomic. The MSF is left in an inconsistent
+     * state if this is interrupted.
+     *
+     * Returns: false if canWriteInPlace() is false or the mapping is
+     * read-only. In that case, nothing is modified.
+     */
+    bool writeInPlace();
+
+   private:
+    /**
+     * Creates a stream that reads the pages of the original stream `index`.
+     */
+    MsfStreamRef _originalStream(size_t index) const;
+
+    /**
+     * Returns true if `stream` reads the pages of the original stream `index`.
+     */
+    bool _readsOriginal(size_t index, const MsfStream* stream) const;
+
+    /**
+     * Returns the current length of the stream `index`, in bytes. A missing
+     * stream has a length of 0.
+     */
+    size_t _streamLength(size_t index) const;
+
+    /**
+     * Implements both versions of write(). If `f` is given, pages may be copied
+     * to it by the kernel instead of going through `sink`.
+     */
+    void _write(const MsfSink& sink, FILE* f, Stats* stats,
+                uint8_t digest[32]) const;
+
+    /**
+     * Returns true if write(FileRef) can read the streams from several threads
+     * at once. Streams that read from a file can't, since they share its
+     * position.
+     */
+    bool _canWriteConcurrently() const;
+
+    /**
+     * Implements write(FileRef) with positional writes from several threads.
+     */
+    void _writeConcurrently(FILE* f, Stats* stats) const;
+
+    // Where write() puts everything. See _planWrite().
+    struct WriteLayout {
+        // The streams in the order they are written, and how many of them
+        // come before the stream table.
+        std::vector<size_t> order;
+        size_t leadingCount;
+
+        // The stream table, the pages it is written to, and the pages those
+        // are listed in.
+        std::vector<uint32_t> streamTable;
+        std::vector<uint32_t> streamTablePages;
+        std::vector<uint32_t> streamTablePgPg;
+
+        // The pages allocated to each stream, by stream index.
+        std::vector<std::vector<uint32_t>> streamPages;
+
+        // Pages that are written but marked as free.
+        std::vector<uint32_t> freePages;
+
+        // The header, which is the first page.
+        std::vector<uint8_t> headerPage;
+
+        // Total number of pages.
+        uint32_t pageCount;
+    };
+
+    /**
+     * Allocates the pages of every stream and of the stream table for write()
+     * and creates the header.
+     *
+     * Throws: InvalidMsf if the stream table doesn't fit.
+     */
+    void _planWrite(WriteLayout& layout) const;
+
+    /**
+     * Calculates the new stream table for writing in place. The stream table
+     * pages, and pages that will no longer be used, are appended to the given
+     * vectors. Returns false if writing in place is not possible.
+     */
+    bool _planInPlace(std::vector<uint32_t>& streamTable,
+                      std::vector<uint32_t>& streamTablePages,
+                      std::vector<uint32_t>& freed) const;
 };
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/overlay_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "msf/file_stream.h"
+#include "msf/mapped_stream.h"
+
+namespace {
+
+// Page size used if the original stream is not backed by an MSF file.
+const size_t kDefaultPageSize = 4096;
+
+size_t originalPageSize(MsfStream* stream) {
+    if (auto mapped = dynamic_cast<MsfMappedStream*>(stream))
+        return mapped->pageSize();
+
+    if (auto file = dynamic_cast<MsfFileStream*>(stream))
+        return file->pageSize();
+
+    return kDefaultPageSize;
+}
+
+}  // namespace
+
+MsfOverlayStream::MsfOverlayStream(MsfStreamRef original)
+    : _original(original),
+      _pageSize(originalPageSize(original.get())),
+      _pos(0),
+      _length(original->length()),
+      _dirty(::pageCount(_pageSize, _length)) {}
+
+size_t MsfOverlayStream::length() const { return _length; }
+
+void MsfOverlayStream::truncate(size_t length) {
+    if (length >= _length) return;
+
+    _length = length;
+    _dirty.resize(::pageCount(_pageSize, _length));
+}
+
+size_t MsfOverlayStream::getPos() const { return _pos; }
+
+void MsfOverlayStream::setPos(size_t pos) { _pos = pos; }
+
+uint8_t* MsfOverlayStream::makeDirty(size_t i) {
+    if (!_dirty[i]) {
+        std::unique_ptr<uint8_t[]> page(new uint8_t[_pageSize]);
+
+        const size_t offset = i * _pageSize;
+        const size_t length = std::min(_pageSize, _length - offset);
+
+        _original->setPos(offset);
+        if (_original->read(length, page.get()) != length)
+            throw InvalidMsf("failed to read MSF stream page");
+
+        memset(page.get() + length, 0, _pageSize - length);
+
+        _dirty[i] = std::move(page);
+    }
+
+    return _dirty[i].get();
+}
+
+size_t MsfOverlayStream::read(size_t length, void* buf) {
+    if (_pos >= _length) return 0;
+
+    length = std::min(length, _length - _pos);
+
+    size_t bytesRead = 0;
+
+    while (bytesRead < length) {
+        const size_t i      = _pos / _pageSize;
+        const size_t offset = _pos % _pageSize;
+        const size_t chunkSize =
+            std::min(length - bytesRead, _pageSize - offset);
+
+        uint8_t* out = (uint8_t*)buf + bytesRead;
+
+        if (const uint8_t* page = _dirty[i].get()) {
+            memcpy(out, page + offset, chunkSize);
+        } else {
+            _original->setPos(_pos);
+            if (_original->read(chunkSize, out) != chunkSize)
+                throw InvalidMsf("failed to read MSF stream page");
+        }
+
+        bytesRead += chunkSize;
+        _pos += chunkSize;
+    }
+
+    return bytesRead;
+}
+
+size_t MsfOverlayStream::read(void* buf) {
+    if (_pos >= _length) return 0;
+    return read(_length - _pos, buf);
+}
+
+size_t MsfOverlayStream::write(size_t length, const void* buf) {
+    if (_pos >= _length) return 0;
+
+    length = std::min(length, _length - _pos);
+
+    size_t bytesWritten = 0;
+
+    while (bytesWritten < length) {
+        const size_t i      = _pos / _pageSize;
+        const size_t offset = _pos % _pageSize;
+        const size_t chunkSize =
+            std::min(length - bytesWritten, _pageSize - offset);
+
+        memcpy(makeDirty(i) + offset, (const uint8_t*)buf + bytesWritten,
+               chunkSize);
+
+        bytesWritten += chunkSize;
+        _pos += chunkSize;
+    }
+
+    return bytesWritten;
+}
+
+size_t MsfOverlayStream::dirtyPageCount() const {
+    size_t count = 0;
+
+    for (auto&& page : _dirty) {
+        if (page) ++count;
+    }
+
+    return count;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "msf/msf.h"
+#include "msf/stream.h"
+
+/**
+ * An MSF stream that records writes on top of another stream.
+ *
+ * Only the pages that are written to are copied into memory. Reads of the other
+ * pages fall through to the original stream. This is much cheaper than
+ * MsfMemoryStream when only a few bytes of a large stream need to be changed.
+ *
+ * When writing out the MSF, the unmodified pages can be copied straight from
+ * the original file.
+ *
+ * Note that reading from this stream moves the position of the original stream.
+ */
+class MsfOverlayStream : public MsfStream {
+   private:
+    MsfStreamRef _original;
+    size_t _pageSize;
+    size_t _pos;
+    size_t _length;
+
+    // Modified pages. Clean pages are null.
+    std::vector<std::unique_ptr<uint8_t[]>> _dirty;
+
+   public:
+    /**
+     * Params:
+     *   original = The stream to modify. It must not be changed for the
+     *              lifetime of this stream.
+     *
+     * The pages have the same size as the pages of the original stream if it
+     * was read from an MSF file.
+     */
+    explicit MsfOverlayStream(MsfStreamRef original);
+
+    /**
+     * Returns the length of the stream, in bytes.
+     */
+    size_t length() const;
+
+    /**
+     * Truncates the stream to the given length. Nothing happens if the stream
+     * is already shorter than that.
+     */
+    void truncate(size_t length);
+
+    /**
+     * Gets the current position, in bytes, in the stream.
+     */
+    size_t getPos() const;
+
+    /**
+     * Sets the current position, in bytes, in the stream.
+     */
+    void setPos(size_t p);
+
+    /**
+     * Reads a length of the stream. Reading past the end of the stream is not
+     * possible.
+     *
+     * Params:
+     *   length = The number of bytes to read from the stream.
+     *   buf    = The buffer to read the stream into.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(size_t length, void* buf);
+
+    /**
+     * Reads the entire stream.
+     *
+     * Params:
+     *   buf = The buffer to read the stream into. This must be large enough to
+     *         hold the entire stream.
+     *
+     * Returns: The number of bytes read.
+     */
+    size_t read(void* buf);
+
+    /**
+     * Writes a buffer to the stream from the current position. The stream
+     * cannot grow, so writing stops at the end of the stream.
+     *
+     * Returns: The number of bytes written.
+     */
+    size_t write(size_t length, const void* buf);
+
+    /**
+     * Returns the original stream.
+     */
+    const MsfStreamRef& original() const { return _original; }
+
+    /**
+     * Returns the length of one page, in bytes.
+     */
+    size_t pageSize() const { return _pageSize; }
+
+    /**
+     * Returns the contents of the `i`th page if it has been modified, or null
+     * if it is the same as in the original stream. Bytes past the end of the
+     * stream are unspecified.
+     */
+    const uint8_t* dirtyPage(size_t i) const {
+        return i < _dirty.size() ? _dirty[i].get() : nullptr;
+    }
+
+    /**
+     * Returns the number of pages that have been modified.
+     */
+    size_t dirtyPageCount() const;
+
+   private:
+    /**
+     * Returns the `i`th page, copying it from the original stream first if
+     * necessary.
+     */
+    uint8_t* makeDirty(size_t i);
+};
@@ -22,8 +22,13 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 /**
  * Helper function for computing the number of pages required to hold a length
  * of bytes.
@@ -33,6 +38,31 @@ inline T pageCount(T pageSize, T length) {
     return (length + pageSize - 1) / pageSize;
 }
 
+/**
+ * Page numbers shared by the streams of an MSF. Each stream refers to its own
+ * range of the list instead of having a copy of its pages.
+ */
+typedef std::shared_ptr<const std::vector<uint32_t>> MsfPageListRef;
+
+/**
+ * Counts the bytes read from the streams of an MSF file and the number of page
+ * reads that took. A page is counted each time it is read from. The streams of
+ * one MSF share a counter and may be read from several threads at once.
+ */
+struct MsfReadCounter {
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> pages;
+
+    MsfReadCounter() : bytes(0), pages(0) {}
+
+    void add(uint64_t byteCount, uint64_t pageCount) {
+        bytes.fetch_add(byteCount, std::memory_order_relaxed);
+        pages.fetch_add(pageCount, std::memory_order_relaxed);
+    }
+};
+
+typedef std::shared_ptr<MsfReadCounter> MsfReadCounterRef;
+
 /**
  * Represents an MSF stream.
  *
@@ -104,6 +104,42 @@ struct PdbStream70 : public PdbStream {
 
 static_assert(sizeof(PdbStream70) == 28, "invalid struct size");
 
+/**
+ * The header of the type info (TPI) and ID info (IPI) streams. The type
+ * records follow it.
+ */
+struct TpiStreamHeader {
+    uint32_t version;
+
+    // Size of this header, in bytes.
+    uint32_t headerSize;
+
+    // The type records have the indices [typeIndexBegin, typeIndexEnd).
+    uint32_t typeIndexBegin;
+    uint32_t typeIndexEnd;
+
+    // Size of the type records following the header, in bytes.
+    uint32_t typeRecordBytes;
+
+    // Stream with the hashes of the type records and an auxiliary hash
+    // stream, or invalidStream if there are none.
+    uint16_t hashStream;
+    uint16_t hashAuxStream;
+
+    uint32_t hashKeySize;
+    uint32_t hashBucketCount;
+
+    // Offsets and sizes of the parts of the hash stream.
+    int32_t hashValueOffset;
+    uint32_t hashValueSize;
+    int32_t indexOffsetOffset;
+    uint32_t indexOffsetSize;
+    int32_t hashAdjOffset;
+    uint32_t hashAdjSize;
+};
+
+static_assert(sizeof(TpiStreamHeader) == 56, "invalid struct size");
+
 /**
  * The DBI header signature.
  */
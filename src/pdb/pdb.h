@@ -21,9 +21,6 @@
  */
 #pragma once
 
-#include <map>
-#include <string>
-
 /**
  * Thrown when a PDB is found to be invalid or unsupported.
  */
@@ -36,7 +33,3 @@ class InvalidPdb {
 
     const char* why() const { return _why; }
 };
-
-using NameMapTable = std::map<std::string, uint32_t>;
-
-NameMapTable readNameMapTable(const uint8_t* data, const uint8_t* dataEnd);
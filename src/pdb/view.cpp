@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pdb/view.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+namespace {
+
+/**
+ * Finds the end of a null-terminated string that must end before `end`.
+ * Returns nullptr if it doesn't.
+ */
+const char* findTerminator(const char* s, const char* end) {
+    return (const char*)memchr(s, 0, end - s);
+}
+
+}  // namespace
+
+StringRef::StringRef(const char* s) : _data(s), _length(strlen(s)) {}
+
+int StringRef::compare(StringRef other) const {
+    const size_t n = std::min(_length, other._length);
+
+    if (n > 0) {
+        if (int cmp = memcmp(_data, other._data, n)) return cmp;
+    }
+
+    if (_length < other._length) return -1;
+    if (_length > other._length) return 1;
+    return 0;
+}
+
+std::ostream& operator<<(std::ostream& os, StringRef s) {
+    return os.write(s.data(), s.length());
+}
+
+NameMapView::iterator::iterator(const NameMapView* view, size_t index)
+    : _view(view), _index(index) {
+    if (_index < _view->size()) _entry = (*_view)[_index];
+}
+
+NameMapView::iterator& NameMapView::iterator::operator++() {
+    if (++_index < _view->size()) _entry = (*_view)[_index];
+    return *this;
+}
+
+NameMapView::NameMapView()
+    : _strings(nullptr), _stringsLength(0), _pairs(nullptr), _count(0) {}
+
+NameMapView::NameMapView(const uint8_t* data, const uint8_t* dataEnd) {
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing PDB name table strings length");
+
+    _stringsLength = *(const uint32_t*)data;
+    data += sizeof(_stringsLength);
+
+    if (size_t(dataEnd - data) < _stringsLength)
+        throw InvalidPdb("missing PDB name table strings data");
+
+    // The names of the streams. We'll index into this later.
+    _strings = (const char*)data;
+    data += _stringsLength;
+
+    if (size_t(dataEnd - data) < 2 * sizeof(uint32_t))
+        throw InvalidPdb("missing PDB stream name map sizes");
+
+    // The number of elements in the hash table.
+    const uint32_t elemCount = *(const uint32_t*)data;
+    data += sizeof(elemCount);
+
+    // The maximum number of elements in the hash table. This isn't needed.
+    data += sizeof(uint32_t);
+
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing PDB name table 'present' bitset size");
+
+    // Skip over the "present" bitset.
+    const uint32_t presentSize = *(const uint32_t*)data;
+    data += sizeof(presentSize);
+
+    if (size_t(dataEnd - data) / sizeof(uint32_t) < presentSize)
+        throw InvalidPdb("missing PDB name table 'present' bitset data");
+
+    data += presentSize * sizeof(uint32_t);
+
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing PDB name table 'deleted' bitset size");
+
+    // Skip over the "deleted" bitset.
+    const uint32_t deletedSize = *(const uint32_t*)data;
+    data += sizeof(deletedSize);
+
+    if (size_t(dataEnd - data) / sizeof(uint32_t) < deletedSize)
+        throw InvalidPdb("missing PDB name table 'deleted' bitset data");
+
+    data += deletedSize * sizeof(uint32_t);
+
+    if (size_t(dataEnd - data) / (2 * sizeof(uint32_t)) < elemCount)
+        throw InvalidPdb("missing PDB name table pairs");
+
+    // Finally, the pairs of string offsets and stream indices.
+    _pairs = (const uint32_t*)data;
+    _count = elemCount;
+
+    for (size_t i = 0; i < _count; ++i) {
+        const uint32_t offset = _pairs[i * 2];
+
+        if (offset >= _stringsLength)
+            throw InvalidPdb(
+                "invalid PDB name table offset into strings buffer");
+
+        if (!findTerminator(_strings + offset, _strings + _stringsLength))
+            throw InvalidPdb("PDB name table string is not null-terminated");
+    }
+}
+
+NameMapEntry NameMapView::operator[](size_t i) const {
+    const char* name = _strings + _pairs[i * 2];
+    const char* end  = findTerminator(name, _strings + _stringsLength);
+
+    NameMapEntry entry;
+    entry.name   = StringRef(name, end - name);
+    entry.stream = _pairs[i * 2 + 1];
+    return entry;
+}
+
+NameMapView::iterator NameMapView::find(StringRef name) const {
+    for (size_t i = 0; i < _count; ++i) {
+        if ((*this)[i].name == name) return iterator(this, i);
+    }
+
+    return end();
+}
+
+ModuleInfoView::iterator::iterator(uint8_t* data, size_t length, size_t offset)
+    : _data(data), _length(length), _offset(offset), _size(0) {
+    if (_offset < _length) parse();
+}
+
+void ModuleInfoView::iterator::parse() {
+    if (_length - _offset < sizeof(ModuleInfo))
+        throw InvalidPdb("got partial DBI module info");
+
+    ModuleInfo* info = (ModuleInfo*)(_data + _offset);
+
+    // The module name is followed by the object name. Both must end before
+    // the end of the substream.
+    const char* end = (const char*)_data + _length;
+
+    const char* moduleName    = info->names;
+    const char* moduleNameEnd = findTerminator(moduleName, end);
+    if (!moduleNameEnd) throw InvalidPdb("got partial DBI module info");
+
+    const char* objectName    = moduleNameEnd + 1;
+    const char* objectNameEnd = findTerminator(objectName, end);
+    if (!objectNameEnd) throw InvalidPdb("got partial DBI module info");
+
+    _entry.info       = info;
+    _entry.moduleName = StringRef(moduleName, moduleNameEnd - moduleName);
+    _entry.objectName = StringRef(objectName, objectNameEnd - objectName);
+
+    // Records are aligned to 4 bytes.
+    _size = (size_t(objectNameEnd + 1 - (const char*)info) + 3) & ~size_t(3);
+}
+
+ModuleInfoView::iterator& ModuleInfoView::iterator::operator++() {
+    _offset += _size;
+    if (_offset < _length) parse();
+    return *this;
+}
+
+bool ModuleInfoView::iterator::operator==(const iterator& o) const {
+    // The padding of the last record may go past the end.
+    const bool atEnd  = _offset >= _length;
+    const bool oAtEnd = o._offset >= o._length;
+
+    if (atEnd || oAtEnd) return atEnd == oAtEnd;
+
+    return _offset == o._offset;
+}
+
+size_t ModuleInfoView::count() const {
+    size_t n = 0;
+    for (auto it = begin(); it != end(); ++it) ++n;
+    return n;
+}
+
+SectionContributionView::SectionContributionView(uint8_t* data,
+                                                 size_t length) {
+    if (length < sizeof(_version))
+        throw InvalidPdb("missing section contribution substream version");
+
+    _version = *(const SectionContribVersion*)data;
+
+    if (_version != SectionContribVersion::v1 &&
+        _version != SectionContribVersion::v2) {
+        throw InvalidPdb("got invalid section contribution substream version");
+    }
+
+    _contribs = (SectionContribution*)(data + sizeof(_version));
+    _count    = (length - sizeof(_version)) / sizeof(SectionContribution);
+}
+
+FileInfoView::FileInfoView(uint8_t* data, size_t length, size_t moduleCount)
+    : _moduleCount(moduleCount) {
+    // Skip over the header as it doesn't always provide correct information.
+    size_t pos = sizeof(FileInfoHeader);
+
+    // Skip over file indices array. We don't need them.
+    pos += moduleCount * sizeof(uint16_t);
+
+    // File counts array
+    _fileCounts = (const uint16_t*)(data + pos);
+    pos += moduleCount * sizeof(uint16_t);
+
+    if (pos >= length) throw InvalidPdb("got partial file info in DBI stream");
+
+    _nameCount = 0;
+    for (size_t i = 0; i < moduleCount; ++i) _nameCount += _fileCounts[i];
+
+    _offsets = (const uint32_t*)(data + pos);
+    pos += _nameCount * sizeof(uint32_t);
+
+    if (pos >= length) throw InvalidPdb("got partial file info in DBI stream");
+
+    _names       = (char*)(data + pos);
+    _namesLength = length - pos;
+}
+
+uint32_t FileInfoView::nameOffset(size_t i) const {
+    const uint32_t offset = _offsets[i];
+
+    if (offset >= _namesLength)
+        throw InvalidPdb("invalid offset for file info name");
+
+    return offset;
+}
+
+StringRef FileInfoView::name(size_t i) const {
+    const char* name = _names + nameOffset(i);
+    const char* end  = findTerminator(name, _names + _namesLength);
+
+    if (!end) throw InvalidPdb("file name exceeds file info section size");
+
+    return StringRef(name, end - name);
+}
+
+DbiView::DbiView(uint8_t* data, size_t length) : _data(data), _length(length) {
+    if (_length < sizeof(DbiHeader)) throw InvalidPdb("DBI stream too short");
+}
+
+uint8_t* DbiView::substream(size_t offset, size_t length,
+                            const char* what) const {
+    if (offset > _length || _length - offset < length) throw InvalidPdb(what);
+
+    return _data + offset;
+}
+
+size_t DbiView::sectionContributionOffset() const {
+    return sizeof(DbiHeader) + header().gpModInfoSize;
+}
+
+size_t DbiView::fileInfoOffset() const {
+    const DbiHeader& dbi = header();
+    return sectionContributionOffset() + dbi.sectionContributionSize +
+           dbi.sectionMapSize;
+}
+
+size_t DbiView::debugHeaderOffset() const {
+    const DbiHeader& dbi = header();
+    return fileInfoOffset() + dbi.fileInfoSize + dbi.typeServerMapSize +
+           dbi.ecInfoSize;
+}
+
+ModuleInfoView DbiView::moduleInfo() const {
+    const size_t length = header().gpModInfoSize;
+
+    return ModuleInfoView(
+        substream(sizeof(DbiHeader), length,
+                  "DBI module info size exceeds stream length"),
+        length);
+}
+
+SectionContributionView DbiView::sectionContributions() const {
+    const size_t length = header().sectionContributionSize;
+
+    return SectionContributionView(
+        substream(sectionContributionOffset(), length,
+                  "DBI section contributions size exceeds stream length"),
+        length);
+}
+
+FileInfoView DbiView::fileInfo(size_t moduleCount) const {
+    const size_t length = header().fileInfoSize;
+
+    return FileInfoView(substream(fileInfoOffset(), length,
+                                  "Missing file info in DBI stream"),
+                        length, moduleCount);
+}
+
+const int16_t* DbiView::debugStreams() const {
+    const size_t length = header().debugHeaderSize;
+
+    const uint8_t* data =
+        substream(debugHeaderOffset(), length, "missing DBI debug header");
+
+    if (length / sizeof(int16_t) < DebugTypes::count)
+        throw InvalidPdb("got partial DBI debug header");
+
+    return (const int16_t*)data;
+}
+
+SymbolRecord* SymbolRecordReader::next() {
+    if (_offset >= _length) return nullptr;
+
+    if (_length - _offset < sizeof(SymbolRecord)) {
+        if (_final) throw InvalidPdb("got partial symbol record");
+        return nullptr;
+    }
+
+    SymbolRecord* rec = (SymbolRecord*)(_data + _offset);
+
+    // The symbol record length must be at least the size of SymbolRecord::type
+    // and the size of the entire record must be a multiple of 4.
+    if (rec->length < sizeof(rec->type) ||
+        (rec->length + sizeof(rec->length)) % 4 != 0) {
+        throw InvalidPdb("invalid symbol record size");
+    }
+
+    const size_t size = sizeof(rec->length) + rec->length;
+
+    if (size > _length - _offset) {
+        if (_final) throw InvalidPdb("symbol record size too large");
+        return nullptr;
+    }
+
+    _offset += size;
+
+    return rec;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iosfwd>
+#include <iterator>
+#include <string>
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+/**
+ * Views over the data of PDB streams. None of these copy anything; they point
+ * into a buffer that must outlive them. Everything is bounds-checked and an
+ * InvalidPdb is thrown if the data is malformed.
+ */
+
+/**
+ * A string that is not owned. This is the same idea as C++17's
+ * std::string_view.
+ */
+class StringRef {
+   private:
+    const char* _data;
+    size_t _length;
+
+   public:
+    StringRef() : _data(""), _length(0) {}
+    StringRef(const char* s);
+    StringRef(const char* s, size_t length) : _data(s), _length(length) {}
+    StringRef(const std::string& s) : _data(s.data()), _length(s.length()) {}
+
+    const char* data() const { return _data; }
+    size_t length() const { return _length; }
+    bool empty() const { return _length == 0; }
+
+    const char* begin() const { return _data; }
+    const char* end() const { return _data + _length; }
+
+    std::string str() const { return std::string(_data, _length); }
+
+    int compare(StringRef other) const;
+};
+
+inline bool operator==(StringRef a, StringRef b) { return a.compare(b) == 0; }
+inline bool operator!=(StringRef a, StringRef b) { return a.compare(b) != 0; }
+inline bool operator<(StringRef a, StringRef b) { return a.compare(b) < 0; }
+
+std::ostream& operator<<(std::ostream& os, StringRef s);
+
+/**
+ * An entry in the table of named streams.
+ */
+struct NameMapEntry {
+    StringRef name;
+    uint32_t stream;
+};
+
+/**
+ * The name map table in the PDB header stream. This maps the names of streams
+ * (e.g., "/LinkInfo") to stream indices.
+ *
+ * The format is as follows:
+ *
+ *  1. String buffer:
+ *     (a) stringsLength (4 bytes): The size of the string buffer
+ *     (b) strings (stringsLength bytes): A list of null-terminated strings.
+ *  2. The map of strings to stream indices:
+ *     (a) elemCount (4 byte): The number of items in the map (aka its
+ *         cardinality).
+ *     (b) elemCountMax (4 bytes): The capacity of the map.
+ *     (c) Bitset of present elements. This keeps track of which 'holes' have
+ *         been filled in the map. There should be elemCount bits set in this
+ *         bitset.
+ *         i. count (4 bytes): The number of elements in the bitset
+ *         ii. bitset (count * 4 bytes): The bits
+ *     (c) Bitmap of deleted elements
+ *         i. count (4 bytes): The number of elements in the bitset
+ *         ii. bitset (count * 4 bytes): The bits
+ *     (d) A list of elemCount (string offset, stream index) pairs.
+ *
+ * Microsoft's PDB implementation was used as a reference. More specifically,
+ * see the following files:
+ *
+ *  1. PDB/include/nmtni.h - NMTNI::reload() - for loading the name table from
+ *     disk, which includes a Map.
+ *  2. PDB/include/map.h - Map::reload() - for loading a Map from disk.
+ *  3. PDB/include/iset.h - ISet::reload() - for loading a bitset from disk,
+ *     which is just an Array of longs.
+ */
+class NameMapView {
+   private:
+    const char* _strings;
+    uint32_t _stringsLength;
+
+    // (string offset, stream index) pairs.
+    const uint32_t* _pairs;
+    size_t _count;
+
+   public:
+    class iterator {
+       private:
+        const NameMapView* _view;
+        size_t _index;
+        NameMapEntry _entry;
+
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef NameMapEntry value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const NameMapEntry* pointer;
+        typedef const NameMapEntry& reference;
+
+        iterator(const NameMapView* view, size_t index);
+
+        reference operator*() const { return _entry; }
+        pointer operator->() const { return &_entry; }
+
+        iterator& operator++();
+
+        bool operator==(const iterator& o) const { return _index == o._index; }
+        bool operator!=(const iterator& o) const { return _index != o._index; }
+    };
+
+    /**
+     * An empty table.
+     */
+    NameMapView();
+
+    /**
+     * Parses the table in [data, dataEnd).
+     */
+    NameMapView(const uint8_t* data, const uint8_t* dataEnd);
+
+    size_t size() const { return _count; }
+
+    NameMapEntry operator[](size_t i) const;
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, _count); }
+
+    /**
+     * Finds the stream with the given name. Returns end() if there is none.
+     */
+    iterator find(StringRef name) const;
+};
+
+/**
+ * A module info record along with its names.
+ */
+struct ModuleEntry {
+    ModuleInfo* info;
+    StringRef moduleName;
+    StringRef objectName;
+};
+
+/**
+ * The module info substream of the DBI stream. This is a list of variable
+ * length ModuleInfo records.
+ */
+class ModuleInfoView {
+   private:
+    uint8_t* _data;
+    size_t _length;
+
+   public:
+    class iterator {
+       private:
+        uint8_t* _data;
+        size_t _length;
+        size_t _offset;
+
+        // Size of the current record, including its names and padding.
+        size_t _size;
+
+        ModuleEntry _entry;
+
+        void parse();
+
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef ModuleEntry value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const ModuleEntry* pointer;
+        typedef const ModuleEntry& reference;
+
+        iterator(uint8_t* data, size_t length, size_t offset);
+
+        reference operator*() const { return _entry; }
+        pointer operator->() const { return &_entry; }
+
+        iterator& operator++();
+
+        bool operator==(const iterator& o) const;
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+    };
+
+    ModuleInfoView(uint8_t* data, size_t length)
+        : _data(data), _length(length) {}
+
+    iterator begin() const { return iterator(_data, _length, 0); }
+    iterator end() const { return iterator(_data, _length, _length); }
+
+    /**
+     * Returns the number of modules. This has to walk all of the records.
+     */
+    size_t count() const;
+};
+
+/**
+ * The section contributions substream of the DBI stream. This is a version
+ * followed by an array of SectionContribution.
+ */
+class SectionContributionView {
+   private:
+    SectionContribVersion _version;
+    SectionContribution* _contribs;
+    size_t _count;
+
+   public:
+    SectionContributionView(uint8_t* data, size_t length);
+
+    SectionContribVersion version() const { return _version; }
+
+    size_t size() const { return _count; }
+
+    SectionContribution& operator[](size_t i) const { return _contribs[i]; }
+
+    SectionContribution* begin() const { return _contribs; }
+    SectionContribution* end() const { return _contribs + _count; }
+};
+
+/**
+ * The file info substream of the DBI stream. This lists the source files that
+ * contribute to each module. The names are offsets into a buffer of
+ * null-terminated strings, and many of them point to the same string.
+ */
+class FileInfoView {
+   private:
+    size_t _moduleCount;
+    const uint16_t* _fileCounts;
+
+    const uint32_t* _offsets;
+    size_t _nameCount;
+
+    char* _names;
+    size_t _namesLength;
+
+   public:
+    /**
+     * The header doesn't always have the correct module count, so it must be
+     * taken from the module info substream instead.
+     */
+    FileInfoView(uint8_t* data, size_t length, size_t moduleCount);
+
+    size_t moduleCount() const { return _moduleCount; }
+
+    /**
+     * Number of files in the given module.
+     */
+    uint16_t fileCount(size_t module) const { return _fileCounts[module]; }
+
+    /**
+     * Total number of file names for all modules.
+     */
+    size_t nameCount() const { return _nameCount; }
+
+    /**
+     * Offset of the i'th file name in the names buffer.
+     */
+    uint32_t nameOffset(size_t i) const;
+
+    /**
+     * Returns the i'th file name.
+     */
+    StringRef name(size_t i) const;
+
+    /**
+     * The buffer of names. The names can be changed in place, so long as their
+     * length stays the same.
+     */
+    char* names() const { return _names; }
+};
+
+/**
+ * The DBI stream. This is the header followed by a number of substreams, one
+ * after the other.
+ */
+class DbiView {
+   private:
+    uint8_t* _data;
+    size_t _length;
+
+    /**
+     * Returns a pointer to a substream, checking that it is within the stream.
+     */
+    uint8_t* substream(size_t offset, size_t length, const char* what) const;
+
+    size_t sectionContributionOffset() const;
+    size_t fileInfoOffset() const;
+    size_t debugHeaderOffset() const;
+
+   public:
+    DbiView(uint8_t* data, size_t length);
+
+    DbiHeader& header() const { return *(DbiHeader*)_data; }
+
+    ModuleInfoView moduleInfo() const;
+
+    SectionContributionView sectionContributions() const;
+
+    FileInfoView fileInfo(size_t moduleCount) const;
+
+    /**
+     * The indices of the streams in the debug header. Index this with
+     * DebugTypes.
+     */
+    const int16_t* debugStreams() const;
+};
+
+/**
+ * Reads one symbol record after another.
+ */
+class SymbolRecordReader {
+   private:
+    uint8_t* _data;
+    size_t _length;
+    size_t _offset;
+    bool _final;
+
+   public:
+    /**
+     * If `final` is false, the data may stop partway through a record. That
+     * record is then left for later instead of being an error.
+     */
+    SymbolRecordReader(uint8_t* data, size_t length, bool final = true)
+        : _data(data), _length(length), _offset(0), _final(final) {}
+
+    /**
+     * Returns the next symbol record or nullptr if there are no more.
+     */
+    SymbolRecord* next();
+
+    /**
+     * Offset of the end of the last record returned by next().
+     */
+    size_t offset() const { return _offset; }
+};
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pdbdump/diff.h"
+
+#include "msf/mapped_stream.h"
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "util/memmap.h"
+#include "util/thread_pool.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pdb/view.h"
+
+namespace {
+
+// Streams are compared in chunks of this size. The chunks of every stream are
+// compared in parallel.
+const size_t kChunkSize = 1024 * 1024;
+
+// Differing bytes closer together than this are reported as one range.
+const size_t kMergeDistance = 8;
+
+// At most this many ranges are printed for each stream.
+const size_t kMaxRanges = 16;
+
+/**
+ * A range of bytes, [begin, end), that differs.
+ */
+struct ByteRange {
+    size_t begin;
+    size_t end;
+};
+
+/**
+ * Appends a range to a sorted list of ranges, merging it with the last one if
+ * they are close together.
+ */
+void addRange(std::vector<ByteRange>& ranges, size_t begin, size_t end) {
+    if (!ranges.empty() && begin <= ranges.back().end + kMergeDistance) {
+        ranges.back().end = std::max(ranges.back().end, end);
+        return;
+    }
+
+    ranges.push_back({begin, end});
+}
+
+/**
+ * Returns the stream as it is mapped from the file. This can be copied to read
+ * the same stream from several threads at once.
+ */
+std::shared_ptr<MsfMappedStream> mappedStream(MsfFile& msf, size_t index) {
+    auto stream = std::dynamic_pointer_cast<MsfMappedStream>(
+        msf.getStream(index));
+
+    if (!stream) throw InvalidMsf("stream is not mapped");
+
+    return stream;
+}
+
+/**
+ * A chunk of a stream that is present in both PDBs.
+ */
+struct Chunk {
+    size_t stream;
+    size_t offset;
+    size_t length;
+
+    // The ranges that differ. Set once the chunk has been compared.
+    std::vector<ByteRange> ranges;
+};
+
+/**
+ * Compares a chunk of the two versions of a stream.
+ */
+void compareChunk(const MsfMappedStream& a, const MsfMappedStream& b,
+                  Chunk& chunk) {
+    // Each chunk gets its own copy of the streams so that they can be read
+    // concurrently.
+    MsfMappedStream readerA(a), readerB(b);
+
+    std::vector<uint8_t> bufA(chunk.length), bufB(chunk.length);
+
+    readerA.setPos(chunk.offset);
+    readerB.setPos(chunk.offset);
+
+    if (readerA.read(chunk.length, bufA.data()) != chunk.length ||
+        readerB.read(chunk.length, bufB.data()) != chunk.length) {
+        throw InvalidMsf("failed to read stream");
+    }
+
+    if (memcmp(bufA.data(), bufB.data(), chunk.length) == 0) return;
+
+    for (size_t i = 0; i < chunk.length;) {
+        if (bufA[i] == bufB[i]) {
+            ++i;
+            continue;
+        }
+
+        size_t j = i + 1;
+        while (j < chunk.length && bufA[j] != bufB[j]) ++j;
+
+        addRange(chunk.ranges, chunk.offset + i, chunk.offset + j);
+
+        i = j;
+    }
+}
+
+/**
+ * Names the streams listed in the name map of the PDB header stream.
+ */
+void nameNamedStreams(MsfFile& msf, std::vector<std::string>& names) {
+    auto stream = msf.getStream((size_t)PdbStreamType::header);
+    if (!stream) return;
+
+    MsfMemoryStream header(stream.get());
+    if (header.length() < sizeof(PdbStream70)) return;
+
+    const NameMapView nameMap(header.data() + sizeof(PdbStream70),
+                              header.data() + header.length());
+
+    for (const auto& entry : nameMap) {
+        if (entry.stream < names.size() && names[entry.stream].empty())
+            names[entry.stream] = entry.name.str();
+    }
+}
+
+/**
+ * Names the streams listed in the DBI stream.
+ */
+void nameDbiStreams(MsfFile& msf, std::vector<std::string>& names) {
+    auto stream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!stream) return;
+
+    MsfMemoryStream copy(stream.get());
+    const DbiView dbi(copy.data(), copy.length());
+
+    auto name = [&](size_t index, const std::string& name) {
+        if (index < names.size() && names[index].empty()) names[index] = name;
+    };
+
+    const DbiHeader& header = dbi.header();
+    name(header.globalSymbolStream, "global symbols");
+    name(header.publicSymbolStream, "public symbols");
+    name(header.symbolRecordsStream, "symbol records");
+
+    for (const auto& module : dbi.moduleInfo())
+        name(module.info->stream, "module " + module.moduleName.str());
+
+    static const char* debugNames[DebugTypes::count] = {
+        "FPO",
+        "exception",
+        "fixup",
+        "OMAP to source",
+        "OMAP from source",
+        "section headers",
+        "token RID map",
+        "xdata",
+        "pdata",
+        "new FPO",
+        "original section headers",
+    };
+
+    const int16_t* debugStreams = dbi.debugStreams();
+
+    for (size_t i = 0; i < DebugTypes::count; ++i) {
+        if (debugStreams[i] >= 0) name((size_t)debugStreams[i], debugNames[i]);
+    }
+}
+
+/**
+ * Returns a name for each stream of the PDB that can be identified. The others
+ * are left empty. Invalid streams are skipped, since a PDB that can't be
+ * decoded can still be compared.
+ */
+std::vector<std::string> streamNames(MsfFile& msf) {
+    std::vector<std::string> names(msf.streamCount());
+
+    static const char* fixedNames[] = {"old stream table", "PDB header", "TPI",
+                                       "DBI", "IPI"};
+
+    for (size_t i = 0; i < names.size() && i < 5; ++i) names[i] = fixedNames[i];
+
+    try {
+        nameNamedStreams(msf, names);
+    } catch (const InvalidPdb&) {
+    }
+
+    try {
+        nameDbiStreams(msf, names);
+    } catch (const InvalidPdb&) {
+    }
+
+    return names;
+}
+
+/**
+ * How a stream differs between the two PDBs.
+ */
+struct StreamDiff {
+    size_t index;
+
+    // Length of the stream in each PDB, if it exists there.
+    bool inA, inB;
+    size_t lengthA, lengthB;
+
+    std::vector<ByteRange> ranges;
+};
+
+/**
+ * Prints the differences in one stream.
+ */
+void printStreamDiff(const StreamDiff& diff, const std::string& name,
+                     std::ostream& os) {
+    os << "Stream " << diff.index;
+    if (!name.empty()) os << " (" << name << ")";
+    os << ": ";
+
+    if (!diff.inB) {
+        os << "only in the first PDB\n";
+        return;
+    }
+
+    if (!diff.inA) {
+        os << "only in the second PDB\n";
+        return;
+    }
+
+    os << diff.ranges.size() << " differing range"
+       << (diff.ranges.size() == 1 ? "" : "s");
+
+    if (diff.lengthA != diff.lengthB)
+        os << ", length " << diff.lengthA << " vs. " << diff.lengthB;
+
+    os << "\n";
+
+    const auto fill = os.fill('0');
+
+    for (size_t i = 0; i < diff.ranges.size() && i < kMaxRanges; ++i) {
+        const ByteRange& range = diff.ranges[i];
+
+        const size_t length = range.end - range.begin;
+
+        os << "    0x" << std::hex << std::setw(8) << range.begin << "-0x"
+           << std::setw(8) << range.end << std::dec << " (" << length
+           << (length == 1 ? " byte)\n" : " bytes)\n");
+    }
+
+    os.fill(fill);
+
+    if (diff.ranges.size() > kMaxRanges)
+        os << "    ... and " << diff.ranges.size() - kMaxRanges << " more\n";
+}
+
+size_t diffPdbs(MsfFile& a, MsfFile& b, size_t threads, std::ostream& os) {
+    const size_t commonCount = std::min(a.streamCount(), b.streamCount());
+    const size_t streamCount = std::max(a.streamCount(), b.streamCount());
+
+    std::vector<std::shared_ptr<MsfMappedStream>> streamsA, streamsB;
+    std::vector<Chunk> chunks;
+
+    for (size_t i = 0; i < commonCount; ++i) {
+        streamsA.push_back(mappedStream(a, i));
+        streamsB.push_back(mappedStream(b, i));
+
+        const size_t length =
+            std::min(streamsA[i]->length(), streamsB[i]->length());
+
+        for (size_t offset = 0; offset < length; offset += kChunkSize) {
+            chunks.push_back(
+                {i, offset, std::min(kChunkSize, length - offset), {}});
+        }
+    }
+
+    parallelFor(chunks.size(), threads, [&](size_t i) {
+        Chunk& chunk = chunks[i];
+        compareChunk(*streamsA[chunk.stream], *streamsB[chunk.stream], chunk);
+    });
+
+    std::vector<StreamDiff> diffs;
+
+    // The chunks are in order, so the ranges of each stream are too.
+    auto chunk = chunks.begin();
+
+    for (size_t i = 0; i < streamCount; ++i) {
+        StreamDiff diff = {i, i < a.streamCount(), i < b.streamCount(), 0, 0,
+                           {}};
+
+        if (diff.inA) diff.lengthA = a.getStream(i)->length();
+        if (diff.inB) diff.lengthB = b.getStream(i)->length();
+
+        for (; chunk != chunks.end() && chunk->stream == i; ++chunk) {
+            for (const auto& range : chunk->ranges)
+                addRange(diff.ranges, range.begin, range.end);
+        }
+
+        // Bytes past the end of the shorter stream also differ.
+        const size_t common = std::min(diff.lengthA, diff.lengthB);
+        const size_t longer = std::max(diff.lengthA, diff.lengthB);
+        if (diff.inA && diff.inB && longer > common)
+            addRange(diff.ranges, common, longer);
+
+        if (!diff.inA || !diff.inB || !diff.ranges.empty())
+            diffs.push_back(diff);
+    }
+
+    if (diffs.empty()) {
+        os << "The PDBs have the same streams.\n";
+        return 0;
+    }
+
+    const auto namesA = streamNames(a);
+    const auto namesB = streamNames(b);
+
+    for (const auto& diff : diffs) {
+        const size_t i = diff.index;
+
+        std::string name;
+        if (i < namesA.size()) name = namesA[i];
+        if (name.empty() && i < namesB.size()) name = namesB[i];
+
+        printStreamDiff(diff, name, os);
+    }
+
+    os << diffs.size() << " of " << streamCount << " streams differ.\n";
+
+    return diffs.size();
+}
+
+template <typename CharT>
+size_t diffPdbsImpl(const CharT* a, const CharT* b, size_t threads,
+                    std::ostream& os) {
+    MsfFile msfA(std::make_shared<MemMap>(a, 0, true));
+    MsfFile msfB(std::make_shared<MemMap>(b, 0, true));
+
+    return diffPdbs(msfA, msfB, threads, os);
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+size_t diffPdbs(const wchar_t* a, const wchar_t* b, size_t threads,
+                std::ostream& os) {
+    return diffPdbsImpl(a, b, threads, os);
+}
+
+#else
+
+size_t diffPdbs(const char* a, const char* b, size_t threads,
+                std::ostream& os) {
+    return diffPdbsImpl(a, b, threads, os);
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <iostream>
+
+/**
+ * Compares two PDBs stream by stream and prints the streams that differ, along
+ * with the ranges of bytes that differ in each of them. Streams are named from
+ * the name map and the DBI stream where possible. These are only read if
+ * something differs, and identical streams are never decoded.
+ *
+ * The streams are compared in chunks using up to `threads` threads, so that
+ * even a single large stream is spread over all of them. If `threads` is 0,
+ * the number of hardware threads is used.
+ *
+ * Returns the number of streams that differ.
+ *
+ * Throws: InvalidMsf if either file is not a valid MSF.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+size_t diffPdbs(const wchar_t* a, const wchar_t* b, size_t threads,
+                std::ostream& os);
+
+#else
+
+size_t diffPdbs(const char* a, const char* b, size_t threads,
+                std::ostream& os);
+
+#endif
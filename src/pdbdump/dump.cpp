@@ -20,26 +20,30 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cstring>
-#include <iomanip>
-#include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "pdbdump/dump.h"
+#include "pdbdump/output.h"
 
 #include "msf/file_stream.h"
+#include "msf/mapped_stream.h"
 #include "msf/memory_stream.h"
 #include "msf/msf.h"
 #include "msf/stream.h"
 #include "util/file.h"
+#include "util/memmap.h"
 
 #include "pdb/format.h"
 #include "pdb/pdb.h"
+#include "pdb/view.h"
 
 namespace {
 
-void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os);
+void printLinkInfoStream(MsfMemoryStream* stream, Output& os);
 
 /**
  * Prints a nicely formatted page sequences (as if you were specifying the pages
@@ -53,7 +57,7 @@ void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os);
  *
  *    [0-4, 6-9, 20]
  */
-void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
+void printPageSequences(const std::vector<uint32_t>& pages, Output& os) {
     os << "[";
 
     for (size_t i = 0; i < pages.size();) {
@@ -67,141 +71,186 @@ void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
         // Find how long a run of pages is.
         for (; i < pages.size() && pages[i] == pages[i - 1] + 1; ++i) ++count;
 
-        if (count == 0) {
-            os << start << " (0x" << std::hex << (uint64_t)start * 4096 << "-0x"
-               << ((uint64_t)start + 1) * 4096 - 1 << ")" << std::dec;
-        } else {
-            os << start << "-" << start + count << " (0x" << std::hex
-               << ((uint64_t)start) * 4096 << "-0x"
-               << ((uint64_t)start + count + 1) * 4096 - 1 << ")" << std::dec;
-        }
+        os << start;
+
+        if (count > 0) os << "-" << start + count;
+
+        os << " (0x";
+        os.hex((uint64_t)start * 4096);
+        os << "-0x";
+        os.hex(((uint64_t)start + count + 1) * 4096 - 1);
+        os << ")";
     }
 
     os << "]";
 }
 
 /**
- * Prints the stream table.
+ * Returns the list of pages for the given stream.
  */
-void printStreamTable(MsfFile& msf, std::ostream& os) {
-    os << "Stream Table\n"
-       << "============\n";
+std::vector<uint32_t> streamPages(MsfStreamRef stream) {
+    if (auto s = std::dynamic_pointer_cast<MsfMappedStream>(stream))
+        return std::vector<uint32_t>(s->pages(), s->pages() + s->pageCount());
 
-    const size_t streamCount = msf.streamCount();
+    if (auto s = std::dynamic_pointer_cast<MsfFileStream>(stream))
+        return std::vector<uint32_t>(s->pages(), s->pages() + s->pageCount());
 
-    for (size_t i = 0; i < streamCount; ++i) {
-        auto stream =
-            std::dynamic_pointer_cast<MsfFileStream>(msf.getStream(i));
+    return std::vector<uint32_t>();
+}
 
-        const auto& pages = stream->pages();
+/**
+ * Prints the size and pages of one stream in the stream table.
+ */
+void printStreamTableEntry(MsfFile& msf, size_t i, Output& os) {
+    auto stream = msf.getStream(i);
 
-        os << std::setw(5) << i << ": " << std::setw(8) << stream->length()
-           << " bytes, " << std::setw(4) << pages.size() << " pages ";
+    const auto pages = streamPages(stream);
 
-        printPageSequences(pages, os);
+    os.dec(i, 5) << ": ";
+    os.dec(stream->length(), 8) << " bytes, ";
+    os.dec(pages.size(), 4) << " pages ";
 
-        std::cout << std::endl;
-    }
+    printPageSequences(pages, os);
 
-    os << std::endl;
+    os << "\n";
 }
 
 /**
- * Prints out a GUID to the given stream.
+ * Prints the stream table.
  */
-void printGUID(uint8_t guid[16], std::ostream& os) {
-    const auto flags = os.flags();
+void printStreamTable(MsfFile& msf, Output& os) {
+    os << "Stream Table\n"
+       << "============\n";
 
-    os << std::hex << std::setfill('0') << std::setw(2) << std::uppercase;
+    const size_t streamCount = msf.streamCount();
+
+    for (size_t i = 0; i < streamCount; ++i) printStreamTableEntry(msf, i, os);
+
+    os << "\n";
+}
 
-    for (size_t i = 0; i < 4; ++i) os << (int)guid[i];
+/**
+ * Prints out a GUID to the given stream.
+ */
+void printGUID(const uint8_t guid[16], Output& os) {
+    for (size_t i = 0; i < 4; ++i) os.hex(guid[i], 2, true);
     os << "-";
-    for (size_t i = 4; i < 6; ++i) os << (int)guid[i];
+    for (size_t i = 4; i < 6; ++i) os.hex(guid[i], 2, true);
     os << "-";
-    for (size_t i = 6; i < 8; ++i) os << (int)guid[i];
+    for (size_t i = 6; i < 8; ++i) os.hex(guid[i], 2, true);
     os << "-";
-    for (size_t i = 8; i < 10; ++i) os << (int)guid[i];
+    for (size_t i = 8; i < 10; ++i) os.hex(guid[i], 2, true);
     os << "-";
-    for (size_t i = 10; i < 16; ++i) os << (int)guid[i];
+    for (size_t i = 10; i < 16; ++i) os.hex(guid[i], 2, true);
+}
 
-    // Restore flags
-    os.flags(flags);
+/**
+ * Reads the PDB header stream into memory.
+ */
+std::unique_ptr<MsfMemoryStream> readPdbStream(MsfFile& msf) {
+    auto stream = msf.getStream((size_t)PdbStreamType::header);
+    if (!stream) throw InvalidPdb("missing PDB header stream");
+
+    return std::unique_ptr<MsfMemoryStream>(new MsfMemoryStream(stream.get()));
+}
+
+/**
+ * Returns the table of named streams that follows the PDB 7.0 header.
+ */
+NameMapView readNameMap(MsfMemoryStream* stream) {
+    if (stream->length() < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    const uint8_t* data = stream->data();
+
+    return NameMapView(data + sizeof(PdbStream70), data + stream->length());
+}
+
+/**
+ * Returns the entries of the name map sorted by name.
+ */
+std::vector<NameMapEntry> sortedNameMap(const NameMapView& nameMap) {
+    std::vector<NameMapEntry> entries(nameMap.begin(), nameMap.end());
+    std::sort(entries.begin(), entries.end(),
+              [](const NameMapEntry& a, const NameMapEntry& b) {
+                  return a.name < b.name;
+              });
+    return entries;
+}
+
+/**
+ * Reads the "/LinkInfo" stream into memory. Returns null if there is none.
+ */
+std::unique_ptr<MsfMemoryStream> readLinkInfoStream(
+    MsfFile& msf, const NameMapView& nameMap) {
+    const auto it = nameMap.find("/LinkInfo");
+    if (it == nameMap.end()) return nullptr;
+
+    auto stream = msf.getStream(it->stream);
+    if (!stream) throw InvalidPdb("missing '/LinkInfo' stream");
+
+    return std::unique_ptr<MsfMemoryStream>(new MsfMemoryStream(stream.get()));
 }
 
 /**
  * Prints out information in the PDB stream.
  */
-void printPdbStream(MsfFile& msf, std::ostream& os) {
+void printPdbStream(MsfFile& msf, Output& os) {
     static const size_t streamid = (size_t)PdbStreamType::header;
 
-    auto stream = msf.getStream(streamid);
-    if (!stream) throw InvalidPdb("missing PDB header stream");
+    const auto stream = readPdbStream(msf);
 
     os << "PDB Stream Info\n"
        << "===============\n";
 
-    os << "Stream ID:   " << streamid << std::endl;
-    os << "Stream Size: " << stream->length() << " bytes" << std::endl;
-    os << std::endl;
-
-    PdbStream70 header;
+    os << "Stream ID:   " << streamid << "\n";
+    os << "Stream Size: " << stream->length() << " bytes\n";
+    os << "\n";
 
-    if (stream->read(sizeof(header), &header) != sizeof(header))
+    if (stream->length() < sizeof(PdbStream70))
         throw InvalidPdb("missing PDB 7.0 header");
 
+    PdbStream70 header;
+    memcpy(&header, stream->data(), sizeof(header));
+
     os << "Header\n"
        << "------\n";
 
-    os << "Version:   " << (uint32_t)header.version << std::endl;
-    os << "Timestamp: " << header.timestamp << std::endl;
-    os << "Age:       " << header.age << std::endl;
+    os << "Version:   " << (uint32_t)header.version << "\n";
+    os << "Timestamp: " << header.timestamp << "\n";
+    os << "Age:       " << header.age << "\n";
     os << "Signature: ";
     printGUID(header.sig70, os);
-    os << std::endl;
-    os << std::endl;
+    os << "\n";
+    os << "\n";
 
     os << "Name Map Table\n"
        << "--------------\n";
 
-    // Read the rest of the stream, it should contain only the name map.
-    const size_t remaining = stream->length() - stream->getPos();
-    std::unique_ptr<uint8_t> buf(new uint8_t[remaining]);
-    if (stream->read(remaining, buf.get()) != remaining)
-        throw InvalidPdb("failed to read name map table");
-
-    auto nameMap = readNameMapTable(buf.get(), buf.get() + remaining);
+    // The rest of the stream should contain only the name map.
+    const NameMapView nameMap = readNameMap(stream.get());
 
-    for (auto const& kv : nameMap)
-        os << kv.first << " => " << kv.second << std::endl;
+    // Print the names in order.
+    for (const auto& entry : sortedNameMap(nameMap))
+        os << entry.name << " => " << entry.stream << "\n";
 
-    os << std::endl;
+    os << "\n";
 
     // Dump the /LinkInfo stream if it exists.
-    const auto it = nameMap.find("/LinkInfo");
-    if (it != nameMap.end()) {
-        auto linkInfoStream = msf.getStream(it->second);
-        if (!linkInfoStream) throw InvalidPdb("missing '/LinkInfo' stream");
-
-        auto memStream = std::shared_ptr<MsfMemoryStream>(
-            new MsfMemoryStream(linkInfoStream.get()));
-
-        printLinkInfoStream(memStream.get(), os);
-    }
+    if (auto linkInfoStream = readLinkInfoStream(msf, nameMap))
+        printLinkInfoStream(linkInfoStream.get(), os);
 }
 
 /**
- * Prints out information in the "/LinkInfo" stream.
+ * Returns the LinkInfo at the start of the stream, or null if the stream is
+ * empty.
  */
-void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os) {
-    uint8_t* data       = stream->data();
+const LinkInfo* readLinkInfo(MsfMemoryStream* stream) {
     const size_t length = stream->length();
 
-    if (length == 0) return;
-
-    os << "Link Info Stream\n"
-       << "================\n";
+    if (length == 0) return nullptr;
 
-    const LinkInfo* linkInfo = (const LinkInfo*)data;
+    const LinkInfo* linkInfo = (const LinkInfo*)stream->data();
 
     if (length < sizeof(LinkInfo))
         throw InvalidPdb("got partial LinkInfo stream");
@@ -209,303 +258,736 @@ void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os) {
     if (linkInfo->size > length)
         throw InvalidPdb("LinkInfo size too large for stream");
 
-    os << "CWD:         '" << linkInfo->cwd<char>() << "'" << std::endl
-       << "Command:     '" << linkInfo->command<char>() << "'" << std::endl
-       << "Libs:        '" << linkInfo->libs<char>() << "'" << std::endl
-       << "Output File: '" << linkInfo->outputFile<char>() << "'" << std::endl
-       << std::endl;
+    return linkInfo;
 }
 
 /**
- * Prints out information in the DBI stream.
+ * Prints out information in the "/LinkInfo" stream.
  */
-void printDbiStream(MsfFile& msf, std::ostream& os, bool verbose) {
-    static const size_t streamid = (size_t)PdbStreamType::dbi;
+void printLinkInfoStream(MsfMemoryStream* stream, Output& os) {
+    const LinkInfo* linkInfo = readLinkInfo(stream);
+    if (!linkInfo) return;
 
-    auto stream = msf.getStream(streamid);
-    if (!stream) return;
+    os << "Link Info Stream\n"
+       << "================\n";
 
-    os << "DBI Stream Info\n"
-       << "===============\n";
+    os << "CWD:         '" << linkInfo->cwd<char>() << "'\n"
+       << "Command:     '" << linkInfo->command<char>() << "'\n"
+       << "Libs:        '" << linkInfo->libs<char>() << "'\n"
+       << "Output File: '" << linkInfo->outputFile<char>() << "'\n"
+       << "\n";
+}
 
-    os << "Stream ID:   " << streamid << std::endl;
-    os << "Stream Size: " << stream->length() << " bytes" << std::endl;
-    os << std::endl;
+/**
+ * Reads the DBI stream into memory.
+ */
+std::unique_ptr<MsfMemoryStream> readDbiStream(MsfStream* stream) {
+    return std::unique_ptr<MsfMemoryStream>(new MsfMemoryStream(stream));
+}
 
-    DbiHeader dbi;
+/**
+ * Prints out the DBI header.
+ */
+void printDbiHeader(const DbiHeader& dbi, size_t streamLength, Output& os) {
+    os << "DBI Stream Info\n"
+       << "===============\n";
 
-    if (stream->read(sizeof(dbi), &dbi) != sizeof(dbi))
-        throw InvalidPdb("missing DBI dbi");
+    os << "Stream ID:   " << (size_t)PdbStreamType::dbi << "\n";
+    os << "Stream Size: " << streamLength << " bytes\n";
+    os << "\n";
 
     os << "Header\n"
        << "------\n";
 
-    os << "Signature:                          0x" << std::hex << dbi.signature
-       << std::dec << std::endl
-       << "Version:                            " << (uint32_t)dbi.version
-       << std::endl
-       << "Age:                                " << dbi.age << std::endl
+    os << "Signature:                          0x";
+    os.hex(dbi.signature) << "\n";
+
+    os << "Version:                            " << (uint32_t)dbi.version
+       << "\n"
+       << "Age:                                " << dbi.age << "\n"
        << "Global Symbol Info (GSI) Stream ID: " << dbi.globalSymbolStream
-       << std::endl
+       << "\n"
        << "PDB DLL Version:                    " << dbi.pdbDllVersion.major
        << "." << dbi.pdbDllVersion.minor << "." << dbi.pdbDllVersion.format
-       << std::endl
+       << "\n"
        << "Public Symbol Info (PSI) Stream ID: " << dbi.publicSymbolStream
-       << std::endl
+       << "\n"
        << "PDB DLL Build Major Version:        " << dbi.pdbDllBuildVersionMajor
-       << std::endl
+       << "\n"
        << "Symbol Records Stream ID:           " << dbi.symbolRecordsStream
-       << std::endl
+       << "\n"
        << "PDB DLL Build Minor Version:        " << dbi.pdbDllBuildVersionMinor
-       << std::endl
+       << "\n"
        << "Module Info Size:                   " << dbi.gpModInfoSize
-       << " bytes" << std::endl
+       << " bytes\n"
        << "Section Contribution Size:          " << dbi.sectionContributionSize
-       << " bytes" << std::endl
+       << " bytes\n"
        << "Section Map Size:                   " << dbi.sectionMapSize
-       << " bytes" << std::endl
-       << "File Info Size:                     " << dbi.fileInfoSize << " bytes"
-       << std::endl
+       << " bytes\n"
+       << "File Info Size:                     " << dbi.fileInfoSize
+       << " bytes\n"
        << "Type Server Map Size:               " << dbi.typeServerMapSize
-       << " bytes" << std::endl
-       << "MFC Type Server Index:              " << dbi.mfcIndex << std::endl
+       << " bytes\n"
+       << "MFC Type Server Index:              " << dbi.mfcIndex << "\n"
        << "Debug Header Size:                  " << dbi.debugHeaderSize
-       << " bytes" << std::endl
-       << "EC Info Size:                       " << dbi.ecInfoSize << " bytes"
-       << std::endl
-       << "Flags:" << std::endl
+       << " bytes\n"
+       << "EC Info Size:                       " << dbi.ecInfoSize
+       << " bytes\n"
+       << "Flags:\n"
        << "    Incrementally Linked:           "
-       << (dbi.flags.incLink ? "yes" : "no") << std::endl
+       << (dbi.flags.incLink ? "yes" : "no") << "\n"
        << "    Stripped:                       "
-       << (dbi.flags.stripped ? "yes" : "no") << std::endl
+       << (dbi.flags.stripped ? "yes" : "no") << "\n"
        << "    CTypes:                         "
-       << (dbi.flags.ctypes ? "yes" : "no") << std::endl
-       << "Machine Type:                       " << dbi.machine << std::endl
-       << std::endl;
+       << (dbi.flags.ctypes ? "yes" : "no") << "\n"
+       << "Machine Type:                       " << dbi.machine << "\n"
+       << "\n";
+}
+
+/**
+ * Prints out the module info substream. Returns the number of modules.
+ */
+size_t printModuleInfo(const DbiView& dbi, Output& os) {
+    os << "Module Info\n"
+       << "-----------\n";
 
     size_t moduleCount = 0;
 
-    {
-        os << "Module Info\n"
-           << "-----------\n";
+    for (const ModuleEntry& module : dbi.moduleInfo()) {
+        os << "Module ID:   " << moduleCount << "\n"
+           << "Module Name: '" << module.moduleName << "'\n"
+           << "Object Name: '" << module.objectName << "'\n"
+           << "Stream ID:   " << module.info->stream << "\n"
+           << "\n";
 
-        std::unique_ptr<uint8_t> modInfo(new uint8_t[dbi.gpModInfoSize]);
-        if (stream->read(dbi.gpModInfoSize, modInfo.get()) != dbi.gpModInfoSize)
-            throw InvalidPdb("failed to read module info sub-stream");
+        ++moduleCount;
+    }
 
-        // Print the module info
-        for (size_t i = 0; i < dbi.gpModInfoSize;) {
-            if (dbi.gpModInfoSize - i < sizeof(ModuleInfo))
-                throw InvalidPdb("got partial DBI module info");
+    return moduleCount;
+}
 
-            ModuleInfo* info = (ModuleInfo*)(modInfo.get() + i);
+/**
+ * Prints out the section contributions substream.
+ */
+void printSectionContributions(const DbiView& dbi, Output& os) {
+    os << "Section Contributions\n"
+       << "---------------------\n";
+
+    const SectionContributionView contribs = dbi.sectionContributions();
+
+    os << "Section Contribution Count: " << contribs.size() << "\n";
+
+    for (size_t i = 0; i < contribs.size(); ++i) {
+        const SectionContribution& sc = contribs[i];
+
+        os << "id              = " << i << "\n"
+           << "section         = " << sc.section << "\n"
+           << "padding1        = " << sc.padding1 << "\n"
+           << "offset          = 0x";
+        os.hex((uint32_t)sc.offset);
+        os << "\n"
+           << "size            = " << sc.size << "\n"
+           << "characteristics = " << sc.characteristics << "\n"
+           << "imod            = " << sc.imod << "\n"
+           << "padding2        = " << sc.padding2 << "\n"
+           << "dataCrc         = 0x";
+        os.hex(sc.dataCrc);
+        os << "\n"
+           << "relocCrc        = " << sc.relocCrc << "\n"
+           << "\n";
+    }
+
+    os << "\n";
+}
+
+/**
+ * Prints out the file info substream. These are files that correspond to each
+ * module as listed in the module info substream.
+ */
+void printFileInfo(const DbiView& dbi, size_t moduleCount, Output& os) {
+    os << "File Info\n"
+       << "---------\n";
 
-            os << "Module ID:   " << moduleCount << std::endl
-               << "Module Name: '" << info->moduleName() << "'" << std::endl
-               << "Object Name: '" << info->objectName() << "'" << std::endl
-               << "Stream ID:   " << info->stream << std::endl
-               << std::endl;
+    const FileInfoView fileInfo = dbi.fileInfo(moduleCount);
 
-            i += info->size();
-            ++moduleCount;
+    size_t offset = 0;
+
+    for (size_t i = 0; i < moduleCount; ++i) {
+        os << "Module " << i << "\n";
+
+        for (size_t j = 1; j < fileInfo.fileCount(i); ++j) {
+            os << "    " << fileInfo.name(offset) << "\n";
+            ++offset;
         }
+
+        os << "\n";
     }
+}
 
-    if (verbose) {
-        os << "Section Contributions\n"
-           << "---------------------\n";
+/**
+ * Names of the streams in the debug header, in order.
+ */
+const char* const kDebugStreamNames[] = {
+    "fpo",       "exception", "fixup", "omapToSrc", "omapFromSrc",
+    "sectionHdr", "tokenRidMap", "xdata", "pdata",   "newFPO",
+    "sectionHdrOrig",
+};
 
-        SectionContribVersion scVersion;
-        if (stream->read(sizeof(scVersion), &scVersion) != sizeof(scVersion))
-            throw InvalidPdb("failed to read section contribution version");
+const size_t kDebugStreamCount =
+    sizeof(kDebugStreamNames) / sizeof(kDebugStreamNames[0]);
 
-        if (scVersion != SectionContribVersion::v1 &&
-            scVersion != SectionContribVersion::v2) {
-            throw InvalidPdb(
-                "got invalid section contribution substream version");
-        }
+/**
+ * Prints out the debug header substream.
+ */
+void printDebugHeader(const DbiView& dbi, Output& os) {
+    os << "Debug Header\n"
+       << "------------\n";
+
+    const int16_t* streams = dbi.debugStreams();
+
+    for (size_t i = 0; i < kDebugStreamCount; ++i) {
+        const size_t length = strlen(kDebugStreamNames[i]);
+        os << kDebugStreamNames[i];
+        os.repeat(' ', 15 - length) << "= " << streams[i] << "\n";
+    }
+
+    os << "\n";
+}
+
+/**
+ * Prints a substream that has nothing to show.
+ */
+void printUnavailable(const char* title, Output& os) {
+    os << title << "\n";
+    os.repeat('-', strlen(title)) << "\n";
+
+    os << "No information available.\n";
+
+    os << "\n";
+}
+
+/**
+ * Prints out information in the DBI stream.
+ */
+void printDbiStream(MsfFile& msf, Output& os, bool verbose) {
+    auto stream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!stream) return;
+
+    const auto memStream = readDbiStream(stream.get());
+    const DbiView dbi(memStream->data(), memStream->length());
+
+    printDbiHeader(dbi.header(), stream->length(), os);
+
+    const size_t moduleCount = printModuleInfo(dbi, os);
+
+    if (verbose) printSectionContributions(dbi, os);
 
-        const size_t count = (dbi.sectionContributionSize - sizeof(scVersion)) /
-                             sizeof(SectionContribution);
-
-        os << "Section Contribution Count: " << count << std::endl;
-
-        for (size_t i = 0; i < count; ++i) {
-            SectionContribution sc;
-
-            if (stream->read(sizeof(sc), &sc) != sizeof(sc))
-                throw InvalidPdb("failed to read SectionContribution");
-
-            os << "id              = " << i << std::endl
-               << "section         = " << sc.section << std::endl
-               << "padding1        = " << sc.padding1 << std::endl
-               << "offset          = " << std::hex << "0x" << sc.offset
-               << std::dec << std::endl
-               << "size            = " << sc.size << std::endl
-               << "characteristics = " << sc.characteristics << std::endl
-               << "imod            = " << sc.imod << std::endl
-               << "padding2        = " << sc.padding2 << std::endl
-               << "dataCrc         = " << std::hex << "0x" << sc.dataCrc
-               << std::dec << std::endl
-               << "relocCrc        = " << sc.relocCrc << std::endl
-               << std::endl;
+    printUnavailable("Section Map", os);
+
+    if (verbose && dbi.header().fileInfoSize > 0)
+        printFileInfo(dbi, moduleCount, os);
+
+    os << "\n";
+
+    printUnavailable("Type Server Map (TSM)", os);
+    printUnavailable("EC Info", os);
+
+    printDebugHeader(dbi, os);
+}
+
+/**
+ * Prints out a single part of the DBI stream. Other parts of the stream are not
+ * read unless they are needed to make sense of the requested part.
+ */
+void printDbiSubstream(MsfFile& msf, DbiSubstream substream, Output& os) {
+    auto stream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!stream) throw InvalidPdb("missing DBI stream");
+
+    const auto memStream = readDbiStream(stream.get());
+    const DbiView dbi(memStream->data(), memStream->length());
+
+    switch (substream) {
+        case DbiSubstream::all:
+            break;
+        case DbiSubstream::header:
+            printDbiHeader(dbi.header(), stream->length(), os);
+            break;
+        case DbiSubstream::moduleInfo:
+            printModuleInfo(dbi, os);
+            break;
+        case DbiSubstream::sectionContributions:
+            printSectionContributions(dbi, os);
+            break;
+        case DbiSubstream::fileInfo:
+            // The module count is needed to parse the file info.
+            printFileInfo(dbi, dbi.moduleInfo().count(), os);
+            break;
+        case DbiSubstream::debugHeader:
+            printDebugHeader(dbi, os);
+            break;
+    }
+}
+
+/**
+ * Prints the contents of a stream as a hex dump. The stream is read a page at a
+ * time.
+ */
+void printStreamContents(MsfStream* stream, Output& os) {
+    uint8_t buf[4096];
+
+    stream->setPos(0);
+
+    size_t offset = 0;
+
+    while (size_t n = stream->read(sizeof(buf), buf)) {
+        for (size_t i = 0; i < n; i += 16) {
+            const size_t row = std::min<size_t>(16, n - i);
+
+            os.hex(offset + i, 8) << ":";
+
+            for (size_t j = 0; j < 16; ++j) {
+                if (j < row) {
+                    os << " ";
+                    os.hex(buf[i + j], 2);
+                } else {
+                    os << "   ";
+                }
+            }
+
+            os << "  ";
+
+            for (size_t j = 0; j < row; ++j) {
+                const uint8_t c = buf[i + j];
+                os << (char)(c >= 0x20 && c < 0x7f ? c : '.');
+            }
+
+            os << "\n";
         }
 
-        os << std::endl;
-    } else {
-        // Skip over the section contribution
-        stream->skip(dbi.sectionContributionSize);
+        offset += n;
     }
 
-    {
-        os << "Section Map\n"
-           << "-----------\n";
+    os << "\n";
+}
 
-        os << "No information available.\n";
+/**
+ * Finds a stream by its index or by its name.
+ */
+size_t findStream(MsfFile& msf, const NameMapView& nameMap,
+                  const std::string& name) {
+    if (!name.empty() &&
+        std::all_of(name.begin(), name.end(), [](char c) {
+            return c >= '0' && c <= '9';
+        })) {
+        const size_t index = std::stoul(name);
+        if (index >= msf.streamCount()) throw UnknownStream(name);
+        return index;
+    }
 
-        os << std::endl;
+    const auto it = nameMap.find(name);
+    if (it == nameMap.end() || it->stream >= msf.streamCount())
+        throw UnknownStream(name);
 
-        // Skip over the section map
-        stream->skip(dbi.sectionMapSize);
+    return it->stream;
+}
+
+/**
+ * Prints a single stream. Streams that are understood are printed the same way
+ * as in the full dump. Anything else is printed as a hex dump.
+ */
+void printStream(MsfFile& msf, size_t index, const NameMapView& nameMap,
+                 const DumpOptions& opts, Output& os) {
+    if (index == (size_t)PdbStreamType::header) {
+        printPdbStream(msf, os);
+        return;
     }
 
-    if (verbose && dbi.fileInfoSize > 0) {
-        // These are files that correspond to each module as listed in the
-        // Module Info substream above.
+    if (index == (size_t)PdbStreamType::dbi) {
+        printDbiStream(msf, os, opts.verbose);
+        return;
+    }
 
-        os << "File Info\n"
-           << "---------\n";
+    auto stream = msf.getStream(index);
 
-        std::unique_ptr<uint8_t> fileInfo(new uint8_t[dbi.fileInfoSize]);
-        if (stream->read(dbi.fileInfoSize, fileInfo.get()) != dbi.fileInfoSize)
-            throw InvalidPdb("failed to read file info sub-stream");
+    const auto it = nameMap.find("/LinkInfo");
+    if (it != nameMap.end() && it->stream == index) {
+        stream->setPos(0);
+        MsfMemoryStream memStream(stream.get());
+        printLinkInfoStream(&memStream, os);
+        return;
+    }
 
-        const uint8_t* p    = fileInfo.get();
-        const uint8_t* pEnd = p + dbi.fileInfoSize;
+    os << "Stream " << index << "\n";
+    os.repeat('=', 7 + std::to_string(index).length()) << "\n";
 
-        // Skip over the header as it doesn't always provide correct
-        // information.
-        p += sizeof(FileInfoHeader);
+    printStreamTableEntry(msf, index, os);
+    os << "\n";
 
-        // Skip over file indices array. We don't need them.
-        p += moduleCount * sizeof(uint16_t);
+    printStreamContents(stream.get(), os);
+}
 
-        // File counts array
-        const uint16_t* fileCounts = (const uint16_t*)p;
-        p += moduleCount * sizeof(*fileCounts);
+/**
+ * JSON Lines output. Every record is a JSON object on its own line with a
+ * "type" field saying what it describes. The fields are named after the
+ * structures in pdb/format.h.
+ */
+namespace json {
 
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+void begin(Output& os, const char* type) {
+    os << "{\"type\":\"" << type << "\"";
+}
 
-        const uint32_t* offsets = (const uint32_t*)p;
+template <typename T>
+void field(Output& os, const char* name, T value) {
+    os << ",\"" << name << "\":" << value;
+}
 
-        uint32_t offsetCount = 0;
-        for (size_t i = 0; i < moduleCount; ++i) offsetCount += fileCounts[i];
+void stringField(Output& os, const char* name, StringRef value) {
+    os << ",\"" << name << "\":";
+    os.json(value);
+}
 
-        p += offsetCount * sizeof(*offsets);
+void boolField(Output& os, const char* name, bool value) {
+    os << ",\"" << name << "\":" << (value ? "true" : "false");
+}
 
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+void end(Output& os) { os << "}\n"; }
 
-        const char* names = (char*)p;
+void printStreamTableEntry(MsfFile& msf, size_t i, Output& os) {
+    auto stream = msf.getStream(i);
 
-        size_t offset = 0;
+    begin(os, "stream");
+    field(os, "index", i);
+    field(os, "size", stream->length());
 
-        for (size_t i = 0; i < moduleCount; ++i) {
-            os << "Module " << i << std::endl;
+    os << ",\"pages\":[";
 
-            for (size_t j = 1; j < fileCounts[i]; ++j) {
-                os << "    " << names + offsets[offset] << std::endl;
-                ++offset;
-            }
+    const auto pages = streamPages(stream);
+    for (size_t j = 0; j < pages.size(); ++j) {
+        if (j > 0) os << ',';
+        os << pages[j];
+    }
+
+    os << "]";
+    end(os);
+}
+
+void printStreamTable(MsfFile& msf, Output& os) {
+    const size_t streamCount = msf.streamCount();
+
+    for (size_t i = 0; i < streamCount; ++i) printStreamTableEntry(msf, i, os);
+}
+
+void printLinkInfoStream(MsfMemoryStream* stream, Output& os) {
+    const LinkInfo* linkInfo = readLinkInfo(stream);
+    if (!linkInfo) return;
+
+    begin(os, "linkInfo");
+    stringField(os, "cwd", linkInfo->cwd<char>());
+    stringField(os, "command", linkInfo->command<char>());
+    stringField(os, "libs", linkInfo->libs<char>());
+    stringField(os, "outputFile", linkInfo->outputFile<char>());
+    end(os);
+}
+
+void printPdbStream(MsfFile& msf, Output& os) {
+    const auto stream = readPdbStream(msf);
+
+    if (stream->length() < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    PdbStream70 header;
+    memcpy(&header, stream->data(), sizeof(header));
+
+    begin(os, "pdb");
+    field(os, "stream", (size_t)PdbStreamType::header);
+    field(os, "size", stream->length());
+    field(os, "version", (uint32_t)header.version);
+    field(os, "timestamp", header.timestamp);
+    field(os, "age", header.age);
+    os << ",\"signature\":\"";
+    printGUID(header.sig70, os);
+    os << "\"";
+    end(os);
 
-            os << std::endl;
+    const NameMapView nameMap = readNameMap(stream.get());
+
+    for (const auto& entry : sortedNameMap(nameMap)) {
+        begin(os, "namedStream");
+        stringField(os, "name", entry.name);
+        field(os, "stream", entry.stream);
+        end(os);
+    }
+
+    if (auto linkInfoStream = readLinkInfoStream(msf, nameMap))
+        printLinkInfoStream(linkInfoStream.get(), os);
+}
+
+void printDbiHeader(const DbiHeader& dbi, size_t streamLength, Output& os) {
+    begin(os, "dbi");
+    field(os, "stream", (size_t)PdbStreamType::dbi);
+    field(os, "size", streamLength);
+    field(os, "signature", dbi.signature);
+    field(os, "version", (uint32_t)dbi.version);
+    field(os, "age", dbi.age);
+    field(os, "globalSymbolStream", dbi.globalSymbolStream);
+    field(os, "pdbDllVersionMajor", dbi.pdbDllVersion.major);
+    field(os, "pdbDllVersionMinor", dbi.pdbDllVersion.minor);
+    field(os, "pdbDllVersionFormat", dbi.pdbDllVersion.format);
+    field(os, "publicSymbolStream", dbi.publicSymbolStream);
+    field(os, "pdbDllBuildVersionMajor", dbi.pdbDllBuildVersionMajor);
+    field(os, "symbolRecordsStream", dbi.symbolRecordsStream);
+    field(os, "pdbDllBuildVersionMinor", dbi.pdbDllBuildVersionMinor);
+    field(os, "gpModInfoSize", dbi.gpModInfoSize);
+    field(os, "sectionContributionSize", dbi.sectionContributionSize);
+    field(os, "sectionMapSize", dbi.sectionMapSize);
+    field(os, "fileInfoSize", dbi.fileInfoSize);
+    field(os, "typeServerMapSize", dbi.typeServerMapSize);
+    field(os, "mfcIndex", dbi.mfcIndex);
+    field(os, "debugHeaderSize", dbi.debugHeaderSize);
+    field(os, "ecInfoSize", dbi.ecInfoSize);
+    boolField(os, "incLink", dbi.flags.incLink);
+    boolField(os, "stripped", dbi.flags.stripped);
+    boolField(os, "ctypes", dbi.flags.ctypes);
+    field(os, "machine", dbi.machine);
+    end(os);
+}
+
+size_t printModuleInfo(const DbiView& dbi, Output& os) {
+    size_t moduleCount = 0;
+
+    for (const ModuleEntry& module : dbi.moduleInfo()) {
+        begin(os, "module");
+        field(os, "id", moduleCount);
+        stringField(os, "moduleName", module.moduleName);
+        stringField(os, "objectName", module.objectName);
+        field(os, "stream", module.info->stream);
+        end(os);
+
+        ++moduleCount;
+    }
+
+    return moduleCount;
+}
+
+void printSectionContributions(const DbiView& dbi, Output& os) {
+    const SectionContributionView contribs = dbi.sectionContributions();
+
+    for (size_t i = 0; i < contribs.size(); ++i) {
+        const SectionContribution& sc = contribs[i];
+
+        begin(os, "sectionContribution");
+        field(os, "id", i);
+        field(os, "section", sc.section);
+        field(os, "padding1", sc.padding1);
+        field(os, "offset", sc.offset);
+        field(os, "size", sc.size);
+        field(os, "characteristics", sc.characteristics);
+        field(os, "imod", sc.imod);
+        field(os, "padding2", sc.padding2);
+        field(os, "dataCrc", sc.dataCrc);
+        field(os, "relocCrc", sc.relocCrc);
+        end(os);
+    }
+}
+
+void printFileInfo(const DbiView& dbi, size_t moduleCount, Output& os) {
+    const FileInfoView fileInfo = dbi.fileInfo(moduleCount);
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < moduleCount; ++i) {
+        for (size_t j = 1; j < fileInfo.fileCount(i); ++j) {
+            begin(os, "file");
+            field(os, "module", i);
+            stringField(os, "name", fileInfo.name(offset));
+            end(os);
+            ++offset;
         }
-    } else {
-        // Skip over the file info
-        stream->skip(dbi.fileInfoSize);
     }
+}
+
+void printDebugHeader(const DbiView& dbi, Output& os) {
+    const int16_t* streams = dbi.debugStreams();
+
+    begin(os, "debugHeader");
+    for (size_t i = 0; i < kDebugStreamCount; ++i)
+        field(os, kDebugStreamNames[i], streams[i]);
+    end(os);
+}
+
+void printDbiStream(MsfFile& msf, Output& os, bool verbose) {
+    auto stream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!stream) return;
+
+    const auto memStream = readDbiStream(stream.get());
+    const DbiView dbi(memStream->data(), memStream->length());
+
+    printDbiHeader(dbi.header(), stream->length(), os);
+
+    const size_t moduleCount = printModuleInfo(dbi, os);
+
+    if (verbose) printSectionContributions(dbi, os);
+
+    if (verbose && dbi.header().fileInfoSize > 0)
+        printFileInfo(dbi, moduleCount, os);
+
+    printDebugHeader(dbi, os);
+}
+
+void printDbiSubstream(MsfFile& msf, DbiSubstream substream, Output& os) {
+    auto stream = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!stream) throw InvalidPdb("missing DBI stream");
+
+    const auto memStream = readDbiStream(stream.get());
+    const DbiView dbi(memStream->data(), memStream->length());
+
+    switch (substream) {
+        case DbiSubstream::all:
+            break;
+        case DbiSubstream::header:
+            printDbiHeader(dbi.header(), stream->length(), os);
+            break;
+        case DbiSubstream::moduleInfo:
+            printModuleInfo(dbi, os);
+            break;
+        case DbiSubstream::sectionContributions:
+            printSectionContributions(dbi, os);
+            break;
+        case DbiSubstream::fileInfo:
+            printFileInfo(dbi, dbi.moduleInfo().count(), os);
+            break;
+        case DbiSubstream::debugHeader:
+            printDebugHeader(dbi, os);
+            break;
+    }
+}
 
-    os << std::endl;
+/**
+ * Prints the contents of a stream as hex, one record per page.
+ */
+void printStreamContents(MsfStream* stream, size_t index, Output& os) {
+    uint8_t buf[4096];
 
-    {
-        os << "Type Server Map (TSM)\n"
-           << "---------------------\n";
+    stream->setPos(0);
 
-        os << "No information available.\n";
+    size_t offset = 0;
 
-        os << std::endl;
+    while (size_t n = stream->read(sizeof(buf), buf)) {
+        begin(os, "data");
+        field(os, "stream", index);
+        field(os, "offset", offset);
+        os << ",\"hex\":\"";
+        for (size_t i = 0; i < n; ++i) os.hex(buf[i], 2);
+        os << "\"";
+        end(os);
 
-        // Skip over the TSM substream
-        stream->skip(dbi.typeServerMapSize);
+        offset += n;
     }
+}
 
-    {
-        os << "EC Info\n"
-           << "-------\n";
+void printStream(MsfFile& msf, size_t index, const NameMapView& nameMap,
+                 const DumpOptions& opts, Output& os) {
+    if (index == (size_t)PdbStreamType::header) {
+        printPdbStream(msf, os);
+        return;
+    }
 
-        os << "No information available.\n";
+    if (index == (size_t)PdbStreamType::dbi) {
+        printDbiStream(msf, os, opts.verbose);
+        return;
+    }
 
-        os << std::endl;
+    auto stream = msf.getStream(index);
 
-        // Skip over the EC info substream
-        stream->skip(dbi.ecInfoSize);
+    const auto it = nameMap.find("/LinkInfo");
+    if (it != nameMap.end() && it->stream == index) {
+        stream->setPos(0);
+        MsfMemoryStream memStream(stream.get());
+        printLinkInfoStream(&memStream, os);
+        return;
     }
 
-    {
-        os << "Debug Header\n"
-           << "------------\n";
-
-        std::unique_ptr<uint8_t> debugHeader(new uint8_t[dbi.debugHeaderSize]);
-        if (stream->read(dbi.debugHeaderSize, debugHeader.get()) !=
-            dbi.debugHeaderSize)
-            throw InvalidPdb("failed to read DBI debug header");
-
-        if (dbi.debugHeaderSize / sizeof(int16_t) < DebugTypes::count)
-            throw InvalidPdb("got partial DBI debug header");
-
-        const int16_t* streams = (const int16_t*)debugHeader.get();
-
-        os << "fpo            = " << streams[DebugTypes::fpo] << std::endl
-           << "exception      = " << streams[DebugTypes::exception] << std::endl
-           << "fixup          = " << streams[DebugTypes::fixup] << std::endl
-           << "omapToSrc      = " << streams[DebugTypes::omapToSrc] << std::endl
-           << "omapFromSrc    = " << streams[DebugTypes::omapFromSrc]
-           << std::endl
-           << "sectionHdr     = " << streams[DebugTypes::sectionHdr]
-           << std::endl
-           << "tokenRidMap    = " << streams[DebugTypes::tokenRidMap]
-           << std::endl
-           << "xdata          = " << streams[DebugTypes::xdata] << std::endl
-           << "pdata          = " << streams[DebugTypes::pdata] << std::endl
-           << "newFPO         = " << streams[DebugTypes::newFPO] << std::endl
-           << "sectionHdrOrig = " << streams[DebugTypes::sectionHdrOrig]
-           << std::endl
-           << std::endl;
+    printStreamTableEntry(msf, index, os);
+    printStreamContents(stream.get(), index, os);
+}
+
+}  // namespace json
+
+void dumpPdbText(MsfFile& msf, const DumpOptions& opts, Output& os) {
+    if (opts.dbi != DbiSubstream::all) {
+        printDbiSubstream(msf, opts.dbi, os);
+        return;
     }
+
+    if (!opts.stream.empty()) {
+        const auto pdbStream = readPdbStream(msf);
+        const auto nameMap   = readNameMap(pdbStream.get());
+        printStream(msf, findStream(msf, nameMap, opts.stream), nameMap, opts,
+                    os);
+        return;
+    }
+
+    printStreamTable(msf, os);
+    printPdbStream(msf, os);
+    printDbiStream(msf, os, opts.verbose);
+}
+
+void dumpPdbJson(MsfFile& msf, const DumpOptions& opts, Output& os) {
+    if (opts.dbi != DbiSubstream::all) {
+        json::printDbiSubstream(msf, opts.dbi, os);
+        return;
+    }
+
+    if (!opts.stream.empty()) {
+        const auto pdbStream = readPdbStream(msf);
+        const auto nameMap   = readNameMap(pdbStream.get());
+        json::printStream(msf, findStream(msf, nameMap, opts.stream), nameMap,
+                          opts, os);
+        return;
+    }
+
+    json::printStreamTable(msf, os);
+    json::printPdbStream(msf, os);
+    json::printDbiStream(msf, os, opts.verbose);
 }
 
-void dumpPdb(MsfFile& msf, bool verbose) {
-    printStreamTable(msf, std::cout);
-    printPdbStream(msf, std::cout);
-    printDbiStream(msf, std::cout, verbose);
+void dumpPdb(MsfFile& msf, const DumpOptions& opts) {
+    Output os(stdout);
+
+    switch (opts.format) {
+        case DumpFormat::text:
+            dumpPdbText(msf, opts, os);
+            break;
+        case DumpFormat::jsonLines:
+            dumpPdbJson(msf, opts, os);
+            break;
+    }
+
+    os.flush();
 }
 
 template <typename CharT>
-void dumpPdbImpl(const CharT* path, bool verbose) {
-    auto pdb = openFile(path, FileMode<CharT>::readExisting);
+void dumpPdbImpl(const CharT* path, const DumpOptions& opts) {
+    auto pdb = std::make_shared<MemMap>(path, 0, true);
 
     MsfFile msf(pdb);
 
-    dumpPdb(msf, verbose);
+    dumpPdb(msf, opts);
 }
 
 }  // namespace
 
 #if defined(_WIN32) && defined(UNICODE)
 
-void dumpPdb(const wchar_t* path, bool verbose) { dumpPdbImpl(path, verbose); }
+void dumpPdb(const wchar_t* path, const DumpOptions& opts) {
+    dumpPdbImpl(path, opts);
+}
 
 #else
 
-void dumpPdb(const char* path, bool verbose) { dumpPdbImpl(path, verbose); }
+void dumpPdb(const char* path, const DumpOptions& opts) {
+    dumpPdbImpl(path, opts);
+}
 
 #endif
@@ -21,15 +21,74 @@
  */
 #pragma once
 
+#include <string>
+
+/**
+ * Parts of the DBI stream that can be dumped on their own.
+ */
+enum class DbiSubstream {
+    all,
+    header,
+    moduleInfo,
+    sectionContributions,
+    fileInfo,
+    debugHeader,
+};
+
+/**
+ * How the dump is formatted.
+ */
+enum class DumpFormat {
+    // Human readable text.
+    text,
+
+    // One JSON object per line, for feeding into other tools.
+    jsonLines,
+};
+
+/**
+ * Controls what is dumped.
+ */
+struct DumpOptions {
+    // Print out extra information.
+    bool verbose;
+
+    // If not empty, only this stream is dumped. This is either a stream index
+    // or the name of a named stream (e.g., "/LinkInfo").
+    std::string stream;
+
+    // If not `all`, only this part of the DBI stream is dumped.
+    DbiSubstream dbi;
+
+    DumpFormat format;
+
+    DumpOptions()
+        : verbose(false), dbi(DbiSubstream::all), format(DumpFormat::text) {}
+};
+
+/**
+ * Thrown when the requested stream does not exist.
+ */
+class UnknownStream {
+   private:
+    std::string _name;
+
+   public:
+    UnknownStream(const std::string& name) : _name(name) {}
+
+    const std::string& name() const { return _name; }
+};
+
 /**
- * Prints information about a PDB.
+ * Prints information about a PDB to stdout. Only the streams that are dumped are
+ * read. The output is buffered and is only flushed at the end.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
-void dumpPdb(const wchar_t* path, bool verbose);
+void dumpPdb(const wchar_t* path, const DumpOptions& opts);
 
 #else
 
-void dumpPdb(const char* path, bool verbose);
+void dumpPdb(const char* path, const DumpOptions& opts);
 
 #endif
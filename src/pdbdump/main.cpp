@@ -20,13 +20,16 @@
  * SOFTWARE.
  */
 
+#include <codecvt>
 #include <iostream>
+#include <locale>
 #include <string>
 #include <vector>
 
 #include "msf/msf.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
+#include "pdbdump/diff.h"
 #include "pdbdump/dump.h"
 
 #include "version.h"
@@ -83,7 +86,21 @@ struct OptionNames<char> {
     const char* versionLong  = "--version";
     const char* verboseLong  = "--verbose";
     const char* verboseShort = "-v";
+    const char* streamLong   = "--stream";
+    const char* dbiLong      = "--dbi";
+    const char* diffLong     = "--diff";
+    const char* threadsLong  = "--threads";
+    const char* formatLong   = "--format";
     const char* dashDash     = "--";
+
+    const char* dbiHeader        = "header";
+    const char* dbiModules       = "modules";
+    const char* dbiContributions = "contributions";
+    const char* dbiFiles         = "files";
+    const char* dbiDebugHeader   = "debug-header";
+
+    const char* formatText  = "text";
+    const char* formatJsonl = "jsonl";
 };
 
 template <>
@@ -93,9 +110,54 @@ struct OptionNames<wchar_t> {
     const wchar_t* versionLong  = L"--version";
     const wchar_t* verboseLong  = L"--verbose";
     const wchar_t* verboseShort = L"-v";
+    const wchar_t* streamLong   = L"--stream";
+    const wchar_t* dbiLong      = L"--dbi";
+    const wchar_t* diffLong     = L"--diff";
+    const wchar_t* threadsLong  = L"--threads";
+    const wchar_t* formatLong   = L"--format";
     const wchar_t* dashDash     = L"--";
+
+    const wchar_t* dbiHeader        = L"header";
+    const wchar_t* dbiModules       = L"modules";
+    const wchar_t* dbiContributions = L"contributions";
+    const wchar_t* dbiFiles         = L"files";
+    const wchar_t* dbiDebugHeader   = L"debug-header";
+
+    const wchar_t* formatText  = L"text";
+    const wchar_t* formatJsonl = L"jsonl";
 };
 
+/**
+ * Converts the given character type to UTF-8 for printing.
+ */
+inline std::string toUtf8(const std::string& s) { return s; }
+
+inline std::string toUtf8(const std::wstring& s) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(s);
+}
+
+/**
+ * Parses a positive integer option value.
+ */
+template <typename CharT>
+size_t parseCount(const std::basic_string<CharT>& s) {
+    size_t n = 0;
+
+    if (s.empty()) throw InvalidCommandLine("Expected a positive integer");
+
+    for (CharT c : s) {
+        if (c < '0' || c > '9')
+            throw InvalidCommandLine("Expected a positive integer");
+
+        n = n * 10 + (size_t)(c - '0');
+    }
+
+    if (n == 0) throw InvalidCommandLine("Expected a positive integer");
+
+    return n;
+}
+
 /**
  * Command line options.
  */
@@ -107,9 +169,17 @@ class CommandOptions {
    public:
     const CharT* pdb;
 
-    bool verbose;
+    DumpOptions dump;
 
-    CommandOptions() : pdb(NULL), verbose(false) {}
+    // If true, `pdb` is compared with `other` instead of being dumped.
+    bool diff;
+    const CharT* other;
+
+    // Number of threads used to compare the PDBs. 0 means to use the number
+    // of hardware threads.
+    size_t threads;
+
+    CommandOptions() : pdb(NULL), diff(false), other(NULL), threads(0) {}
 
     /**
      * Parses the command line arguments.
@@ -137,6 +207,17 @@ class CommandOptions {
             }
         }
 
+        // Look for the diff option first. It changes the exit code of errors,
+        // including errors in the other options.
+        for (int i = 1; i < argc; ++i) {
+            const string arg = argv[i];
+            if (arg == opt.diffLong) {
+                diff = true;
+            } else if (arg == opt.dashDash) {
+                break;
+            }
+        }
+
         // Set to true if only positional arguments can occur.
         bool onlyPositional = false;
 
@@ -151,7 +232,49 @@ class CommandOptions {
             } else if (arg == opt.dashDash) {
                 onlyPositional = true;
             } else if (arg == opt.verboseLong || arg == opt.verboseShort) {
-                verbose = true;
+                dump.verbose = true;
+            } else if (arg == opt.diffLong) {
+                diff = true;
+            } else if (arg == opt.threadsLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --threads");
+                threads = parseCount(string(argv[i]));
+            } else if (arg == opt.streamLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --stream");
+                dump.stream = toUtf8(string(argv[i]));
+                if (dump.stream.empty())
+                    throw InvalidCommandLine("Empty argument for --stream");
+            } else if (arg == opt.formatLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --format");
+
+                const string name = argv[i];
+                if (name == opt.formatText)
+                    dump.format = DumpFormat::text;
+                else if (name == opt.formatJsonl)
+                    dump.format = DumpFormat::jsonLines;
+                else
+                    throw InvalidCommandLine("Unknown format '" +
+                                             toUtf8(name) + "' for --format");
+            } else if (arg == opt.dbiLong) {
+                if (++i >= argc)
+                    throw InvalidCommandLine("Missing argument for --dbi");
+
+                const string name = argv[i];
+                if (name == opt.dbiHeader)
+                    dump.dbi = DbiSubstream::header;
+                else if (name == opt.dbiModules)
+                    dump.dbi = DbiSubstream::moduleInfo;
+                else if (name == opt.dbiContributions)
+                    dump.dbi = DbiSubstream::sectionContributions;
+                else if (name == opt.dbiFiles)
+                    dump.dbi = DbiSubstream::fileInfo;
+                else if (name == opt.dbiDebugHeader)
+                    dump.dbi = DbiSubstream::debugHeader;
+                else
+                    throw InvalidCommandLine("Unknown substream '" +
+                                             toUtf8(name) + "' for --dbi");
             } else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             } else {
@@ -159,6 +282,21 @@ class CommandOptions {
             }
         }
 
+        if (diff) {
+            if (positional.size() != 2)
+                throw InvalidCommandLine("--diff requires two PDBs");
+
+            if (!dump.stream.empty() || dump.dbi != DbiSubstream::all ||
+                dump.format != DumpFormat::text) {
+                throw InvalidCommandLine(
+                    "--diff cannot be used with --stream, --dbi, or --format");
+            }
+
+            pdb   = positional[0];
+            other = positional[1];
+            return;
+        }
+
         switch (positional.size()) {
             case 1:
                 pdb = positional[0];
@@ -170,13 +308,22 @@ class CommandOptions {
                 throw InvalidCommandLine("Too many positional arguments given");
                 break;
         }
+
+        if (dump.dbi != DbiSubstream::all && !dump.stream.empty()) {
+            throw InvalidCommandLine(
+                "--stream and --dbi cannot be used together");
+        }
     }
 };
 
 template <typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
-const char* usage = "Usage: pdbdump pdb [--help] [--verbose]";
+const char* usage =
+    "Usage: pdbdump pdb [--help] [--verbose] [--stream ID|NAME] [--dbi "
+    "SUBSTREAM]\n"
+    "                   [--format NAME]\n"
+    "       pdbdump --diff pdb1 pdb2 [--threads N]";
 
 const char* help =
     R"(
@@ -189,23 +336,50 @@ Optional arguments:
   --help, -h     Prints this help.
   --version      Prints version information.
   --verbose, -v  Prints extra information about the PDB.
+  --stream ID|NAME
+                 Only dumps the stream with the given index or name (e.g.,
+                 /LinkInfo). Streams that pdbdump does not understand are
+                 printed as a hex dump.
+  --dbi SUBSTREAM
+                 Only dumps one part of the DBI stream. Must be one of
+                 'header', 'modules', 'contributions', 'files', or
+                 'debug-header'.
+  --format NAME  How the dump is formatted. Either 'text' (the default), or
+                 'jsonl' for JSON Lines: one JSON object per line, each with a
+                 "type" field saying what it describes, for feeding into other
+                 tools. Names are printed as they are stored in the PDB, which
+                 is normally UTF-8.
+  --diff         Compares two PDBs stream by stream instead of dumping one.
+                 Only the streams that differ are printed, along with the
+                 ranges of bytes that differ in them. This is much faster
+                 than diffing two dumps. Like diff(1), the exit code is 0 if
+                 the PDBs are the same, 1 if any stream differs, and 2 if
+                 there was an error.
+  --threads N    Maximum number of threads used by --diff. Defaults to the
+                 number of hardware threads.
+
+Only the parts of the PDB that are dumped are read, so dumping a single stream
+of a very large PDB is fast.
 )";
 
 template <typename CharT = char>
 int pdbdump(int argc, CharT** argv) {
     CommandOptions<CharT> opts;
 
+    // With --diff, 1 means that the PDBs differ, so errors are 2 instead.
+    auto errorCode = [&opts]() { return opts.diff ? 2 : 1; };
+
     try {
         opts.parse(argc, argv);
     } catch (const InvalidCommandLine& error) {
         std::cout << "Error parsing arguments: " << error.why() << std::endl;
         std::cout << usage << std::endl;
-        return 1;
+        return errorCode();
     } catch (const UnknownOption<CharT>& error) {
         std::cout << "Error parsing arguments: Unknown option '" << error.name()
                   << "'" << std::endl;
         std::cout << usage << std::endl;
-        return 1;
+        return errorCode();
     } catch (const CommandLineHelp&) {
         std::cout << usage << std::endl;
         std::cout << help;
@@ -216,16 +390,25 @@ int pdbdump(int argc, CharT** argv) {
     }
 
     try {
-        dumpPdb(opts.pdb, opts.verbose);
+        if (opts.diff) {
+            const size_t differences =
+                diffPdbs(opts.pdb, opts.other, opts.threads, std::cout);
+            return differences > 0 ? 1 : 0;
+        }
+
+        dumpPdb(opts.pdb, opts.dump);
+    } catch (const UnknownStream& error) {
+        std::cerr << "Error: No such stream '" << error.name() << "'\n";
+        return errorCode();
     } catch (const InvalidMsf& error) {
         std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
-        return 1;
+        return errorCode();
     } catch (const InvalidPdb& error) {
         std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
-        return 1;
+        return errorCode();
     } catch (const std::system_error& error) {
         std::cerr << "Error: " << error.what() << "\n";
-        return 1;
+        return errorCode();
     }
 
     return 0;
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pdbdump/output.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <system_error>
+
+namespace {
+
+const char kLowerDigits[] = "0123456789abcdef";
+const char kUpperDigits[] = "0123456789ABCDEF";
+
+}  // namespace
+
+Output::Output(FILE* f, size_t bufferSize)
+    : _f(f), _buf(bufferSize), _used(0) {}
+
+Output::~Output() {
+    if (_used > 0) fwrite(_buf.data(), 1, _used, _f);
+    fflush(_f);
+}
+
+void Output::flush() {
+    const size_t used = _used;
+    _used             = 0;
+
+    if ((used > 0 && fwrite(_buf.data(), 1, used, _f) != used) ||
+        fflush(_f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to write output");
+    }
+}
+
+Output& Output::write(const char* s, size_t length) {
+    if (length > _buf.size() - _used) {
+        flush();
+
+        // Don't bother copying anything that doesn't fit anyway.
+        if (length >= _buf.size()) {
+            if (fwrite(s, 1, length, _f) != length) {
+                throw std::system_error(errno, std::system_category(),
+                                        "failed to write output");
+            }
+
+            return *this;
+        }
+    }
+
+    memcpy(_buf.data() + _used, s, length);
+    _used += length;
+
+    return *this;
+}
+
+Output& Output::operator<<(const char* s) { return write(s, strlen(s)); }
+
+Output& Output::dec(uint64_t value, size_t width) {
+    char digits[20];
+    size_t n = 0;
+
+    do {
+        digits[sizeof(digits) - ++n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (width > n) repeat(' ', width - n);
+
+    return write(digits + sizeof(digits) - n, n);
+}
+
+Output& Output::negative(int64_t value) {
+    *this << '-';
+
+    // Negating the most negative value overflows, but not once it's unsigned.
+    return dec(0 - (uint64_t)value);
+}
+
+Output& Output::hex(uint64_t value, size_t width, bool upper) {
+    const char* table = upper ? kUpperDigits : kLowerDigits;
+
+    char digits[16];
+    size_t n = 0;
+
+    do {
+        digits[sizeof(digits) - ++n] = table[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+
+    if (width > n) repeat('0', width - n);
+
+    return write(digits + sizeof(digits) - n, n);
+}
+
+Output& Output::repeat(char c, size_t count) {
+    while (count > 0) {
+        if (_used == _buf.size()) flush();
+
+        const size_t n = std::min(count, _buf.size() - _used);
+        memset(_buf.data() + _used, c, n);
+        _used += n;
+        count -= n;
+    }
+
+    return *this;
+}
+
+Output& Output::json(StringRef s) {
+    *this << '"';
+
+    const char* run = s.begin();
+
+    for (const char* p = s.begin(); p != s.end(); ++p) {
+        const unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        write(run, p - run);
+        run = p + 1;
+
+        switch (c) {
+            case '"':
+                *this << "\\\"";
+                break;
+            case '\\':
+                *this << "\\\\";
+                break;
+            case '\n':
+                *this << "\\n";
+                break;
+            case '\r':
+                *this << "\\r";
+                break;
+            case '\t':
+                *this << "\\t";
+                break;
+            default:
+                *this << "\\u";
+                hex(c, 4);
+                break;
+        }
+    }
+
+    write(run, s.end() - run);
+
+    return *this << '"';
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "pdb/view.h"
+
+/**
+ * Buffered output for dumps.
+ *
+ * Unlike std::ostream, nothing is written until the buffer fills up or flush()
+ * is called, and integers are formatted directly instead of going through the
+ * locale. Dumps of large PDBs are millions of lines long, so this makes a big
+ * difference.
+ */
+class Output {
+   private:
+    FILE* _f;
+    std::vector<char> _buf;
+    size_t _used;
+
+   public:
+    /**
+     * Params:
+     *   f          = The file to write to. It is not closed.
+     *   bufferSize = Number of bytes to buffer before writing them out.
+     */
+    explicit Output(FILE* f, size_t bufferSize = 256 * 1024);
+
+    /**
+     * Writes out anything that is still buffered. Errors are ignored. Call
+     * flush() first to find out about them.
+     */
+    ~Output();
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    /**
+     * Writes out everything that is buffered.
+     *
+     * Throws: std::system_error if writing fails.
+     */
+    void flush();
+
+    Output& write(const char* s, size_t length);
+
+    Output& operator<<(char c) {
+        if (_used == _buf.size()) flush();
+        _buf[_used++] = c;
+        return *this;
+    }
+
+    Output& operator<<(const char* s);
+    Output& operator<<(const std::string& s) {
+        return write(s.data(), s.length());
+    }
+    Output& operator<<(StringRef s) { return write(s.data(), s.length()); }
+
+    /**
+     * Integers are printed in decimal. Use hex() for hexadecimal.
+     */
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value &&
+                                !std::is_same<T, char>::value &&
+                                !std::is_same<T, bool>::value,
+                            Output&>::type
+    operator<<(T value) {
+        if (std::is_signed<T>::value && value < 0)
+            return negative((int64_t)value);
+        return dec((uint64_t)value);
+    }
+
+    /**
+     * Prints an unsigned integer in decimal, right-aligned to at least
+     * `width` characters.
+     */
+    Output& dec(uint64_t value, size_t width = 0);
+
+    /**
+     * Prints an unsigned integer in lowercase hexadecimal without a prefix. If
+     * it is shorter than `width` digits, it is padded with zeros.
+     */
+    Output& hex(uint64_t value, size_t width = 0, bool upper = false);
+
+    /**
+     * Prints `count` copies of `c`.
+     */
+    Output& repeat(char c, size_t count);
+
+    /**
+     * Prints a string as a quoted JSON string. The string is expected to be
+     * UTF-8, and only the characters that JSON requires are escaped.
+     */
+    Output& json(StringRef s);
+
+   private:
+    Output& negative(int64_t value);
+};
@@ -144,6 +144,9 @@ typedef struct _IMAGE_FILE_HEADER {
 #define IMAGE_FILE_MACHINE_EBC 0x0EBC    // EFI Byte Code
 #define IMAGE_FILE_MACHINE_AMD64 0x8664  // AMD64 (K8)
 #define IMAGE_FILE_MACHINE_M32R 0x9041   // M32R little-endian
+#define IMAGE_FILE_MACHINE_ARM64 0xAA64  // ARM64 Little-Endian
+#define IMAGE_FILE_MACHINE_ARM64EC 0xA641
+#define IMAGE_FILE_MACHINE_ARM64X 0xA64E
 #define IMAGE_FILE_MACHINE_CEE 0xC0EE
 
 //
@@ -392,6 +395,76 @@ typedef struct _IMAGE_SECTION_HEADER {
 
 #define IMAGE_SIZEOF_SECTION_HEADER 40
 
+//
+// Object files that don't start with an IMAGE_FILE_HEADER. These start with
+// Sig1 == IMAGE_FILE_MACHINE_UNKNOWN and Sig2 == 0xFFFF instead, and Version
+// tells them apart.
+//
+
+// Short import library member.
+typedef struct IMPORT_OBJECT_HEADER {
+    uint16_t Sig1;     // Must be IMAGE_FILE_MACHINE_UNKNOWN
+    uint16_t Sig2;     // Must be IMPORT_OBJECT_HDR_SIG2.
+    uint16_t Version;  // Must be 0.
+    uint16_t Machine;
+    uint32_t TimeDateStamp;  // Time/date stamp
+    uint32_t SizeOfData;     // Size of the import name and DLL name.
+    uint16_t OrdinalOrHint;
+    uint16_t Type;  // Import type and name type
+} IMPORT_OBJECT_HEADER;
+
+#define IMPORT_OBJECT_HDR_SIG2 0xffff
+
+// Object whose contents are opaque, such as one compiled with /GL. Version is
+// 1. Only the fields that are common to all versions are defined here.
+typedef struct ANON_OBJECT_HEADER {
+    uint16_t Sig1;  // Must be IMAGE_FILE_MACHINE_UNKNOWN
+    uint16_t Sig2;  // Must be 0xffff
+    uint16_t Version;
+    uint16_t Machine;
+    uint32_t TimeDateStamp;
+    uint8_t ClassID[16];
+    uint32_t SizeOfData;
+} ANON_OBJECT_HEADER;
+
+// Object file with more than 65,279 sections, compiled with /bigobj. Version
+// is 2 or more. The section headers follow this header.
+typedef struct ANON_OBJECT_HEADER_BIGOBJ {
+    uint16_t Sig1;  // Must be IMAGE_FILE_MACHINE_UNKNOWN
+    uint16_t Sig2;  // Must be 0xffff
+    uint16_t Version;
+    uint16_t Machine;
+    uint32_t TimeDateStamp;
+    uint8_t ClassID[16];  // {D1BAA1C7-BAEE-4ba9-AF20-FAF66AA4DCB8}
+    uint32_t SizeOfData;
+    uint32_t Flags;
+    uint32_t MetaDataSize;
+    uint32_t MetaDataOffset;
+    uint32_t NumberOfSections;
+    uint32_t PointerToSymbolTable;
+    uint32_t NumberOfSymbols;
+} ANON_OBJECT_HEADER_BIGOBJ;
+
+//
+// Archive (static library) format.
+//
+
+#define IMAGE_ARCHIVE_START_SIZE 8
+#define IMAGE_ARCHIVE_START "!<arch>\n"
+#define IMAGE_ARCHIVE_END "`\n"
+
+typedef struct _IMAGE_ARCHIVE_MEMBER_HEADER {
+    uint8_t Name[16];  // File member name - `/' terminated.
+    uint8_t Date[12];  // File member date - decimal.
+    uint8_t UserID[6];   // File member user id - decimal.
+    uint8_t GroupID[6];  // File member group id - decimal.
+    uint8_t Mode[8];     // File member mode - octal.
+    uint8_t Size[10];    // File member size - decimal.
+    uint8_t EndHeader[2];  // String to end header.
+} IMAGE_ARCHIVE_MEMBER_HEADER, *PIMAGE_ARCHIVE_MEMBER_HEADER;
+
+#define IMAGE_SIZEOF_ARCHIVE_MEMBER_HDR 60
+
 //
 // CodeView Info
 //
@@ -22,9 +22,17 @@
 
 #include "pe/pe.h"
 
+#include <algorithm>
 #include <cstring>
 
-PEFile::PEFile(const uint8_t* buf, size_t length) : buf(buf), length(length) {
+PEFile::PEFile(const uint8_t* buf, size_t length)
+    : buf(buf),
+      length(length),
+      exportDir(NULL),
+      resourceDir(NULL),
+      debugDirs(NULL),
+      debugDirCount(0),
+      pdbInfo(NULL) {
     memset(pdbSignature, 0, sizeof(pdbSignature) / sizeof(*pdbSignature));
 
     _init();
@@ -80,18 +88,80 @@ void PEFile::_init() {
     // Section headers. There are IMAGE_FILE_HEADER.NumberOfSections of these.
     //
     sectionHeaders = (IMAGE_SECTION_HEADER*)p;
-}
 
-const uint8_t* PEFile::translate(size_t rva) const {
-    const IMAGE_SECTION_HEADER* s = sectionHeaders;
+    if (!isValidRef(p, fileHeader->NumberOfSections *
+                           sizeof(IMAGE_SECTION_HEADER)))
+        throw InvalidImage("missing IMAGE_SECTION_HEADER");
+
+    _sections.reserve(fileHeader->NumberOfSections);
 
-    for (size_t i = 0; i < fileHeader->NumberOfSections; ++i) {
-        if (rva >= s->VirtualAddress &&
-            rva < s->VirtualAddress + s->Misc.VirtualSize)
+    for (size_t i = 0; i < fileHeader->NumberOfSections; ++i)
+        _sections.push_back(sectionHeaders + i);
+
+    std::stable_sort(_sections.begin(), _sections.end(),
+                     [](const IMAGE_SECTION_HEADER* a,
+                        const IMAGE_SECTION_HEADER* b) {
+                         return a->VirtualAddress < b->VirtualAddress;
+                     });
+
+    //
+    // Find the data directories that we care about. This depends on whether
+    // this is a 32- or 64-bit image. If it is neither, there is nothing we can
+    // find.
+    //
+    switch (magic()) {
+        case IMAGE_NT_OPTIONAL_HDR32_MAGIC:
+            _initDirectories(optionalHeader<IMAGE_OPTIONAL_HEADER32>());
+            break;
+        case IMAGE_NT_OPTIONAL_HDR64_MAGIC:
+            _initDirectories(optionalHeader<IMAGE_OPTIONAL_HEADER64>());
             break;
+    }
+}
+
+template <typename OptHeader>
+void PEFile::_initDirectories(const OptHeader* opt) {
+    exportDir = getDataDir<IMAGE_EXPORT_DIRECTORY>(
+        opt, IMAGE_DIRECTORY_ENTRY_EXPORT);
+
+    resourceDir = getDataDir<IMAGE_RESOURCE_DIRECTORY>(
+        opt, IMAGE_DIRECTORY_ENTRY_RESOURCE);
 
-        ++s;
+    debugDirs = getDebugDataDirs(opt, debugDirCount);
+    if (!debugDirs) {
+        debugDirCount = 0;
+        return;
     }
 
+    // At most one of the debug data directories is a CodeView entry which has
+    // information about the PDB.
+    for (size_t i = 0; i < debugDirCount; ++i) {
+        const IMAGE_DEBUG_DIRECTORY& dir = debugDirs[i];
+
+        if (dir.Type == IMAGE_DEBUG_TYPE_CODEVIEW) {
+            if (pdbInfo)
+                throw InvalidImage("found multiple CodeView debug entries");
+
+            pdbInfo = (const CV_INFO_PDB70*)(buf + dir.PointerToRawData);
+
+            if (!isValidRef(pdbInfo))
+                throw InvalidImage("invalid CodeView debug entry location");
+        }
+    }
+}
+
+const uint8_t* PEFile::translate(size_t rva) const {
+    // Find the last section that starts at or before the RVA.
+    auto it = std::upper_bound(_sections.begin(), _sections.end(), rva,
+                               [](size_t rva, const IMAGE_SECTION_HEADER* s) {
+                                   return rva < s->VirtualAddress;
+                               });
+
+    if (it == _sections.begin()) return NULL;
+
+    const IMAGE_SECTION_HEADER* s = *(it - 1);
+
+    if (rva >= (size_t)s->VirtualAddress + s->Misc.VirtualSize) return NULL;
+
     return buf + rva - s->VirtualAddress + s->PointerToRawData;
 }
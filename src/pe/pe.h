@@ -24,6 +24,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "pe/format.h"
 
 /**
@@ -47,8 +49,15 @@ class PEFile {
     // Pointer to the optional header.
     const uint8_t* _optional;
 
+    // Section headers sorted by their virtual address. This is used to quickly
+    // translate RVAs.
+    std::vector<const IMAGE_SECTION_HEADER*> _sections;
+
     void _init();
 
+    template <typename OptHeader>
+    void _initDirectories(const OptHeader* opt);
+
    public:
     const uint8_t* buf;
     const size_t length;
@@ -57,6 +66,17 @@ class PEFile {
     const IMAGE_FILE_HEADER* fileHeader;
     const IMAGE_SECTION_HEADER* sectionHeaders;
 
+    // Data directories found while parsing the headers. These are all
+    // validated and are NULL if they don't exist.
+    const IMAGE_EXPORT_DIRECTORY* exportDir;
+    const IMAGE_RESOURCE_DIRECTORY* resourceDir;
+    const IMAGE_DEBUG_DIRECTORY* debugDirs;
+    size_t debugDirCount;
+
+    // The CodeView debug entry that has information about the PDB. This is NULL
+    // if there is no such entry.
+    const CV_INFO_PDB70* pdbInfo;
+
     // Replacement for timestamps
     //
     // The timestamp can't just be set to zero as that represents a special
@@ -100,8 +120,9 @@ class PEFile {
 
     /**
      * Translates a relative virtual address (RVA) to a physical address within
-     * the mapped file. Note that this does not do any bounds checking. You must
-     * check the bounds before dereferencing the returned pointer.
+     * the mapped file. Returns NULL if the RVA is not in any section. Note that
+     * this does not do any bounds checking. You must check the bounds before
+     * dereferencing the returned pointer.
      */
     const uint8_t* translate(size_t rva) const;
 
@@ -165,34 +186,4 @@ class PEFile {
 
         return (const IMAGE_DEBUG_DIRECTORY*)p;
     }
-
-    /**
-     * Returns the PDB information in the PE file. If it doesn't exist, returns
-     * NULL.
-     */
-    template <typename OptHeader>
-    const CV_INFO_PDB70* pdbInfo(const OptHeader* opt) const {
-        size_t debugDirCount;
-        auto dir = getDebugDataDirs(opt, debugDirCount);
-        if (!dir) return NULL;
-
-        // Information about the PDB that we're looking for.
-        const CV_INFO_PDB70* cvInfo = NULL;
-
-        for (size_t i = 0; i < debugDirCount; ++i) {
-            if (dir->Type == IMAGE_DEBUG_TYPE_CODEVIEW) {
-                if (cvInfo)
-                    throw InvalidImage("found multiple CodeView debug entries");
-
-                cvInfo = (const CV_INFO_PDB70*)(buf + dir->PointerToRawData);
-
-                if (!isValidRef(cvInfo))
-                    throw InvalidImage("invalid CodeView debug entry location");
-            }
-
-            ++dir;
-        }
-
-        return cvInfo;
-    }
 };
@@ -22,14 +22,27 @@
 
 #include "util/file.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <codecvt>
+#include <cstring>
 #include <iostream>
 #include <locale>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
+#include <io.h>
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 #endif
 
 const FileMode<char> FileMode<char>::readExisting("rb");
@@ -134,6 +147,178 @@ void deleteFile(const wchar_t* path) {
     }
 }
 
+namespace {
+
+bool isDirectory(const char* path) {
+    const DWORD attrs = GetFileAttributesA(path);
+    return attrs != INVALID_FILE_ATTRIBUTES &&
+           (attrs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+bool isDirectory(const wchar_t* path) {
+    const DWORD attrs = GetFileAttributesW(path);
+    return attrs != INVALID_FILE_ATTRIBUTES &&
+           (attrs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+void makeDirectory(const char* path) {
+    if (!CreateDirectoryA(path, NULL) &&
+        GetLastError() != ERROR_ALREADY_EXISTS) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to create directory");
+    }
+}
+
+void makeDirectory(const wchar_t* path) {
+    if (!CreateDirectoryW(path, NULL) &&
+        GetLastError() != ERROR_ALREADY_EXISTS) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to create directory");
+    }
+}
+
+bool isPathSeparator(wchar_t c) { return c == '/' || c == '\\'; }
+
+bool getFileId(HANDLE h, FileId& id) {
+    if (h == INVALID_HANDLE_VALUE) return false;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    const bool ok = GetFileInformationByHandle(h, &info) != 0;
+
+    CloseHandle(h);
+
+    if (!ok) return false;
+
+    const ULARGE_INTEGER modified = {info.ftLastWriteTime.dwLowDateTime,
+                                     info.ftLastWriteTime.dwHighDateTime};
+
+    id.device   = info.dwVolumeSerialNumber;
+    id.index    = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    id.size     = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    id.modified = (int64_t)modified.QuadPart;
+
+    return true;
+}
+
+}  // namespace
+
+bool getFileId(const char* path, FileId& id) {
+    return getFileId(CreateFileA(path, FILE_READ_ATTRIBUTES,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                     FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, 0, NULL),
+                     id);
+}
+
+bool getFileId(const wchar_t* path, FileId& id) {
+    return getFileId(CreateFileW(path, FILE_READ_ATTRIBUTES,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                     FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, 0, NULL),
+                     id);
+}
+
+FileLink linkFile(const char* src, const char* dest) {
+    // The copy is made under a temporary name first so that `dest` is
+    // replaced atomically.
+    const std::string tmp = std::string(dest) + ".tmp";
+    DeleteFileA(tmp.c_str());
+
+    if (!CopyFileA(src, tmp.c_str(), FALSE)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to copy file");
+    }
+
+    renameFile(tmp.c_str(), dest);
+    return FileLink::copy;
+}
+
+FileLink linkFile(const wchar_t* src, const wchar_t* dest) {
+    const std::wstring tmp = std::wstring(dest) + L".tmp";
+    DeleteFileW(tmp.c_str());
+
+    if (!CopyFileW(src, tmp.c_str(), FALSE)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to copy file");
+    }
+
+    renameFile(tmp.c_str(), dest);
+    return FileLink::copy;
+}
+
+int seekFile(FILE* f, int64_t offset, int origin) {
+    return _fseeki64(f, offset, origin);
+}
+
+int64_t tellFile(FILE* f) { return _ftelli64(f); }
+
+void resizeFile(FILE* f, int64_t length) {
+    if (fflush(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to flush file");
+    }
+
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+
+    // Setting the end of the file also allocates the space for it.
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = length;
+
+    if (!SetFileInformationByHandle(h, FileEndOfFileInfo, &info,
+                                    sizeof(info))) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to resize file");
+    }
+}
+
+void writeFileAt(FILE* f, int64_t offset, const void* data, size_t length) {
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (length > 0) {
+        // WriteFile() can only write 4 GB at a time.
+        const DWORD n = (DWORD)(std::min)(length, (size_t)1 << 30);
+
+        OVERLAPPED overlapped = {};
+        overlapped.Offset     = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+
+        DWORD written = 0;
+        if (!WriteFile(h, p, n, &written, &overlapped) || written == 0) {
+            throw std::system_error(GetLastError(), std::system_category(),
+                                    "failed to write file");
+        }
+
+        p += written;
+        offset += written;
+        length -= written;
+    }
+}
+
+std::string getCurrentDir() {
+    std::wstring dir(MAX_PATH, L'\0');
+
+    while (true) {
+        const DWORD n = GetCurrentDirectoryW((DWORD)dir.size(), &dir[0]);
+        if (n == 0) {
+            throw std::system_error(GetLastError(), std::system_category(),
+                                    "failed to get the current directory");
+        }
+
+        if (n < dir.size()) {
+            dir.resize(n);
+            break;
+        }
+
+        // Not big enough. `n` is the required size.
+        dir.resize(n);
+    }
+
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(dir);
+}
+
 #else  // !_WIN32
 
 FileRef openFile(const char* path, FileMode<char> mode) {
@@ -179,4 +364,206 @@ void deleteFile(const char* path) {
     }
 }
 
+namespace {
+
+bool isDirectory(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void makeDirectory(const char* path) {
+    if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+        auto err = errno;
+
+        std::stringbuf buf;
+        std::ostream msg(&buf);
+
+        msg << "failed to create directory '" << path << "'";
+
+        throw std::system_error(err, std::system_category(), buf.str());
+    }
+}
+
+bool isPathSeparator(char c) { return c == '/'; }
+
+#ifdef FICLONE
+
+/**
+ * Creates `dest` as a reflink of `src`. Returns false if the file system
+ * doesn't support it.
+ */
+bool reflinkFile(const char* src, const char* dest) {
+    const int in = open(src, O_RDONLY);
+    if (in < 0) return false;
+
+    const int out = open(dest, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    const bool ok = ioctl(out, FICLONE, in) == 0;
+
+    close(out);
+    close(in);
+
+    if (!ok) unlink(dest);
+
+    return ok;
+}
+
+#endif
+
+void copyFile(const char* src, const char* dest) {
+    auto in  = openFile(src, FileMode<char>::readExisting);
+    auto out = openFile(dest, FileMode<char>::writeEmpty);
+
+    std::vector<uint8_t> buf(1024 * 1024);
+
+    while (size_t n = fread(buf.data(), 1, buf.size(), in.get())) {
+        if (fwrite(buf.data(), 1, n, out.get()) != n) {
+            throw std::system_error(errno, std::system_category(),
+                                    "failed to copy file");
+        }
+    }
+
+    if (ferror(in.get()) || fflush(out.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to copy file");
+    }
+}
+
+}  // namespace
+
+FileLink linkFile(const char* src, const char* dest) {
+    // The link is made under a temporary name first so that `dest` is
+    // replaced atomically.
+    const std::string tmp = std::string(dest) + ".tmp";
+    unlink(tmp.c_str());
+
+#ifdef FICLONE
+    if (reflinkFile(src, tmp.c_str())) {
+        renameFile(tmp.c_str(), dest);
+        return FileLink::reflink;
+    }
+#endif
+
+    copyFile(src, tmp.c_str());
+
+    renameFile(tmp.c_str(), dest);
+    return FileLink::copy;
+}
+
+bool getFileId(const char* path, FileId& id) {
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+
+    id.device = (uint64_t)st.st_dev;
+    id.index  = (uint64_t)st.st_ino;
+    id.size   = (uint64_t)st.st_size;
+
+#if defined(__APPLE__)
+    id.modified = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+                  st.st_mtimespec.tv_nsec;
+#else
+    id.modified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+
+    return true;
+}
+
+int seekFile(FILE* f, int64_t offset, int origin) {
+    return fseeko(f, (off_t)offset, origin);
+}
+
+int64_t tellFile(FILE* f) { return (int64_t)ftello(f); }
+
+void resizeFile(FILE* f, int64_t length) {
+    if (fflush(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to flush file");
+    }
+
+    const int fd = fileno(f);
+
+#ifdef __linux__
+    // Not every file system supports this. The file is still resized below if
+    // it fails.
+    (void)fallocate(fd, 0, 0, (off_t)length);
+#endif
+
+    if (ftruncate(fd, (off_t)length) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to resize file");
+    }
+}
+
+void writeFileAt(FILE* f, int64_t offset, const void* data, size_t length) {
+    const int fd = fileno(f);
+
+    const uint8_t* p = (const uint8_t*)data;
+
+    while (length > 0) {
+        const ssize_t n = pwrite(fd, p, length, (off_t)offset);
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) {
+            throw std::system_error(n < 0 ? errno : EIO,
+                                    std::system_category(),
+                                    "failed to write file");
+        }
+
+        p += n;
+        offset += n;
+        length -= (size_t)n;
+    }
+}
+
+std::string getCurrentDir() {
+    std::string dir(256, '\0');
+
+    while (!getcwd(&dir[0], dir.size())) {
+        if (errno != ERANGE) {
+            throw std::system_error(errno, std::system_category(),
+                                    "failed to get the current directory");
+        }
+
+        dir.resize(dir.size() * 2);
+    }
+
+    dir.resize(strlen(dir.c_str()));
+    return dir;
+}
+
 #endif  // _WIN32
+
+namespace {
+
+template <typename CharT>
+void createDirectoriesImpl(const CharT* path) {
+    std::basic_string<CharT> dir(path);
+
+    while (dir.length() > 1 && isPathSeparator(dir.back())) dir.pop_back();
+
+    if (dir.empty() || isDirectory(dir.c_str())) return;
+
+    // Create the parent first. It is found by going back to the previous
+    // separator.
+    size_t end = dir.length();
+    while (end > 0 && !isPathSeparator(dir[end - 1])) --end;
+
+    if (end > 0) createDirectoriesImpl(dir.substr(0, end).c_str());
+
+    makeDirectory(dir.c_str());
+}
+
+}  // namespace
+
+void createDirectories(const char* path) { createDirectoriesImpl(path); }
+
+#ifdef _WIN32
+
+void createDirectories(const wchar_t* path) { createDirectoriesImpl(path); }
+
+#endif
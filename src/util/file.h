@@ -21,8 +21,10 @@
  */
 #pragma once
 
+#include <stdint.h>
 #include <cstdio>
 #include <memory>
+#include <string>
 
 /**
  * Abstracts file mode so we can use them generically with other templates.
@@ -69,11 +71,109 @@ void renameFile(const char* src, const char* dest);
  */
 void deleteFile(const char* path);
 
+/**
+ * How linkFile() made the new file.
+ */
+enum class FileLink {
+    // The new file shares the blocks of the original until either is
+    // modified.
+    reflink,
+
+    // The contents were copied.
+    copy,
+};
+
+/**
+ * Makes `dest` a file with the same contents as `src`, replacing it if it
+ * exists. A reflink is made where the file system supports it, and the file is
+ * copied otherwise. Hard links are never made, since modifying either file in
+ * place would then change the other one as well. If `dest` is a hard link to
+ * `src`, it is replaced by a separate file.
+ *
+ * Throws std::system_error if it failed.
+ */
+FileLink linkFile(const char* src, const char* dest);
+
+/**
+ * Creates a directory and any of its parents that don't exist yet. Nothing is
+ * done if it already exists.
+ *
+ * Throws std::system_error if it failed.
+ */
+void createDirectories(const char* path);
+
+/**
+ * Seeks to a 64-bit offset in a file. This is like fseek(), but works with
+ * files larger than 2 GB on every platform. Returns 0 on success.
+ */
+int seekFile(FILE* f, int64_t offset, int origin);
+
+/**
+ * Returns the current 64-bit position in a file, or -1 on failure.
+ */
+int64_t tellFile(FILE* f);
+
+/**
+ * Sets the length of a file, extending it with zeros if necessary. Where it is
+ * supported, the space is also allocated so that writing the file later does
+ * not fragment it. Anything buffered in `f` is flushed first.
+ *
+ * Throws std::system_error if it failed.
+ */
+void resizeFile(FILE* f, int64_t length);
+
+/**
+ * Writes a buffer at an offset in a file, bypassing the buffering of `f`. This
+ * is safe to do from several threads at once as long as the ranges don't
+ * overlap. The position of `f` is unspecified afterwards.
+ *
+ * Throws std::system_error if it failed.
+ */
+void writeFileAt(FILE* f, int64_t offset, const void* data, size_t length);
+
+/**
+ * Identifies a file and the version of its contents. If a file is modified, at
+ * least its modification time changes. If it is replaced, its device or index
+ * changes.
+ */
+struct FileId {
+    uint64_t device;
+    uint64_t index;
+    uint64_t size;
+
+    // Last modification time in an unspecified, platform dependent unit.
+    int64_t modified;
+};
+
+inline bool operator==(const FileId& a, const FileId& b) {
+    return a.device == b.device && a.index == b.index && a.size == b.size &&
+           a.modified == b.modified;
+}
+
+inline bool operator!=(const FileId& a, const FileId& b) { return !(a == b); }
+
+/**
+ * Gets the identity of the file at the given path.
+ *
+ * Returns false if the file does not exist or cannot be accessed.
+ */
+bool getFileId(const char* path, FileId& id);
+
+/**
+ * Returns the current working directory, encoded as UTF-8.
+ *
+ * Throws std::system_error if it failed.
+ */
+std::string getCurrentDir();
+
 #ifdef _WIN32
 
 FileRef openFile(const wchar_t* path, FileMode<wchar_t> mode);
 
 void renameFile(const wchar_t* src, const wchar_t* dest);
 void deleteFile(const wchar_t* path);
+FileLink linkFile(const wchar_t* src, const wchar_t* dest);
+void createDirectories(const wchar_t* path);
+bool getFileId(const wchar_t* path, FileId& id);
 
 #endif  // _WIN32
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/ipc.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#ifdef _WIN32
+#include <codecvt>
+#include <locale>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+namespace {
+
+// Size of the pipe buffers.
+const DWORD kPipeBufferSize = 64 * 1024;
+
+std::wstring pipeName(const std::string& address) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    std::wstring name = converter.from_bytes(address);
+
+    if (name.compare(0, 2, L"\\\\") != 0) name.insert(0, L"\\\\.\\pipe\\");
+
+    return name;
+}
+
+HANDLE createPipe(const std::wstring& name, bool first) {
+    HANDLE h = CreateNamedPipeW(
+        name.c_str(),
+        PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT |
+            PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, kPipeBufferSize, kPipeBufferSize, 0, NULL);
+
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to create named pipe");
+    }
+
+    return h;
+}
+
+}  // namespace
+
+IpcConnection::IpcConnection(void* handle, bool server)
+    : _handle(handle), _server(server), _readTimeout(0) {}
+
+IpcConnection::~IpcConnection() {
+    if (_server) {
+        FlushFileBuffers(_handle);
+        DisconnectNamedPipe(_handle);
+    }
+
+    CloseHandle(_handle);
+}
+
+bool IpcConnection::read(void* buf, size_t length) {
+    ULONGLONG lastRead = GetTickCount64();
+
+    while (length > 0) {
+        DWORD chunk = (DWORD)std::min<size_t>(length, kPipeBufferSize);
+
+        if (_readTimeout != 0) {
+            // ReadFile() can't time out on a synchronous pipe, so only read
+            // what is already there.
+            DWORD available = 0;
+            if (!PeekNamedPipe(_handle, NULL, 0, NULL, &available, NULL))
+                return false;
+
+            if (available == 0) {
+                if (GetTickCount64() - lastRead >= _readTimeout) return false;
+
+                Sleep(1);
+                continue;
+            }
+
+            chunk = std::min(chunk, available);
+        }
+
+        DWORD n = 0;
+        if (!ReadFile(_handle, buf, chunk, &n, NULL) || n == 0) return false;
+
+        buf = (uint8_t*)buf + n;
+        length -= n;
+        lastRead = GetTickCount64();
+    }
+
+    return true;
+}
+
+bool IpcConnection::write(const void* buf, size_t length) {
+    while (length > 0) {
+        const DWORD chunk = (DWORD)std::min<size_t>(length, kPipeBufferSize);
+
+        DWORD n = 0;
+        if (!WriteFile(_handle, buf, chunk, &n, NULL)) return false;
+
+        buf = (const uint8_t*)buf + n;
+        length -= n;
+    }
+
+    return true;
+}
+
+void IpcConnection::setReadTimeout(unsigned milliseconds) {
+    _readTimeout = milliseconds;
+}
+
+IpcConnectionPtr connectIpc(const std::string& address) {
+    const std::wstring name = pipeName(address);
+
+    while (true) {
+        HANDLE h = CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                               NULL, OPEN_EXISTING, 0, NULL);
+
+        if (h != INVALID_HANDLE_VALUE)
+            return IpcConnectionPtr(new IpcConnection(h, false));
+
+        // All instances are busy. Wait for one to become available.
+        if (GetLastError() != ERROR_PIPE_BUSY ||
+            !WaitNamedPipeW(name.c_str(), 1000)) {
+            return nullptr;
+        }
+    }
+}
+
+IpcListener::IpcListener(const std::string& address)
+    : _name(pipeName(address)), _next(createPipe(_name, true)) {}
+
+IpcListener::~IpcListener() { CloseHandle(_next); }
+
+IpcConnectionPtr IpcListener::accept() {
+    if (!ConnectNamedPipe(_next, NULL) &&
+        GetLastError() != ERROR_PIPE_CONNECTED) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to accept connection");
+    }
+
+    IpcConnectionPtr connection(new IpcConnection(_next, true));
+
+    _next = createPipe(_name, false);
+
+    return connection;
+}
+
+#else  // !_WIN32
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+// Don't get killed by SIGPIPE if the other end goes away.
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.length() >= sizeof(addr.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::system_category(),
+                                "socket path is too long");
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.length());
+    return addr;
+}
+
+int createSocket() {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed to create socket");
+    }
+
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    return fd;
+}
+
+}  // namespace
+
+IpcConnection::IpcConnection(int fd) : _fd(fd) {}
+
+IpcConnection::~IpcConnection() { close(_fd); }
+
+bool IpcConnection::read(void* buf, size_t length) {
+    while (length > 0) {
+        const ssize_t n = recv(_fd, buf, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        buf = (uint8_t*)buf + n;
+        length -= (size_t)n;
+    }
+
+    return true;
+}
+
+bool IpcConnection::write(const void* buf, size_t length) {
+    while (length > 0) {
+        const ssize_t n = send(_fd, buf, length, kSendFlags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        buf = (const uint8_t*)buf + n;
+        length -= (size_t)n;
+    }
+
+    return true;
+}
+
+void IpcConnection::setReadTimeout(unsigned milliseconds) {
+    timeval tv;
+    tv.tv_sec  = milliseconds / 1000;
+    tv.tv_usec = (milliseconds % 1000) * 1000;
+    setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+IpcConnectionPtr connectIpc(const std::string& address) {
+    const sockaddr_un addr = socketAddress(address);
+    const int fd           = createSocket();
+
+    if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    return IpcConnectionPtr(new IpcConnection(fd));
+}
+
+IpcListener::IpcListener(const std::string& address)
+    : _path(address), _fd(-1) {
+    // A socket file may be left over from a server that didn't shut down
+    // cleanly. It is only safe to remove it if nothing is listening on it.
+    if (connectIpc(address)) {
+        throw std::system_error(EADDRINUSE, std::system_category(),
+                                "a server is already listening on '" +
+                                    address + "'");
+    }
+
+    unlink(address.c_str());
+
+    const sockaddr_un addr = socketAddress(address);
+    _fd                    = createSocket();
+
+    if (bind(_fd, (const sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(_fd, SOMAXCONN) != 0) {
+        const int err = errno;
+        close(_fd);
+        throw std::system_error(err, std::system_category(),
+                                "failed to listen on '" + address + "'");
+    }
+}
+
+IpcListener::~IpcListener() {
+    close(_fd);
+    unlink(_path.c_str());
+}
+
+IpcConnectionPtr IpcListener::accept() {
+    while (true) {
+        const int fd = ::accept(_fd, NULL, NULL);
+
+        if (fd != -1) return IpcConnectionPtr(new IpcConnection(fd));
+
+        if (errno != EINTR && errno != ECONNABORTED) {
+            throw std::system_error(errno, std::system_category(),
+                                    "failed to accept connection");
+        }
+    }
+}
+
+#endif  // _WIN32
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+
+/**
+ * A connection between two processes on the same machine. This is a Unix domain
+ * socket on POSIX systems and a named pipe on Windows.
+ */
+class IpcConnection {
+   private:
+#ifdef _WIN32
+    void* _handle;
+
+    // True if this is the server end of a named pipe.
+    bool _server;
+
+    // See setReadTimeout(). Named pipes don't have a timeout of their own.
+    unsigned _readTimeout;
+#else
+    int _fd;
+#endif
+
+   public:
+#ifdef _WIN32
+    IpcConnection(void* handle, bool server);
+#else
+    explicit IpcConnection(int fd);
+#endif
+
+    ~IpcConnection();
+
+    IpcConnection(const IpcConnection&) = delete;
+    IpcConnection& operator=(const IpcConnection&) = delete;
+
+    /**
+     * Reads exactly `length` bytes. Returns false if the connection was closed
+     * or broken before then.
+     */
+    bool read(void* buf, size_t length);
+
+    /**
+     * Writes all of the given bytes. Returns false if the connection was closed
+     * or broken.
+     */
+    bool write(const void* buf, size_t length);
+
+    /**
+     * Makes read() fail if no data arrives for the given number of
+     * milliseconds. 0 means to wait forever, which is the default.
+     */
+    void setReadTimeout(unsigned milliseconds);
+};
+
+typedef std::unique_ptr<IpcConnection> IpcConnectionPtr;
+
+/**
+ * Connects to a server listening on the given address. Returns null if there
+ * is no server listening.
+ *
+ * On Windows, the address is the name of a pipe. For convenience, "\\.\pipe\"
+ * is prepended if it isn't a full pipe path. Otherwise, the address is the path
+ * to a Unix domain socket.
+ */
+IpcConnectionPtr connectIpc(const std::string& address);
+
+/**
+ * Listens for connections on an address. See connectIpc() for the format of the
+ * address.
+ */
+class IpcListener {
+   private:
+#ifdef _WIN32
+    std::wstring _name;
+
+    // The next pipe instance to connect.
+    void* _next;
+#else
+    std::string _path;
+    int _fd;
+#endif
+
+   public:
+    /**
+     * Throws: std::system_error if the address can't be listened on, such as
+     * when another server is already listening there.
+     */
+    explicit IpcListener(const std::string& address);
+
+    ~IpcListener();
+
+    IpcListener(const IpcListener&) = delete;
+    IpcListener& operator=(const IpcListener&) = delete;
+
+    /**
+     * Blocks until a client connects.
+     *
+     * Throws: std::system_error on failure.
+     */
+    IpcConnectionPtr accept();
+};
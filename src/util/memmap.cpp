@@ -25,20 +25,33 @@
 #if defined(_WIN32)
 
 #include <windows.h>
+#include <algorithm>
 #include <limits>
 #include <system_error>
 
-MemMap::MemMap(const char* path, size_t length)
-    : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL),
+MemMap::MemMap(const char* path, size_t length, bool readOnly)
+    : _buf(NULL),
+      _length(0),
+      _readOnly(readOnly),
+      _borrowed(false),
+      _fileMap(NULL) {
+    _init(CreateFileA(path,
+                      readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                      readOnly ? FILE_SHARE_READ : 0, NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL, NULL),
           length);
 }
 
-MemMap::MemMap(const wchar_t* path, size_t length)
-    : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL),
+MemMap::MemMap(const wchar_t* path, size_t length, bool readOnly)
+    : _buf(NULL),
+      _length(0),
+      _readOnly(readOnly),
+      _borrowed(false),
+      _fileMap(NULL) {
+    _init(CreateFileW(path,
+                      readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                      readOnly ? FILE_SHARE_READ : 0, NULL, OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL, NULL),
           length);
 }
 
@@ -48,47 +61,59 @@ void MemMap::_init(HANDLE hFile, size_t length) {
                                 "Failed to open file");
     }
 
-    ULARGE_INTEGER maxSize;
-    maxSize.QuadPart = length;
-
-    _fileMap =
-        CreateFileMappingW(hFile,             // File handle
-                           NULL,              // Security attributes
-                           PAGE_READWRITE,    // Page protection flags
-                           maxSize.HighPart,  // Maximum size (high-order bytes)
-                           maxSize.LowPart,   // Maximum size (low-order bytes)
-                           NULL  // Optional name to give the object
-        );
-
-    if (!_fileMap) {
-        throw std::system_error(GetLastError(), std::system_category(),
-                                "Failed to create file map");
-    }
-
     if (length == 0) {
         LARGE_INTEGER fileSize;
         if (!GetFileSizeEx(hFile, &fileSize)) {
-            throw std::system_error(GetLastError(), std::system_category(),
+            auto err = GetLastError();
+            CloseHandle(hFile);
+            throw std::system_error(err, std::system_category(),
                                     "Failed to get file length");
         }
 
         // Detect overflow
         if ((ULONGLONG)fileSize.QuadPart >
             (std::numeric_limits<size_t>::max)()) {
+            CloseHandle(hFile);
             throw std::range_error("File is too large to map");
         }
 
         length = (size_t)fileSize.QuadPart;
+
+        // An empty file cannot be mapped. There is nothing to map anyway.
+        if (length == 0) {
+            CloseHandle(hFile);
+            return;
+        }
+    }
+
+    ULARGE_INTEGER maxSize;
+    maxSize.QuadPart = length;
+
+    _fileMap = CreateFileMappingW(
+        hFile,                                      // File handle
+        NULL,                                       // Security attributes
+        _readOnly ? PAGE_READONLY : PAGE_READWRITE,  // Page protection flags
+        maxSize.HighPart,  // Maximum size (high-order bytes)
+        maxSize.LowPart,   // Maximum size (low-order bytes)
+        NULL               // Optional name to give the object
+    );
+
+    if (!_fileMap) {
+        auto err = GetLastError();
+        CloseHandle(hFile);
+        throw std::system_error(err, std::system_category(),
+                                "Failed to create file map");
     }
 
     CloseHandle(hFile);
 
     // Create a view into the file mapping
-    _buf = MapViewOfFileEx(_fileMap,  // File mapping object
-                           FILE_MAP_READ | FILE_MAP_WRITE,  // Desired access
-                           0, 0,                            // File offset
-                           length,  // Number of bytes to map
-                           NULL     // Preferred base address
+    _buf = MapViewOfFileEx(
+        _fileMap,  // File mapping object
+        _readOnly ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE,  // Access
+        0, 0,    // File offset
+        length,  // Number of bytes to map
+        NULL     // Preferred base address
     );
 
     if (!_buf) {
@@ -99,22 +124,90 @@ void MemMap::_init(HANDLE hFile, size_t length) {
     _length = length;
 }
 
+MemMap::MemMap(void* buf, size_t length, bool readOnly)
+    : _buf(buf),
+      _length(length),
+      _readOnly(readOnly),
+      _borrowed(true),
+      _fileMap(NULL) {}
+
+MemMap::MemMap(size_t length)
+    : _buf(NULL),
+      _length(0),
+      _readOnly(false),
+      _borrowed(false),
+      _fileMap(NULL) {
+    wchar_t dir[MAX_PATH + 1];
+    wchar_t path[MAX_PATH + 1];
+
+    if (GetTempPathW(MAX_PATH + 1, dir) == 0 ||
+        GetTempFileNameW(dir, L"duc", 0, path) == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "Failed to create temporary file");
+    }
+
+    // The file is deleted once the mapping is closed.
+    _init(CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                      CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                      NULL),
+          length);
+}
+
 MemMap::~MemMap() {
-    if (_buf) UnmapViewOfFile(_buf);
+    if (_buf && !_borrowed) UnmapViewOfFile(_buf);
     if (_fileMap) CloseHandle(_fileMap);
 }
 
+namespace {
+
+// Same as WIN32_MEMORY_RANGE_ENTRY, which is only declared for Windows 8 and
+// later.
+struct MemoryRange {
+    void* address;
+    size_t length;
+};
+
+typedef BOOL(WINAPI* PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR, MemoryRange*,
+                                              ULONG);
+
+}  // namespace
+
+void MemMap::advise(MemAccess access, size_t offset, size_t length) const {
+    if (!_buf || _borrowed || offset >= _length) return;
+
+    // Views of a file can only be prefetched. A sequential scan reads all of
+    // the range anyway, so it may as well be prefetched too.
+    if (access != MemAccess::willNeed && access != MemAccess::sequential)
+        return;
+
+    // Not available before Windows 8.
+    static const auto prefetch = (PrefetchVirtualMemoryFn)GetProcAddress(
+        GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+
+    if (!prefetch) return;
+
+    MemoryRange range = {(char*)_buf + offset,
+                         (std::min)(length, _length - offset)};
+
+    prefetch(GetCurrentProcess(), 1, &range, 0);
+}
+
 #else
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <string>
 #include <system_error>
 
-MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
-    int fd = open(path, O_RDWR);
+MemMap::MemMap(const char* path, size_t length, bool readOnly)
+    : _buf(NULL), _length(0), _readOnly(readOnly), _borrowed(false) {
+    int fd = open(path, readOnly ? O_RDONLY : O_RDWR);
     if (fd == -1) {
         throw std::system_error(errno, std::system_category(),
                                 "Failed to open file");
@@ -123,23 +216,33 @@ MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
     if (length == 0) {
         struct stat stbuf;
         if (fstat(fd, &stbuf) == -1) {
-            throw std::system_error(errno, std::system_category(),
+            auto err = errno;
+            close(fd);
+            throw std::system_error(err, std::system_category(),
                                     "Failed to stat file");
         }
 
         length = stbuf.st_size;
+
+        // An empty file cannot be mapped. There is nothing to map anyway.
+        if (length == 0) {
+            close(fd);
+            return;
+        }
     }
 
     void* p = mmap(NULL,    // Preferred base address (don't care)
                    length,  // Length of the memory map
-                   PROT_READ | PROT_WRITE,  // Protection flags
+                   readOnly ? PROT_READ : PROT_READ | PROT_WRITE,  // Protection
                    MAP_SHARED,
                    fd,  // File descriptor
                    0    // Offset within the file
     );
 
     if (p == MAP_FAILED) {
-        throw std::system_error(errno, std::system_category(),
+        auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category(),
                                 "Failed to map file");
     }
 
@@ -153,10 +256,85 @@ MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
     }
 }
 
+MemMap::MemMap(void* buf, size_t length, bool readOnly)
+    : _buf(buf), _length(length), _readOnly(readOnly), _borrowed(true) {}
+
+MemMap::MemMap(size_t length)
+    : _buf(NULL), _length(0), _readOnly(false), _borrowed(false) {
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+
+    std::string path = std::string(dir) + "/ducible-XXXXXX";
+
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to create temporary file");
+    }
+
+    // Nothing else needs to open the file, so it can be deleted right away.
+    // It is only freed once it is unmapped.
+    unlink(path.c_str());
+
+    if (ftruncate(fd, (off_t)length) == -1) {
+        auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category(),
+                                "Failed to resize temporary file");
+    }
+
+    void* p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category(),
+                                "Failed to map file");
+    }
+
+    _buf    = p;
+    _length = length;
+
+    if (close(fd) == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to close file");
+    }
+}
+
 MemMap::~MemMap() {
-    if (_buf) {
+    if (_buf && !_borrowed) {
         munmap(_buf, _length);
     }
 }
 
+void MemMap::advise(MemAccess access, size_t offset, size_t length) const {
+    if (!_buf || _borrowed || offset >= _length) return;
+
+    length = std::min(length, _length - offset);
+
+    int advice = MADV_NORMAL;
+
+    switch (access) {
+        case MemAccess::normal:
+            advice = MADV_NORMAL;
+            break;
+        case MemAccess::sequential:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case MemAccess::random:
+            advice = MADV_RANDOM;
+            break;
+        case MemAccess::willNeed:
+            advice = MADV_WILLNEED;
+            break;
+    }
+
+    // The range must start on a page boundary.
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    const size_t start = offset - offset % pageSize;
+
+    madvise((char*)_buf + start, length + (offset - start), advice);
+}
+
 #endif
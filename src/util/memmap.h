@@ -31,11 +31,29 @@
 #pragma once
 
 #include <stdlib.h>  // For size_t
+#include <memory>
 
 #ifdef _WIN32
 typedef void* HANDLE;
 #endif
 
+/**
+ * How a range of a mapping is about to be accessed. See MemMap::advise().
+ */
+enum class MemAccess {
+    // No particular pattern. This is the default.
+    normal,
+
+    // Read once from start to end. More of it can be read ahead.
+    sequential,
+
+    // Read in no particular order. Reading ahead would be wasted.
+    random,
+
+    // Read soon. Starts reading it in before it is accessed.
+    willNeed,
+};
+
 /**
  * Maps a file into memory.
  */
@@ -43,6 +61,10 @@ class MemMap {
    private:
     void* _buf;
     size_t _length;
+    bool _readOnly;
+
+    // True if `_buf` is owned by someone else and must not be unmapped.
+    bool _borrowed;
 
 #ifdef _WIN32
     HANDLE _fileMap;
@@ -50,13 +72,36 @@ class MemMap {
 #endif
 
    public:
-    MemMap(const char* path, size_t length = 0);
+    /**
+     * Maps the file at the given path. If `length` is 0, the whole file is
+     * mapped. If `readOnly` is true, the file is opened read-only and the
+     * mapping must not be written to.
+     */
+    MemMap(const char* path, size_t length = 0, bool readOnly = false);
     ~MemMap();
 
 #ifdef _WIN32
-    MemMap(const wchar_t* path, size_t length = 0);
+    MemMap(const wchar_t* path, size_t length = 0, bool readOnly = false);
 #endif
 
+    /**
+     * Wraps a buffer owned by the caller instead of mapping a file. The buffer
+     * is not copied and must outlive this object. This allows the code that
+     * works on mappings to also work on data that is already in memory.
+     */
+    MemMap(void* buf, size_t length, bool readOnly = true);
+
+    /**
+     * Maps a new temporary file of the given length to use as scratch memory.
+     * Unlike memory from the heap, the system can write it out to the file
+     * instead of running out of memory. The file is deleted once it is
+     * unmapped.
+     */
+    explicit MemMap(size_t length);
+
+    MemMap(const MemMap&) = delete;
+    MemMap& operator=(const MemMap&) = delete;
+
     /**
      * Returns the size of the file.
      */
@@ -66,4 +111,21 @@ class MemMap {
      * Returns a pointer to the buffer.
      */
     void* buf() { return _buf; }
+    const void* buf() const { return _buf; }
+
+    /**
+     * Returns true if the mapping is read-only.
+     */
+    bool readOnly() const { return _readOnly; }
+
+    /**
+     * Tells the system how a range of the mapping is about to be accessed so
+     * that fewer page faults are taken on a cold cache. The range is clamped to
+     * the mapping. This is only a hint; errors are ignored and buffers owned by
+     * the caller are left alone.
+     */
+    void advise(MemAccess access, size_t offset = 0,
+                size_t length = (size_t)-1) const;
 };
+
+typedef std::shared_ptr<MemMap> MemMapRef;
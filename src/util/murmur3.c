@@ -0,0 +1,131 @@
+/**
+ * This MurmurHash3 implementation comes from:
+ * https://github.com/aappleby/smhasher
+ *
+ * MurmurHash3 was written by Austin Appleby, and is placed in the public
+ * domain. Only MurmurHash3_x64_128 is kept here, adapted for ducible to read
+ * unaligned input with memcpy and to write the digest as little-endian bytes.
+ */
+#include <string.h>
+#include "murmur3.h"
+
+#if defined(_MSC_VER)
+#define ROTL64(x,y) _rotl64(x,y)
+#else
+#define ROTL64(x,y) (((x) << (y)) | ((x) >> (64 - (y))))
+#endif
+
+/*
+ * Block read. Using memcpy avoids unaligned access and is optimized away on
+ * platforms that support it.
+ */
+static uint64_t getblock64(const unsigned char *p, size_t i)
+{
+    uint64_t k;
+    memcpy(&k, p + i * 8, sizeof(k));
+    return k;
+}
+
+/*
+ * Finalization mix - force all bits of a hash block to avalanche
+ */
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+static void put_uint64_le(uint64_t n, unsigned char *b)
+{
+    int i;
+
+    for (i = 0; i < 8; ++i)
+        b[i] = (unsigned char)(n >> (i * 8));
+}
+
+void murmur3_x64_128(const void *input, size_t len, uint32_t seed,
+                     unsigned char output[16])
+{
+    const unsigned char *data = (const unsigned char *)input;
+    const size_t nblocks = len / 16;
+    const unsigned char *tail;
+    size_t i;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t k1, k2;
+
+    /*
+     * Body
+     */
+    for (i = 0; i < nblocks; i++)
+    {
+        k1 = getblock64(data, i * 2 + 0);
+        k2 = getblock64(data, i * 2 + 1);
+
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    /*
+     * Tail
+     */
+    tail = data + nblocks * 16;
+
+    k1 = 0;
+    k2 = 0;
+
+    switch (len & 15)
+    {
+    case 15: k2 ^= ((uint64_t)tail[14]) << 48;
+    case 14: k2 ^= ((uint64_t)tail[13]) << 40;
+    case 13: k2 ^= ((uint64_t)tail[12]) << 32;
+    case 12: k2 ^= ((uint64_t)tail[11]) << 24;
+    case 11: k2 ^= ((uint64_t)tail[10]) << 16;
+    case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;
+    case  9: k2 ^= ((uint64_t)tail[ 8]) << 0;
+             k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+
+    case  8: k1 ^= ((uint64_t)tail[ 7]) << 56;
+    case  7: k1 ^= ((uint64_t)tail[ 6]) << 48;
+    case  6: k1 ^= ((uint64_t)tail[ 5]) << 40;
+    case  5: k1 ^= ((uint64_t)tail[ 4]) << 32;
+    case  4: k1 ^= ((uint64_t)tail[ 3]) << 24;
+    case  3: k1 ^= ((uint64_t)tail[ 2]) << 16;
+    case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;
+    case  1: k1 ^= ((uint64_t)tail[ 0]) << 0;
+             k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+    };
+
+    /*
+     * Finalization
+     */
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    put_uint64_le(h1, output);
+    put_uint64_le(h2, output + 8);
+}
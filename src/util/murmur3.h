@@ -0,0 +1,31 @@
+/**
+ * This MurmurHash3 implementation comes from:
+ * https://github.com/aappleby/smhasher
+ *
+ * MurmurHash3 was written by Austin Appleby, and is placed in the public
+ * domain. Only MurmurHash3_x64_128 is kept here, adapted for ducible to read
+ * unaligned input with memcpy and to write the digest as little-endian bytes.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>  // For size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Output = MurmurHash3_x64_128( input buffer )
+ *
+ * \param input    buffer holding the data
+ * \param len      length of the input data
+ * \param seed     seed for the hash
+ * \param output   128-bit hash result, as two little endian 64-bit integers
+ */
+void murmur3_x64_128(const void *input, size_t len, uint32_t seed,
+                     unsigned char output[16]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,196 @@
+/**
+ * SHA-256 as specified in FIPS 180-4.
+ *
+ * The structure follows the MD5 implementation in md5.c.
+ */
+#include <memory.h>
+#include "sha256.h"
+
+/*
+ * 32-bit integer manipulation macros (big endian)
+ */
+#define GET_UINT32_BE(n,b,i)                        \
+{                                                   \
+    (n) = ( (uint32_t) (b)[(i)    ] << 24 )         \
+        | ( (uint32_t) (b)[(i) + 1] << 16 )         \
+        | ( (uint32_t) (b)[(i) + 2] <<  8 )         \
+        | ( (uint32_t) (b)[(i) + 3]       );        \
+}
+
+#define PUT_UINT32_BE(n,b,i)                        \
+{                                                   \
+    (b)[(i)    ] = (unsigned char) ( (n) >> 24 );   \
+    (b)[(i) + 1] = (unsigned char) ( (n) >> 16 );   \
+    (b)[(i) + 2] = (unsigned char) ( (n) >>  8 );   \
+    (b)[(i) + 3] = (unsigned char) ( (n)       );   \
+}
+
+static const uint32_t K[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+/*
+ * SHA-256 context setup
+ */
+void sha256_starts(sha256_context *ctx)
+{
+    ctx->total = 0;
+
+    ctx->state[0] = 0x6A09E667;
+    ctx->state[1] = 0xBB67AE85;
+    ctx->state[2] = 0x3C6EF372;
+    ctx->state[3] = 0xA54FF53A;
+    ctx->state[4] = 0x510E527F;
+    ctx->state[5] = 0x9B05688C;
+    ctx->state[6] = 0x1F83D9AB;
+    ctx->state[7] = 0x5BE0CD19;
+}
+
+#define ROTR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define S0(x) (ROTR(x, 7) ^ ROTR(x,18) ^ ((x) >>  3))
+#define S1(x) (ROTR(x,17) ^ ROTR(x,19) ^ ((x) >> 10))
+
+#define S2(x) (ROTR(x, 2) ^ ROTR(x,13) ^ ROTR(x,22))
+#define S3(x) (ROTR(x, 6) ^ ROTR(x,11) ^ ROTR(x,25))
+
+#define F0(x,y,z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define F1(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+
+static void sha256_process(sha256_context *ctx, const unsigned char data[64])
+{
+    uint32_t W[64];
+    uint32_t A[8];
+    uint32_t temp1, temp2;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        GET_UINT32_BE(W[i], data, 4 * i);
+
+    for (; i < 64; i++)
+        W[i] = S1(W[i - 2]) + W[i - 7] + S0(W[i - 15]) + W[i - 16];
+
+    for (i = 0; i < 8; i++)
+        A[i] = ctx->state[i];
+
+    for (i = 0; i < 64; i++)
+    {
+        temp1 = A[7] + S3(A[4]) + F1(A[4], A[5], A[6]) + K[i] + W[i];
+        temp2 = S2(A[0]) + F0(A[0], A[1], A[2]);
+
+        A[7] = A[6];
+        A[6] = A[5];
+        A[5] = A[4];
+        A[4] = A[3] + temp1;
+        A[3] = A[2];
+        A[2] = A[1];
+        A[1] = A[0];
+        A[0] = temp1 + temp2;
+    }
+
+    for (i = 0; i < 8; i++)
+        ctx->state[i] += A[i];
+}
+
+/*
+ * SHA-256 process buffer
+ */
+void sha256_update(sha256_context *ctx, const unsigned char *input,
+                   size_t len)
+{
+    size_t fill;
+    size_t left;
+
+    if (len == 0)
+        return;
+
+    left = (size_t)(ctx->total & 0x3F);
+    fill = 64 - left;
+
+    ctx->total += len;
+
+    if (left && len >= fill)
+    {
+        memcpy((void *)(ctx->buffer + left),
+               (const void *)input, fill);
+        sha256_process(ctx, ctx->buffer);
+        input += fill;
+        len -= fill;
+        left = 0;
+    }
+
+    while (len >= 64)
+    {
+        sha256_process(ctx, input);
+        input += 64;
+        len -= 64;
+    }
+
+    if (len > 0)
+    {
+        memcpy((void *)(ctx->buffer + left),
+               (const void *)input, len);
+    }
+}
+
+static const unsigned char sha256_padding[64] =
+{
+ 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/*
+ * SHA-256 final digest
+ */
+void sha256_finish(sha256_context *ctx, unsigned char output[32])
+{
+    size_t last, padn;
+    uint32_t high, low;
+    unsigned char msglen[8];
+    int i;
+
+    high = (uint32_t)(ctx->total >> 29);
+    low  = (uint32_t)(ctx->total <<  3);
+
+    PUT_UINT32_BE(high, msglen, 0);
+    PUT_UINT32_BE(low,  msglen, 4);
+
+    last = (size_t)(ctx->total & 0x3F);
+    padn = (last < 56) ? (56 - last) : (120 - last);
+
+    sha256_update(ctx, sha256_padding, padn);
+    sha256_update(ctx, msglen, 8);
+
+    for (i = 0; i < 8; i++)
+        PUT_UINT32_BE(ctx->state[i], output, 4 * i);
+}
+
+/*
+ * output = SHA-256( input buffer )
+ */
+void sha256(const unsigned char *input, size_t len, unsigned char output[32])
+{
+    sha256_context ctx;
+
+    sha256_starts(&ctx);
+    sha256_update(&ctx, input, len);
+    sha256_finish(&ctx, output);
+}
@@ -0,0 +1,60 @@
+/**
+ * SHA-256 as specified in FIPS 180-4.
+ *
+ * The interface is the same as the MD5 implementation in md5.h.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>  // For size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          SHA-256 context structure
+ */
+typedef struct {
+    uint64_t total;           /*!< number of bytes processed  */
+    uint32_t state[8];        /*!< intermediate digest state  */
+    unsigned char buffer[64]; /*!< data block being processed */
+} sha256_context;
+
+/**
+ * \brief          SHA-256 context setup
+ *
+ * \param ctx      context to be initialized
+ */
+void sha256_starts(sha256_context *ctx);
+
+/**
+ * \brief          SHA-256 process buffer
+ *
+ * \param ctx      SHA-256 context
+ * \param input    buffer holding the  data
+ * \param ilen     length of the input data
+ */
+void sha256_update(sha256_context *ctx, const unsigned char *input,
+                   size_t len);
+
+/**
+ * \brief          SHA-256 final digest
+ *
+ * \param ctx      SHA-256 context
+ * \param output   SHA-256 checksum result
+ */
+void sha256_finish(sha256_context *ctx, unsigned char output[32]);
+
+/**
+ * \brief          Output = SHA-256( input buffer )
+ *
+ * \param input    buffer holding the  data
+ * \param ilen     length of the input data
+ * \param output   SHA-256 checksum result
+ */
+void sha256(const unsigned char *input, size_t len, unsigned char output[32]);
+
+#ifdef __cplusplus
+}
+#endif
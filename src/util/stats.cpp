@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/stats.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+/**
+ * Returns the number of milliseconds between two points in time.
+ */
+double milliseconds(Stats::Clock::time_point start,
+                    Stats::Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Returns the number of microseconds between two points in time.
+ */
+double microseconds(Stats::Clock::time_point start,
+                    Stats::Clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+void writeString(std::ostream& os, const std::string& s) {
+    os << '"';
+
+    for (char c : s) {
+        switch (c) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    os << "\\u" << std::hex << std::setw(4)
+                       << std::setfill('0') << (int)c << std::dec
+                       << std::setfill(' ');
+                } else {
+                    os << c;
+                }
+                break;
+        }
+    }
+
+    os << '"';
+}
+
+/**
+ * Restores the formatting flags of a stream when it goes out of scope.
+ */
+class FormatGuard {
+   private:
+    std::ostream& _os;
+    std::ios_base::fmtflags _flags;
+    std::streamsize _precision;
+
+   public:
+    FormatGuard(std::ostream& os)
+        : _os(os), _flags(os.flags()), _precision(os.precision()) {}
+
+    ~FormatGuard() {
+        _os.flags(_flags);
+        _os.precision(_precision);
+    }
+};
+
+}  // namespace
+
+Stats::Stats() : _start(Clock::now()) {}
+
+void Stats::addPhase(const char* name, Clock::time_point start,
+                     Clock::time_point end) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto id = std::this_thread::get_id();
+
+    auto it = _threads.find(id);
+    if (it == _threads.end())
+        it = _threads.insert(std::make_pair(id, _threads.size())).first;
+
+    Phase phase;
+    phase.name   = name;
+    phase.thread = it->second;
+    phase.start  = start;
+    phase.end    = end;
+    _phases.push_back(phase);
+}
+
+void Stats::add(const char* counter, uint64_t value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _counters[counter] += value;
+}
+
+void Stats::writeJson(std::ostream& os) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    FormatGuard guard(os);
+    os << std::fixed << std::setprecision(3);
+
+    std::vector<Phase> phases = _phases;
+    std::stable_sort(phases.begin(), phases.end(),
+                     [](const Phase& a, const Phase& b) {
+                         return a.start < b.start;
+                     });
+
+    os << "{\n  \"phases\": [";
+
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const Phase& phase = phases[i];
+
+        os << (i > 0 ? ",\n" : "\n") << "    {\"name\": ";
+        writeString(os, phase.name);
+        os << ", \"thread\": " << phase.thread
+           << ", \"start_ms\": " << milliseconds(_start, phase.start)
+           << ", \"duration_ms\": " << milliseconds(phase.start, phase.end)
+           << "}";
+    }
+
+    os << "\n  ],\n  \"totals_ms\": {";
+
+    std::map<std::string, double> totals;
+    for (auto&& phase : phases)
+        totals[phase.name] += milliseconds(phase.start, phase.end);
+
+    for (auto it = totals.begin(); it != totals.end(); ++it) {
+        os << (it != totals.begin() ? ",\n" : "\n") << "    ";
+        writeString(os, it->first);
+        os << ": " << it->second;
+    }
+
+    os << "\n  },\n  \"counters\": {";
+
+    for (auto it = _counters.begin(); it != _counters.end(); ++it) {
+        os << (it != _counters.begin() ? ",\n" : "\n") << "    ";
+        writeString(os, it->first);
+        os << ": " << it->second;
+    }
+
+    os << "\n  },\n  \"wall_ms\": " << milliseconds(_start, Clock::now())
+       << ",\n  \"peak_memory_bytes\": " << peakMemoryUsage() << "\n}\n";
+}
+
+void Stats::writeTrace(std::ostream& os) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    FormatGuard guard(os);
+    os << std::fixed << std::setprecision(3);
+
+    os << "{\"traceEvents\": [";
+
+    for (size_t i = 0; i < _phases.size(); ++i) {
+        const Phase& phase = _phases[i];
+
+        os << (i > 0 ? ",\n" : "\n") << "{\"name\": ";
+        writeString(os, phase.name);
+        os << ", \"cat\": \"ducible\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+           << phase.thread << ", \"ts\": " << microseconds(_start, phase.start)
+           << ", \"dur\": " << microseconds(phase.start, phase.end) << "}";
+    }
+
+    os << "\n],\n\"displayTimeUnit\": \"ms\",\n\"otherData\": {";
+
+    for (auto it = _counters.begin(); it != _counters.end(); ++it) {
+        os << (it != _counters.begin() ? ", " : "");
+        writeString(os, it->first);
+        os << ": " << it->second;
+    }
+
+    os << "}}\n";
+}
+
+size_t peakMemoryUsage() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+        return 0;
+    }
+
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+#ifdef __APPLE__
+    // Already in bytes.
+    return (size_t)usage.ru_maxrss;
+#else
+    // In kilobytes.
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
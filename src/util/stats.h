@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Collects timings and counters while patching. This is used to find out where
+ * the time goes when patching is slow.
+ *
+ * Everything that records statistics takes a `Stats*` that is null when
+ * statistics are not wanted. In that case, nothing is recorded and the clock is
+ * never read.
+ *
+ * This is safe to use from multiple threads at once.
+ */
+class Stats {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+   private:
+    struct Phase {
+        const char* name;
+        size_t thread;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+    mutable std::mutex _mutex;
+
+    Clock::time_point _start;
+
+    std::vector<Phase> _phases;
+    std::map<std::string, uint64_t> _counters;
+
+    // Small numbers for the threads that have recorded phases, in the order
+    // they were first seen.
+    std::map<std::thread::id, size_t> _threads;
+
+   public:
+    Stats();
+
+    /**
+     * Records a phase that ran on the calling thread. `name` must outlive this
+     * object.
+     */
+    void addPhase(const char* name, Clock::time_point start,
+                  Clock::time_point end);
+
+    /**
+     * Adds to a counter. Counters start at 0.
+     */
+    void add(const char* counter, uint64_t value);
+
+    /**
+     * Writes the statistics as JSON. This includes every phase, the total time
+     * spent in each kind of phase, the counters, and the peak memory usage of
+     * the process.
+     */
+    void writeJson(std::ostream& os) const;
+
+    /**
+     * Writes the phases in the Chrome trace event format. The file can be
+     * loaded into chrome://tracing to see what ran when and on which thread.
+     */
+    void writeTrace(std::ostream& os) const;
+};
+
+/**
+ * Times the enclosing scope as a phase. Does nothing if `stats` is null.
+ */
+class StatsPhase {
+   private:
+    Stats* _stats;
+    const char* _name;
+    Stats::Clock::time_point _start;
+
+   public:
+    StatsPhase(Stats* stats, const char* name) : _stats(stats), _name(name) {
+        if (_stats) _start = Stats::Clock::now();
+    }
+
+    ~StatsPhase() { stop(); }
+
+    /**
+     * Ends the phase before the end of the scope.
+     */
+    void stop() {
+        if (_stats) _stats->addPhase(_name, _start, Stats::Clock::now());
+        _stats = nullptr;
+    }
+
+    StatsPhase(const StatsPhase&) = delete;
+    StatsPhase& operator=(const StatsPhase&) = delete;
+};
+
+/**
+ * Adds to a counter if `stats` is not null.
+ */
+inline void addStat(Stats* stats, const char* counter, uint64_t value) {
+    if (stats) stats->add(counter, value);
+}
+
+/**
+ * Returns the peak memory usage of this process so far, in bytes. Returns 0 if
+ * it cannot be determined.
+ */
+size_t peakMemoryUsage();
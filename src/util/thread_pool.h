@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads that execute submitted tasks in FIFO
+ * order.
+ *
+ * Tasks must not throw. Anything that can fail should catch its own errors and
+ * report them through its own channel.
+ */
+class ThreadPool {
+   private:
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+
+    std::mutex _mutex;
+
+    // Signaled when a task is queued or when the pool is shutting down.
+    std::condition_variable _taskReady;
+
+    // Signaled when the number of pending tasks drops to zero.
+    std::condition_variable _idle;
+
+    // Number of tasks that have been submitted but not yet finished.
+    size_t _pending;
+
+    bool _stopping;
+
+    void _work();
+
+   public:
+    /**
+     * Params:
+     *   threads = The number of worker threads. If 0, defaultThreadCount() is
+     *             used.
+     */
+    explicit ThreadPool(size_t threads = 0);
+
+    /**
+     * Waits for all queued tasks to finish and joins the worker threads.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Queues a task to be run on one of the worker threads.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * Blocks until all submitted tasks have finished.
+     */
+    void wait();
+
+    /**
+     * Returns the number of worker threads.
+     */
+    size_t size() const { return _workers.size(); }
+};
+
+/**
+ * Returns the number of threads to use when none is specified. This is the
+ * number of hardware threads, or 1 if that cannot be determined.
+ */
+size_t defaultThreadCount();
+
+/**
+ * Calls `fn(i)` for every `i` in `[0, count)` using at most `threads` threads,
+ * including the calling thread. The order in which indices are visited is
+ * unspecified, so `fn` must only touch state belonging to its own index.
+ *
+ * If any call throws, the remaining indices are abandoned and the first
+ * exception is rethrown on the calling thread after all threads have finished.
+ *
+ * This spawns its own threads instead of using a ThreadPool so that it can be
+ * safely used from within a ThreadPool task without deadlocking.
+ */
+template <typename F>
+void parallelFor(size_t count, size_t threads, F fn) {
+    if (threads == 0) threads = defaultThreadCount();
+    if (threads > count) threads = count;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto work = [&]() {
+        while (!failed) {
+            const size_t i = next++;
+            if (i >= count) break;
+
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    helpers.reserve(threads - 1);
+    for (size_t i = 1; i < threads; ++i) helpers.emplace_back(work);
+
+    work();
+
+    for (auto& t : helpers) t.join();
+
+    if (error) std::rethrow_exception(error);
+}